@@ -165,6 +165,8 @@ void IotApplication::init(iot_app_cfg_t config)
     device->device_info->metadata = meta;
     device->device_info->uuid = _device_data.uuid;
 
+    IotDevice::invalidate_info();
+
     for (const auto &service: device->device_info->services) {
         if (service.name == IOT_OTA_SERVICE) {
             if (service.enabled) {
@@ -415,12 +417,8 @@ void IotApplication::process_event(iot_event_queue_t event)
                 _iot_device->subscribe_to_mqtt();
             break;
         case IOT_APP_MQTT_CONNECTION_FAIL_EVENT:
-            // TODO: Should create an mqtt task perhaps ?
-            break;
         case IOT_APP_MQTT_DISCONNECTED_EVENT:
-            // TODO: Should create an mqtt task perhaps ?
-            if(_iot_mqtt != nullptr && !_iot_mqtt->connected())
-                _iot_mqtt->reconnect();
+            // The mqtt component reconnects on its own with backoff.
             break;
 #endif
         default:
@@ -87,6 +87,7 @@ void iot_delete_task_queue(TaskHandle_t &task_handle, QueueHandle_t &queue_handl
 
 const time_t *iot_now(void);
 std::string iot_now_str(void);
+size_t iot_now_str(char *buf, size_t len);
 uint64_t iot_time_str_to_ms(const char *time);
 unsigned long IRAM_ATTR iot_millis();
 void iot_hex_to_bytes(const char* hex_str, char* byte_array, size_t byte_array_size);
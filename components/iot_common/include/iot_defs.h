@@ -99,4 +99,32 @@ typedef struct iot_event_queue
 /** A structure for IOT_APP_SHOULD_REBOOT_EVENT event, */
 typedef struct iot_should_reboot_event {
     uint64_t delay = 15000;         /**< The reboot delay in milliseconds. Default 15000 ms. */
-} iot_should_reboot_event_t;
\ No newline at end of file
+} iot_should_reboot_event_t;
+/**
+ * An enum of the json token types read by the json reader.
+ */
+typedef enum iot_json_token_type
+{
+    IOT_JSON_OBJECT_START = 0,  /**< The start of an object. */
+    IOT_JSON_OBJECT_END,        /**< The end of an object. */
+    IOT_JSON_ARRAY_START,       /**< The start of an array. */
+    IOT_JSON_ARRAY_END,         /**< The end of an array. */
+    IOT_JSON_KEY,               /**< An object key, unescaped in place. */
+    IOT_JSON_STRING,            /**< A string value, unescaped in place. */
+    IOT_JSON_NUMBER,            /**< A number value. */
+    IOT_JSON_TRUE,              /**< A true value. */
+    IOT_JSON_FALSE,             /**< A false value. */
+    IOT_JSON_NULL,              /**< A null value. */
+    IOT_JSON_END,               /**< The end of the document. */
+    IOT_JSON_ERROR,             /**< The document is malformed. */
+} iot_json_token_e;
+
+/**
+ * A struct of a json token, it points into the buffer being read.
+ */
+typedef struct iot_json_token
+{
+    iot_json_token_e type;   /**< The token's type. */
+    char *start;             /**< A pointer to the token's text, strings and keys are null terminated. */
+    size_t len;              /**< The length of the token's text. */
+} iot_json_token_t;
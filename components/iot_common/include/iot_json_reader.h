@@ -0,0 +1,59 @@
+#pragma once
+
+#include "iot_common.h"
+
+/**
+ * A class for reading a json document token by token, in a single pass and without allocating.
+ *
+ * Strings are unescaped in place and null terminated, so tokens point into the buffer being read and are only
+ * valid while it's alive. The document is validated as it's read, a malformed document yields an error token.
+ */
+class IotJsonReader final
+{
+public:
+    IotJsonReader(char *buf, size_t len);
+
+    IotJsonReader(const IotJsonReader&) = delete;
+    IotJsonReader(IotJsonReader&&) = delete;
+    IotJsonReader& operator=(const IotJsonReader&) = delete;
+    IotJsonReader& operator=(IotJsonReader&&) = delete;
+
+    iot_json_token_e next(iot_json_token_t *token);
+    iot_json_token_e skip(const iot_json_token_t &token);
+
+    static bool equals(const iot_json_token_t &token, const char *str, size_t len);
+    static bool to_uint(const iot_json_token_t &token, uint64_t *value);
+    static bool to_float(const iot_json_token_t &token, float *value);
+
+private:
+    static constexpr uint8_t MAX_DEPTH = 32;  /**< The maximum nesting depth of objects and arrays. */
+
+    /**
+     * An enum of what the reader expects next.
+     */
+    enum class Expect : uint8_t
+    {
+        VALUE,          /**< A value, or the end of an empty array. */
+        KEY,            /**< A key, or the end of an empty object. */
+        SEPARATOR,      /**< A comma, or the end of the current container. */
+    };
+
+    char *_pos;                     /**< A pointer to the next character to read. */
+    char *_end;                     /**< A pointer to the end of the buffer. */
+    uint8_t _depth = 0;             /**< The current nesting depth. */
+    uint32_t _objects = 0;          /**< A bit per depth indicating that the container is an object. */
+    Expect _expect = Expect::VALUE; /**< What is expected next. */
+    bool _first = false;            /**< Indicates that the current container was just opened. */
+    bool _error = false;            /**< Indicates that the document is malformed. */
+
+    iot_json_token_e fail(iot_json_token_t *token);
+    iot_json_token_e read_value(iot_json_token_t *token);
+    iot_json_token_e open(iot_json_token_t *token, iot_json_token_e type, bool object);
+    iot_json_token_e close(iot_json_token_t *token, iot_json_token_e type);
+    bool read_string(iot_json_token_t *token);
+    bool read_number(iot_json_token_t *token);
+    bool read_literal(const char *literal, size_t len);
+    bool in_object(void) const;
+    void skip_whitespace(void);
+    static bool read_hex(const char *src, const char *end, uint32_t *value);
+};
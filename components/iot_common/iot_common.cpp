@@ -143,13 +143,33 @@ std::string iot_now_str(void)
 {
     char datetime_str[64];
 
+    iot_now_str(datetime_str, sizeof(datetime_str));
+
+    return datetime_str;
+}
+
+/**
+ * Writes a string representation of the current time to a buffer.
+ *
+ * @param[out] buf A pointer to the buffer to write the time string to.
+ * @param[in] len The size of the buffer.
+ * @return The length of the time string, or 0 if the buffer is too small.
+ */
+size_t iot_now_str(char *buf, size_t len)
+{
+    time_t now;
+    time(&now);
+
     struct tm time_info;
 
-    localtime_r(iot_now(), &time_info);
+    localtime_r(&now, &time_info);
 
-    strftime(datetime_str, sizeof(datetime_str), "%Y-%m-%d %H:%M:%S", &time_info);
+    size_t written = strftime(buf, len, "%Y-%m-%d %H:%M:%S", &time_info);
 
-    return datetime_str;
+    if (written == 0 && len > 0)
+        buf[0] = '\0';
+
+    return written;
 }
 
 /**
@@ -0,0 +1,507 @@
+#include "iot_json_reader.h"
+
+/**
+ * Initialises a new instance of the IotJsonReader class.
+ *
+ * @param[in] buf A pointer to the json document, which is modified as strings are unescaped.
+ * @param[in] len The length of the document.
+ */
+IotJsonReader::IotJsonReader(char *buf, size_t len) : _pos(buf), _end(buf + len)
+{
+}
+
+/**
+ * Reads the next token of the document.
+ *
+ * @param[out] token A pointer to the token to fill.
+ * @return The type of the token read, IOT_JSON_END at the end of the document or IOT_JSON_ERROR if it's malformed.
+ */
+iot_json_token_e IotJsonReader::next(iot_json_token_t *token)
+{
+    token->type = IOT_JSON_ERROR;
+    token->start = _pos;
+    token->len = 0;
+
+    if (_error)
+        return IOT_JSON_ERROR;
+
+    skip_whitespace();
+
+    if (_expect == Expect::SEPARATOR) {
+        if (_depth == 0) {
+            if (_pos != _end)
+                return fail(token);
+
+            token->type = IOT_JSON_END;
+            return IOT_JSON_END;
+        }
+
+        if (_pos == _end)
+            return fail(token);
+
+        if (*_pos == '}' && in_object())
+            return close(token, IOT_JSON_OBJECT_END);
+
+        if (*_pos == ']' && !in_object())
+            return close(token, IOT_JSON_ARRAY_END);
+
+        if (*_pos != ',')
+            return fail(token);
+
+        _pos++;
+        _first = false;
+        _expect = in_object() ? Expect::KEY : Expect::VALUE;
+
+        skip_whitespace();
+    }
+
+    if (_pos == _end)
+        return fail(token);
+
+    if (_expect == Expect::KEY) {
+        if (*_pos == '}' && _first)
+            return close(token, IOT_JSON_OBJECT_END);
+
+        if (*_pos != '"' || !read_string(token))
+            return fail(token);
+
+        skip_whitespace();
+
+        if (_pos == _end || *_pos != ':')
+            return fail(token);
+
+        _pos++;
+        _expect = Expect::VALUE;
+        token->type = IOT_JSON_KEY;
+
+        return IOT_JSON_KEY;
+    }
+
+    if (*_pos == ']' && _first && !in_object())
+        return close(token, IOT_JSON_ARRAY_END);
+
+    return read_value(token);
+}
+
+/**
+ * Skips the rest of a value whose first token was just read, so nested objects and arrays can be ignored.
+ *
+ * @param[in] token The first token of the value.
+ * @return The type of the last token of the value, or IOT_JSON_ERROR if the document is malformed.
+ */
+iot_json_token_e IotJsonReader::skip(const iot_json_token_t &token)
+{
+    if (token.type != IOT_JSON_OBJECT_START && token.type != IOT_JSON_ARRAY_START)
+        return token.type;
+
+    uint8_t depth = _depth - 1;
+    iot_json_token_t inner;
+
+    while (_depth > depth) {
+        if (next(&inner) == IOT_JSON_ERROR || inner.type == IOT_JSON_END)
+            return IOT_JSON_ERROR;
+    }
+
+    return inner.type;
+}
+
+/**
+ * Checks whether the text of a token equals a string.
+ *
+ * @param[in] token The token to compare.
+ * @param[in] str A pointer to the string.
+ * @param[in] len The length of the string.
+ * @return true if they are equal, otherwise false.
+ */
+bool IotJsonReader::equals(const iot_json_token_t &token, const char *str, size_t len)
+{
+    return token.len == len && memcmp(token.start, str, len) == 0;
+}
+
+/**
+ * Converts a number token to an unsigned integer.
+ *
+ * @param[in] token The number token.
+ * @param[out] value A pointer to store the integer.
+ * @return true on success, false if the number isn't a non-negative integer or it overflows.
+ */
+bool IotJsonReader::to_uint(const iot_json_token_t &token, uint64_t *value)
+{
+    if (token.type != IOT_JSON_NUMBER)
+        return false;
+
+    uint64_t result = 0;
+
+    for (size_t i = 0; i < token.len; i++) {
+        char c = token.start[i];
+
+        if (c < '0' || c > '9' || result > (UINT64_MAX - (c - '0')) / 10)
+            return false;
+
+        result = result * 10 + (c - '0');
+    }
+
+    *value = result;
+
+    return true;
+}
+
+/**
+ * Converts a number token to a float.
+ *
+ * @param[in] token The number token.
+ * @param[out] value A pointer to store the float.
+ * @return true on success, otherwise false.
+ */
+bool IotJsonReader::to_float(const iot_json_token_t &token, float *value)
+{
+    char num[32];
+
+    // Numbers aren't null terminated in the buffer.
+    if (token.type != IOT_JSON_NUMBER || token.len >= sizeof(num))
+        return false;
+
+    memcpy(num, token.start, token.len);
+    num[token.len] = '\0';
+
+    *value = strtof(num, nullptr);
+
+    return true;
+}
+
+/**
+ * Marks the document as malformed.
+ *
+ * @param[out] token A pointer to the token to set as an error.
+ * @return IOT_JSON_ERROR.
+ */
+iot_json_token_e IotJsonReader::fail(iot_json_token_t *token)
+{
+    _error = true;
+    token->type = IOT_JSON_ERROR;
+    token->start = _pos;
+    token->len = 0;
+
+    return IOT_JSON_ERROR;
+}
+
+/**
+ * Reads a value token.
+ *
+ * @param[out] token A pointer to the token to fill.
+ * @return The type of the token read.
+ */
+iot_json_token_e IotJsonReader::read_value(iot_json_token_t *token)
+{
+    token->start = _pos;
+
+    switch (*_pos) {
+        case '{':
+            return open(token, IOT_JSON_OBJECT_START, true);
+        case '[':
+            return open(token, IOT_JSON_ARRAY_START, false);
+        case '"':
+            if (!read_string(token))
+                return fail(token);
+            token->type = IOT_JSON_STRING;
+            break;
+        case 't':
+            if (!read_literal("true", 4))
+                return fail(token);
+            token->type = IOT_JSON_TRUE;
+            token->len = 4;
+            break;
+        case 'f':
+            if (!read_literal("false", 5))
+                return fail(token);
+            token->type = IOT_JSON_FALSE;
+            token->len = 5;
+            break;
+        case 'n':
+            if (!read_literal("null", 4))
+                return fail(token);
+            token->type = IOT_JSON_NULL;
+            token->len = 4;
+            break;
+        default:
+            if (!read_number(token))
+                return fail(token);
+            token->type = IOT_JSON_NUMBER;
+            break;
+    }
+
+    _first = false;
+    _expect = Expect::SEPARATOR;
+
+    return token->type;
+}
+
+/**
+ * Opens an object or an array.
+ *
+ * @param[out] token A pointer to the token to fill.
+ * @param[in] type The type of the token.
+ * @param[in] object Whether the container is an object.
+ * @return The type of the token, or IOT_JSON_ERROR if the document is nested too deep.
+ */
+iot_json_token_e IotJsonReader::open(iot_json_token_t *token, iot_json_token_e type, bool object)
+{
+    if (_depth == MAX_DEPTH)
+        return fail(token);
+
+    if (object)
+        _objects |= 1UL << _depth;
+    else
+        _objects &= ~(1UL << _depth);
+
+    _depth++;
+    _pos++;
+    _first = true;
+    _expect = object ? Expect::KEY : Expect::VALUE;
+
+    token->type = type;
+    token->len = 1;
+
+    return type;
+}
+
+/**
+ * Closes the current object or array.
+ *
+ * @param[out] token A pointer to the token to fill.
+ * @param[in] type The type of the token.
+ * @return The type of the token.
+ */
+iot_json_token_e IotJsonReader::close(iot_json_token_t *token, iot_json_token_e type)
+{
+    token->type = type;
+    token->start = _pos;
+    token->len = 1;
+
+    _pos++;
+    _depth--;
+    _first = false;
+    _expect = Expect::SEPARATOR;
+
+    return type;
+}
+
+/**
+ * Reads a string, unescaping it in place and null terminating it. An unescaped string is never longer than its
+ * escaped form, so it always fits where it was read from.
+ *
+ * @param[out] token A pointer to the token to set the string's start and length.
+ * @return true on success, false if the string is malformed.
+ */
+bool IotJsonReader::read_string(iot_json_token_t *token)
+{
+    char *src = _pos + 1;
+    char *dst = src;
+
+    token->start = src;
+
+    while (src < _end) {
+        char c = *src++;
+
+        if (c == '"') {
+            *dst = '\0';
+            token->len = dst - token->start;
+            _pos = src;
+            return true;
+        }
+
+        if (static_cast<unsigned char>(c) < 0x20)
+            return false;
+
+        if (c != '\\') {
+            *dst++ = c;
+            continue;
+        }
+
+        if (src == _end)
+            return false;
+
+        switch (c = *src++) {
+            case '"':
+            case '\\':
+            case '/':
+                *dst++ = c;
+                break;
+            case 'b':
+                *dst++ = '\b';
+                break;
+            case 'f':
+                *dst++ = '\f';
+                break;
+            case 'n':
+                *dst++ = '\n';
+                break;
+            case 'r':
+                *dst++ = '\r';
+                break;
+            case 't':
+                *dst++ = '\t';
+                break;
+            case 'u': {
+                uint32_t cp;
+
+                if (!read_hex(src, _end, &cp))
+                    return false;
+
+                src += 4;
+
+                if (cp >= 0xD800 && cp <= 0xDBFF) {
+                    uint32_t low;
+
+                    if (_end - src < 6 || src[0] != '\\' || src[1] != 'u' || !read_hex(src + 2, _end, &low) ||
+                        low < 0xDC00 || low > 0xDFFF)
+                        return false;
+
+                    src += 6;
+                    cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                } else if (cp >= 0xDC00 && cp <= 0xDFFF) {
+                    return false;
+                }
+
+                if (cp < 0x80) {
+                    *dst++ = static_cast<char>(cp);
+                } else if (cp < 0x800) {
+                    *dst++ = static_cast<char>(0xC0 | cp >> 6);
+                    *dst++ = static_cast<char>(0x80 | (cp & 0x3F));
+                } else if (cp < 0x10000) {
+                    *dst++ = static_cast<char>(0xE0 | cp >> 12);
+                    *dst++ = static_cast<char>(0x80 | (cp >> 6 & 0x3F));
+                    *dst++ = static_cast<char>(0x80 | (cp & 0x3F));
+                } else {
+                    *dst++ = static_cast<char>(0xF0 | cp >> 18);
+                    *dst++ = static_cast<char>(0x80 | (cp >> 12 & 0x3F));
+                    *dst++ = static_cast<char>(0x80 | (cp >> 6 & 0x3F));
+                    *dst++ = static_cast<char>(0x80 | (cp & 0x3F));
+                }
+                break;
+            }
+            default:
+                return false;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Reads a number, validating its format.
+ *
+ * @param[out] token A pointer to the token to set the number's start and length.
+ * @return true on success, false if the number is malformed.
+ */
+bool IotJsonReader::read_number(iot_json_token_t *token)
+{
+    char *p = _pos;
+
+    auto digits = [&p, this]() -> bool {
+        char *start = p;
+
+        while (p < _end && *p >= '0' && *p <= '9')
+            p++;
+
+        return p != start;
+    };
+
+    if (p < _end && *p == '-')
+        p++;
+
+    if (p < _end && *p == '0')
+        p++;
+    else if (p == _end || *p < '1' || *p > '9' || !digits())
+        return false;
+
+    if (p < _end && *p == '.' && (++p, !digits()))
+        return false;
+
+    if (p < _end && (*p == 'e' || *p == 'E')) {
+        p++;
+
+        if (p < _end && (*p == '+' || *p == '-'))
+            p++;
+
+        if (!digits())
+            return false;
+    }
+
+    token->start = _pos;
+    token->len = p - _pos;
+    _pos = p;
+
+    return true;
+}
+
+/**
+ * Reads a literal value.
+ *
+ * @param[in] literal A pointer to the literal.
+ * @param[in] len The length of the literal.
+ * @return true if the literal matched, otherwise false.
+ */
+bool IotJsonReader::read_literal(const char *literal, size_t len)
+{
+    if (static_cast<size_t>(_end - _pos) < len || memcmp(_pos, literal, len) != 0)
+        return false;
+
+    _pos += len;
+
+    return true;
+}
+
+/**
+ * Checks whether the current container is an object.
+ *
+ * @return true if it's an object, otherwise false.
+ */
+bool IotJsonReader::in_object(void) const
+{
+    return _depth > 0 && (_objects & (1UL << (_depth - 1))) != 0;
+}
+
+/**
+ * Skips the whitespace at the current position.
+ */
+void IotJsonReader::skip_whitespace(void)
+{
+    while (_pos < _end && (*_pos == ' ' || *_pos == '\t' || *_pos == '\n' || *_pos == '\r'))
+        _pos++;
+}
+
+/**
+ * Reads the four hex digits of a unicode escape.
+ *
+ * @param[in] src A pointer to the digits.
+ * @param[in] end A pointer to the end of the buffer.
+ * @param[out] value A pointer to store the value.
+ * @return true on success, otherwise false.
+ */
+bool IotJsonReader::read_hex(const char *src, const char *end, uint32_t *value)
+{
+    if (end - src < 4)
+        return false;
+
+    uint32_t result = 0;
+
+    for (uint8_t i = 0; i < 4; i++) {
+        char c = src[i];
+
+        result <<= 4;
+
+        if (c >= '0' && c <= '9')
+            result |= c - '0';
+        else if (c >= 'a' && c <= 'f')
+            result |= c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F')
+            result |= c - 'A' + 10;
+        else
+            return false;
+    }
+
+    *value = result;
+
+    return true;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <mutex>
+#include <vector>
+#include "iot_common.h"
+#include "iot_device_defs.h"
+#include "iot_attribute_registry.h"
+#include "iot_attribute_shadow.h"
+
+/**
+ * A class for coalescing bursts of attribute writes. Each attribute with a coalescing window gets a latest-wins
+ * mailbox, writes replace the value waiting in it and a single task applies the mailboxes through the write callback
+ * at most once per window, so intermediate values are dropped and the device sees a bounded write rate.
+ *
+ * String values are never coalesced, the mailbox doesn't own their memory.
+ */
+class IotAttributeMailbox final
+{
+public:
+    esp_err_t init(const IotAttributeRegistry &registry, iot_attribute_write_cb_t write_cb, IotAttributeShadow *shadow,
+                   std::mutex *cb_mutex);
+    size_t post(iot_attribute_req_param_t *param);
+    size_t cancel(const iot_attribute_req_param_t *param);
+
+private:
+    static constexpr const char *TAG = "IotAttributeMailbox";  /**< A constant used to identify the source of the log message of this class. */
+    static constexpr uint32_t STACK_SIZE = 4096;                /**< The stack size of the mailbox task. */
+
+    std::mutex _mutex{};                               /**< The mutex used to safe guard the mailboxes. */
+    std::vector<iot_attribute_mailbox_t> _slots{};     /**< The mailboxes, indexed by slot. */
+    const IotAttributeRegistry *_registry = nullptr;   /**< A pointer to the registry interning the attributes' names. */
+    IotAttributeShadow *_shadow = nullptr;             /**< A pointer to the shadow updated with applied values. */
+    iot_attribute_write_cb_t _write_cb = nullptr;      /**< The device's write callback. */
+    std::mutex *_cb_mutex = nullptr;                   /**< A pointer to the mutex serializing the device's callbacks. */
+    TaskHandle_t _task = nullptr;                      /**< The handle of the task applying the mailboxes. */
+
+    static void task(void *arg);
+    TickType_t flush(void);
+};
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <string_view>
+#include <vector>
+#include "iot_common.h"
+#include "iot_device_defs.h"
+
+/**
+ * A class for the registry of a device's attributes. Names are interned once when the registry is built and each
+ * attribute gets a small integer slot, its position in the schema or the device info. Names are resolved to slots
+ * through an open addressing hash table, so a lookup costs one hash of the name and, in the common case, one compare.
+ */
+class IotAttributeRegistry final
+{
+public:
+    esp_err_t build(const iot_device_cfg_t *cfg);
+    uint8_t find(const char *name, size_t len) const;
+    uint8_t count(void) const;
+    std::string_view name(uint8_t slot) const;
+    uint32_t max_age(uint8_t slot) const;
+    uint32_t coalesce(uint8_t slot) const;
+    iot_telemetry_class_e telemetry(uint8_t slot) const;
+    const iot_attribute_schema_t *schema(uint8_t slot) const;
+
+private:
+    static constexpr const char *TAG = "IotAttributeRegistry";  /**< A constant used to identify the source of the log message of this class. */
+
+    std::vector<std::string_view> _names{};                 /**< The interned names, indexed by slot. */
+    std::vector<iot_attribute_policy_t> _policies{};        /**< The runtime policies of each attribute, indexed by slot. */
+    std::vector<uint8_t> _table{};                          /**< The hash table, each entry is a slot plus one or zero if empty. */
+    uint32_t _mask = 0;                                     /**< The mask mapping a hash to a table index. */
+    const iot_device_schema_t *_schema = nullptr;           /**< A pointer to the device's schema or nullptr. */
+
+    static uint32_t hash(const char *name, size_t len);
+};
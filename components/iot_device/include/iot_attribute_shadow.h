@@ -0,0 +1,38 @@
+#pragma once
+
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+#include "iot_common.h"
+#include "iot_device_defs.h"
+#include "iot_attribute_registry.h"
+
+/**
+ * A class for the shadow of a device's attribute values. Reads of an attribute with a max age are served from the
+ * shadow while its value is fresh, concurrent misses of an attribute are coalesced into one read callback and writes
+ * update the shadow immediately.
+ *
+ * Every value that changes, whether read, written or marked, sets the attribute's dirty bit so the changes can be
+ * notified in batches. String values are never kept, the shadow doesn't own their memory.
+ */
+class IotAttributeShadow final
+{
+public:
+    void init(const IotAttributeRegistry &registry);
+    esp_err_t read(iot_attribute_req_param_t *param, iot_attribute_read_cb_t read_cb);
+    void update(const iot_attribute_req_param_t *param);
+    esp_err_t set(uint8_t slot, iot_val_t value);
+    bool take_dirty(iot_attribute_req_param_t *param);
+    bool get(uint8_t slot, iot_val_t *value);
+
+private:
+    std::mutex _mutex{};                             /**< The mutex used to safe guard the shadow entries. */
+    std::condition_variable _cond{};                 /**< Signalled whenever a pending read completes. */
+    std::vector<iot_attribute_shadow_t> _entries{};  /**< The shadow entries, indexed by slot. */
+    const IotAttributeRegistry *_registry = nullptr; /**< A pointer to the registry interning the attributes' names. */
+    bool _dirty = false;                             /**< Indicates whether any entry is dirty. */
+
+    iot_attribute_shadow_t *entry(uint8_t slot);
+    iot_attribute_shadow_t *cached(uint8_t slot);
+    void store(iot_attribute_shadow_t *shadow, iot_val_t value, uint32_t now);
+};
@@ -1,10 +1,17 @@
 #pragma once
 
 #include <typeinfo>
+#include <mutex>
 #include "iot_server.h"
 #include "iot_common.h"
+#include "iot_json_reader.h"
 #include "iot_factory.h"
 #include "iot_device_defs.h"
+#include "iot_device_schema.h"
+#include "iot_attribute_registry.h"
+#include "iot_attribute_shadow.h"
+#include "iot_attribute_mailbox.h"
+#include "iot_telemetry.h"
 
 class IotDevice final
 {
@@ -12,6 +19,10 @@ public:
     IotDevice(void);
     ~IotDevice(void);
     esp_err_t init(iot_device_cfg_t *iot_device_cfg);
+    static void invalidate_info(void);
+    static esp_err_t report(const iot_attribute_req_param_t *param);
+    static esp_err_t mark_changed(uint8_t slot, iot_val_t value);
+    static esp_err_t mark_changed(std::string_view name, iot_val_t value);
 #ifdef CONFIG_IOT_HOVER_MQTT_ENABLED
     bool subscribed_to_mqtt() const;
     void subscribe_to_mqtt();
@@ -21,17 +32,52 @@ private:
     static constexpr const char *TAG = "IotDevice"; /* A constant used to identify the source of the log message of this. */
     static IotServer *_iot_server;
     static iot_device_cfg_t *_iot_device_cfg;
+    static std::mutex _info_mutex;
+    static std::mutex _cb_mutex;
+    static iot_device_info_doc_t *_info_doc;
+    static IotAttributeRegistry _registry;
+    static IotAttributeShadow _shadow;
+    static IotAttributeMailbox _mailbox;
+    static constexpr uint32_t NOTIFY_STACK_SIZE = 4096;  /**< The stack size of the notify task. */
+    static TaskHandle_t _notify_task;
+    static esp_timer_handle_t _notify_timer;
 
     esp_err_t validate_cfg(const iot_device_cfg_t *cfg);
     esp_err_t register_routes(httpd_method_t method);
     static esp_err_t _register_route(const char *path, httpd_method_t method, esp_err_t (*handler)(httpd_req_t *r));
     static esp_err_t on_write(httpd_req_t *req);
+    static esp_err_t write_attributes(httpd_req_t *req);
+    static esp_err_t apply_writes(iot_attribute_req_param_t *param);
+    static esp_err_t read_values(iot_attribute_req_param_t *param);
+    static esp_err_t on_batch(httpd_req_t *req);
+    static esp_err_t run_batch(httpd_req_t *req);
+    static char *read_body(httpd_req_t *req, size_t *len);
     static esp_err_t on_read(httpd_req_t *req);
     static esp_err_t on_info(httpd_req_t *req);
+    static esp_err_t build_info(void);
+    static void release_info(iot_device_info_doc_t *doc);
+    static esp_err_t start_notify(void);
+    static void notify_task(void *arg);
+    static char *attributes_to_json(const iot_attribute_req_param_t *param);
 #ifdef CONFIG_IOT_HOVER_MQTT_ENABLED
     bool _mqtt_subscribed = false;
-    static void on_data(std::string topic, std::string data, size_t len, void *priv_data);
+    static IotTelemetry _telemetry;
+    static void on_data(const char *topic, size_t topic_len, const char *data, size_t len, void *priv_data);
+    static esp_err_t run_cmd(char *buf, size_t len, iot_json_token_t *id);
+    static void publish_cmd_result(const iot_json_token_t &id, esp_err_t ret);
+    static esp_err_t iot_attribute_cmd_from_json(char *buf, size_t len, iot_json_token_t *id,
+                                                 iot_attribute_req_param_t *param);
+    static esp_err_t publish_telemetry(const uint8_t *data, size_t len, bool snapshot);
 #endif
-    static esp_err_t iot_attribute_req_from_json(char *buf, iot_attribute_req_param_t *param);
+    static esp_err_t iot_attribute_req_from_json(char *buf, size_t len, iot_attribute_req_param_t *param);
+    static esp_err_t iot_attribute_list_from_json(IotJsonReader &reader, iot_attribute_req_param_t *param);
+    static esp_err_t iot_attribute_batch_from_json(char *buf, size_t len, iot_attribute_req_param_t *writes,
+                                                   iot_attribute_req_param_t *reads, std::vector<bool> *order);
+    static esp_err_t iot_attribute_data_from_json(IotJsonReader &reader, iot_attribute_req_data_t *attribute,
+                                                  bool *write);
+    static esp_err_t schema_value_from_json(const iot_attribute_schema_t *attribute, const iot_json_token_t &value,
+                                            const iot_json_token_t &type, iot_val_t *val);
+    static bool values_valid(const iot_attribute_req_param_t *param);
+    static esp_err_t write_value(IotResWriter &writer, const iot_attribute_req_data_t &item);
     static std::string iot_device_type_to_str(iot_device_type_t type);
 };
\ No newline at end of file
@@ -4,7 +4,11 @@
 #include "esp_err.h"
 #include "esp_timer.h"
 #include <string>
+#include <string_view>
 #include <cJSON.h>
+#include "iot_defs.h"
+
+class IotResWriter;
 
 // region STANDARD PARAMETERS
 #define IOT_VAL_TYPE_INTEGER_STR  "integer"    /**< A string representation of an integer value type. */
@@ -14,6 +18,12 @@
 #define IOT_VAL_TYPE_BOOLEAN_STR  "bool"    /**< A string representation of a boolean value type. */
 // endregion
 
+#define IOT_DEVICE_MAX_BATCH_OPS 16    /**< The maximum number of operations in a batch request. */
+#define IOT_ATTR_SLOT_NONE       0xFF  /**< The slot of an attribute which isn't registered. */
+#define IOT_TELEMETRY_VERSION     1    /**< The version of the binary telemetry encoding. */
+#define IOT_TELEMETRY_MAX_SIZE    256  /**< The maximum size of a telemetry message. */
+#define IOT_TELEMETRY_FLAG_SNAPSHOT 0x01 /**< The telemetry flag of a message holding every value, not only changes. */
+
 // region STANDARD PARAMETERS
 #define IOT_ATTR_PARAM_MAX "Max"        /**< The name of a max param. */
 #define IOT_ATTR_PARAM_MIN "Min"        /**< The name of a min param. */
@@ -44,6 +54,18 @@ typedef enum iot_val_type
     IOT_VAL_TYPE_INVALID,     /**< An invalid value type. */
 } iot_val_type_e;
 
+/**
+ * An enum of the telemetry classes of attributes, each class is published at its own period.
+ */
+typedef enum iot_telemetry_class
+{
+    IOT_TELEMETRY_NONE = 0,   /**< The attribute isn't published as telemetry. */
+    IOT_TELEMETRY_FAST,       /**< A fast changing attribute, e.g. a power reading. */
+    IOT_TELEMETRY_NORMAL,     /**< An attribute changing at a normal rate, e.g. a switch state. */
+    IOT_TELEMETRY_SLOW,       /**< A slow changing attribute, e.g. a temperature. */
+    IOT_TELEMETRY_CLASS_MAX,  /**< The number of telemetry classes. */
+} iot_telemetry_class_e;
+
 /**
  * A struct of a value type.
  */
@@ -78,6 +100,9 @@ typedef struct iot_attribute
     bool is_primary = false;             /**< Indicates whether the attribute is a primary attribute. */
     iot_val_t value;                     /**< The attribute's value. */
     std::vector<iot_param_t> params{};   /**< The attribute's parameters. */
+    uint32_t max_age_ms = 0;             /**< How long a read value is served from the shadow, 0 to always read. */
+    uint32_t coalesce_ms = 0;            /**< The minimum interval between writes of the attribute, 0 to write each. */
+    iot_telemetry_class_e telemetry = IOT_TELEMETRY_NORMAL; /**< The attribute's telemetry class. */
 } iot_attribute_t;
 
 /**
@@ -145,13 +170,119 @@ typedef struct iot_device_info
     std::vector<iot_device_service_t> services;    /**< The device's services list. */
 } iot_device_info_t;
 
+/**
+ * A struct of a serialized device information document, shared by the requests sending it.
+ */
+typedef struct iot_device_info_doc
+{
+    uint8_t refs;       /**< The number of holders of the document, the cache and each request sending it. */
+    size_t len;         /**< The length of the document. */
+    char etag[11];      /**< The entity tag of the document. */
+    char *data;         /**< A pointer to the document, allocated by cJSON. */
+} iot_device_info_doc_t;
+
+/**
+ * A struct of an attribute declared in a device schema, generated at compile time by IotDeviceSchema.
+ */
+typedef struct iot_attribute_schema
+{
+    std::string_view name;       /**< The attribute's name. */
+    std::string_view type_name;  /**< The string representation of the attribute's value type. */
+    iot_val_type_e type;         /**< The attribute's value type. */
+    bool is_primary;             /**< Indicates whether the attribute is a primary attribute. */
+    bool has_min;                /**< Indicates whether values are bounded by min. */
+    bool has_max;                /**< Indicates whether values are bounded by max. */
+    iot_val_t min;               /**< The attribute's minimum value. */
+    iot_val_t max;               /**< The attribute's maximum value. */
+    uint32_t max_age_ms;         /**< How long a read value is served from the shadow, 0 to always read. */
+    uint32_t coalesce_ms;        /**< The minimum interval between writes of the attribute, 0 to write each. */
+    iot_telemetry_class_e telemetry; /**< The attribute's telemetry class. */
+
+    /**
+     * Parses and validates a json value of the attribute's type.
+     *
+     * @param[in] attribute A pointer to the attribute.
+     * @param[in] token The json value token.
+     * @param[out] val A pointer to store the value.
+     * @return ESP_OK on success, ESP_ERR_INVALID_ARG if the value is of another type or out of range.
+     */
+    esp_err_t (*parse)(const struct iot_attribute_schema *attribute, const iot_json_token_t &token, iot_val_t *val);
+
+    /**
+     * Writes a value of the attribute's type and the type to a response writer.
+     *
+     * @param[in] writer The writer with the object to add the value to opened.
+     * @param[in] val The value, read as the attribute's type whatever its type tag.
+     * @return ESP_OK on success, otherwise an error code.
+     */
+    esp_err_t (*write)(IotResWriter &writer, const iot_val_t &val);
+} iot_attribute_schema_t;
+
+/**
+ * A struct of a device schema, generated at compile time by IotDeviceSchema.
+ */
+typedef struct iot_device_schema
+{
+    const iot_attribute_schema_t *attributes;  /**< A pointer to the attributes, their index is their slot. */
+    uint8_t count;                             /**< The number of attributes. */
+    std::string_view attributes_json;          /**< The attributes of the device info document, null terminated. */
+} iot_device_schema_t;
+
+/**
+ * A struct of the runtime policies of an attribute, resolved once from the schema or the device info.
+ */
+typedef struct iot_attribute_policy
+{
+    uint32_t max_age_ms;             /**< How long a read value is served from the shadow, 0 to always read. */
+    uint32_t coalesce_ms;            /**< The minimum interval between writes of the attribute, 0 to write each. */
+    iot_telemetry_class_e telemetry; /**< The attribute's telemetry class. */
+} iot_attribute_policy_t;
+
+/**
+ * A struct of the telemetry state of an attribute.
+ */
+typedef struct iot_telemetry_slot
+{
+    iot_val_t published;             /**< The value last published. */
+    iot_val_t staged;                /**< The value in the message being published. */
+    iot_telemetry_class_e telemetry; /**< The attribute's telemetry class. */
+    bool valid;                      /**< Indicates whether a value has been published yet. */
+    bool is_staged;                  /**< Indicates whether the attribute is in the message being published. */
+} iot_telemetry_slot_t;
+
+/**
+ * A struct of the shadow of an attribute's value.
+ */
+typedef struct iot_attribute_shadow
+{
+    iot_val_t value;          /**< The last value read or written. */
+    uint32_t updated;         /**< The time in milliseconds the value was read or written. */
+    uint32_t max_age_ms;      /**< How long the value is fresh, 0 if the attribute isn't cached. */
+    iot_val_type_e type;      /**< The declared value type, or IOT_VAL_TYPE_INVALID to keep the value's own. */
+    bool valid;               /**< Indicates whether the value has been read or written yet. */
+    bool pending;             /**< Indicates whether a read of the attribute is in flight. */
+    bool dirty;               /**< Indicates whether the value changed since the last notification. */
+} iot_attribute_shadow_t;
+
+/**
+ * A struct of the write mailbox of an attribute, holding only the latest value written.
+ */
+typedef struct iot_attribute_mailbox
+{
+    iot_val_t value;          /**< The latest value written and not applied yet. */
+    uint32_t applied;         /**< The time in milliseconds a value was last applied. */
+    uint32_t window_ms;       /**< The minimum interval between applied values, 0 if writes aren't coalesced. */
+    bool full;                /**< Indicates whether a value is waiting to be applied. */
+} iot_attribute_mailbox_t;
+
 /**
  * A struct of an attribute request data.
  */
 typedef struct iot_attribute_req_data
 {
-    std::string name;             /**< The attribute's name. */
-    iot_val_t value;              /**< The attribute's value. */
+    std::string_view name;              /**< The attribute's interned name, which is null terminated. */
+    iot_val_t value;                    /**< The attribute's value. */
+    uint8_t slot = IOT_ATTR_SLOT_NONE;  /**< The attribute's slot, its position in the schema or the device info. */
 } iot_attribute_req_data_t;
 
 /**
@@ -163,7 +294,8 @@ typedef struct iot_attribute_req_param
 } iot_attribute_req_param_t;
 
 /**
- * A callback function for attribute write requests.
+ * A callback function for attribute write requests. Requests are served by several tasks, but the device never calls
+ * its read and write callbacks concurrently, so the callback doesn't need to be reentrant.
  *
  * @param[in] param A pointer to the attribute write parameter.
  * @return ESP_OK on success, otherwise an error code.
@@ -171,7 +303,8 @@ typedef struct iot_attribute_req_param
 typedef esp_err_t (*iot_attribute_write_cb_t)(iot_attribute_req_param_t *param);
 
 /**
- * A callback function for attribute read requests.
+ * A callback function for attribute read requests. It's never called concurrently with the device's other read and
+ * write callbacks.
  *
  * @param[in,out] param A pointer to the attribute read parameter.
  * @return  ESP_OK on success, otherwise an error code.
@@ -191,11 +324,20 @@ typedef esp_err_t (*iot_attribute_notify_cb_t)(iot_attribute_req_param_t *param)
  */
 typedef struct iot_notify_attribute_cfg
 {
-    TimerHandle_t callback_handle;           /**<  Handle for the timer used for notifications. */
-    int period = 0;                          /**<  Period (in milliseconds) for the notification timer. */
-    iot_attribute_notify_cb_t notify_cb;     /**<  Callback function to be called on notification events. */
+    int period = 0;                          /**<  Period (in milliseconds) at which changed attributes are notified. */
+    iot_attribute_notify_cb_t notify_cb;     /**<  Callback function called with the changed attributes, can be nullptr. */
 } iot_notify_attribute_cfg_t;
 
+/**
+ * A struct of a telemetry configuration. Changed values of each attribute class are published at the class' period
+ * and every value at the snapshot period.
+ */
+typedef struct iot_telemetry_cfg
+{
+    uint32_t period_ms[IOT_TELEMETRY_CLASS_MAX] = {}; /**< The period of each class in milliseconds, 0 to publish no deltas of it. */
+    uint32_t snapshot_ms = 0;                         /**< The period of the snapshots in milliseconds, 0 to publish only deltas. */
+} iot_telemetry_cfg_t;
+
 /**
  * A struct of a device configuration.
  */
@@ -206,6 +348,8 @@ typedef struct iot_device_cfg
     iot_attribute_read_cb_t read_cb;                          /**< The device's callback function for attribute read requests. */
     iot_attribute_write_cb_t write_cb;                        /**< The device's callback function for attribute write requests. */
     iot_notify_attribute_cfg_t *notify_cfg;                   /**< A pointer to the device's attribute notify configuration. */
+    const iot_device_schema_t *schema = nullptr;              /**< A pointer to the device's compile time schema, replaces the info attributes. */
+    const iot_telemetry_cfg_t *telemetry_cfg = nullptr;       /**< A pointer to the device's telemetry configuration, nullptr to disable it. */
 } iot_device_cfg_t;
 
 // region UTILITY FUNCTIONS
@@ -222,6 +366,9 @@ esp_err_t iot_attribute_add_param(iot_attribute_t *attribute,const char *key, io
 esp_err_t iot_device_add_service(iot_device_info_t *device, const char *name, bool enabled, bool core_service);
 esp_err_t iot_device_add_attribute(iot_device_info_t *device, iot_attribute_t attribute);
 
-iot_attribute_req_data_t iot_attribute_create_read_req_data(std::string name);
+iot_attribute_req_data_t iot_attribute_create_read_req_data(std::string_view name, uint8_t slot = IOT_ATTR_SLOT_NONE);
 esp_err_t iot_val_add_to_json(cJSON *p_json, iot_val_t val);
+esp_err_t iot_val_add_to_writer(IotResWriter &writer, iot_val_t val);
+iot_val_type_e iot_val_type_from_str(const char *str, size_t len);
+bool iot_val_equals(const iot_val_t &a, const iot_val_t &b);
 // endregion
\ No newline at end of file
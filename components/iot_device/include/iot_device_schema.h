@@ -0,0 +1,549 @@
+#pragma once
+
+#include <array>
+#include <cmath>
+#include <tuple>
+#include <type_traits>
+#include "iot_device_defs.h"
+#include "iot_json_reader.h"
+#include "iot_res_writer.h"
+
+/**
+ * A class for rendering json at compile time. Without an output buffer it only counts the length, so the same code
+ * sizes the buffer and then fills it.
+ */
+class IotSchemaRenderer final
+{
+public:
+    constexpr explicit IotSchemaRenderer(char *out) : _out(out)
+    {
+    }
+
+    constexpr size_t length(void) const
+    {
+        return _len;
+    }
+
+    constexpr void put(char c)
+    {
+        if (_out != nullptr)
+            _out[_len] = c;
+
+        _len++;
+    }
+
+    constexpr void raw(std::string_view str)
+    {
+        for (char c: str)
+            put(c);
+    }
+
+    constexpr void str(std::string_view str)
+    {
+        constexpr std::string_view hex = "0123456789abcdef";
+
+        put('"');
+
+        for (char c: str) {
+            auto u = static_cast<unsigned char>(c);
+
+            if (c == '"' || c == '\\') {
+                put('\\');
+                put(c);
+            } else if (u < 0x20) {
+                raw("\\u00");
+                put(hex[u >> 4]);
+                put(hex[u & 0x0F]);
+            } else {
+                put(c);
+            }
+        }
+
+        put('"');
+    }
+
+    constexpr void uint(uint64_t value)
+    {
+        char digits[20]{};
+        uint8_t count = 0;
+
+        do {
+            digits[count++] = static_cast<char>('0' + value % 10);
+            value /= 10;
+        } while (value != 0);
+
+        while (count > 0)
+            put(digits[--count]);
+    }
+
+    /**
+     * Renders a float with up to six decimals, trailing zeros trimmed.
+     */
+    constexpr void real(float value)
+    {
+        if (value != value || value > 1e18f || value < -1e18f) {
+            raw("null");
+            return;
+        }
+
+        double abs = value < 0 ? -static_cast<double>(value) : value;
+        auto whole = static_cast<uint64_t>(abs);
+        auto frac = static_cast<uint32_t>((abs - static_cast<double>(whole)) * 1e6 + 0.5);
+
+        if (frac == 1000000) {
+            whole++;
+            frac = 0;
+        }
+
+        if (value < 0 && (whole != 0 || frac != 0))
+            put('-');
+
+        uint(whole);
+
+        if (frac == 0)
+            return;
+
+        uint8_t decimals = 6;
+
+        while (frac % 10 == 0) {
+            frac /= 10;
+            decimals--;
+        }
+
+        put('.');
+
+        for (uint32_t div = pow10(decimals - 1); div > 0; div /= 10)
+            put(static_cast<char>('0' + frac / div % 10));
+    }
+
+private:
+    char *_out;       /**< The output buffer, nullptr when only counting. */
+    size_t _len = 0;  /**< The number of characters rendered. */
+
+    static constexpr uint32_t pow10(uint8_t exp)
+    {
+        uint32_t result = 1;
+
+        while (exp-- > 0)
+            result *= 10;
+
+        return result;
+    }
+};
+
+/**
+ * The traits of the C++ types attribute values can be declared with, mapping each to its value type.
+ */
+template <typename T>
+struct iot_val_traits;
+
+template <>
+struct iot_val_traits<bool>
+{
+    static constexpr iot_val_type_e type = IOT_VAL_TYPE_BOOLEAN;
+    static constexpr std::string_view name = IOT_VAL_TYPE_BOOLEAN_STR;
+
+    static constexpr bool get(const iot_val_t &val) { return val.b; }
+    static constexpr void set(iot_val_t &val, bool value) { val.b = value; }
+    static constexpr void render(IotSchemaRenderer &out, bool value) { out.raw(value ? "true" : "false"); }
+    static void write(IotResWriter &writer, const char *key, bool value) { writer.add_bool(key, value); }
+
+    static bool parse(const iot_json_token_t &token, bool *value)
+    {
+        *value = token.type == IOT_JSON_TRUE;
+        return token.type == IOT_JSON_TRUE || token.type == IOT_JSON_FALSE;
+    }
+};
+
+template <>
+struct iot_val_traits<uint32_t>
+{
+    static constexpr iot_val_type_e type = IOT_VAL_TYPE_INTEGER;
+    static constexpr std::string_view name = IOT_VAL_TYPE_INTEGER_STR;
+
+    static constexpr uint32_t get(const iot_val_t &val) { return val.i; }
+    static constexpr void set(iot_val_t &val, uint32_t value) { val.i = value; }
+    static constexpr void render(IotSchemaRenderer &out, uint32_t value) { out.uint(value); }
+    static void write(IotResWriter &writer, const char *key, uint32_t value) { writer.add_uint(key, value); }
+
+    static bool parse(const iot_json_token_t &token, uint32_t *value)
+    {
+        uint64_t num;
+
+        if (!IotJsonReader::to_uint(token, &num) || num > UINT32_MAX)
+            return false;
+
+        *value = static_cast<uint32_t>(num);
+        return true;
+    }
+};
+
+template <>
+struct iot_val_traits<uint64_t>
+{
+    static constexpr iot_val_type_e type = IOT_VAL_TYPE_LONG;
+    static constexpr std::string_view name = IOT_VAL_TYPE_LONG_STR;
+
+    static constexpr uint64_t get(const iot_val_t &val) { return val.l; }
+    static constexpr void set(iot_val_t &val, uint64_t value) { val.l = value; }
+    static constexpr void render(IotSchemaRenderer &out, uint64_t value) { out.uint(value); }
+    static void write(IotResWriter &writer, const char *key, uint64_t value) { writer.add_ulong(key, value); }
+    static bool parse(const iot_json_token_t &token, uint64_t *value) { return IotJsonReader::to_uint(token, value); }
+};
+
+template <>
+struct iot_val_traits<float>
+{
+    static constexpr iot_val_type_e type = IOT_VAL_TYPE_FLOAT;
+    static constexpr std::string_view name = IOT_VAL_TYPE_FLOAT_STR;
+
+    static constexpr float get(const iot_val_t &val) { return val.f; }
+    static constexpr void set(iot_val_t &val, float value) { val.f = value; }
+    static constexpr void render(IotSchemaRenderer &out, float value) { out.real(value); }
+    static void write(IotResWriter &writer, const char *key, float value) { writer.add_float(key, value); }
+    static bool parse(const iot_json_token_t &token, float *value) { return IotJsonReader::to_float(token, value); }
+};
+
+template <>
+struct iot_val_traits<const char *>
+{
+    static constexpr iot_val_type_e type = IOT_VAL_TYPE_STRING;
+    static constexpr std::string_view name = IOT_VAL_TYPE_STRING_STR;
+
+    static constexpr const char *get(const iot_val_t &val) { return val.s; }
+    static constexpr void set(iot_val_t &val, const char *value) { val.s = const_cast<char *>(value); }
+    static void write(IotResWriter &writer, const char *key, const char *value) { writer.add_str(key, value); }
+
+    static constexpr void render(IotSchemaRenderer &out, const char *value)
+    {
+        if (value == nullptr)
+            out.raw("null");
+        else
+            out.str(value);
+    }
+
+    static bool parse(const iot_json_token_t &token, const char **value)
+    {
+        *value = token.start;
+        return token.type == IOT_JSON_STRING;
+    }
+};
+
+/**
+ * Creates a value of a declared type.
+ *
+ * @param[in] value The value.
+ * @return The value.
+ */
+template <typename T>
+constexpr iot_val_t iot_val_of(T value)
+{
+    iot_val_t val{};
+
+    val.is_null = false;
+    val.type = iot_val_traits<T>::type;
+    iot_val_traits<T>::set(val, value);
+
+    return val;
+}
+
+/**
+ * The generated parser and validator of the values of an attribute of a declared type.
+ */
+template <typename T>
+esp_err_t iot_schema_parse(const iot_attribute_schema_t *attribute, const iot_json_token_t &token, iot_val_t *val)
+{
+    using traits = iot_val_traits<T>;
+    T value;
+
+    if (!traits::parse(token, &value))
+        return ESP_ERR_INVALID_ARG;
+
+    if constexpr (std::is_arithmetic_v<T> && !std::is_same_v<T, bool>) {
+        if ((attribute->has_min && value < traits::get(attribute->min)) ||
+            (attribute->has_max && value > traits::get(attribute->max)))
+            return ESP_ERR_INVALID_ARG;
+    }
+
+    *val = iot_val_of<T>(value);
+
+    return ESP_OK;
+}
+
+/**
+ * The generated serializer of the values of an attribute of a declared type.
+ */
+template <typename T>
+esp_err_t iot_schema_write(IotResWriter &writer, const iot_val_t &val)
+{
+    using traits = iot_val_traits<T>;
+
+    traits::write(writer, "value", traits::get(val));
+    writer.add_str("type", traits::name.data(), traits::name.size());
+
+    return writer.error();
+}
+
+/**
+ * A struct of an attribute declaration, created with iot_attr.
+ */
+template <typename T>
+struct iot_attr_decl
+{
+    std::string_view name;    /**< The attribute's name. */
+    T value;                  /**< The attribute's initial value. */
+    bool is_primary = false;  /**< Indicates whether the attribute is a primary attribute. */
+    bool has_min = false;     /**< Indicates whether values are bounded by min. */
+    bool has_max = false;     /**< Indicates whether values are bounded by max. */
+    T min{};                  /**< The minimum value. */
+    T max{};                  /**< The maximum value. */
+    uint32_t max_age_ms = 0;  /**< How long a read value is served from the shadow. */
+    uint32_t coalesce_ms = 0; /**< The minimum interval between writes applied to the device. */
+    iot_telemetry_class_e telemetry_class = IOT_TELEMETRY_NORMAL; /**< The telemetry class. */
+
+    /**
+     * Marks the attribute as the device's primary attribute.
+     */
+    constexpr iot_attr_decl primary(void) const
+    {
+        iot_attr_decl decl = *this;
+        decl.is_primary = true;
+        return decl;
+    }
+
+    /**
+     * Serves reads of the attribute from the device's shadow for a while after each read or write.
+     */
+    constexpr iot_attr_decl max_age(uint32_t ms) const
+    {
+        iot_attr_decl decl = *this;
+        decl.max_age_ms = ms;
+        return decl;
+    }
+
+    /**
+     * Coalesces bursts of writes of the attribute, the device gets at most one write per interval, the latest.
+     */
+    constexpr iot_attr_decl coalesce(uint32_t ms) const
+    {
+        iot_attr_decl decl = *this;
+        decl.coalesce_ms = ms;
+        return decl;
+    }
+
+    /**
+     * Sets the attribute's telemetry class, which determines how often its changes are published.
+     */
+    constexpr iot_attr_decl telemetry(iot_telemetry_class_e cls) const
+    {
+        iot_attr_decl decl = *this;
+        decl.telemetry_class = cls;
+        return decl;
+    }
+
+    /**
+     * Bounds the attribute's values, writes outside of the range are rejected.
+     */
+    constexpr iot_attr_decl range(T lower, T upper) const requires (std::is_arithmetic_v<T> && !std::is_same_v<T, bool>)
+    {
+        iot_attr_decl decl = *this;
+        decl.has_min = true;
+        decl.has_max = true;
+        decl.min = lower;
+        decl.max = upper;
+        return decl;
+    }
+};
+
+/**
+ * The value type an attribute declared with a value of type T has: booleans, unsigned 32-bit or 64-bit integers,
+ * floats or strings.
+ */
+template <typename T, typename D = std::decay_t<T>>
+using iot_val_decl_t = std::conditional_t<std::is_same_v<D, bool>, bool,
+                       std::conditional_t<std::is_integral_v<D>, std::conditional_t<(sizeof(D) > 4), uint64_t, uint32_t>,
+                       std::conditional_t<std::is_floating_point_v<D>, float, const char *>>>;
+
+/**
+ * Declares an attribute, its type is deduced from its initial value.
+ *
+ * @param[in] name The attribute's name.
+ * @param[in] value The attribute's initial value.
+ * @return The attribute declaration.
+ */
+template <typename T>
+constexpr iot_attr_decl<iot_val_decl_t<T>> iot_attr(std::string_view name, T value)
+{
+    return {.name = name, .value = static_cast<iot_val_decl_t<T>>(value)};
+}
+
+/**
+ * A class of a device schema declared at compile time. The attributes' names, types and ranges are fixed by the
+ * declaration, so their parsers, validators and serializers are generated per type, their slots are their position
+ * in the declaration and the attributes of the device info document are rendered into flash.
+ *
+ * @code
+ * static constexpr IotDeviceSchema light{iot_attr(IOT_ATTR_NAME_POWER, false).primary(),
+ *                                        iot_attr(IOT_ATTR_NAME_BRIGHTNESS, 100u).range(0, 100)};
+ *
+ * cfg.schema = &iot_schema_v<light>;
+ * @endcode
+ */
+template <typename... T>
+class IotDeviceSchema final
+{
+public:
+    static constexpr size_t COUNT = sizeof...(T);
+
+    static_assert(COUNT > 0 && COUNT <= UINT8_MAX, "A schema must declare between 1 and 255 attributes");
+
+    constexpr IotDeviceSchema(iot_attr_decl<T>... attributes) : _attributes(attributes...)
+    {
+    }
+
+    /**
+     * Gets the attribute table of the schema.
+     */
+    constexpr std::array<iot_attribute_schema_t, COUNT> table(void) const
+    {
+        return std::apply([](const auto &... decl) {
+            return std::array<iot_attribute_schema_t, COUNT>{entry(decl)...};
+        }, _attributes);
+    }
+
+    /**
+     * Renders the attributes array of the device info document.
+     *
+     * @param[out] out The buffer to render to, nullptr to only count the length.
+     * @return The length of the json.
+     */
+    constexpr size_t render(char *out) const
+    {
+        IotSchemaRenderer renderer(out);
+
+        renderer.put('[');
+
+        std::apply([&renderer](const auto &... decl) {
+            bool first = true;
+            ((render_attribute(renderer, decl, first), first = false), ...);
+        }, _attributes);
+
+        renderer.put(']');
+
+        return renderer.length();
+    }
+
+    /**
+     * Checks at compile time that the attribute names are unique.
+     */
+    constexpr bool unique(void) const
+    {
+        auto attributes = table();
+
+        for (size_t i = 0; i < COUNT; i++) {
+            for (size_t j = i + 1; j < COUNT; j++) {
+                if (attributes[i].name == attributes[j].name)
+                    return false;
+            }
+        }
+
+        return true;
+    }
+
+private:
+    std::tuple<iot_attr_decl<T>...> _attributes;  /**< The attribute declarations. */
+
+    template <typename V>
+    static constexpr iot_attribute_schema_t entry(const iot_attr_decl<V> &decl)
+    {
+        return {
+            .name = decl.name,
+            .type_name = iot_val_traits<V>::name,
+            .type = iot_val_traits<V>::type,
+            .is_primary = decl.is_primary,
+            .has_min = decl.has_min,
+            .has_max = decl.has_max,
+            .min = iot_val_of<V>(decl.min),
+            .max = iot_val_of<V>(decl.max),
+            .max_age_ms = decl.max_age_ms,
+            .coalesce_ms = decl.coalesce_ms,
+            .telemetry = decl.telemetry_class,
+            .parse = iot_schema_parse<V>,
+            .write = iot_schema_write<V>,
+        };
+    }
+
+    template <typename V>
+    static constexpr void render_param(IotSchemaRenderer &out, std::string_view key, V value)
+    {
+        out.raw("{\"key\":");
+        out.str(key);
+        out.raw(",\"value\":");
+        iot_val_traits<V>::render(out, value);
+        out.raw(",\"type\":");
+        out.str(iot_val_traits<V>::name);
+        out.put('}');
+    }
+
+    template <typename V>
+    static constexpr void render_attribute(IotSchemaRenderer &out, const iot_attr_decl<V> &decl, bool first)
+    {
+        if (!first)
+            out.put(',');
+
+        out.raw("{\"name\":");
+        out.str(decl.name);
+        out.raw(",\"value\":");
+        iot_val_traits<V>::render(out, decl.value);
+        out.raw(",\"type\":");
+        out.str(iot_val_traits<V>::name);
+        out.raw(",\"is_primary\":");
+        out.raw(decl.is_primary ? "true" : "false");
+
+        if (decl.has_min || decl.has_max) {
+            out.raw(",\"parameters\":[");
+
+            if (decl.has_min)
+                render_param(out, IOT_ATTR_PARAM_MIN, decl.min);
+
+            if (decl.has_min && decl.has_max)
+                out.put(',');
+
+            if (decl.has_max)
+                render_param(out, IOT_ATTR_PARAM_MAX, decl.max);
+
+            out.put(']');
+        }
+
+        out.put('}');
+    }
+};
+
+/**
+ * A struct holding the generated tables of a schema, which are constant and so placed in flash.
+ */
+template <const auto &Schema>
+struct iot_schema_storage
+{
+    static_assert(Schema.unique(), "The attribute names of a schema must be unique");
+
+    static constexpr auto attributes = Schema.table();
+
+    static constexpr auto json = [] {
+        std::array<char, Schema.render(nullptr) + 1> buf{};
+        Schema.render(buf.data());
+        return buf;
+    }();
+
+    static constexpr iot_device_schema_t schema = {
+        .attributes = attributes.data(),
+        .count = static_cast<uint8_t>(attributes.size()),
+        .attributes_json = std::string_view(json.data(), json.size() - 1),
+    };
+};
+
+/**
+ * The generated runtime schema of a schema declaration, set it as the device configuration's schema.
+ */
+template <const auto &Schema>
+inline constexpr const iot_device_schema_t &iot_schema_v = iot_schema_storage<Schema>::schema;
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <vector>
+#include "iot_common.h"
+#include "iot_device_defs.h"
+#include "iot_attribute_registry.h"
+#include "iot_attribute_shadow.h"
+
+/**
+ * A callback publishing an encoded telemetry message.
+ *
+ * @param[in] data A pointer to the message.
+ * @param[in] len The length of the message.
+ * @param[in] snapshot Indicates whether the message is a snapshot of every value.
+ * @return ESP_OK if the message was published or buffered, otherwise an error code.
+ */
+typedef esp_err_t (*iot_telemetry_publish_cb_t)(const uint8_t *data, size_t len, bool snapshot);
+
+/**
+ * A class for publishing the device's attribute values from the shadow in a compact binary encoding. Each telemetry
+ * class is published at its own period and only with the values which changed since they were last published, while
+ * a snapshot periodically carries every value so a late subscriber can catch up.
+ *
+ * A message is a header of the encoding version, the flags and a little endian sequence number, followed by a slot
+ * and a little endian value per attribute. The value's size is implied by the slot's schema type, 1 byte for a
+ * boolean, 4 for an integer or a float and 8 for a long. String attributes are never published.
+ */
+class IotTelemetry final
+{
+public:
+    esp_err_t start(const IotAttributeRegistry &registry, IotAttributeShadow *shadow, const iot_telemetry_cfg_t *cfg,
+                    iot_telemetry_publish_cb_t publish_cb);
+
+private:
+    static constexpr const char *TAG = "IotTelemetry";  /**< A constant used to identify the source of the log message of this class. */
+    static constexpr uint32_t STACK_SIZE = 4096;         /**< The stack size of the telemetry task. */
+    static constexpr size_t HEADER_SIZE = 4;             /**< The size of a message header. */
+
+    std::vector<iot_telemetry_slot_t> _slots{};          /**< The telemetry state of each attribute, indexed by slot. */
+    IotAttributeShadow *_shadow = nullptr;               /**< A pointer to the shadow holding the attributes' values. */
+    const iot_telemetry_cfg_t *_cfg = nullptr;           /**< A pointer to the telemetry configuration. */
+    iot_telemetry_publish_cb_t _publish_cb = nullptr;    /**< The callback publishing the encoded messages. */
+    uint32_t _due[IOT_TELEMETRY_CLASS_MAX] = {};         /**< The time each class is next due at in milliseconds. */
+    uint32_t _snapshot_due = 0;                          /**< The time the next snapshot is due at in milliseconds. */
+    uint16_t _seq = 0;                                   /**< The sequence number of the next message. */
+    TaskHandle_t _task = nullptr;                        /**< The handle of the telemetry task. */
+
+    static void task(void *arg);
+    TickType_t tick(void);
+    void publish(const bool *classes, bool snapshot);
+    size_t encode(uint8_t *buf, size_t size, const bool *classes, bool snapshot, uint8_t *slot);
+    static size_t value_size(iot_val_type_e type);
+};
@@ -0,0 +1,180 @@
+#include "iot_attribute_mailbox.h"
+
+/**
+ * Initialises the mailboxes of a device's attributes, starting the mailbox task if any attribute coalesces writes.
+ *
+ * @param[in] registry The device's attribute registry.
+ * @param[in] write_cb The device's write callback.
+ * @param[in] shadow A pointer to the device's attribute shadow.
+ * @param[in] cb_mutex A pointer to the mutex serializing the device's callbacks, held while a write is applied.
+ * @return ESP_OK on success, otherwise an error code.
+ */
+esp_err_t IotAttributeMailbox::init(const IotAttributeRegistry &registry, iot_attribute_write_cb_t write_cb,
+                                    IotAttributeShadow *shadow, std::mutex *cb_mutex)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    _registry = &registry;
+    _write_cb = write_cb;
+    _shadow = shadow;
+    _cb_mutex = cb_mutex;
+    _slots.assign(registry.count(), {});
+
+    bool coalesce = false;
+    uint32_t now = iot_millis();
+
+    for (uint8_t slot = 0; slot < registry.count(); slot++) {
+        const iot_attribute_schema_t *schema = registry.schema(slot);
+
+        if (write_cb == nullptr || (schema != nullptr && schema->type == IOT_VAL_TYPE_STRING))
+            continue;
+
+        _slots[slot].window_ms = registry.coalesce(slot);
+        // The first write of an attribute is applied right away.
+        _slots[slot].applied = now - _slots[slot].window_ms;
+        coalesce |= _slots[slot].window_ms != 0;
+    }
+
+    if (!coalesce || _task != nullptr)
+        return ESP_OK;
+
+    if (xTaskCreate(task, "iot_mailbox", STACK_SIZE, this, 3, &_task) != pdPASS) {
+        ESP_LOGE(TAG, "%s: Failed to create the mailbox task", __func__);
+        return ESP_ERR_NO_MEM;
+    }
+
+    return ESP_OK;
+}
+
+/**
+ * Posts the writes of attributes which coalesce writes to their mailboxes, replacing any value waiting there.
+ *
+ * @param[in,out] param A pointer to the attributes written, the posted ones are removed and the rest must be written
+ *                      as usual.
+ * @return The number of writes posted.
+ */
+size_t IotAttributeMailbox::post(iot_attribute_req_param_t *param)
+{
+    if (_task == nullptr)
+        return 0;
+
+    size_t posted = 0;
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        std::erase_if(param->attributes, [this, &posted](const iot_attribute_req_data_t &item) {
+            if (item.slot >= _slots.size() || _slots[item.slot].window_ms == 0 ||
+                item.value.type == IOT_VAL_TYPE_STRING)
+                return false;
+
+            _slots[item.slot].value = item.value;
+            _slots[item.slot].full = true;
+            posted++;
+
+            return true;
+        });
+    }
+
+    if (posted > 0)
+        xTaskNotifyGive(_task);
+
+    return posted;
+}
+
+/**
+ * Cancels the values waiting in the mailboxes of attributes which are about to be written directly, like the writes of
+ * a batch, so a value posted before can't be applied after them. A direct write counts as the mailbox's latest write,
+ * the next posted value waits for the rest of the window. It must be called with the callback mutex held, until the
+ * direct writes are applied.
+ *
+ * @param[in] param A pointer to the attributes about to be written.
+ * @return The number of waiting values cancelled.
+ */
+size_t IotAttributeMailbox::cancel(const iot_attribute_req_param_t *param)
+{
+    if (_task == nullptr)
+        return 0;
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    uint32_t now = iot_millis();
+    size_t cancelled = 0;
+
+    for (const iot_attribute_req_data_t &item : param->attributes) {
+        if (item.slot >= _slots.size() || _slots[item.slot].window_ms == 0)
+            continue;
+
+        cancelled += _slots[item.slot].full;
+        _slots[item.slot].full = false;
+        _slots[item.slot].applied = now;
+    }
+
+    return cancelled;
+}
+
+/**
+ * The mailbox task, it applies the mailboxes that are due and sleeps until the next one is or a write is posted.
+ *
+ * @param[in] arg A pointer to the mailbox instance.
+ */
+void IotAttributeMailbox::task(void *arg)
+{
+    auto *self = static_cast<IotAttributeMailbox *>(arg);
+    TickType_t wait = portMAX_DELAY;
+
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, wait);
+        wait = self->flush();
+    }
+}
+
+/**
+ * Applies the full mailboxes whose window has elapsed in one write callback. The callback mutex is held from taking
+ * the values out of the mailboxes until the shadow is updated, so a write applied elsewhere in the meantime can't be
+ * overtaken by an older value.
+ *
+ * @return The ticks until the next mailbox is due, or portMAX_DELAY if none is waiting.
+ */
+TickType_t IotAttributeMailbox::flush(void)
+{
+    std::lock_guard<std::mutex> cb_lock(*_cb_mutex);
+    iot_attribute_req_param_t param;
+    uint32_t next = UINT32_MAX;
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        uint32_t now = iot_millis();
+
+        for (uint8_t slot = 0; slot < _slots.size(); slot++) {
+            iot_attribute_mailbox_t &mailbox = _slots[slot];
+
+            if (!mailbox.full)
+                continue;
+
+            uint32_t elapsed = now - mailbox.applied;
+
+            if (elapsed < mailbox.window_ms) {
+                next = std::min(next, mailbox.window_ms - elapsed);
+                continue;
+            }
+
+            param.attributes.push_back({.name = _registry->name(slot), .value = mailbox.value, .slot = slot});
+            mailbox.full = false;
+            mailbox.applied = now;
+        }
+    }
+
+    if (!param.attributes.empty()) {
+        esp_err_t ret = _write_cb(&param);
+
+        if (ret == ESP_OK)
+            _shadow->update(&param);
+        else
+            ESP_LOGE(TAG, "%s: Failed to apply coalesced writes [reason: %s]", __func__, esp_err_to_name(ret));
+    }
+
+    if (next == UINT32_MAX)
+        return portMAX_DELAY;
+
+    return std::max<TickType_t>(pdMS_TO_TICKS(next), 1);
+}
@@ -0,0 +1,174 @@
+#include "iot_attribute_registry.h"
+
+/**
+ * Builds the registry from a device configuration, interning the names of the schema's attributes or, without a
+ * schema, of the device info's attributes.
+ *
+ * @param[in] cfg A pointer to the device configuration.
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG if a name is declared twice or there are too many attributes.
+ * @note The device info's attributes must not change once the registry is built, the names point into them.
+ */
+esp_err_t IotAttributeRegistry::build(const iot_device_cfg_t *cfg)
+{
+    _schema = cfg->schema;
+    _names.clear();
+    _policies.clear();
+
+    if (_schema != nullptr) {
+        for (uint8_t i = 0; i < _schema->count; i++) {
+            _names.push_back(_schema->attributes[i].name);
+            const iot_attribute_schema_t &attribute = _schema->attributes[i];
+
+            _policies.push_back({attribute.max_age_ms, attribute.coalesce_ms, attribute.telemetry});
+        }
+    } else if (cfg->device_info != nullptr) {
+        for (const auto &attribute: cfg->device_info->attributes) {
+            _names.emplace_back(attribute.name.c_str(), attribute.name.length());
+            _policies.push_back({attribute.max_age_ms, attribute.coalesce_ms, attribute.telemetry});
+        }
+    }
+
+    if (_names.size() >= IOT_ATTR_SLOT_NONE) {
+        ESP_LOGE(TAG, "%s: Too many attributes [count: %d, max: %d]", __func__, _names.size(), IOT_ATTR_SLOT_NONE - 1);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    // Keep the load factor at or below a half so probe sequences stay short.
+    size_t size = 8;
+
+    while (size < _names.size() * 2)
+        size <<= 1;
+
+    _mask = size - 1;
+    _table.assign(size, 0);
+
+    for (uint8_t slot = 0; slot < _names.size(); slot++) {
+        std::string_view name = _names[slot];
+
+        if (find(name.data(), name.size()) != IOT_ATTR_SLOT_NONE) {
+            ESP_LOGE(TAG, "%s: Attribute has already been added [name: %s]", __func__, name.data());
+            return ESP_ERR_INVALID_ARG;
+        }
+
+        uint32_t index = hash(name.data(), name.size()) & _mask;
+
+        while (_table[index] != 0)
+            index = (index + 1) & _mask;
+
+        _table[index] = slot + 1;
+    }
+
+    ESP_LOGD(TAG, "%s: Built the attribute registry [count: %d, table: %d]", __func__, _names.size(), size);
+
+    return ESP_OK;
+}
+
+/**
+ * Resolves an attribute's name to its slot.
+ *
+ * @param[in] name A pointer to the name, which needn't be null terminated.
+ * @param[in] len The length of the name.
+ * @return The attribute's slot, or IOT_ATTR_SLOT_NONE if it isn't registered.
+ */
+uint8_t IotAttributeRegistry::find(const char *name, size_t len) const
+{
+    if (_table.empty())
+        return IOT_ATTR_SLOT_NONE;
+
+    uint32_t index = hash(name, len) & _mask;
+
+    while (_table[index] != 0) {
+        std::string_view candidate = _names[_table[index] - 1];
+
+        if (candidate.size() == len && memcmp(candidate.data(), name, len) == 0)
+            return _table[index] - 1;
+
+        index = (index + 1) & _mask;
+    }
+
+    return IOT_ATTR_SLOT_NONE;
+}
+
+/**
+ * Gets the number of registered attributes, the slots are zero to count minus one.
+ *
+ * @return The number of attributes.
+ */
+uint8_t IotAttributeRegistry::count(void) const
+{
+    return _names.size();
+}
+
+/**
+ * Gets the interned name of an attribute.
+ *
+ * @param[in] slot The attribute's slot.
+ * @return The name, which is null terminated, or an empty view for an invalid slot.
+ */
+std::string_view IotAttributeRegistry::name(uint8_t slot) const
+{
+    return slot < _names.size() ? _names[slot] : std::string_view();
+}
+
+/**
+ * Gets how long a read value of an attribute is served from the shadow.
+ *
+ * @param[in] slot The attribute's slot.
+ * @return The max age in milliseconds, 0 if the attribute isn't cached.
+ */
+uint32_t IotAttributeRegistry::max_age(uint8_t slot) const
+{
+    return slot < _policies.size() ? _policies[slot].max_age_ms : 0;
+}
+
+/**
+ * Gets the minimum interval between writes of an attribute applied to the device.
+ *
+ * @param[in] slot The attribute's slot.
+ * @return The coalescing window in milliseconds, 0 if writes aren't coalesced.
+ */
+uint32_t IotAttributeRegistry::coalesce(uint8_t slot) const
+{
+    return slot < _policies.size() ? _policies[slot].coalesce_ms : 0;
+}
+
+/**
+ * Gets the telemetry class of an attribute.
+ *
+ * @param[in] slot The attribute's slot.
+ * @return The telemetry class, IOT_TELEMETRY_NONE for an unknown slot.
+ */
+iot_telemetry_class_e IotAttributeRegistry::telemetry(uint8_t slot) const
+{
+    return slot < _policies.size() ? _policies[slot].telemetry : IOT_TELEMETRY_NONE;
+}
+
+/**
+ * Gets the schema declaration of an attribute.
+ *
+ * @param[in] slot The attribute's slot.
+ * @return A pointer to the declaration, or nullptr if the device has no schema or the slot is invalid.
+ */
+const iot_attribute_schema_t *IotAttributeRegistry::schema(uint8_t slot) const
+{
+    return _schema != nullptr && slot < _schema->count ? &_schema->attributes[slot] : nullptr;
+}
+
+/**
+ * Hashes an attribute's name with FNV-1a.
+ *
+ * @param[in] name A pointer to the name.
+ * @param[in] len The length of the name.
+ * @return The hash.
+ */
+uint32_t IotAttributeRegistry::hash(const char *name, size_t len)
+{
+    uint32_t hash = 2166136261UL;
+
+    for (size_t i = 0; i < len; i++) {
+        hash ^= static_cast<uint8_t>(name[i]);
+        hash *= 16777619UL;
+    }
+
+    return hash;
+}
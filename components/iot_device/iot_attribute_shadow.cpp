@@ -0,0 +1,249 @@
+#include "iot_attribute_shadow.h"
+
+/**
+ * Initialises the shadow entries of a device's attributes.
+ *
+ * @param[in] registry The device's attribute registry.
+ */
+void IotAttributeShadow::init(const IotAttributeRegistry &registry)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    _registry = &registry;
+    _entries.assign(registry.count(), {});
+    _dirty = false;
+
+    for (uint8_t slot = 0; slot < registry.count(); slot++) {
+        const iot_attribute_schema_t *schema = registry.schema(slot);
+
+        _entries[slot].type = schema != nullptr ? schema->type : IOT_VAL_TYPE_INVALID;
+
+        if (schema == nullptr || schema->type != IOT_VAL_TYPE_STRING)
+            _entries[slot].max_age_ms = registry.max_age(slot);
+    }
+}
+
+/**
+ * Reads attribute values, from the shadow where fresh and otherwise with the read callback. Attributes another
+ * request is already reading are waited for instead of being read again.
+ *
+ * @param[in,out] param A pointer to the attributes to read, their values are filled in.
+ * @param[in] read_cb The device's read callback.
+ * @return ESP_OK on success, otherwise the read callback's error or ESP_FAIL if a coalesced read failed.
+ */
+esp_err_t IotAttributeShadow::read(iot_attribute_req_param_t *param, iot_attribute_read_cb_t read_cb)
+{
+    iot_attribute_req_param_t misses;
+    std::vector<size_t> miss_index;
+    std::vector<size_t> wait_index;
+    uint32_t start = iot_millis();
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        for (size_t i = 0; i < param->attributes.size(); i++) {
+            iot_attribute_req_data_t &item = param->attributes[i];
+            iot_attribute_shadow_t *shadow = cached(item.slot);
+
+            if (shadow != nullptr && shadow->valid && start - shadow->updated <= shadow->max_age_ms) {
+                item.value = shadow->value;
+                continue;
+            }
+
+            if (shadow != nullptr && shadow->pending) {
+                wait_index.push_back(i);
+                continue;
+            }
+
+            if (shadow != nullptr)
+                shadow->pending = true;
+
+            misses.attributes.push_back(item);
+            miss_index.push_back(i);
+        }
+    }
+
+    esp_err_t ret = ESP_OK;
+
+    if (!misses.attributes.empty()) {
+        ret = read_cb(&misses);
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        uint32_t now = iot_millis();
+
+        for (size_t i = 0; i < misses.attributes.size(); i++) {
+            const iot_attribute_req_data_t &item = misses.attributes[i];
+            iot_attribute_shadow_t *shadow = entry(item.slot);
+
+            if (shadow == nullptr)
+                continue;
+
+            shadow->pending = false;
+
+            if (ret != ESP_OK)
+                continue;
+
+            param->attributes[miss_index[i]].value = item.value;
+            store(shadow, item.value, now);
+        }
+
+        _cond.notify_all();
+    }
+
+    if (ret != ESP_OK || wait_index.empty())
+        return ret;
+
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    for (size_t i: wait_index) {
+        iot_attribute_req_data_t &item = param->attributes[i];
+        iot_attribute_shadow_t *shadow = entry(item.slot);
+
+        _cond.wait(lock, [shadow] { return !shadow->pending; });
+
+        // The read waited for started after this request, anything older means it failed.
+        if (!shadow->valid || static_cast<int32_t>(shadow->updated - start) < 0)
+            return ESP_FAIL;
+
+        item.value = shadow->value;
+    }
+
+    return ESP_OK;
+}
+
+/**
+ * Updates the shadow with written attribute values.
+ *
+ * @param[in] param A pointer to the attributes written.
+ */
+void IotAttributeShadow::update(const iot_attribute_req_param_t *param)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    uint32_t now = iot_millis();
+
+    for (const auto &item: param->attributes) {
+        iot_attribute_shadow_t *shadow = entry(item.slot);
+
+        if (shadow != nullptr)
+            store(shadow, item.value, now);
+    }
+}
+
+/**
+ * Sets the value of an attribute which changed outside of a request, such as a sensor reading or a local control.
+ *
+ * @param[in] slot The attribute's slot.
+ * @param[in] value The attribute's new value.
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG for an unknown slot.
+ */
+esp_err_t IotAttributeShadow::set(uint8_t slot, iot_val_t value)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    iot_attribute_shadow_t *shadow = entry(slot);
+
+    if (shadow == nullptr)
+        return ESP_ERR_INVALID_ARG;
+
+    store(shadow, value, iot_millis());
+
+    return ESP_OK;
+}
+
+/**
+ * Takes the attributes whose values changed since the last call, clearing their dirty bits.
+ *
+ * @param[out] param A pointer to store the changed attributes and their values in.
+ * @return true if any attribute changed, otherwise false.
+ */
+bool IotAttributeShadow::take_dirty(iot_attribute_req_param_t *param)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    if (!_dirty)
+        return false;
+
+    for (uint8_t slot = 0; slot < _entries.size(); slot++) {
+        iot_attribute_shadow_t &shadow = _entries[slot];
+
+        if (!shadow.dirty)
+            continue;
+
+        shadow.dirty = false;
+        param->attributes.push_back({.name = _registry->name(slot), .value = shadow.value, .slot = slot});
+    }
+
+    _dirty = false;
+
+    return !param->attributes.empty();
+}
+
+/**
+ * Gets the last known value of an attribute, regardless of its age.
+ *
+ * @param[in] slot The attribute's slot.
+ * @param[out] value A pointer to store the value in.
+ * @return true if the attribute has a value, otherwise false.
+ */
+bool IotAttributeShadow::get(uint8_t slot, iot_val_t *value)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    iot_attribute_shadow_t *shadow = entry(slot);
+
+    if (shadow == nullptr || !shadow->valid)
+        return false;
+
+    *value = shadow->value;
+
+    return true;
+}
+
+/**
+ * Gets the shadow entry of an attribute.
+ *
+ * @param[in] slot The attribute's slot.
+ * @return A pointer to the entry, or nullptr for an unknown slot.
+ */
+iot_attribute_shadow_t *IotAttributeShadow::entry(uint8_t slot)
+{
+    return slot < _entries.size() ? &_entries[slot] : nullptr;
+}
+
+/**
+ * Gets the shadow entry of an attribute whose reads are cached.
+ *
+ * @param[in] slot The attribute's slot.
+ * @return A pointer to the entry, or nullptr if the attribute isn't cached.
+ */
+iot_attribute_shadow_t *IotAttributeShadow::cached(uint8_t slot)
+{
+    iot_attribute_shadow_t *shadow = entry(slot);
+
+    return shadow != nullptr && shadow->max_age_ms != 0 ? shadow : nullptr;
+}
+
+/**
+ * Stores a value in a shadow entry, setting its dirty bit if the value changed.
+ *
+ * @param[in] shadow A pointer to the entry.
+ * @param[in] value The value.
+ * @param[in] now The current time in milliseconds.
+ * @note The mutex must be held.
+ */
+void IotAttributeShadow::store(iot_attribute_shadow_t *shadow, iot_val_t value, uint32_t now)
+{
+    // Values of declared attributes are typed by the schema, read callbacks may leave the tag unset.
+    if (shadow->type != IOT_VAL_TYPE_INVALID)
+        value.type = shadow->type;
+
+    if (value.type == IOT_VAL_TYPE_STRING || value.type >= IOT_VAL_TYPE_INVALID)
+        return;
+
+    if (!shadow->valid || !iot_val_equals(shadow->value, value)) {
+        shadow->dirty = true;
+        _dirty = true;
+    }
+
+    shadow->value = value;
+    shadow->updated = now;
+    shadow->valid = true;
+}
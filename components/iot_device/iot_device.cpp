@@ -14,6 +14,53 @@ IotServer *IotDevice::_iot_server{nullptr};
  */
 iot_device_cfg_t *IotDevice::_iot_device_cfg{nullptr};
 
+/**
+ * The mutex used to safe guard the cached device information document.
+ */
+std::mutex IotDevice::_info_mutex{};
+
+/**
+ * The mutex used to serialize the device's read and write callbacks, wherever the request comes from.
+ */
+std::mutex IotDevice::_cb_mutex{};
+
+/**
+ * The cached serialized device information document, nullptr until built.
+ */
+iot_device_info_doc_t *IotDevice::_info_doc{nullptr};
+
+/**
+ * The registry of the device's attributes, resolving their names to slots.
+ */
+IotAttributeRegistry IotDevice::_registry{};
+
+/**
+ * The shadow of the device's attribute values, serving fresh values without calling the read callback.
+ */
+IotAttributeShadow IotDevice::_shadow{};
+
+/**
+ * The write mailboxes of the device's attributes, coalescing bursts of writes.
+ */
+IotAttributeMailbox IotDevice::_mailbox{};
+
+#ifdef CONFIG_IOT_HOVER_MQTT_ENABLED
+/**
+ * The publisher of the device's attribute telemetry.
+ */
+IotTelemetry IotDevice::_telemetry{};
+#endif
+
+/**
+ * The handle of the task emitting the changed attributes.
+ */
+TaskHandle_t IotDevice::_notify_task{nullptr};
+
+/**
+ * The handle of the timer waking the notify task every notification period.
+ */
+esp_timer_handle_t IotDevice::_notify_timer{nullptr};
+
 /**
  * Initialises a new instance of the IotDevice class.
  */
@@ -40,15 +87,40 @@ esp_err_t IotDevice::init(iot_device_cfg_t *cfg)
 {
     esp_err_t ret = validate_cfg(cfg);
 
+    if (ret != ESP_OK)
+        return ret;
+
+    ret = _registry.build(cfg);
+
+    if (ret != ESP_OK)
+        return ret;
+
+    _shadow.init(_registry);
+
+    ret = _mailbox.init(_registry, cfg->write_cb, &_shadow, &_cb_mutex);
+
     if (ret != ESP_OK)
         return ret;
 
     _iot_device_cfg = cfg;
 
+    invalidate_info();
+
+    if (cfg->notify_cfg != nullptr && start_notify() != ESP_OK)
+        return ESP_FAIL;
+
+#ifdef CONFIG_IOT_HOVER_MQTT_ENABLED
+    if (cfg->telemetry_cfg != nullptr && _telemetry.start(_registry, &_shadow, cfg->telemetry_cfg,
+                                                          publish_telemetry) != ESP_OK)
+        return ESP_FAIL;
+#endif
+
     ret = _register_route("info", HTTP_GET, on_info);
 
     ret |= _register_route("attributes", HTTP_GET, on_read);
 
+    ret |= _register_route("batch", HTTP_POST, on_batch);
+
     if (ret != ESP_OK)
         return ret;
 
@@ -86,18 +158,16 @@ esp_err_t IotDevice::validate_cfg(const iot_device_cfg_t *cfg)
         return ret;
     }
 
-    if (cfg->notify_cfg != nullptr) {
-        if (cfg->notify_cfg->callback_handle == nullptr) {
-            ESP_LOGE(TAG, "%s: The notify callback is required.", __func__);
-            return ret;
-        }
-
-        if (cfg->notify_cfg->notify_cb == nullptr) {
-            ESP_LOGE(TAG, "%s: The notify callback is required.", __func__);
-            return ret;
-        }
+    if (cfg->notify_cfg != nullptr && cfg->notify_cfg->period <= 0) {
+        ESP_LOGE(TAG, "%s: The notify period is required.", __func__);
+        return ret;
     }
 
+#ifndef CONFIG_IOT_HOVER_MQTT_ENABLED
+    if (cfg->telemetry_cfg != nullptr)
+        ESP_LOGW(TAG, "%s: Telemetry requires mqtt, it won't be published.", __func__);
+#endif
+
     if (cfg->req_mode == IOT_ATTRIBUTE_CB_RW && (cfg->read_cb == nullptr || cfg->write_cb == nullptr)) {
         ESP_LOGE(TAG, "%s: Both read and write callbacks are required for IOT_CAP_CB_READ_WRITE", __func__);
         return ret;
@@ -149,315 +219,943 @@ esp_err_t IotDevice::_register_route(const char *path, httpd_method_t method, es
 }
 
 /**
- * Handles a request to get the device information.
+ * Handles a request to get the device information. The cached document is held by the request while it's sent, so
+ * the info mutex is released before the network send.
  *
  * @param[in] req The HTTP request object.
  * @return ESP_OK.
  */
 esp_err_t IotDevice::on_info(httpd_req_t *req)
 {
-    ESP_LOGI(TAG, "%s: Received request to get device information.", __func__ );
-
-    cJSON *root = cJSON_CreateObject();
+    iot_device_info_doc_t *doc;
 
-    iot_device_info_t *info = _iot_device_cfg->device_info;
+    {
+        std::lock_guard<std::mutex> lock(_info_mutex);
 
-    cJSON_AddStringToObject(root, "uuid", _iot_device_cfg->device_info->uuid.data());
-    cJSON_AddStringToObject(root, "name", info->device_name.data());
-    cJSON_AddStringToObject(root, "type", iot_device_type_to_str(info->device_type).data());
+        if (_info_doc == nullptr && build_info() != ESP_OK)
+            return _iot_server->send_err(req, IOT_HTTP_SERIALIZATION_ERR);
 
-    cJSON *attributes = cJSON_AddArrayToObject(root, "attributes");
+        doc = _info_doc;
+        doc->refs++;
+    }
 
-    ESP_LOGI(TAG, "%s: Attributes size %d", __func__, info->attributes.size());
+    esp_err_t ret = _iot_server->send_cached(req, doc->data, doc->len, doc->etag);
 
-    for (int i = 0; i < info->attributes.size(); i++) {
+    std::lock_guard<std::mutex> lock(_info_mutex);
 
-        iot_attribute_t attribute = info->attributes[i];
+    release_info(doc);
 
-        cJSON *j_attribute = cJSON_CreateObject();
+    return ret;
+}
 
-        cJSON_AddStringToObject(j_attribute, "name", attribute.name.data());
+/**
+ * Discards the cached device information document, it will be rebuilt on the next request.
+ *
+ * @note Call this whenever the device's attributes, services or configuration change.
+ */
+void IotDevice::invalidate_info(void)
+{
+    std::lock_guard<std::mutex> lock(_info_mutex);
 
-        esp_err_t ret = iot_val_add_to_json(j_attribute, attribute.value);
+    if (_info_doc != nullptr)
+        release_info(_info_doc);
 
-        if (ret != ESP_OK) {
-            continue;
-        }
+    _info_doc = nullptr;
+}
 
-        cJSON_AddBoolToObject(j_attribute, "is_primary", attribute.is_primary);
+/**
+ * Releases a holder's reference to a device information document, freeing it once no one holds it.
+ *
+ * @param[in] doc A pointer to the document.
+ * @note The info mutex must be held.
+ */
+void IotDevice::release_info(iot_device_info_doc_t *doc)
+{
+    if (--doc->refs > 0)
+        return;
 
-        if (attribute.params.size() > 0) {
-            cJSON *parameters = cJSON_AddArrayToObject(j_attribute, "parameters");
+    cJSON_free(doc->data);
+    free(doc);
+}
 
-            for (int j = 0; j < attribute.params.size(); j++) {
-                cJSON *j_param = cJSON_CreateObject();
-                iot_param_t param = info->attributes[i].params[j];
+/**
+ * Reports changed attribute values, pushing them to the clients subscribed to the server's push channel.
+ *
+ * @param[in] param A pointer to the attributes that changed and their new values.
+ * @return ESP_OK on success, otherwise an error code.
+ * @note Nothing is serialized while there are no subscribers.
+ */
+esp_err_t IotDevice::report(const iot_attribute_req_param_t *param)
+{
+#ifdef CONFIG_IOT_HOVER_SERVER_PUSH
+    if (param == nullptr || param->attributes.empty())
+        return ESP_ERR_INVALID_ARG;
 
-                cJSON_AddStringToObject(j_param, "key", param.key.c_str());
+    if (_iot_server == nullptr || !_iot_server->has_subscribers())
+        return ESP_OK;
 
-                ret = iot_val_add_to_json(j_param, param.value);
+    char *json = attributes_to_json(param);
 
-                if (ret != ESP_OK) {
-                    continue;
-                }
+    if (json == nullptr)
+        return ESP_ERR_NO_MEM;
 
-                cJSON_AddItemToArray(parameters, j_param);
-            }
-        }
+    esp_err_t ret = _iot_server->publish(json, strlen(json));
 
-        cJSON_AddItemToArray(attributes, j_attribute);
-    }
+    cJSON_free(json);
 
-    cJSON *services = cJSON_AddArrayToObject(root,"services");
+    return ret;
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
 
-    for (int i = 0; i < info->services.size(); i++) {
-        cJSON  *service = cJSON_CreateObject();
+/**
+ * Marks an attribute's value as changed outside of a request, such as a sensor reading or a local control. The
+ * change is notified with the others on the next notification period.
+ *
+ * @param[in] slot The attribute's slot.
+ * @param[in] value The attribute's new value.
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG for an unknown slot.
+ */
+esp_err_t IotDevice::mark_changed(uint8_t slot, iot_val_t value)
+{
+    return _shadow.set(slot, value);
+}
 
-        cJSON_AddStringToObject(service, "name",info->services[i].name.data());
-        cJSON_AddBoolToObject(service, "enabled",info->services[i].enabled);
-        cJSON_AddBoolToObject(service, "core_service",info->services[i].core_service);
+/**
+ * Marks an attribute's value as changed outside of a request, resolving the attribute by name.
+ *
+ * @param[in] name The attribute's name.
+ * @param[in] value The attribute's new value.
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG for an unknown attribute.
+ */
+esp_err_t IotDevice::mark_changed(std::string_view name, iot_val_t value)
+{
+    return _shadow.set(_registry.find(name.data(), name.size()), value);
+}
 
-        ESP_LOGD(TAG, "%s: Adding service [name: %s ] to response", __func__, info->services[i].name.data());
+/**
+ * Starts the notification engine, one periodic timer waking the notify task which emits the changed attributes.
+ *
+ * @return ESP_OK on success, otherwise an error code.
+ */
+esp_err_t IotDevice::start_notify(void)
+{
+    if (_notify_task != nullptr)
+        return ESP_OK;
 
-        cJSON_AddItemToArray(services, service);
+    if (xTaskCreate(notify_task, "iot_notify", NOTIFY_STACK_SIZE, nullptr, 3, &_notify_task) != pdPASS) {
+        ESP_LOGE(TAG, "%s: Failed to create the notify task", __func__);
+        return ESP_ERR_NO_MEM;
     }
 
-    cJSON *metadata = cJSON_AddObjectToObject(root, "metadata");
-
-    cJSON_AddStringToObject(metadata, "mac_address",info->metadata.mac_address.data());
-    cJSON_AddStringToObject(metadata, "last_updated",info->metadata.last_updated.data());
-    cJSON_AddStringToObject(metadata, "model",info->metadata.model.data());
-    cJSON_AddStringToObject(metadata, "version",info->metadata.version.data());
-
-    char *buf = cJSON_Print(root);
-
-    if (buf == nullptr) {
-        return _iot_server->send_err(req, IOT_HTTP_SERIALIZATION_ERR);
-    }
+    esp_timer_create_args_t args = {
+        .callback = [](void *) { xTaskNotifyGive(_notify_task); },
+        .arg = nullptr,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "iot_notify",
+        .skip_unhandled_events = true,
+    };
 
-    esp_err_t ret = _iot_server->send_res(req, buf);
+    esp_err_t ret = esp_timer_create(&args, &_notify_timer);
 
-    iot_free(buf);
-    cJSON_Delete(root);
+    if (ret == ESP_OK)
+        ret = esp_timer_start_periodic(_notify_timer, static_cast<uint64_t>(_iot_device_cfg->notify_cfg->period) * 1000);
 
     if (ret != ESP_OK)
-        return _iot_server->send_err(req,"Failed to send HTTP response");
+        ESP_LOGE(TAG, "%s: Failed to start the notify timer [reason: %s]", __func__, esp_err_to_name(ret));
 
-    return ESP_OK;
+    return ret;
 }
 
 /**
- * Handles a request to write a device's attribute.
+ * The notify task, on each period it emits the attributes that changed since the previous one as one batch, to the
+ * notify callback and the clients subscribed to the server's push channel. Mqtt deltas are only published by the
+ * telemetry publisher.
  *
- * @param[in] req The HTTP request object.
- * @return ESP_OK.
+ * @param[in] arg Unused.
  */
-esp_err_t IotDevice::on_write(httpd_req_t *req)
+void IotDevice::notify_task(void *arg)
 {
-    size_t buf_len = req->content_len + 1;
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
 
-    char *buf = iot_allocate_mem<char>(buf_len);
+        iot_attribute_req_param_t param;
 
-    if (buf == nullptr)
-        return _iot_server->send_err(req, "Failed to create object");
+        if (!_shadow.take_dirty(&param))
+            continue;
 
-    esp_err_t ret = _iot_server->get_body(req, buf, buf_len);
+        ESP_LOGD(TAG, "%s: Notifying changed attributes [count: %d]", __func__, param.attributes.size());
 
-    if (ret != ESP_OK) {
-        iot_free(buf);
-        return _iot_server->send_err(req, "Failed to get request body");
+        const iot_notify_attribute_cfg_t *notify_cfg = _iot_device_cfg->notify_cfg;
+
+        if (notify_cfg->notify_cb != nullptr && notify_cfg->notify_cb(&param) != ESP_OK)
+            ESP_LOGW(TAG, "%s: The notify callback failed", __func__);
+
+#ifdef CONFIG_IOT_HOVER_SERVER_PUSH
+        if (!_iot_server->has_subscribers())
+            continue;
+
+        char *json = attributes_to_json(&param);
+
+        if (json == nullptr)
+            continue;
+
+        _iot_server->publish(json, strlen(json));
+
+        cJSON_free(json);
+#endif
     }
+}
 
-    iot_attribute_req_param_t data;
+/**
+ * Serializes attributes and their values to a json object with an attributes array.
+ *
+ * @param[in] param A pointer to the attributes.
+ * @return A pointer to the json on success, otherwise nullptr.
+ * @note Free the json with cJSON_free once done.
+ */
+char *IotDevice::attributes_to_json(const iot_attribute_req_param_t *param)
+{
+    cJSON *root = cJSON_CreateObject();
 
-    ret = iot_attribute_req_from_json(buf, &data);
+    if (root == nullptr)
+        return nullptr;
 
-    iot_free(buf);
+    cJSON *attributes = cJSON_AddArrayToObject(root, "attributes");
 
-    if (ret == ESP_FAIL || ret == ESP_ERR_INVALID_ARG)
-        return _iot_server->send_err(req, IOT_HTTP_DESERIALIZATION_ERR, ret == ESP_FAIL ?
-                                                                        IOT_HTTP_STATUS_500_INT_SERVER_ERROR
-                                                                                                     : IOT_HTTP_STATUS_400_BAD_REQUEST);
+    for (const auto &item: param->attributes) {
+        cJSON *attribute = cJSON_CreateObject();
 
-    ret = _iot_device_cfg->write_cb(&data);
+        cJSON_AddStringToObject(attribute, "name", item.name.data());
 
-    if (ret != ESP_OK)
-        return _iot_server->send_err(req, "Failed to write attributes");
+        if (iot_val_add_to_json(attribute, item.value) != ESP_OK) {
+            cJSON_Delete(attribute);
+            continue;
+        }
 
-    ret = _iot_server->send_res(req, "Write Successful", true);
+        cJSON_AddItemToArray(attributes, attribute);
+    }
 
-    if (ret != ESP_OK)
-        return _iot_server->send_err(req, nullptr);
+    char *json = cJSON_PrintUnformatted(root);
 
-    return ESP_OK;
+    cJSON_Delete(root);
+
+    return json;
 }
 
 /**
- * Handles a request to read a device's attribute.
+ * Serializes the device information document once into the cache and computes its entity tag.
  *
- * @param[in] req The HTTP request object.
- * @return ESP_OK.
+ * @return ESP_OK on success, otherwise an error code.
+ * @note The info mutex must be held.
  */
-esp_err_t IotDevice::on_read(httpd_req_t *req)
+esp_err_t IotDevice::build_info(void)
 {
-    ESP_LOGI(TAG, "%s: Received request to read attribute", __func__ );
+    ESP_LOGI(TAG, "%s: Building the device information document", __func__);
+
+    cJSON *root = cJSON_CreateObject();
 
-    std::string name = _iot_server->get_path_param(req, "attributes/");
+    if (root == nullptr)
+        return ESP_ERR_NO_MEM;
 
-    iot_attribute_req_data_t data = {};
-    iot_attribute_req_param_t param = {};
+    const iot_device_info_t *info = _iot_device_cfg->device_info;
 
-    if (name.empty()) {
-        if (_iot_device_cfg != nullptr) {
-            for (const auto &item: _iot_device_cfg->device_info->attributes)
-                param.attributes.push_back(iot_attribute_create_read_req_data(item.name));
+    cJSON_AddStringToObject(root, "uuid", info->uuid.data());
+    cJSON_AddStringToObject(root, "name", info->device_name.data());
+    cJSON_AddStringToObject(root, "type", iot_device_type_to_str(info->device_type).data());
+
+    const iot_device_schema_t *schema = _iot_device_cfg->schema;
+
+    // A schema's attributes were rendered into flash at compile time.
+    if (schema != nullptr) {
+        cJSON_AddRawToObject(root, "attributes", schema->attributes_json.data());
+    } else {
+        cJSON *attributes = cJSON_AddArrayToObject(root, "attributes");
+
+        for (const auto &attribute: info->attributes) {
+            cJSON *j_attribute = cJSON_CreateObject();
+
+            cJSON_AddStringToObject(j_attribute, "name", attribute.name.data());
+
+            if (iot_val_add_to_json(j_attribute, attribute.value) != ESP_OK) {
+                cJSON_Delete(j_attribute);
+                continue;
+            }
+
+            cJSON_AddBoolToObject(j_attribute, "is_primary", attribute.is_primary);
+
+            if (!attribute.params.empty()) {
+                cJSON *parameters = cJSON_AddArrayToObject(j_attribute, "parameters");
+
+                for (const auto &param: attribute.params) {
+                    cJSON *j_param = cJSON_CreateObject();
+
+                    cJSON_AddStringToObject(j_param, "key", param.key.c_str());
+
+                    if (iot_val_add_to_json(j_param, param.value) != ESP_OK) {
+                        cJSON_Delete(j_param);
+                        continue;
+                    }
+
+                    cJSON_AddItemToArray(parameters, j_param);
+                }
+            }
+
+            cJSON_AddItemToArray(attributes, j_attribute);
         }
-    } else
-        param.attributes.push_back(iot_attribute_create_read_req_data(name));
+    }
 
-    esp_err_t ret = _iot_device_cfg->read_cb(&param);
+    cJSON *services = cJSON_AddArrayToObject(root,"services");
 
-    if (ret != ESP_OK) {
-        return _iot_server->send_err(req,"Failed to read attributes");
+    for (const auto &item: info->services) {
+        cJSON  *service = cJSON_CreateObject();
+
+        cJSON_AddStringToObject(service, "name", item.name.data());
+        cJSON_AddBoolToObject(service, "enabled", item.enabled);
+        cJSON_AddBoolToObject(service, "core_service", item.core_service);
+
+        cJSON_AddItemToArray(services, service);
     }
 
-    cJSON *response = cJSON_CreateArray();
+    cJSON *metadata = cJSON_AddObjectToObject(root, "metadata");
 
-    for (const auto &item: param.attributes) {
-        cJSON *attribute = cJSON_CreateObject();
+    cJSON_AddStringToObject(metadata, "mac_address",info->metadata.mac_address.data());
+    cJSON_AddStringToObject(metadata, "last_updated",info->metadata.last_updated.data());
+    cJSON_AddStringToObject(metadata, "model",info->metadata.model.data());
+    cJSON_AddStringToObject(metadata, "version",info->metadata.version.data());
 
-        cJSON_AddStringToObject(attribute, "name", item.name.c_str());
+    char *data = cJSON_PrintUnformatted(root);
 
-        ret = iot_val_add_to_json(attribute, item.value);
+    cJSON_Delete(root);
 
-        if (ret != ESP_OK)
-            return _iot_server->send_err(req,IOT_HTTP_SERIALIZATION_ERR);
+    if (data == nullptr)
+        return ESP_ERR_NO_MEM;
 
-        cJSON_AddItemToArray(response, attribute);
+    auto *doc = static_cast<iot_device_info_doc_t *>(malloc(sizeof(iot_device_info_doc_t)));
+
+    if (doc == nullptr) {
+        cJSON_free(data);
+        return ESP_ERR_NO_MEM;
     }
 
-    char *buf = cJSON_Print(response);
+    doc->refs = 1;
+    doc->data = data;
+    doc->len = strlen(data);
 
-    if (buf == nullptr)
-        return _iot_server->send_err(req, "Failed to create json");
+    // FNV-1a, only used to tell versions of the document apart.
+    uint32_t hash = 2166136261UL;
 
-    ret = _iot_server->send_res(req, buf, 0);
+    for (size_t i = 0; i < doc->len; i++) {
+        hash ^= static_cast<uint8_t>(data[i]);
+        hash *= 16777619UL;
+    }
 
-    iot_free(buf);
-    cJSON_Delete(response);
+    snprintf(doc->etag, sizeof(doc->etag), "\"%08" PRIx32 "\"", hash);
 
-    if (ret != ESP_OK)
-        return _iot_server->send_err(req, "Failed to send http response");
+    _info_doc = doc;
+
+    ESP_LOGI(TAG, "%s: Cached the device information document [size: %d, etag: %s]", __func__, doc->len,
+             doc->etag);
 
     return ESP_OK;
 }
 
 /**
- * Deserializes the attribute write request json to an attribute ctl data struct.
+ * Handles a request to write a device's attribute, the write runs on an async worker of the server.
  *
- * @param[in] buf A point ot the json to deserialize.
- * @param[out] data A pointer to the iot attribute ctl data.
- * @return ESP_OK on success, otherwise an error code.
+ * @param[in] req The HTTP request object.
+ * @return ESP_OK.
  */
-esp_err_t IotDevice::iot_attribute_req_from_json(char *buf, iot_attribute_req_param_t *param)
+esp_err_t IotDevice::on_write(httpd_req_t *req)
 {
-    ESP_LOGI(TAG, "%s: Parsing attribute write data", __func__);
+    return _iot_server->run_async(req, write_attributes);
+}
 
-    cJSON *root = cJSON_Parse(buf);
+/**
+ * Writes the attributes of a request with the device's write callback and responds to the request.
+ *
+ * @param[in] req The HTTP request object.
+ * @return ESP_OK.
+ */
+esp_err_t IotDevice::write_attributes(httpd_req_t *req)
+{
+    size_t len;
+    char *buf = read_body(req, &len);
 
-    if (root == nullptr) {
-        ESP_LOGE(TAG, "%s: Failed to deserialize request data, [reason: %s]", __func__, cJSON_GetErrorPtr());
-        return ESP_FAIL;
-    }
+    if (buf == nullptr)
+        return _iot_server->send_err(req, "Failed to get request body");
 
-    std::vector<iot_attribute_req_data_t> attributes;
+    iot_attribute_req_param_t data;
 
-    int count = cJSON_GetArraySize(root);
+    esp_err_t ret = iot_attribute_req_from_json(buf, len, &data);
 
-    if (count == 0) {
-        ESP_LOGE(TAG, "%s: Request contains zero attribute write data", __func__);
-        cJSON_free(root);
-        return ESP_ERR_INVALID_ARG;
+    if (ret != ESP_OK) {
+        iot_free(buf);
+        return _iot_server->send_err(req, IOT_HTTP_DESERIALIZATION_ERR, ret == ESP_ERR_INVALID_ARG ?
+                                                                        IOT_HTTP_STATUS_400_BAD_REQUEST
+                                                                                                   : IOT_HTTP_STATUS_500_INT_SERVER_ERROR);
     }
 
-    ESP_LOGI(TAG, "%s: Found attributes [count: %d]", __func__, count);
+    // Coalesced writes are acknowledged now and applied by the mailbox task, latest value wins.
+    _mailbox.post(&data);
 
-    iot_zero_mem(param, sizeof(iot_attribute_req_param_t));
+    // String values point into the body, so it's only freed once the callback is done with them.
+    ret = data.attributes.empty() ? ESP_OK : apply_writes(&data);
 
-    for (size_t i = 0; i < count; ++i) {
-        cJSON *item = cJSON_GetArrayItem(root, i);
+    iot_free(buf);
 
-        if (item == nullptr) {
-            ESP_LOGE(TAG, "%s: Failed to read attribute from array[reason: %s]", __func__, cJSON_GetErrorPtr());
-            cJSON_free(root);
-            return ESP_FAIL;
-        }
+    if (ret != ESP_OK)
+        return _iot_server->send_err(req, "Failed to write attributes");
 
-        cJSON *item_name = cJSON_GetObjectItem(item, "name");
-        cJSON *item_value = cJSON_GetObjectItem(item, "value");
-        cJSON *item_type = cJSON_GetObjectItem(item, "type");
+    ret = _iot_server->send_res(req, "Write Successful", true);
 
-        if (item_name == nullptr || item_value == nullptr || item_type == nullptr) {
-            ESP_LOGE(TAG, "%s: Attribute data is missing, [name: %d, value: %d, type: %d]", __func__,
-                     item_value != nullptr, item_value != nullptr, item_type != nullptr);
-            cJSON_free(root);
-            return ESP_ERR_INVALID_ARG;
-        }
+    if (ret != ESP_OK)
+        return _iot_server->send_err(req, nullptr);
 
-        std::string name = item_name->string;
-        std::string type = item_type->valuestring;
-
-        ESP_LOGI(TAG, "%s: Reading attribute [name: %s, type: %s]", __func__, name.data(), type.data());
-
-        iot_attribute_req_data_t attribute = {.name = item_name->valuestring, .value = {}};
-
-        iot_val_t val;
-        val.is_null = false;
-
-        if (type == IOT_VAL_TYPE_BOOLEAN_STR) {
-            val.type = IOT_VAL_TYPE_BOOLEAN;
-            val.b =  (bool)item_value->valueint;
-        } else if (type == IOT_VAL_TYPE_INTEGER_STR) {
-            val.type = IOT_VAL_TYPE_INTEGER;
-            val.i = item_value->valueint;
-        } else if (type == IOT_VAL_TYPE_LONG_STR) {
-            val.type = IOT_VAL_TYPE_LONG;
-            val.l = item_value->valueint;
-        } else if (type == IOT_VAL_TYPE_FLOAT_STR) {
-            val.type = IOT_VAL_TYPE_FLOAT;
-            val.i = (float)item_value->valuedouble;
-        } else if (type == IOT_VAL_TYPE_STRING_STR) {
-            val.type = IOT_VAL_TYPE_STRING;
-            val.s = strdup(item_value->valuestring);
-        } else {
-            ESP_LOGE(TAG, "%s: Received invalid value type", __func__);
-            val.type = IOT_VAL_TYPE_INVALID;
-        }
+    return ESP_OK;
+}
 
-        if (val.type == IOT_VAL_TYPE_INVALID) {
-            cJSON_free(root);
-            return ESP_ERR_INVALID_ARG;
-        }
+/**
+ * Applies attribute writes with the device's write callback and updates the shadow with the written values. Writes
+ * run on the server's async workers, the mqtt dispatch workers and the mailbox task, so the callback and the shadow
+ * update are applied together under the callback mutex, and overlapping writes of an attribute reach the device and
+ * the shadow in the same order. A value of the same attribute still waiting in its mailbox is older, it's cancelled.
+ *
+ * @param[in] param A pointer to the attributes to write.
+ * @return ESP_OK on success, otherwise the write callback's error.
+ */
+esp_err_t IotDevice::apply_writes(iot_attribute_req_param_t *param)
+{
+    std::lock_guard<std::mutex> lock(_cb_mutex);
 
-        attributes.push_back(attribute);
-    }
+    _mailbox.cancel(param);
 
-    cJSON_free(root);
+    esp_err_t ret = _iot_device_cfg->write_cb(param);
 
-    param->attributes = attributes;
+    if (ret == ESP_OK)
+        _shadow.update(param);
 
-    return ESP_OK;
+    return ret;
 }
 
 /**
- * Gets the string representation of the device type enum.
+ * Reads attribute values with the device's read callback, serialized with the other callbacks of the device.
  *
- * @param type The type to get the string for.
- * @return std::string The string device type.
+ * @param[in,out] param A pointer to the attributes to read, their values are filled in.
+ * @return ESP_OK on success, otherwise the read callback's error.
  */
-std::string IotDevice::iot_device_type_to_str(iot_device_type_t type)
+esp_err_t IotDevice::read_values(iot_attribute_req_param_t *param)
 {
-    switch (type) {
+    std::lock_guard<std::mutex> lock(_cb_mutex);
+
+    return _iot_device_cfg->read_cb(param);
+}
+
+/**
+ * Handles a batch request of attribute reads and writes, the batch runs on an async worker of the server.
+ *
+ * @param[in] req The HTTP request object.
+ * @return ESP_OK.
+ */
+esp_err_t IotDevice::on_batch(httpd_req_t *req)
+{
+    return _iot_server->run_async(req, run_batch);
+}
+
+/**
+ * Runs a batch of attribute operations. All the writes are applied in one write callback, then all the reads in
+ * one read callback, so the reads observe the written values. The results are returned in request order.
+ *
+ * @param[in] req The HTTP request object.
+ * @return ESP_OK.
+ */
+esp_err_t IotDevice::run_batch(httpd_req_t *req)
+{
+    size_t len;
+    char *buf = read_body(req, &len);
+
+    if (buf == nullptr)
+        return _iot_server->send_err(req, "Failed to get request body");
+
+    iot_attribute_req_param_t writes;
+    iot_attribute_req_param_t reads;
+    std::vector<bool> order;
+
+    esp_err_t ret = iot_attribute_batch_from_json(buf, len, &writes, &reads, &order);
+
+    if (ret != ESP_OK) {
+        iot_free(buf);
+        return _iot_server->send_err(req, IOT_HTTP_DESERIALIZATION_ERR, ret == ESP_ERR_INVALID_ARG ?
+                                                                        IOT_HTTP_STATUS_400_BAD_REQUEST
+                                                                                                   : IOT_HTTP_STATUS_500_INT_SERVER_ERROR);
+    }
+
+    if ((!writes.attributes.empty() && _iot_device_cfg->write_cb == nullptr) ||
+        (!reads.attributes.empty() && _iot_device_cfg->read_cb == nullptr)) {
+        iot_free(buf);
+        return _iot_server->send_err(req, "The device doesn't support the requested operations",
+                                     IOT_HTTP_STATUS_400_BAD_REQUEST);
+    }
+
+    if (!writes.attributes.empty()) {
+        // String values point into the body, so it's only freed once the callback is done with them.
+        ret = apply_writes(&writes);
+
+        if (ret != ESP_OK) {
+            iot_free(buf);
+            return _iot_server->send_err(req, "Failed to write attributes");
+        }
+    }
+
+    iot_free(buf);
+
+    if (!reads.attributes.empty()) {
+        ret = _shadow.read(&reads, read_values);
+
+        if (ret != ESP_OK)
+            return _iot_server->send_err(req, "Failed to read attributes");
+
+        if (!values_valid(&reads))
+            return _iot_server->send_err(req, IOT_HTTP_SERIALIZATION_ERR);
+    }
+
+    return _iot_server->send_res(req, [&](IotResWriter &writer) -> esp_err_t {
+        size_t write = 0;
+        size_t read = 0;
+
+        writer.begin_array();
+
+        for (bool is_write: order) {
+            const iot_attribute_req_data_t &item = is_write ? writes.attributes[write++] : reads.attributes[read++];
+
+            writer.begin_object();
+            writer.add_str("op", is_write ? "write" : "read");
+            writer.add_str("name", item.name.data(), item.name.size());
+
+            if (!is_write) {
+                esp_err_t ret = write_value(writer, item);
+
+                if (ret != ESP_OK)
+                    return ret;
+            }
+
+            writer.end_object();
+        }
+
+        writer.end_array();
+
+        return writer.error();
+    });
+}
+
+/**
+ * Reads the body of a request into a null terminated buffer.
+ *
+ * @param[in] req The HTTP request object.
+ * @param[out] len A pointer to store the length of the body.
+ * @return A pointer to the body on success, otherwise nullptr.
+ * @note Free the buffer once done.
+ */
+char *IotDevice::read_body(httpd_req_t *req, size_t *len)
+{
+    size_t buf_len = req->content_len + 1;
+
+    char *buf = iot_allocate_mem<char>(buf_len);
+
+    if (buf == nullptr)
+        return nullptr;
+
+    if (_iot_server->get_body(req, buf, buf_len) != ESP_OK) {
+        iot_free(buf);
+        return nullptr;
+    }
+
+    *len = req->content_len;
+
+    return buf;
+}
+
+/**
+ * Handles a request to read a device's attribute, fresh values are served from the shadow.
+ *
+ * @param[in] req The HTTP request object.
+ * @return ESP_OK.
+ */
+esp_err_t IotDevice::on_read(httpd_req_t *req)
+{
+    ESP_LOGI(TAG, "%s: Received request to read attribute", __func__ );
+
+    std::string_view name = _iot_server->get_path_param(req);
+
+    iot_attribute_req_param_t param = {};
+
+    if (name.empty()) {
+        param.attributes.reserve(_registry.count());
+
+        for (uint8_t slot = 0; slot < _registry.count(); slot++)
+            param.attributes.push_back(iot_attribute_create_read_req_data(_registry.name(slot), slot));
+    } else {
+        uint8_t slot = _registry.find(name.data(), name.size());
+
+        if (slot == IOT_ATTR_SLOT_NONE)
+            return _iot_server->send_err(req, "Unknown attribute", IOT_HTTP_STATUS_404_NOT_FOUND);
+
+        param.attributes.push_back(iot_attribute_create_read_req_data(_registry.name(slot), slot));
+    }
+
+    esp_err_t ret = _shadow.read(&param, read_values);
+
+    if (ret != ESP_OK) {
+        return _iot_server->send_err(req,"Failed to read attributes");
+    }
+
+    if (!values_valid(&param))
+        return _iot_server->send_err(req, IOT_HTTP_SERIALIZATION_ERR);
+
+    return _iot_server->send_res(req, [&param](IotResWriter &writer) -> esp_err_t {
+        writer.begin_array();
+
+        for (const auto &item: param.attributes) {
+            writer.begin_object();
+            writer.add_str("name", item.name.data(), item.name.size());
+
+            esp_err_t ret = write_value(writer, item);
+
+            if (ret != ESP_OK)
+                return ret;
+
+            writer.end_object();
+        }
+
+        writer.end_array();
+
+        return writer.error();
+    });
+}
+
+/**
+ * Checks that the values read by the read callback can be serialized. The values of schema attributes always can,
+ * they're written as the declared type.
+ *
+ * @param[in] param A pointer to the attributes read.
+ * @return true if all the values can be serialized, otherwise false.
+ */
+bool IotDevice::values_valid(const iot_attribute_req_param_t *param)
+{
+    for (const auto &item: param->attributes) {
+        if (item.value.type >= IOT_VAL_TYPE_INVALID && _registry.schema(item.slot) == nullptr)
+            return false;
+    }
+
+    return true;
+}
+
+/**
+ * Writes the value of an attribute and its type to a response writer, with the attribute's generated serializer
+ * if it's declared in the schema.
+ *
+ * @param[in] writer The writer with the attribute's object opened.
+ * @param[in] item The attribute and its value.
+ * @return ESP_OK on success, otherwise an error code.
+ */
+esp_err_t IotDevice::write_value(IotResWriter &writer, const iot_attribute_req_data_t &item)
+{
+    const iot_attribute_schema_t *attribute = _registry.schema(item.slot);
+
+    return attribute != nullptr ? attribute->write(writer, item.value) : iot_val_add_to_writer(writer, item.value);
+}
+
+/**
+ * Deserializes the attribute write request json to an attribute ctl data struct in a single pass. The json is
+ * parsed in place, string values point into the buffer.
+ *
+ * @param[in] buf A pointer to the json to deserialize, which is modified while parsing.
+ * @param[in] len The length of the json.
+ * @param[out] param A pointer to the iot attribute write data.
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG if the request is invalid.
+ * @note The string values are only valid while the buffer is alive.
+ */
+esp_err_t IotDevice::iot_attribute_req_from_json(char *buf, size_t len, iot_attribute_req_param_t *param)
+{
+    IotJsonReader reader(buf, len);
+    iot_json_token_t token;
+
+    if (reader.next(&token) != IOT_JSON_ARRAY_START) {
+        ESP_LOGE(TAG, "%s: Request data isn't an array of attributes", __func__);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    esp_err_t ret = iot_attribute_list_from_json(reader, param);
+
+    if (ret != ESP_OK)
+        return ret;
+
+    if (reader.next(&token) != IOT_JSON_END) {
+        ESP_LOGE(TAG, "%s: Failed to deserialize request data [offset: %d]", __func__, token.start - buf);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    return ESP_OK;
+}
+
+/**
+ * Deserializes the attribute writes of an array whose start was just read, up to and including its end.
+ *
+ * @param[in] reader The reader positioned inside the array.
+ * @param[out] param A pointer to the param to store the attributes in.
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG if the array is invalid or empty.
+ * @note The string values are only valid while the buffer is alive.
+ */
+esp_err_t IotDevice::iot_attribute_list_from_json(IotJsonReader &reader, iot_attribute_req_param_t *param)
+{
+    iot_json_token_t token;
+
+    param->attributes.clear();
+
+    while (reader.next(&token) == IOT_JSON_OBJECT_START) {
+        iot_attribute_req_data_t attribute = {};
+
+        esp_err_t ret = iot_attribute_data_from_json(reader, &attribute, nullptr);
+
+        if (ret != ESP_OK)
+            return ret;
+
+        param->attributes.push_back(std::move(attribute));
+    }
+
+    if (token.type != IOT_JSON_ARRAY_END) {
+        ESP_LOGE(TAG, "%s: Failed to deserialize the attributes", __func__);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (param->attributes.empty()) {
+        ESP_LOGE(TAG, "%s: Request contains zero attribute write data", __func__);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    ESP_LOGD(TAG, "%s: Found attributes [count: %d]", __func__, param->attributes.size());
+
+    return ESP_OK;
+}
+
+/**
+ * Deserializes a batch request json, an array of read and write operations, into the writes and the reads in a
+ * single pass. The json is parsed in place, string values point into the buffer.
+ *
+ * @param[in] buf A pointer to the json to deserialize, which is modified while parsing.
+ * @param[in] len The length of the json.
+ * @param[out] writes A pointer to the param to store the write operations in.
+ * @param[out] reads A pointer to the param to store the read operations in.
+ * @param[out] order A pointer to a list which stores whether each operation is a write, in request order.
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG if the request is invalid.
+ * @note The string values are only valid while the buffer is alive.
+ */
+esp_err_t IotDevice::iot_attribute_batch_from_json(char *buf, size_t len, iot_attribute_req_param_t *writes,
+                                                   iot_attribute_req_param_t *reads, std::vector<bool> *order)
+{
+    IotJsonReader reader(buf, len);
+    iot_json_token_t token;
+
+    if (reader.next(&token) != IOT_JSON_ARRAY_START) {
+        ESP_LOGE(TAG, "%s: Request data isn't an array of operations", __func__);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    while (reader.next(&token) == IOT_JSON_OBJECT_START) {
+        if (order->size() == IOT_DEVICE_MAX_BATCH_OPS) {
+            ESP_LOGE(TAG, "%s: Too many batch operations [max: %d]", __func__, IOT_DEVICE_MAX_BATCH_OPS);
+            return ESP_ERR_INVALID_ARG;
+        }
+
+        iot_attribute_req_data_t attribute = {};
+        bool write;
+
+        esp_err_t ret = iot_attribute_data_from_json(reader, &attribute, &write);
+
+        if (ret != ESP_OK)
+            return ret;
+
+        (write ? writes : reads)->attributes.push_back(std::move(attribute));
+        order->push_back(write);
+    }
+
+    if (token.type != IOT_JSON_ARRAY_END || reader.next(&token) != IOT_JSON_END) {
+        ESP_LOGE(TAG, "%s: Failed to deserialize request data [offset: %d]", __func__, token.start - buf);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (order->empty()) {
+        ESP_LOGE(TAG, "%s: Request contains zero batch operations", __func__);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    return ESP_OK;
+}
+
+/**
+ * Deserializes an attribute's name and optionally its value from the json object being read. The keys may come in
+ * any order, the value token is kept until its type is known and unknown keys are skipped.
+ *
+ * @param[in] reader The reader, positioned right after the object's opening brace.
+ * @param[out] attribute A pointer to the attribute data to store the name and value in.
+ * @param[out] write A pointer to store whether the object is a write operation, read from its "op" key. If nullptr
+ *                   the object is always a write.
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG if the object is invalid.
+ */
+esp_err_t IotDevice::iot_attribute_data_from_json(IotJsonReader &reader, iot_attribute_req_data_t *attribute,
+                                                  bool *write)
+{
+    iot_json_token_t key;
+    iot_json_token_t token;
+    iot_json_token_t value = {.type = IOT_JSON_ERROR, .start = nullptr, .len = 0};
+    iot_json_token_t type = value;
+    iot_json_token_t name = value;
+    iot_json_token_t op = value;
+
+    while (reader.next(&key) == IOT_JSON_KEY) {
+        if (reader.next(&token) == IOT_JSON_ERROR)
+            break;
+
+        if (IotJsonReader::equals(key, "name", 4))
+            name = token;
+        else if (IotJsonReader::equals(key, "value", 5))
+            value = token;
+        else if (IotJsonReader::equals(key, "type", 4))
+            type = token;
+        else if (IotJsonReader::equals(key, "op", 2))
+            op = token;
+
+        if (reader.skip(token) == IOT_JSON_ERROR)
+            break;
+    }
+
+    if (key.type != IOT_JSON_OBJECT_END) {
+        ESP_LOGE(TAG, "%s: Failed to deserialize attribute data", __func__);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (name.type != IOT_JSON_STRING) {
+        ESP_LOGE(TAG, "%s: Attribute name is missing", __func__);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    // Resolve the name once here, from now on the attribute is known by its slot and interned name.
+    attribute->slot = _registry.find(name.start, name.len);
+
+    if (attribute->slot == IOT_ATTR_SLOT_NONE) {
+        ESP_LOGE(TAG, "%s: Received an unknown attribute [name: %s]", __func__, name.start);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    attribute->name = _registry.name(attribute->slot);
+
+    if (write != nullptr) {
+        *write = op.type == IOT_JSON_STRING && IotJsonReader::equals(op, "write", 5);
+
+        if (!*write && (op.type != IOT_JSON_STRING || !IotJsonReader::equals(op, "read", 4))) {
+            ESP_LOGE(TAG, "%s: Invalid batch operation [name: %s]", __func__, name.start);
+            return ESP_ERR_INVALID_ARG;
+        }
+
+        if (!*write)
+            return ESP_OK;
+    }
+
+    if (_registry.schema(attribute->slot) != nullptr)
+        return schema_value_from_json(_registry.schema(attribute->slot), value, type, &attribute->value);
+
+    if (value.start == nullptr || type.type != IOT_JSON_STRING) {
+        ESP_LOGE(TAG, "%s: Attribute data is missing, [name: %s, value: %d, type: %d]", __func__, name.start,
+                 value.start != nullptr, type.type == IOT_JSON_STRING);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    ESP_LOGD(TAG, "%s: Reading attribute [name: %s, type: %s]", __func__, name.start, type.start);
+
+    iot_val_t &val = attribute->value;
+    uint64_t num;
+    bool valid;
+
+    val.is_null = false;
+    val.type = iot_val_type_from_str(type.start, type.len);
+
+    switch (val.type) {
+        case IOT_VAL_TYPE_BOOLEAN:
+            valid = value.type == IOT_JSON_TRUE || value.type == IOT_JSON_FALSE;
+            val.b = value.type == IOT_JSON_TRUE;
+            break;
+        case IOT_VAL_TYPE_INTEGER:
+            valid = IotJsonReader::to_uint(value, &num) && num <= UINT32_MAX;
+            val.i = static_cast<uint32_t>(num);
+            break;
+        case IOT_VAL_TYPE_LONG:
+            valid = IotJsonReader::to_uint(value, &num);
+            val.l = num;
+            break;
+        case IOT_VAL_TYPE_FLOAT:
+            valid = IotJsonReader::to_float(value, &val.f);
+            break;
+        case IOT_VAL_TYPE_STRING:
+            valid = value.type == IOT_JSON_STRING;
+            val.s = value.start;
+            break;
+        default:
+            valid = false;
+            break;
+    }
+
+    if (!valid) {
+        ESP_LOGE(TAG, "%s: Received invalid value [name: %s, type: %s]", __func__, name.start, type.start);
+        val.type = IOT_VAL_TYPE_INVALID;
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    return ESP_OK;
+}
+
+/**
+ * Deserializes the value of an attribute declared in the schema with its generated parser, which also validates its
+ * range. The type is known from the schema, so it's optional in the request but must match when present.
+ *
+ * @param[in] attribute A pointer to the attribute's declaration.
+ * @param[in] value The value token, its start is nullptr if the value is missing.
+ * @param[in] type The type token, an error token if the type is missing.
+ * @param[out] val A pointer to store the value.
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG if the value is invalid.
+ */
+esp_err_t IotDevice::schema_value_from_json(const iot_attribute_schema_t *attribute, const iot_json_token_t &value,
+                                            const iot_json_token_t &type, iot_val_t *val)
+{
+    const char *name = attribute->name.data();
+
+    if (type.type != IOT_JSON_ERROR && (type.type != IOT_JSON_STRING ||
+                                        !IotJsonReader::equals(type, attribute->type_name.data(),
+                                                               attribute->type_name.size()))) {
+        ESP_LOGE(TAG, "%s: Received a value of the wrong type [name: %s, expected: %s]", __func__, name,
+                 attribute->type_name.data());
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (value.start == nullptr || attribute->parse(attribute, value, val) != ESP_OK) {
+        ESP_LOGE(TAG, "%s: Received invalid value [name: %s, type: %s]", __func__, name,
+                 attribute->type_name.data());
+        val->type = IOT_VAL_TYPE_INVALID;
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    return ESP_OK;
+}
+
+/**
+ * Gets the string representation of the device type enum.
+ *
+ * @param type The type to get the string for.
+ * @return std::string The string device type.
+ */
+std::string IotDevice::iot_device_type_to_str(iot_device_type_t type)
+{
+    switch (type) {
         case IOT_DEVICE_TYPE_SWITCH:
             return "Switch";
         case IOT_DEVICE_TYPE_TEMPERATURE:
@@ -501,25 +1199,235 @@ bool IotDevice::subscribed_to_mqtt() const
 }
 
 /**
- * Subscribes to mqtt.
+ * Subscribes to mqtt attribute writes. A write is a json object of a correlation id and the attributes to write,
+ * e.g. {"id": "42", "attributes": [{"name": "Power", "value": true}]}, the result is published to the response topic
+ * as {"id": "42", "status": 200, "message": "Write Successful"}.
+ *
+ * @note Writes are still accepted on the legacy attribute topic during the transition to the write topic, as a
+ * command or a bare array of attributes. The legacy topic will be removed in a future release.
  */
 void IotDevice::subscribe_to_mqtt()
 {
     auto *mqtt = &IotFactory::create_component<IotMqtt>();
 
+    std::string base = "hover/iot/device/" + _iot_device_cfg->device_info->metadata.mac_address + "/attribute/";
+
     iot_mqtt_subscribe_t subscribe = {
-        .topic =  "hover/iot/device/" + _iot_device_cfg->device_info->metadata.mac_address  + "/attribute/",
-        .cb = on_data
+        .topic = base + "write",
+        .qos = 1,
+        .cb = on_data,
+        // Commands are delivered ahead of bulk traffic and never evicted by it.
+        .priority = IOT_MQTT_PRIORITY_HIGH
     };
 
     esp_err_t ret = mqtt->subscribe(subscribe);
 
+    subscribe.topic = base;
+
+    if (ret == ESP_OK)
+        ret = mqtt->subscribe(subscribe);
+
     _mqtt_subscribed = ret == ESP_OK;
 }
 
-void IotDevice::on_data(std::string topic, std::string data, size_t len, void *priv_data)
+/**
+ * Handles an mqtt attribute write and publishes its result. It runs on a dispatch worker, which delivers the commands
+ * of a topic one at a time and in order, but the write topic and the legacy topic are separate subscriptions whose
+ * commands may run concurrently, with each other and with the http requests. The writes are serialized by
+ * apply_writes. The payload is shared with the other subscribers of the message and the parser modifies its input, so
+ * the command is parsed from a private copy.
+ *
+ * @param[in] topic The topic the message was received on.
+ * @param[in] topic_len The length of the topic.
+ * @param[in] data The message payload.
+ * @param[in] len The length of the payload.
+ * @param[in] priv_data Unused.
+ */
+void IotDevice::on_data(const char *topic, size_t topic_len, const char *data, size_t len, void *priv_data)
 {
-    ESP_LOGI(TAG, "%s: Received mqtt message [topic: %s, data: %s, len: %d]", __func__, topic.data(), data.data(), len);
+    char *buf = iot_allocate_mem<char>(len + 1);
+
+    if (buf == nullptr) {
+        ESP_LOGW(TAG, "%s: Dropped an mqtt command, out of memory [topic: %.*s]", __func__,
+                 static_cast<int>(topic_len), topic);
+        return;
+    }
+
+    memcpy(buf, data, len);
+    buf[len] = '\0';
+
+    iot_json_token_t id = {.type = IOT_JSON_NULL, .start = nullptr, .len = 0};
+
+    esp_err_t ret = run_cmd(buf, len, &id);
+
+    // The id points into the copy, so it's only freed after the result is published.
+    publish_cmd_result(id, ret);
+
+    iot_free(buf);
+}
+
+/**
+ * Applies an mqtt attribute write the same way as a write request.
+ *
+ * @param[in] buf A pointer to the payload, which is modified while parsing.
+ * @param[in] len The length of the payload.
+ * @param[out] id A pointer to the token to store the correlation id in.
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG if the command is invalid, otherwise an error code.
+ */
+esp_err_t IotDevice::run_cmd(char *buf, size_t len, iot_json_token_t *id)
+{
+    iot_attribute_req_param_t data;
+
+    esp_err_t ret = iot_attribute_cmd_from_json(buf, len, id, &data);
+
+    if (ret != ESP_OK)
+        return ret;
+
+    _mailbox.post(&data);
+
+    return data.attributes.empty() ? ESP_OK : apply_writes(&data);
+}
+
+/**
+ * Publishes the result of an mqtt command to the response topic.
+ *
+ * @param[in] id The command's correlation id, null if it has none.
+ * @param[in] ret The result of the command.
+ */
+void IotDevice::publish_cmd_result(const iot_json_token_t &id, esp_err_t ret)
+{
+    auto *mqtt = &IotFactory::create_component<IotMqtt>();
+
+    if (!mqtt->connected())
+        return;
+
+    cJSON *root = cJSON_CreateObject();
+
+    if (root == nullptr)
+        return;
+
+    if (id.type == IOT_JSON_STRING)
+        cJSON_AddStringToObject(root, "id", id.start);
+    else
+        cJSON_AddNullToObject(root, "id");
+
+    int status = ret == ESP_OK ? 200 : ret == ESP_ERR_INVALID_ARG ? 400 : 500;
+
+    cJSON_AddNumberToObject(root, "status", status);
+    cJSON_AddStringToObject(root, "message", ret == ESP_OK ? "Write Successful" : ret == ESP_ERR_INVALID_ARG ?
+                                                               IOT_HTTP_DESERIALIZATION_ERR : "Failed to write attributes");
+
+    char *json = cJSON_PrintUnformatted(root);
+
+    cJSON_Delete(root);
+
+    if (json == nullptr)
+        return;
+
+    int msg_id;
+    size_t len = strlen(json);
+    std::string topic = "hover/iot/device/" + _iot_device_cfg->device_info->metadata.mac_address +
+                        "/attribute/write/response";
+
+    // A result is stale by the time the client reconnects, so it's never buffered.
+    if (mqtt->publish(topic, std::string(json, len), len, 1, &msg_id, IOT_MQTT_BUFFER_NONE) != ESP_OK)
+        ESP_LOGE(TAG, "%s: Failed to publish the command result [status: %d]", __func__, status);
+
+    cJSON_free(json);
+}
+
+/**
+ * Publishes an encoded telemetry message to the state topic. A snapshot replaces the older telemetry buffered while
+ * disconnected, as it already holds every value.
+ *
+ * @param[in] data A pointer to the message.
+ * @param[in] len The length of the message.
+ * @param[in] snapshot Indicates whether the message is a snapshot of every value.
+ * @return ESP_OK if the message was published or buffered, otherwise an error code.
+ */
+esp_err_t IotDevice::publish_telemetry(const uint8_t *data, size_t len, bool snapshot)
+{
+    auto *mqtt = &IotFactory::create_component<IotMqtt>();
+
+    if (!mqtt->started())
+        return ESP_ERR_INVALID_STATE;
+
+    int msg_id;
+    std::string topic = "hover/iot/device/" + _iot_device_cfg->device_info->metadata.mac_address + "/state";
+
+    return mqtt->publish(topic, std::string(reinterpret_cast<const char *>(data), len), len, 0, &msg_id,
+                         snapshot ? IOT_MQTT_BUFFER_LATEST : IOT_MQTT_BUFFER_ALL);
+}
+
+/**
+ * Deserializes an mqtt attribute write, an object of a correlation id and an array of attributes, or a bare array of
+ * attributes as sent to the legacy attribute topic. The json is parsed in place, string values point into the buffer.
+ *
+ * @param[in] buf A pointer to the json to deserialize, which is modified while parsing.
+ * @param[in] len The length of the json.
+ * @param[out] id A pointer to the token to store the correlation id in, it's left untouched if there is none.
+ * @param[out] param A pointer to the param to store the attributes in.
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG if the command is invalid.
+ * @note The string values are only valid while the buffer is alive.
+ */
+esp_err_t IotDevice::iot_attribute_cmd_from_json(char *buf, size_t len, iot_json_token_t *id,
+                                                 iot_attribute_req_param_t *param)
+{
+    IotJsonReader reader(buf, len);
+    iot_json_token_t key;
+    iot_json_token_t token;
+    bool attributes = false;
+
+    iot_json_token_e type = reader.next(&token);
+
+    // A legacy write has no correlation id, its result is published with a null id.
+    if (type == IOT_JSON_ARRAY_START) {
+        esp_err_t ret = iot_attribute_list_from_json(reader, param);
+
+        if (ret == ESP_OK && reader.next(&token) != IOT_JSON_END) {
+            ESP_LOGE(TAG, "%s: Failed to deserialize command", __func__);
+            return ESP_ERR_INVALID_ARG;
+        }
+
+        return ret;
+    }
+
+    if (type != IOT_JSON_OBJECT_START) {
+        ESP_LOGE(TAG, "%s: Command isn't an object or an array", __func__);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    while (reader.next(&key) == IOT_JSON_KEY) {
+        if (reader.next(&token) == IOT_JSON_ERROR)
+            break;
+
+        if (IotJsonReader::equals(key, "id", 2) && token.type == IOT_JSON_STRING) {
+            *id = token;
+        } else if (IotJsonReader::equals(key, "attributes", 10) && token.type == IOT_JSON_ARRAY_START) {
+            esp_err_t ret = iot_attribute_list_from_json(reader, param);
+
+            if (ret != ESP_OK)
+                return ret;
+
+            attributes = true;
+            continue;
+        }
+
+        if (reader.skip(token) == IOT_JSON_ERROR)
+            break;
+    }
+
+    if (key.type != IOT_JSON_OBJECT_END || reader.next(&token) != IOT_JSON_END) {
+        ESP_LOGE(TAG, "%s: Failed to deserialize command", __func__);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (!attributes) {
+        ESP_LOGE(TAG, "%s: Command has no attributes", __func__);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    return ESP_OK;
 }
 
 #endif
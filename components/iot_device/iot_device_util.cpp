@@ -1,6 +1,8 @@
 #include <cJSON.h>
 #include "iot_common.h"
 #include "iot_device_defs.h"
+#include "iot_res_writer.h"
+#include "iot_device.h"
 #include "esp_err.h"
 
 static constexpr const char *TAG = "IotDevice"; /* A constant used to identify the source of the log message of this. */
@@ -102,6 +104,8 @@ esp_err_t iot_attribute_add_param(iot_attribute_t *attribute, const char *key, i
 
     attribute->params.push_back(iot_param_t(key, value));
 
+    IotDevice::invalidate_info();
+
     ESP_LOGD(TAG, "%s: Added parameter with name ->  %s to the device",  __func__,  key);
 
     return ESP_OK;
@@ -129,6 +133,8 @@ esp_err_t iot_device_add_service(iot_device_info_t *device, const char *name, bo
 
     device->services.push_back(service);
 
+    IotDevice::invalidate_info();
+
     ESP_LOGD(TAG, "%s: Added service with name ->  %s to the device",  __func__, name);
 
     return ESP_OK;
@@ -139,20 +145,16 @@ esp_err_t iot_device_add_service(iot_device_info_t *device, const char *name, bo
  *
  * @param[in] device  The device to add the attribute to.
  * @param[in] attribute The attribute to add.
- * @returns ESP_OK on success, otherwise ESP_ERR_INVALID_ARG for duplicate values.
+ * @returns ESP_OK.
+ * @note Duplicate names are rejected once, with a hash, when the device's attribute registry is built on init.
  */
 esp_err_t iot_device_add_attribute(iot_device_info_t *device, iot_attribute_t attribute)
 {
-    for (const auto& _attribute : device->attributes) {
-        if (_attribute.name == attribute.name) {
-            ESP_LOGE(TAG, "%s: Attribute [name: %s] has already added.", __func__, attribute.name.c_str());
-            return ESP_ERR_INVALID_ARG;
-        }
-    }
+    device->attributes.push_back(std::move(attribute));
 
-    device->attributes.push_back(attribute);
+    IotDevice::invalidate_info();
 
-    ESP_LOGD(TAG, "%s: Added attribute [name: %s] to the device",  __func__,  attribute.name.c_str());
+    ESP_LOGD(TAG, "%s: Added attribute [name: %s] to the device",  __func__,  device->attributes.back().name.c_str());
 
     return ESP_OK;
 }
@@ -160,14 +162,16 @@ esp_err_t iot_device_add_attribute(iot_device_info_t *device, iot_attribute_t at
 /**
  * Creates an attribute request data.
  *
- * @param[in] name The name of the attribute to create the request data for.
+ * @param[in] name The interned name of the attribute to create the request data for.
+ * @param[in] slot The attribute's slot.
  * @return iot_attribute_req_data_t The attribute request data.
  */
-iot_attribute_req_data_t iot_attribute_create_read_req_data(std::string name)
+iot_attribute_req_data_t iot_attribute_create_read_req_data(std::string_view name, uint8_t slot)
 {
     return {
         .name = name,
-        .value {}
+        .value {},
+        .slot = slot
     };
 }
 
@@ -219,3 +223,118 @@ iot_attribute_req_data_t iot_attribute_create_read_req_data(std::string name)
 
     return ESP_OK;
 }
+
+/**
+ * Writes an iot_val_t value and its type to a response writer.
+ *
+ * @param writer The writer with the object to add the value to opened.
+ * @param val The value to add.
+ * @returns ESP_OK on success, otherwise an error code.
+ */
+esp_err_t iot_val_add_to_writer(IotResWriter &writer, iot_val_t val)
+{
+    const char *value_key = "value";
+    const char *type;
+
+    switch (val.type)
+    {
+        case IOT_VAL_TYPE_BOOLEAN:
+            writer.add_bool(value_key, val.b);
+            type = IOT_VAL_TYPE_BOOLEAN_STR;
+            break;
+        case IOT_VAL_TYPE_INTEGER:
+            writer.add_uint(value_key, val.i);
+            type = IOT_VAL_TYPE_INTEGER_STR;
+            break;
+        case IOT_VAL_TYPE_FLOAT:
+            writer.add_float(value_key, val.f);
+            type = IOT_VAL_TYPE_FLOAT_STR;
+            break;
+        case IOT_VAL_TYPE_LONG:
+            writer.add_ulong(value_key, val.l);
+            type = IOT_VAL_TYPE_LONG_STR;
+            break;
+        case IOT_VAL_TYPE_STRING:
+            writer.add_str(value_key, val.s);
+            type = IOT_VAL_TYPE_STRING_STR;
+            break;
+        default:
+            ESP_LOGE(TAG, "%s: Invalid value [type: %d]", __func__, val.type);
+            return ESP_ERR_INVALID_ARG;
+    }
+
+    writer.add_str("type", type);
+
+    return writer.error();
+}
+
+/**
+ * Gets the value type of its string representation.
+ *
+ * @param str A pointer to the string, which needn't be null terminated.
+ * @param len The length of the string.
+ * @returns The value type, IOT_VAL_TYPE_INVALID if the string isn't a known type.
+ */
+iot_val_type_e iot_val_type_from_str(const char *str, size_t len)
+{
+    iot_val_type_e type;
+    const char *type_str;
+
+    // The length and first character tell the types apart, one compare confirms the match.
+    switch (len == 0 ? 0 : len << 8 | static_cast<uint8_t>(str[0]))
+    {
+        case 4 << 8 | 'b':
+            type = IOT_VAL_TYPE_BOOLEAN;
+            type_str = IOT_VAL_TYPE_BOOLEAN_STR;
+            break;
+        case 7 << 8 | 'i':
+            type = IOT_VAL_TYPE_INTEGER;
+            type_str = IOT_VAL_TYPE_INTEGER_STR;
+            break;
+        case 5 << 8 | 'f':
+            type = IOT_VAL_TYPE_FLOAT;
+            type_str = IOT_VAL_TYPE_FLOAT_STR;
+            break;
+        case 4 << 8 | 'l':
+            type = IOT_VAL_TYPE_LONG;
+            type_str = IOT_VAL_TYPE_LONG_STR;
+            break;
+        case 6 << 8 | 's':
+            type = IOT_VAL_TYPE_STRING;
+            type_str = IOT_VAL_TYPE_STRING_STR;
+            break;
+        default:
+            return IOT_VAL_TYPE_INVALID;
+    }
+
+    return memcmp(str, type_str, len) == 0 ? type : IOT_VAL_TYPE_INVALID;
+}
+
+/**
+ * Checks whether two values are equal.
+ *
+ * @param a The first value.
+ * @param b The second value.
+ * @returns true if both have the same type, nullness and value, otherwise false.
+ */
+bool iot_val_equals(const iot_val_t &a, const iot_val_t &b)
+{
+    if (a.type != b.type || a.is_null != b.is_null)
+        return false;
+
+    switch (a.type)
+    {
+        case IOT_VAL_TYPE_BOOLEAN:
+            return a.b == b.b;
+        case IOT_VAL_TYPE_INTEGER:
+            return a.i == b.i;
+        case IOT_VAL_TYPE_FLOAT:
+            return a.f == b.f;
+        case IOT_VAL_TYPE_LONG:
+            return a.l == b.l;
+        case IOT_VAL_TYPE_STRING:
+            return a.s == b.s || (a.s != nullptr && b.s != nullptr && strcmp(a.s, b.s) == 0);
+        default:
+            return true;
+    }
+}
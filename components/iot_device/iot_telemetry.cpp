@@ -0,0 +1,246 @@
+#include "iot_telemetry.h"
+
+/**
+ * Starts publishing the telemetry of a device's attributes.
+ *
+ * @param[in] registry The device's attribute registry.
+ * @param[in] shadow A pointer to the device's attribute shadow.
+ * @param[in] cfg A pointer to the telemetry configuration, which must outlive the publisher.
+ * @param[in] publish_cb The callback publishing the encoded messages.
+ * @return ESP_OK on success, otherwise an error code.
+ */
+esp_err_t IotTelemetry::start(const IotAttributeRegistry &registry, IotAttributeShadow *shadow,
+                              const iot_telemetry_cfg_t *cfg, iot_telemetry_publish_cb_t publish_cb)
+{
+    if (shadow == nullptr || cfg == nullptr || publish_cb == nullptr)
+        return ESP_ERR_INVALID_ARG;
+
+    if (_task != nullptr)
+        return ESP_OK;
+
+    _shadow = shadow;
+    _cfg = cfg;
+    _publish_cb = publish_cb;
+    _slots.assign(registry.count(), {});
+
+    for (uint8_t slot = 0; slot < registry.count(); slot++) {
+        const iot_attribute_schema_t *schema = registry.schema(slot);
+
+        if (schema == nullptr || schema->type != IOT_VAL_TYPE_STRING)
+            _slots[slot].telemetry = registry.telemetry(slot);
+    }
+
+    uint32_t now = iot_millis();
+
+    for (uint8_t cls = 0; cls < IOT_TELEMETRY_CLASS_MAX; cls++)
+        _due[cls] = now + _cfg->period_ms[cls];
+
+    _snapshot_due = now + _cfg->snapshot_ms;
+
+    if (xTaskCreate(task, "iot_telemetry", STACK_SIZE, this, 3, &_task) != pdPASS) {
+        ESP_LOGE(TAG, "%s: Failed to create the telemetry task", __func__);
+        return ESP_ERR_NO_MEM;
+    }
+
+    return ESP_OK;
+}
+
+/**
+ * The telemetry task, it publishes the classes that are due and sleeps until the next one is.
+ *
+ * @param[in] arg A pointer to the telemetry instance.
+ */
+void IotTelemetry::task(void *arg)
+{
+    auto *self = static_cast<IotTelemetry *>(arg);
+    bool classes[IOT_TELEMETRY_CLASS_MAX] = {};
+
+    // The first snapshot is published right away, so subscribers get the known values without waiting a period.
+    self->publish(classes, true);
+
+    while (true)
+        vTaskDelay(self->tick());
+}
+
+/**
+ * Publishes the classes and the snapshot whose period has elapsed.
+ *
+ * @return The ticks until the next class or snapshot is due.
+ */
+TickType_t IotTelemetry::tick(void)
+{
+    bool classes[IOT_TELEMETRY_CLASS_MAX] = {};
+    bool due = false;
+    uint32_t now = iot_millis();
+
+    for (uint8_t cls = IOT_TELEMETRY_NONE + 1; cls < IOT_TELEMETRY_CLASS_MAX; cls++) {
+        uint32_t period = _cfg->period_ms[cls];
+
+        if (period == 0 || static_cast<int32_t>(now - _due[cls]) < 0)
+            continue;
+
+        classes[cls] = true;
+        due = true;
+        _due[cls] += period;
+
+        // A late tick doesn't publish twice to catch up.
+        if (static_cast<int32_t>(now - _due[cls]) >= 0)
+            _due[cls] = now + period;
+    }
+
+    bool snapshot = _cfg->snapshot_ms != 0 && static_cast<int32_t>(now - _snapshot_due) >= 0;
+
+    if (snapshot) {
+        due = true;
+        _snapshot_due = now + _cfg->snapshot_ms;
+    }
+
+    if (due)
+        publish(classes, snapshot);
+
+    uint32_t next = UINT32_MAX;
+
+    for (uint8_t cls = IOT_TELEMETRY_NONE + 1; cls < IOT_TELEMETRY_CLASS_MAX; cls++) {
+        if (_cfg->period_ms[cls] != 0)
+            next = std::min(next, _due[cls] - now);
+    }
+
+    if (_cfg->snapshot_ms != 0)
+        next = std::min(next, _snapshot_due - now);
+
+    if (next == UINT32_MAX)
+        return portMAX_DELAY;
+
+    return std::max<TickType_t>(pdMS_TO_TICKS(next), 1);
+}
+
+/**
+ * Publishes the changed values of the given classes, or every value for a snapshot, in as many messages as needed.
+ * A value only counts as published once its message was, so a failed message is retried at the next period.
+ *
+ * @param[in] classes The classes to publish, indexed by class.
+ * @param[in] snapshot Indicates whether to publish every value regardless of the classes.
+ */
+void IotTelemetry::publish(const bool *classes, bool snapshot)
+{
+    uint8_t buf[IOT_TELEMETRY_MAX_SIZE];
+    uint8_t slot = 0;
+
+    while (slot < _slots.size()) {
+        size_t len = encode(buf, sizeof(buf), classes, snapshot, &slot);
+
+        if (len == HEADER_SIZE)
+            break;
+
+        esp_err_t ret = _publish_cb(buf, len, snapshot);
+
+        for (iot_telemetry_slot_t &state : _slots) {
+            if (!state.is_staged)
+                continue;
+
+            if (ret == ESP_OK) {
+                state.published = state.staged;
+                state.valid = true;
+            }
+
+            state.is_staged = false;
+        }
+
+        if (ret != ESP_OK) {
+            ESP_LOGW(TAG, "%s: Failed to publish telemetry [reason: %s]", __func__, esp_err_to_name(ret));
+            break;
+        }
+
+        _seq++;
+    }
+}
+
+/**
+ * Encodes the next message, staging the values written to it.
+ *
+ * @param[out] buf A pointer to the buffer to encode the message in.
+ * @param[in] size The size of the buffer.
+ * @param[in] classes The classes to publish, indexed by class.
+ * @param[in] snapshot Indicates whether to encode every value regardless of the classes.
+ * @param[in,out] slot A pointer to the slot to start from, it's set to the first slot that didn't fit.
+ * @return The length of the message, HEADER_SIZE if it holds no values.
+ */
+size_t IotTelemetry::encode(uint8_t *buf, size_t size, const bool *classes, bool snapshot, uint8_t *slot)
+{
+    buf[0] = IOT_TELEMETRY_VERSION;
+    buf[1] = snapshot ? IOT_TELEMETRY_FLAG_SNAPSHOT : 0;
+    buf[2] = static_cast<uint8_t>(_seq);
+    buf[3] = static_cast<uint8_t>(_seq >> 8);
+
+    size_t len = HEADER_SIZE;
+
+    for (; *slot < _slots.size(); (*slot)++) {
+        iot_telemetry_slot_t &state = _slots[*slot];
+        iot_val_t value;
+
+        if (state.telemetry == IOT_TELEMETRY_NONE || (!snapshot && !classes[state.telemetry]))
+            continue;
+
+        if (!_shadow->get(*slot, &value) || value.is_null)
+            continue;
+
+        size_t value_len = value_size(value.type);
+
+        if (value_len == 0 || (!snapshot && state.valid && iot_val_equals(state.published, value)))
+            continue;
+
+        if (len + 1 + value_len > size)
+            break;
+
+        uint64_t bits = 0;
+
+        switch (value.type) {
+            case IOT_VAL_TYPE_BOOLEAN:
+                bits = value.b ? 1 : 0;
+                break;
+            case IOT_VAL_TYPE_INTEGER:
+                bits = value.i;
+                break;
+            case IOT_VAL_TYPE_FLOAT: {
+                uint32_t f;
+                memcpy(&f, &value.f, sizeof(f));
+                bits = f;
+                break;
+            }
+            default:
+                bits = value.l;
+                break;
+        }
+
+        buf[len++] = *slot;
+
+        for (size_t i = 0; i < value_len; i++)
+            buf[len++] = static_cast<uint8_t>(bits >> (8 * i));
+
+        state.staged = value;
+        state.is_staged = true;
+    }
+
+    return len;
+}
+
+/**
+ * Gets the encoded size of a value type.
+ *
+ * @param[in] type The value type.
+ * @return The size in bytes, 0 if the type isn't published.
+ */
+size_t IotTelemetry::value_size(iot_val_type_e type)
+{
+    switch (type) {
+        case IOT_VAL_TYPE_BOOLEAN:
+            return 1;
+        case IOT_VAL_TYPE_INTEGER:
+        case IOT_VAL_TYPE_FLOAT:
+            return 4;
+        case IOT_VAL_TYPE_LONG:
+            return 8;
+        default:
+            return 0;
+    }
+}
@@ -1,8 +1,12 @@
 #pragma once
 
-#include <unordered_map>
 #include "iot_common.h"
 #include "iot_mqtt_defs.h"
+#include "iot_topic_trie.h"
+#include "iot_mqtt_pool.h"
+#include "iot_mqtt_ring.h"
+#include "iot_mqtt_outbox.h"
+#include "iot_mqtt_dispatcher.h"
 #include "mqtt_client.h"
 
 /**
@@ -13,8 +17,13 @@ public:
     esp_err_t start(std::string client_id);
     esp_err_t reconnect();
     esp_err_t subscribe(iot_mqtt_subscribe_t subscribe);
-    esp_err_t publish(std::string topic, std::string data, size_t data_len, uint8_t qos, int *msg_id);
+    esp_err_t publish(std::string topic, std::string data, size_t data_len, uint8_t qos, int *msg_id,
+                      iot_mqtt_buffer_mode_e mode = IOT_MQTT_BUFFER_ALL);
+    bool started() const;
     bool connected() const;
+    iot_mqtt_metrics_t metrics() const;
+    iot_mqtt_dispatch_metrics_t dispatch_metrics() const;
+    esp_err_t callback_stats(std::string topic, iot_mqtt_callback_stats_t *stats) const;
     bool subscribed(std::string topic) const;
 
 private:
@@ -23,11 +32,38 @@ private:
     bool _initialized = false;
 
     esp_mqtt_client_config_t _mqtt_cfg{};                                       /**< The mqtt client config. */
+    std::string _client_id{};                                                   /**< The client id, the config points into it. */
+    std::string _overrides[3]{};                                                /**< The url, username and password overridden from nvs. */
     esp_mqtt_client_handle_t _client;                                           /**< The mqtt client handle. */
-    std::mutex _subscribe_mutex;                                                /**< The mute for protecting access to the subscription map. */
+    mutable std::mutex _subscribe_mutex;                                        /**< The mute for protecting access to the subscription trie. */
     std::mutex _cb_mutex;                                                       /**< Mutex for protecting access to the event callbacks map. */
-    std::unordered_map<std::string, iot_mqtt_subscribe_cb_t> _subscriptions{};  /**< The map of mqtt subscribers. */
+    IotTopicTrie _subscriptions{};                                              /**< The trie of mqtt subscribers. */
+    std::vector<iot_mqtt_filter_t> _filters{};                                  /**< The topic filters subscribed at the broker. */
+    uint8_t _subscription_count = 0;                                            /**< The number of subscriptions, the id of the next one. */
+    IotMqttDispatcher _dispatcher{};                                            /**< The dispatcher delivering messages to subscribers on worker tasks. */
+    IotMqttPool _pool{};                                                        /**< The pool of reassembly buffers, shared with the dispatcher for large messages. */
+    iot_mqtt_reassembly_t _reassembly{};                                        /**< The message being reassembled. */
+    mutable std::mutex _state_mutex;                                            /**< The mutex for protecting access to the connection state. */
+    iot_mqtt_metrics_t _metrics{};                                              /**< The connection state and reconnect metrics. */
+    uint32_t _disconnected_at = 0;                                              /**< The time in milliseconds the client disconnected. */
+    esp_timer_handle_t _reconnect_timer = nullptr;                              /**< The timer of the next reconnect attempt. */
+    std::mutex _ring_mutex;                                                     /**< The mutex for protecting access to the outgoing ring. */
+    IotMqttRing _ring{};                                                        /**< The ring buffering outgoing messages while disconnected. */
+    char *_replay_buf = nullptr;                                                /**< The buffer of the message being replayed, moved out of the ring. */
+    iot_mqtt_record_t _pending{};                                               /**< The message being replayed, it points into the replay buffer, no topic if none. */
+    bool _replaying = false;                                                    /**< Indicates that a task is replaying, new messages are buffered behind. */
+    IotMqttOutbox _outbox{};                                                    /**< The flash outbox of the unacknowledged QoS 1 messages. */
 
     static void on_event(void *args, esp_event_base_t base, int32_t id, void *data);
     void on_data(esp_mqtt_event_handle_t evt);
+    void dispatch(const char *topic, size_t topic_len, const char *data, size_t len, char *buf);
+    void replay(void);
+    void resubscribe(void);
+    esp_err_t buffer(std::string_view topic, const char *data, size_t len, uint8_t qos, int *msg_id,
+                     iot_mqtt_buffer_mode_e mode);
+    bool backlog(void) const;
+    void load_overrides(const char **values[], size_t count);
+    void on_connected(void);
+    void on_disconnected(void);
+    void attempt(void);
 };
\ No newline at end of file
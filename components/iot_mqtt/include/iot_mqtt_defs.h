@@ -1,6 +1,27 @@
 #pragma once
 
-#define IOT_MQTT_MAX_BUFFER 4096
+#include <string>
+#include <vector>
+
+#define IOT_MQTT_MAX_BUFFER 4096          /**< The size of a reassembly buffer, the largest topic plus payload received. */
+#define IOT_MQTT_BUFFER_COUNT 3           /**< The number of reassembly buffers, they also hold large messages waiting for dispatch. */
+#define IOT_MQTT_RING_SIZE 8192           /**< The size of the ring buffering outgoing messages while disconnected. */
+#define IOT_MQTT_BACKOFF_BASE_MS 1000     /**< The reconnect backoff after the first failure. */
+#define IOT_MQTT_BACKOFF_MAX_MS 120000    /**< The cap of the reconnect backoff. */
+#define IOT_NVS_MQTT_NAMESPACE "iot_mqtt"  /**< The nvs namespace of the runtime overrides of the mqtt config. */
+#define IOT_MQTT_MAX_MATCHES 8            /**< The maximum number of subscribers a single message is delivered to. */
+#define IOT_MQTT_TOPIC_NODE_NONE 0xFFFF   /**< The index of a missing topic trie node. */
+#define IOT_MQTT_OUTBOX_PARTITION "mqtt_outbox"  /**< The label of the flash partition of the QoS 1 outbox. */
+#define IOT_MQTT_OUTBOX_BATCH_SIZE 2048   /**< The size of the batch of outbox records waiting to be written to flash. */
+#define IOT_MQTT_OUTBOX_MAX_ENTRIES 64    /**< The maximum number of unacknowledged messages tracked by the outbox. */
+#define IOT_MQTT_OUTBOX_EARLY_ACKS 8      /**< The number of acknowledgements kept while their message id isn't bound yet. */
+#define IOT_MQTT_OUTBOX_FLUSH_MS 500      /**< How long outbox records are batched before being written to flash. */
+#define IOT_MQTT_DISPATCH_QUEUE_SIZE 16   /**< The maximum number of messages waiting to be delivered to subscribers. */
+#define IOT_MQTT_DISPATCH_WORKERS 2       /**< The number of tasks delivering messages to subscribers. */
+#define IOT_MQTT_DISPATCH_BUFFER_SIZE 512 /**< The size of a dispatch buffer, larger messages take a reassembly buffer. */
+#define IOT_MQTT_DISPATCH_BUFFERS (IOT_MQTT_DISPATCH_QUEUE_SIZE + IOT_MQTT_DISPATCH_WORKERS)  /**< The number of dispatch buffers. */
+#define IOT_MQTT_DISPATCH_SLOW_US 100000  /**< A callback running longer than this is logged as slow. */
+#define IOT_MQTT_MAX_SUBSCRIPTIONS 16     /**< The maximum number of subscriptions. */
 
 /**
  * A struct for the mqtt configuration.
@@ -12,6 +33,15 @@ typedef struct iot_mqtt_cfg {
     std::string password;         /** The mqtt password. */
 }iot_mqtt_cfg_t;
 
+/**
+ * A struct of the mqtt configuration compiled in at build time, the strings are literals kept in flash.
+ */
+typedef struct iot_mqtt_conf {
+    const char *mqtt_url;         /** The mqtt broker url. */
+    const char *username;         /** The mqtt username. */
+    const char *password;         /** The mqtt password. */
+} iot_mqtt_conf_t;
+
 /**
  * A struct for a mqtt message payload.
  */
@@ -19,6 +49,65 @@ typedef struct iot_mqtt_message {
 
 } iot_mqtt_message_t;
 
+/**
+ * An enum of the states of the connection to the broker.
+ */
+typedef enum iot_mqtt_state {
+    IOT_MQTT_STATE_IDLE = 0,       /** The client wasn't started. */
+    IOT_MQTT_STATE_CONNECTING,     /** A connection attempt is in progress. */
+    IOT_MQTT_STATE_CONNECTED,      /** The client is connected. */
+    IOT_MQTT_STATE_BACKOFF,        /** The client is waiting out the backoff before the next attempt. */
+} iot_mqtt_state_e;
+
+/**
+ * A struct of the metrics of the reconnect supervisor.
+ */
+typedef struct iot_mqtt_metrics {
+    iot_mqtt_state_e state;        /** The current connection state. */
+    uint32_t attempts;             /** The total number of reconnect attempts. */
+    uint32_t failures;             /** The number of consecutive failed attempts. */
+    uint32_t backoff_ms;           /** The current backoff, the upper bound of the next jittered delay. */
+    uint32_t reconnect_ms;         /** The time it took to reconnect after the last disconnect. */
+} iot_mqtt_metrics_t;
+
+/**
+ * An enum of how an outgoing message is buffered while the client is disconnected.
+ */
+typedef enum iot_mqtt_buffer_mode {
+    IOT_MQTT_BUFFER_ALL = 0,       /** Every message is buffered and replayed. */
+    IOT_MQTT_BUFFER_LATEST,        /** Only the latest message of the topic is kept, e.g. a state snapshot. */
+    IOT_MQTT_BUFFER_NONE,          /** The message is dropped, e.g. a reply that is stale once reconnected. */
+} iot_mqtt_buffer_mode_e;
+
+/**
+ * A struct of a message buffered in the ring, it points into the ring.
+ */
+typedef struct iot_mqtt_record {
+    const char *topic;             /** A pointer to the topic, null terminated. */
+    const char *data;              /** A pointer to the data. */
+    size_t len;                    /** The length of the data. */
+    uint8_t qos;                   /** The quality of service for the message. */
+} iot_mqtt_record_t;
+
+/**
+ * An enum of where the record of an unacknowledged message is.
+ */
+typedef enum iot_mqtt_outbox_state {
+    IOT_MQTT_OUTBOX_BATCHED = 0,   /** The record is in the batch waiting to be written. */
+    IOT_MQTT_OUTBOX_WRITING,       /** The record is being written to flash. */
+    IOT_MQTT_OUTBOX_STORED,        /** The record is stored in flash. */
+} iot_mqtt_outbox_state_e;
+
+/**
+ * A struct of an unacknowledged message tracked by the outbox.
+ */
+typedef struct iot_mqtt_outbox_entry {
+    int msg_id;                    /** The id of the message, 0 until republished after a restart, negative while claimed. */
+    uint32_t offset;               /** The offset of the record in flash, or in the batch until it's written. */
+    iot_mqtt_outbox_state_e state; /** Where the record is. */
+    bool acked;                    /** Indicates the message was acknowledged while its record was being written. */
+} iot_mqtt_outbox_entry_t;
+
 /**
  * A struct for publishing mqtt message.
  */
@@ -29,21 +118,121 @@ typedef struct iot_mqtt_pub_message {
 } iot_mqtt_pub_message_t;
 
 /**
- * A callback function to invoke when a message which is subscribed to is received.
+ * An enum of the priorities of subscriptions, messages of a higher priority are delivered first.
+ */
+typedef enum iot_mqtt_priority {
+    IOT_MQTT_PRIORITY_LOW = 0,     /** Bulk traffic, e.g. configuration, never uses the last idle worker. */
+    IOT_MQTT_PRIORITY_NORMAL,      /** The default priority. */
+    IOT_MQTT_PRIORITY_HIGH,        /** Latency sensitive traffic, e.g. commands. */
+    IOT_MQTT_PRIORITY_MAX,         /** The number of priorities. */
+} iot_mqtt_priority_e;
+
+/**
+ * An enum of what happens to a message of a subscription when the dispatch queue is full and holds no message of a
+ * lower priority to make room.
+ */
+typedef enum iot_mqtt_overflow {
+    IOT_MQTT_OVERFLOW_DROP_NEWEST = 0, /** The new message is dropped. */
+    IOT_MQTT_OVERFLOW_DROP_OLDEST,     /** The oldest message of the same priority is dropped to make room. */
+} iot_mqtt_overflow_e;
+
+/**
+ * A callback function to invoke when a message which is subscribed to is received. It runs on a dispatch worker, the
+ * topic and data are views into a copy of the message, they aren't null terminated and are only valid during the call.
  *
  * @param[in] topic Topic on which the message was received
- * @param[in] payload The received data.
- * @param[in] payload_len The length of the received data.
+ * @param[in] topic_len The length of the topic.
+ * @param[in] data The received data.
+ * @param[in] len The length of the received data.
  * @param[in] priv_data A pointer to the private data passed during subscribing.
  */
-typedef void (*iot_mqtt_subscribe_cb_t)(std::string topic, std::string data, size_t len, void *priv_data);
+typedef void (*iot_mqtt_subscribe_cb_t)(const char *topic, size_t topic_len, const char *data, size_t len,
+                                        void *priv_data);
 
 /**
  * A struct for subscribing to mqtt.
  */
 typedef struct iot_mqtt_subscribe {
-    std::string topic;             /** The subscription's topic. */
+    std::string topic;             /** The subscription's topic filter, it may contain the + and # wildcards. */
     uint8_t qos = 0;               /** The quality of service for the subscription. Default is zero. */
     iot_mqtt_subscribe_cb_t cb;    /** The callback to invoke when a message is received on the sub topic. */
+    void *priv_data = nullptr;     /** A pointer to the private data passed to the callback. */
+    iot_mqtt_priority_e priority = IOT_MQTT_PRIORITY_NORMAL;     /** The priority of the subscription's messages. */
+    iot_mqtt_overflow_e overflow = IOT_MQTT_OVERFLOW_DROP_NEWEST; /** What happens to a message when the queue is full. */
 } iot_mqtt_subscribe_t;
 
+/**
+ * A struct of a topic filter subscribed at the broker, it's subscribed again when a session isn't resumed.
+ */
+typedef struct iot_mqtt_filter {
+    std::string topic;             /** The topic filter. */
+    uint8_t qos;                   /** The highest quality of service it was subscribed with. */
+} iot_mqtt_filter_t;
+
+/**
+ * A struct of a subscriber of a topic filter.
+ */
+typedef struct iot_mqtt_subscriber {
+    iot_mqtt_subscribe_cb_t cb;    /** The callback to invoke when a message matches the filter. */
+    void *priv_data;               /** A pointer to the private data passed to the callback. */
+    iot_mqtt_priority_e priority;  /** The priority of the subscription's messages. */
+    iot_mqtt_overflow_e overflow;  /** What happens to a message when the queue is full. */
+    uint8_t id;                    /** The index of the subscription, its messages are delivered one at a time. */
+} iot_mqtt_subscriber_t;
+
+class IotMqttPool;
+
+/**
+ * A struct of a message waiting in the dispatch queue.
+ */
+typedef struct iot_mqtt_dispatch_item {
+    iot_mqtt_subscriber_t subscriber; /** The subscriber to deliver the message to. */
+    char *buf;                        /** A pointer to the copy of the topic followed by the data, shared by the subscribers. */
+    IotMqttPool *pool;                /** A pointer to the pool the copy belongs to. */
+    size_t topic_len;                 /** The length of the topic. */
+    size_t len;                       /** The length of the data. */
+    int64_t queued_at;                /** The time in microseconds the message was queued. */
+} iot_mqtt_dispatch_item_t;
+
+/**
+ * A struct of the execution time of a subscription's callback.
+ */
+typedef struct iot_mqtt_callback_stats {
+    uint32_t calls;                /** The number of calls. */
+    uint32_t max_us;               /** The longest call in microseconds. */
+    uint64_t total_us;             /** The total time of the calls in microseconds. */
+} iot_mqtt_callback_stats_t;
+
+/**
+ * A struct of the metrics of the dispatch queue.
+ */
+typedef struct iot_mqtt_dispatch_metrics {
+    uint32_t depth[IOT_MQTT_PRIORITY_MAX]; /** The number of messages waiting, per priority. */
+    uint32_t max_depth;            /** The largest number of messages that were waiting at once. */
+    uint32_t max_wait_us;          /** The longest a message waited to be delivered in microseconds. */
+    uint32_t delivered;            /** The number of messages delivered. */
+    uint32_t evicted;              /** The number of waiting messages dropped to make room for another. */
+    uint32_t dropped;              /** The number of new messages dropped because the queue or the pool was full. */
+} iot_mqtt_dispatch_metrics_t;
+
+/**
+ * A struct of a message being reassembled from fragments.
+ */
+typedef struct iot_mqtt_reassembly {
+    char *buf = nullptr;           /** A pointer to the pool buffer holding the topic followed by the data. */
+    size_t topic_len = 0;          /** The length of the topic. */
+    size_t total = 0;              /** The total length of the data. */
+    size_t received = 0;           /** The length of the data received so far. */
+    int msg_id = 0;                /** The id of the message. */
+} iot_mqtt_reassembly_t;
+
+/**
+ * A struct of a node of the topic trie, one level of a topic filter.
+ */
+typedef struct iot_mqtt_topic_node {
+    std::string level;                                 /** The node's level, which may be a + or # wildcard. */
+    uint16_t child = IOT_MQTT_TOPIC_NODE_NONE;         /** The index of the node's first child. */
+    uint16_t sibling = IOT_MQTT_TOPIC_NODE_NONE;       /** The index of the node's next sibling. */
+    std::vector<iot_mqtt_subscriber_t> subscribers{};  /** The subscribers of the filter ending at this node. */
+} iot_mqtt_topic_node_t;
+
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include "iot_common.h"
+#include "iot_mqtt_defs.h"
+#include "iot_mqtt_pool.h"
+
+/**
+ * A class for delivering received messages to their subscribers on worker tasks, so a slow callback never stalls the
+ * mqtt client's task and with it the keepalives and every other subscription.
+ *
+ * A message is copied once into a pooled buffer and shared by its subscribers, it's released after the last one ran.
+ * Messages wait in a bounded queue per priority and the workers always take the highest priority message first. When
+ * the queue is full a message evicts the oldest one of a lower priority, otherwise the subscription's overflow policy
+ * applies. A subscription's messages are delivered one at a time and in order, and low priority messages never take
+ * the last idle worker, so commands are never stuck behind bulk traffic.
+ */
+class IotMqttDispatcher final
+{
+public:
+    esp_err_t start(size_t workers, IotMqttPool *large);
+    void post(const iot_mqtt_subscriber_t *subscribers, size_t count, const char *topic, size_t topic_len,
+              const char *data, size_t len, char *buf);
+    iot_mqtt_dispatch_metrics_t metrics(void) const;
+    iot_mqtt_callback_stats_t stats(uint8_t id) const;
+
+private:
+    static constexpr const char *TAG = "IotMqttDispatcher";  /**< A constant used to identify the source of the log message of this class. */
+    static constexpr uint32_t STACK_SIZE = 4096;              /**< The stack size of a worker task. */
+
+    mutable std::mutex _mutex{};                                     /**< The mutex used to safe guard the queues and metrics. */
+    std::condition_variable _cond{};                                 /**< The condition the workers wait on for messages. */
+    std::deque<iot_mqtt_dispatch_item_t> _queues[IOT_MQTT_PRIORITY_MAX]{}; /**< The waiting messages, per priority. */
+    IotMqttPool _pool{};                                             /**< The pool of the copies of the waiting messages. */
+    IotMqttPool *_large = nullptr;                                   /**< A pointer to the pool of the messages too large for it. */
+    size_t _depth = 0;                                               /**< The number of waiting messages. */
+    size_t _workers = 0;                                             /**< The number of worker tasks. */
+    size_t _active = 0;                                              /**< The number of workers delivering a message. */
+    uint32_t _busy = 0;                                              /**< A bit per subscription being delivered to. */
+    iot_mqtt_dispatch_metrics_t _metrics{};                          /**< The metrics of the queue. */
+    iot_mqtt_callback_stats_t _stats[IOT_MQTT_MAX_SUBSCRIPTIONS]{};  /**< The execution time of each subscription's callback. */
+    TaskHandle_t _tasks[IOT_MQTT_DISPATCH_WORKERS]{};                /**< The handles of the worker tasks. */
+
+    static void task(void *arg);
+    char *acquire(IotMqttPool *pool, uint8_t priority, bool oldest);
+    void take(iot_mqtt_dispatch_item_t *item);
+    void deliver(iot_mqtt_dispatch_item_t &item);
+    bool evict(uint8_t priority, const IotMqttPool *pool = nullptr);
+};
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <mutex>
+#include <string_view>
+#include <vector>
+#include "esp_partition.h"
+#include "iot_common.h"
+#include "iot_mqtt_defs.h"
+#include "mqtt_client.h"
+
+/**
+ * A class for persisting unacknowledged QoS 1 messages in a dedicated flash partition, so they are republished after
+ * a restart. The partition is an append only log of sectors written in a circle, which spreads the erases evenly
+ * across them. Records are batched in ram and written by a low priority task, so the publish path never waits for
+ * the flash. An acknowledged record is cleared in place by zeroing its state word, which needs no erase, and a sector
+ * is only erased once the log wraps around to it, dropping whatever is still unacknowledged there.
+ *
+ * The partition must not be encrypted, records are cleared by overwriting them.
+ */
+class IotMqttOutbox final
+{
+public:
+    esp_err_t init(const char *label);
+    int reserve(std::string_view topic, const char *data, size_t len, uint8_t qos);
+    void bind(int token, int msg_id);
+    void ack(int msg_id);
+    void forget(int msg_id);
+    size_t replay(esp_mqtt_client_handle_t client);
+    uint32_t dropped(void);
+
+private:
+    static constexpr const char *TAG = "IotMqttOutbox";  /**< A constant used to identify the source of the log message of this class. */
+    static constexpr uint32_t STACK_SIZE = 4096;          /**< The stack size of the outbox task. */
+    static constexpr uint32_t SECTOR_SIZE = 4096;         /**< The size of a flash sector, the unit of erasing. */
+    static constexpr uint32_t MAGIC = 0x584F4249;         /**< The magic number marking a sector of the log. */
+    static constexpr uint32_t LIVE = 0x5A5A5A5A;          /**< The state of a record waiting to be acknowledged. */
+    static constexpr uint32_t ACKED = 0;                  /**< The state of an acknowledged record. */
+
+    /**
+     * A struct of the header of a sector of the log.
+     */
+    typedef struct sector {
+        uint32_t magic;            /**< The magic number, anything else marks a free sector. */
+        uint32_t seq;              /**< The sequence number of the sector, ordering the log. */
+    } sector_t;
+
+    /**
+     * A struct of the header of a record in the log, followed by the topic and the data padded to a word.
+     */
+    typedef struct header {
+        uint32_t state;            /**< The state of the record, all bits set marks the end of the sector's records. */
+        uint16_t topic_len;        /**< The length of the topic. */
+        uint16_t len;              /**< The length of the data. */
+        uint8_t qos;               /**< The quality of service for the message. */
+        uint8_t reserved[3];       /**< Reserved, always zero. */
+        uint32_t crc;              /**< The crc of the header after the state, the topic and the data. */
+    } header_t;
+
+    std::mutex _mutex{};                                 /**< The mutex used to safe guard the entries and the batch. */
+    const esp_partition_t *_partition = nullptr;         /**< A pointer to the outbox partition. */
+    std::vector<iot_mqtt_outbox_entry_t> _entries{};     /**< The unacknowledged messages, oldest first. */
+    uint8_t *_batch = nullptr;                           /**< The records waiting to be written. */
+    size_t _batch_len = 0;                               /**< The length of the records waiting to be written. */
+    uint8_t *_writing = nullptr;                         /**< The records being written, only used by the task. */
+    std::vector<uint16_t> _live{};                       /**< The number of live records of each sector, only used by the task. */
+    uint16_t _head = 0;                                  /**< The sector records are appended to. */
+    uint32_t _head_offset = SECTOR_SIZE;                 /**< The offset in the head sector the next record is written at. */
+    uint32_t _seq = 0;                                   /**< The sequence number of the head sector. */
+    bool _has_head = false;                              /**< Indicates whether the log has a head sector yet. */
+    size_t _unreplayed = 0;                              /**< The number of stored records without a message id. */
+    int _token = 0;                                      /**< The last token claiming an entry. */
+    std::array<int, IOT_MQTT_OUTBOX_EARLY_ACKS> _early{}; /**< The acknowledgements which arrived before their message id was bound. */
+    size_t _early_next = 0;                              /**< The slot the next early acknowledgement is kept in. */
+    uint32_t _dropped = 0;                               /**< The number of messages that couldn't be persisted or were overwritten. */
+    TaskHandle_t _task = nullptr;                        /**< The handle of the task writing the batches. */
+
+    static void task(void *arg);
+    esp_err_t recover(void);
+    void scan(uint16_t sector, const uint8_t *buf, bool head);
+    void flush(void);
+    esp_err_t write(const uint8_t *buf, size_t len, std::vector<std::pair<uint32_t, uint32_t>> *placed,
+                    std::vector<uint16_t> *erased);
+    esp_err_t advance(std::vector<uint16_t> *erased);
+    std::vector<iot_mqtt_outbox_entry_t>::iterator find(int msg_id);
+    int token(void);
+    bool assign(std::vector<iot_mqtt_outbox_entry_t>::iterator it, int msg_id);
+    bool clear(std::vector<iot_mqtt_outbox_entry_t>::iterator it);
+    void expire(void);
+    static uint32_t crc(const header_t *header);
+    static size_t record_size(size_t topic_len, size_t len);
+};
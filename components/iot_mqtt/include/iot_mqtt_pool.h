@@ -0,0 +1,31 @@
+#pragma once
+
+#include <mutex>
+#include <vector>
+#include "iot_common.h"
+#include "iot_mqtt_defs.h"
+
+/**
+ * A class for a fixed pool of equally sized buffers. The buffers are allocated once, so reassembling and dispatching
+ * messages neither fragments the heap nor fails on it once the component is running. Buffers are reference counted,
+ * a received message is copied once and shared by every subscriber it's queued for.
+ */
+class IotMqttPool final
+{
+public:
+    esp_err_t init(size_t count, size_t size);
+    char *acquire(void);
+    void retain(char *buf);
+    void release(char *buf);
+    size_t size(void) const;
+
+private:
+    static constexpr const char *TAG = "IotMqttPool";   /**< A constant used to identify the source of the log message of this class. */
+
+    std::mutex _mutex{};                                /**< The mutex used to safe guard the pool. */
+    char *_bufs = nullptr;                              /**< The buffers, back to back in a single allocation. */
+    size_t _size = 0;                                   /**< The size of a buffer. */
+    std::vector<uint8_t> _refs{};                       /**< The number of references to each buffer, 0 if it's free. */
+
+    int index(const char *buf) const;
+};
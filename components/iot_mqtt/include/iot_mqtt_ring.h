@@ -0,0 +1,49 @@
+#pragma once
+
+#include <string_view>
+#include "iot_common.h"
+#include "iot_mqtt_defs.h"
+
+/**
+ * A class for a bounded ring of outgoing messages, stored back to back in a single buffer allocated once. When the
+ * ring is full the oldest messages are dropped to make room, so producers never block. A message can replace the
+ * buffered ones of its topic, keeping only the latest value.
+ *
+ * The ring isn't thread safe, the owner guards it.
+ */
+class IotMqttRing final
+{
+public:
+    esp_err_t init(size_t size);
+    esp_err_t push(std::string_view topic, const char *data, size_t len, uint8_t qos, bool latest);
+    bool front(iot_mqtt_record_t *record);
+    void pop(void);
+    bool empty(void) const;
+    size_t count(void) const;
+    uint32_t dropped(void) const;
+
+private:
+    static constexpr const char *TAG = "IotMqttRing";  /**< A constant used to identify the source of the log message of this class. */
+
+    /**
+     * A struct of the header of a record in the ring, followed by the null terminated topic and the data.
+     */
+    typedef struct header {
+        uint16_t size;             /**< The size of the record including the header, 0 marks a wrap to the start. */
+        uint16_t topic_len;        /**< The length of the topic. */
+        uint16_t len;              /**< The length of the data. */
+        uint8_t qos;               /**< The quality of service for the message. */
+        uint8_t live;              /**< Indicates the record wasn't replaced by a later message of its topic. */
+    } header_t;
+
+    uint8_t *_buf = nullptr;       /**< A pointer to the ring's buffer. */
+    size_t _size = 0;              /**< The size of the buffer. */
+    size_t _head = 0;              /**< The offset of the oldest record. */
+    size_t _tail = 0;              /**< The offset the next record is written at. */
+    size_t _used = 0;              /**< The number of bytes in use, including skipped space at the end. */
+    size_t _count = 0;             /**< The number of live records. */
+    uint32_t _dropped = 0;         /**< The number of messages dropped to make room. */
+
+    header_t *at_head(void);
+    void drop(void);
+};
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <string_view>
+#include <vector>
+#include "iot_common.h"
+#include "iot_mqtt_defs.h"
+
+/**
+ * A class for matching topics against subscribed topic filters. Filters are split into levels stored in a trie, so
+ * matching a topic walks one path per level, branching only at + wildcards, and costs the depth of the topic rather
+ * than the number of subscriptions. Topics are matched in place as (topic, len) and matching never allocates.
+ */
+class IotTopicTrie final
+{
+public:
+    IotTopicTrie(void);
+
+    esp_err_t insert(std::string_view filter, iot_mqtt_subscriber_t subscriber);
+    esp_err_t remove(std::string_view filter, uint8_t id);
+    bool contains(std::string_view filter) const;
+    bool find(std::string_view filter, iot_mqtt_subscriber_t *out) const;
+    size_t match(const char *topic, size_t len, iot_mqtt_subscriber_t *out, size_t max) const;
+    bool empty(void) const;
+
+    static bool valid_filter(std::string_view filter);
+
+private:
+    static constexpr const char *TAG = "IotTopicTrie";  /**< A constant used to identify the source of the log message of this class. */
+
+    std::vector<iot_mqtt_topic_node_t> _nodes{};        /**< The trie's nodes, the first one is the root. */
+
+    uint16_t find_child(uint16_t node, std::string_view level) const;
+    uint16_t find_node(std::string_view filter) const;
+    void collect(uint16_t node, const char *pos, const char *end, bool done, bool first,
+                 iot_mqtt_subscriber_t *out, size_t max, size_t *count) const;
+    static void add(const iot_mqtt_topic_node_t &node, iot_mqtt_subscriber_t *out, size_t max, size_t *count);
+};
@@ -1,12 +1,10 @@
+#include <algorithm>
 #include <mutex>
-#include <cJSON.h>
+#include "esp_random.h"
 #include "iot_mqtt.h"
-
-/* A pointer to the start of the mqtt config. */
-extern const uint8_t config_key_start[] asm("_binary_iot_mqtt_start");
-
-/* A pointer to the end of the mqtt config. */
-extern const uint8_t config_key_end[] asm("_binary_iot_mqtt_end");
+#include "iot_mqtt_conf.h"
+#include "iot_factory.h"
+#include "iot_storage.h"
 
 /**
  * Starts the component
@@ -16,35 +14,56 @@ extern const uint8_t config_key_end[] asm("_binary_iot_mqtt_end");
  */
 esp_err_t IotMqtt::start(std::string client_id)
 {
-    const uint8_t *buf = const_cast<uint8_t *>(config_key_start);
+    _mqtt_cfg.broker.address.uri = IOT_MQTT_CONF.mqtt_url;
+    _mqtt_cfg.credentials.username = IOT_MQTT_CONF.username;
+    _mqtt_cfg.credentials.authentication.password = IOT_MQTT_CONF.password;
 
-    ESP_LOGI(TAG, "Loaded config [json: %s]", buf);
+    const char **values[] = {&_mqtt_cfg.broker.address.uri, &_mqtt_cfg.credentials.username,
+                             &_mqtt_cfg.credentials.authentication.password};
 
-    cJSON *root = cJSON_Parse(reinterpret_cast<const char *>(buf));
+    load_overrides(values, sizeof(values) / sizeof(values[0]));
 
-    if (root == nullptr) {
-        ESP_LOGI(TAG, "%s: Failed to start the component, [reason: %s]", __func__, cJSON_GetErrorPtr());
+    // Keys missing from the config are generated as empty strings, which the client must not send.
+    for (const char **value: values) {
+        if (!iot_valid_str(*value))
+            *value = nullptr;
     }
 
-    if (cJSON_GetObjectItem(root, "mqtt_url")) {
-        char *url = cJSON_GetObjectItem(root,"mqtt_url")->valuestring;
-        _mqtt_cfg.broker.address.uri = url;
-        ESP_LOGI(TAG, "%s: Configuring Mqtt [url: %s]", __func__, _mqtt_cfg.broker.address.uri);
-    }
+    const char *username = _mqtt_cfg.credentials.username;
+    char *mask = iot_mask_str(_mqtt_cfg.credentials.authentication.password);
 
-    if (cJSON_GetObjectItem(root, "username")) {
-        char *username = cJSON_GetObjectItem(root,"username")->valuestring;
-        _mqtt_cfg.credentials.username = username;
-        ESP_LOGI(TAG, "%s: Configuring Mqtt [url: %s]", __func__, username);
-    }
+    ESP_LOGI(TAG, "%s: Configuring Mqtt [url: %s, username: %s, password: %s]", __func__,
+             _mqtt_cfg.broker.address.uri ? _mqtt_cfg.broker.address.uri : "", username ? username : "",
+             mask ? mask : "");
 
-    if (cJSON_GetObjectItem(root, "password")) {
-        char *password = cJSON_GetObjectItem(root,"password")->valuestring;
-        _mqtt_cfg.credentials.authentication.password = password;
-        ESP_LOGI(TAG, "%s: Configuring Mqtt [password: %s]", __func__, iot_mask_str(password));
-    }
+    iot_free(mask);
+
+    if (_pool.init(IOT_MQTT_BUFFER_COUNT, IOT_MQTT_MAX_BUFFER) != ESP_OK || _ring.init(IOT_MQTT_RING_SIZE) != ESP_OK)
+        return ESP_ERR_NO_MEM;
+
+    // The largest record the ring takes is half its size.
+    if (_replay_buf == nullptr && (_replay_buf = iot_allocate_mem<char>(IOT_MQTT_RING_SIZE / 2)) == nullptr)
+        return ESP_ERR_NO_MEM;
 
-    _mqtt_cfg.credentials.client_id = client_id.c_str();
+    if (_dispatcher.start(IOT_MQTT_DISPATCH_WORKERS, &_pool) != ESP_OK)
+        return ESP_ERR_NO_MEM;
+
+    if (_outbox.init(IOT_MQTT_OUTBOX_PARTITION) != ESP_OK)
+        ESP_LOGW(TAG, "%s: The outbox is unavailable, QoS 1 messages won't survive a restart", __func__);
+
+    esp_timer_create_args_t args = {
+        .callback = [](void *arg) { static_cast<IotMqtt *>(arg)->attempt(); },
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "iot_mqtt_reconnect",
+        .skip_unhandled_events = true,
+    };
+
+    if (_reconnect_timer == nullptr && esp_timer_create(&args, &_reconnect_timer) != ESP_OK)
+        return ESP_ERR_NO_MEM;
+
+    _client_id = std::move(client_id);
+    _mqtt_cfg.credentials.client_id = _client_id.c_str();
     _mqtt_cfg.network.disable_auto_reconnect = true;
     _client = esp_mqtt_client_init(&_mqtt_cfg);
 
@@ -58,13 +77,47 @@ esp_err_t IotMqtt::start(std::string client_id)
 
     _initialized = true;
 
+    {
+        std::lock_guard<std::mutex> lock(_state_mutex);
+        _metrics.state = IOT_MQTT_STATE_CONNECTING;
+    }
+
     ESP_LOGI(TAG, "%s: Component started successfully", __func__);
 
     return ESP_OK;
 }
 
 /**
- * Reconnects to the mqtt client,
+ * Overrides the compiled in config with the values stored in nvs, a value without a key keeps its default.
+ *
+ * @param[in,out] values The pointers to the url, username and password of the config.
+ * @param[in] count The number of values.
+ */
+void IotMqtt::load_overrides(const char **values[], size_t count)
+{
+    static constexpr const char *keys[] = {"mqtt_url", "username", "password"};
+
+    auto storage = IotFactory::create_scoped<IotStorage>(IOT_NVS_DEFAULT_PART_NAME, IOT_NVS_MQTT_NAMESPACE);
+
+    for (size_t i = 0; i < count && i < sizeof(keys) / sizeof(keys[0]); i++) {
+        void *buf = nullptr;
+        size_t len = 0;
+
+        if (storage->read(keys[i], &buf, len, IOT_TYPE_STR) != ESP_OK)
+            continue;
+
+        _overrides[i].assign(static_cast<char *>(buf));
+        *values[i] = _overrides[i].c_str();
+
+        iot_free(buf);
+
+        ESP_LOGI(TAG, "%s: Overrode the config from nvs [key: %s]", __func__, keys[i]);
+    }
+}
+
+/**
+ * Reconnects to the mqtt client right away, e.g. once the network is back, unless the client is already connected
+ * or connecting. Reconnects after the broker drops the client are scheduled by the supervisor with backoff.
  *
  * @return ESP_OK on success, otherwise an error code.
  */
@@ -72,16 +125,90 @@ esp_err_t IotMqtt::reconnect()
 {
     assert(_initialized);
 
+    {
+        std::lock_guard<std::mutex> lock(_state_mutex);
+
+        if (_metrics.state == IOT_MQTT_STATE_CONNECTED || _metrics.state == IOT_MQTT_STATE_CONNECTING)
+            return ESP_OK;
+
+        esp_timer_stop(_reconnect_timer);
+    }
+
+    attempt();
+
+    return ESP_OK;
+}
+
+/**
+ * Makes a reconnect attempt, its failure is reported as a disconnect which schedules the next one.
+ */
+void IotMqtt::attempt(void)
+{
+    {
+        std::lock_guard<std::mutex> lock(_state_mutex);
+
+        _metrics.state = IOT_MQTT_STATE_CONNECTING;
+        _metrics.attempts++;
+    }
+
     esp_err_t ret = esp_mqtt_client_reconnect(_client);
 
     if (ret != ESP_OK) {
         ESP_LOGI(TAG, "%s: Failed to reconnect the mqtt client, [reason: %s]", __func__, esp_err_to_name(ret));
+        on_disconnected();
     }
-    return ret;
 }
 
 /**
- * Subscribes to a mqtt topic.
+ * Updates the connection state once the client connected.
+ */
+void IotMqtt::on_connected(void)
+{
+    std::lock_guard<std::mutex> lock(_state_mutex);
+
+    if (_metrics.failures > 0)
+        _metrics.reconnect_ms = iot_millis() - _disconnected_at;
+
+    _metrics.state = IOT_MQTT_STATE_CONNECTED;
+    _metrics.failures = 0;
+    _metrics.backoff_ms = 0;
+}
+
+/**
+ * Schedules the next reconnect attempt after the client disconnected or an attempt failed. The backoff doubles with
+ * each consecutive failure up to a cap and the delay is drawn uniformly from zero to the backoff (full jitter), so
+ * devices dropped together by a broker restart spread their reconnects out instead of all hitting it at once.
+ */
+void IotMqtt::on_disconnected(void)
+{
+    std::lock_guard<std::mutex> lock(_state_mutex);
+
+    // A failed attempt may be reported more than once, only the first report schedules the next one.
+    if (_metrics.state == IOT_MQTT_STATE_BACKOFF)
+        return;
+
+    if (_metrics.failures == 0)
+        _disconnected_at = iot_millis();
+
+    uint32_t shift = std::min<uint32_t>(_metrics.failures, 16);
+
+    _metrics.backoff_ms = std::min<uint32_t>(IOT_MQTT_BACKOFF_MAX_MS, IOT_MQTT_BACKOFF_BASE_MS << shift);
+    _metrics.failures++;
+    _metrics.state = IOT_MQTT_STATE_BACKOFF;
+
+    uint32_t delay = esp_random() % (_metrics.backoff_ms + 1);
+
+    ESP_LOGI(TAG, "%s: Scheduled a reconnect [delay: %" PRIu32 ", backoff: %" PRIu32 ", failures: %" PRIu32 "]",
+             __func__, delay, _metrics.backoff_ms, _metrics.failures);
+
+    esp_timer_stop(_reconnect_timer);
+    esp_timer_start_once(_reconnect_timer, static_cast<uint64_t>(delay) * 1000);
+}
+
+/**
+ * Subscribes to a mqtt topic. The subscriber is added to the trie first and the client is called without holding the
+ * subscribe mutex, which is taken by the dispatch under the client's lock. The subscriber is removed again if the
+ * client fails to subscribe.
  *
  * @param[in] subscribe The the subscription data.
  * @return ESP_OK on success, otherwise an error code.
@@ -90,48 +217,249 @@ esp_err_t IotMqtt::subscribe(iot_mqtt_subscribe_t subscribe)
 {
     assert(_initialized);
 
-    std::lock_guard<std::mutex> lock(_subscribe_mutex);
-
     std::string topic = subscribe.topic;
 
-    if (!iot_valid_str(topic.c_str()))
+    if (!iot_valid_str(topic.c_str()) || !IotTopicTrie::valid_filter(topic))
         return ESP_FAIL;
 
+    uint8_t id;
+    esp_err_t added;
+
+    {
+        std::lock_guard<std::mutex> lock(_subscribe_mutex);
+
+        if (_subscription_count >= IOT_MQTT_MAX_SUBSCRIPTIONS) {
+            ESP_LOGE(TAG, "%s: Too many subscriptions [topic: %s, max: %d]", __func__, topic.c_str(),
+                     IOT_MQTT_MAX_SUBSCRIPTIONS);
+            return ESP_ERR_NO_MEM;
+        }
+
+        id = _subscription_count;
+
+        iot_mqtt_subscriber_t subscriber = {.cb = subscribe.cb, .priv_data = subscribe.priv_data,
+                                            .priority = subscribe.priority, .overflow = subscribe.overflow,
+                                            .id = id};
+
+        // A subscriber already in the trie is subscribed again, the broker treats it as a no-op.
+        added = _subscriptions.insert(topic, subscriber);
+
+        if (added != ESP_OK && added != ESP_ERR_INVALID_STATE)
+            return ESP_FAIL;
+
+        if (added == ESP_OK)
+            _subscription_count++;
+
+        auto filter = std::find_if(_filters.begin(), _filters.end(),
+                                   [&topic](const iot_mqtt_filter_t &filter) { return filter.topic == topic; });
+
+        if (filter == _filters.end())
+            _filters.push_back({.topic = topic, .qos = subscribe.qos});
+        else
+            filter->qos = std::max(filter->qos, subscribe.qos);
+    }
+
     int ret = esp_mqtt_client_subscribe(_client, topic.c_str(), subscribe.qos);
 
     if (ret < 0) {
         ESP_LOGI(TAG, "%s: Failed to subscribe to [topic: %s]", __func__, topic.c_str());
+
+        if (added == ESP_OK) {
+            std::lock_guard<std::mutex> lock(_subscribe_mutex);
+
+            _subscriptions.remove(topic, id);
+
+            if (!_subscriptions.contains(topic))
+                std::erase_if(_filters, [&topic](const iot_mqtt_filter_t &filter) { return filter.topic == topic; });
+
+            // The id is reused unless a later subscription took the next one.
+            if (_subscription_count == id + 1)
+                _subscription_count--;
+        }
+
         return ESP_FAIL;
     }
 
-    _subscriptions[topic] = subscribe.cb;
-
     ESP_LOGI(TAG, "%s: Successfully subscribed successful [msg_id: %d]", __func__, ret);
 
     return ESP_OK;
 }
 
 /**
- * Publishes data to a mqtt topic.
+ * Subscribes to every topic filter again after connecting without a session, the broker forgot them along with it.
+ * It runs from the event handler, so the client's lock is already held and the filters are copied out first.
+ */
+void IotMqtt::resubscribe(void)
+{
+    std::vector<iot_mqtt_filter_t> filters;
+
+    {
+        std::lock_guard<std::mutex> lock(_subscribe_mutex);
+        filters = _filters;
+    }
+
+    for (const iot_mqtt_filter_t &filter : filters) {
+        if (esp_mqtt_client_subscribe(_client, filter.topic.c_str(), filter.qos) < 0)
+            ESP_LOGW(TAG, "%s: Failed to subscribe again [topic: %s]", __func__, filter.topic.c_str());
+    }
+
+    if (!filters.empty())
+        ESP_LOGI(TAG, "%s: Subscribed again after a new session [count: %d]", __func__, filters.size());
+}
+
+/**
+ * Publishes data to a mqtt topic. While the client is disconnected, or older messages are still waiting to be
+ * replayed, the message is buffered in the outgoing ring instead, so it's never reordered and the call never blocks.
+ * A QoS 1 message handed to the client is recorded in the flash outbox until it's acknowledged, unless it isn't
+ * buffered either. The client's api is never called with the ring mutex held, the client holds its own lock while
+ * running the event handler, which replays the ring.
  *
  * @param[in] topic The topic to publish to.
  * @param[in] data The data to publish.
  * @param[in] data_len The length of the data.
  * @param[in] qos The quality of service for the message.
- * @param[out] msg_id A pointer to the message id to fill.
+ * @param[out] msg_id A pointer to the message id to fill, 0 if the message was buffered.
+ * @param[in] mode How the message is buffered while disconnected. Default is every message.
  * @return ESP_OK on success, otherwise an error code.
  */
-esp_err_t IotMqtt::publish(std::string topic, std::string data, size_t data_len, uint8_t qos, int *msg_id)
+esp_err_t IotMqtt::publish(std::string topic, std::string data, size_t data_len, uint8_t qos, int *msg_id,
+                           iot_mqtt_buffer_mode_e mode)
 {
     assert(_initialized);
 
+    std::unique_lock<std::mutex> lock(_ring_mutex);
+
+    if (_connected && !_replaying && backlog()) {
+        lock.unlock();
+        replay();
+        lock.lock();
+    }
+
+    if (!_connected || backlog())
+        return buffer(topic, data.data(), data_len, qos, msg_id, mode);
+
+    lock.unlock();
+
+    // The record is reserved first, the acknowledgement may arrive before the client returns.
+    int token = mode != IOT_MQTT_BUFFER_NONE ? _outbox.reserve(topic, data.data(), data_len, qos) : 0;
+
     *msg_id = esp_mqtt_client_publish(_client, topic.data(), data.data(), data_len, qos, 0);
 
-    if (*msg_id < 0) {
+    _outbox.bind(token, *msg_id);
+
+    if (*msg_id >= 0)
+        return ESP_OK;
+
+    lock.lock();
+
+    return buffer(topic, data.data(), data_len, qos, msg_id, mode);
+}
+
+/**
+ * Buffers a message in the outgoing ring to be replayed once connected. The ring mutex must be held.
+ *
+ * @param[in] topic The topic to publish to.
+ * @param[in] data A pointer to the data to publish.
+ * @param[in] len The length of the data.
+ * @param[in] qos The quality of service for the message.
+ * @param[out] msg_id A pointer to the message id to fill, always 0.
+ * @param[in] mode How the message is buffered.
+ * @return ESP_OK on success, ESP_FAIL if the mode doesn't buffer, otherwise an error code.
+ */
+esp_err_t IotMqtt::buffer(std::string_view topic, const char *data, size_t len, uint8_t qos, int *msg_id,
+                          iot_mqtt_buffer_mode_e mode)
+{
+    *msg_id = 0;
+
+    if (mode == IOT_MQTT_BUFFER_NONE)
         return ESP_FAIL;
+
+    esp_err_t ret = _ring.push(topic, data, len, qos, mode == IOT_MQTT_BUFFER_LATEST);
+
+    if (ret != ESP_OK)
+        ESP_LOGW(TAG, "%s: Failed to buffer a message [topic: %.*s, reason: %s]", __func__,
+                 static_cast<int>(topic.size()), topic.data(), esp_err_to_name(ret));
+
+    return ret;
+}
+
+/**
+ * Checks whether messages are waiting to be replayed, a new message must queue up behind them. The ring mutex must
+ * be held.
+ *
+ * @return true if messages are waiting, otherwise false.
+ */
+bool IotMqtt::backlog(void) const
+{
+    return _replaying || _pending.topic != nullptr || !_ring.empty();
+}
+
+/**
+ * Replays the buffered messages in order, the ones stored in the flash outbox before a restart first. They are
+ * enqueued to the client's outbox rather than sent one by one, so the client writes them back to back from its own
+ * task. Each message is moved out of the ring into the replay buffer under the ring mutex and enqueued once it's
+ * released. A message the outbox refuses is kept there for the next attempt.
+ */
+void IotMqtt::replay(void)
+{
+    {
+        std::lock_guard<std::mutex> lock(_ring_mutex);
+
+        // Only one task replays, the others buffer behind it.
+        if (!_connected || _replaying)
+            return;
+
+        _replaying = true;
     }
 
-    return ESP_OK;
+    _outbox.replay(_client);
+
+    iot_mqtt_record_t record;
+    size_t count = 0;
+
+    while (true) {
+        {
+            std::lock_guard<std::mutex> lock(_ring_mutex);
+
+            if (_pending.topic == nullptr && _ring.front(&record)) {
+                size_t topic_len = strlen(record.topic) + 1;
+
+                memcpy(_replay_buf, record.topic, topic_len);
+                memcpy(_replay_buf + topic_len, record.data, record.len);
+
+                _pending = {.topic = _replay_buf, .data = _replay_buf + topic_len, .len = record.len,
+                            .qos = record.qos};
+                _ring.pop();
+            }
+
+            if (!_connected || _pending.topic == nullptr) {
+                _replaying = false;
+                break;
+            }
+        }
+
+        int token = _outbox.reserve(_pending.topic, _pending.data, _pending.len, _pending.qos);
+        int msg_id = esp_mqtt_client_enqueue(_client, _pending.topic, _pending.data, _pending.len, _pending.qos, 0,
+                                             true);
+
+        _outbox.bind(token, msg_id);
+
+        std::lock_guard<std::mutex> lock(_ring_mutex);
+
+        if (msg_id < 0) {
+            _replaying = false;
+            break;
+        }
+
+        _pending = {};
+        count++;
+    }
+
+    if (count > 0) {
+        std::lock_guard<std::mutex> lock(_ring_mutex);
+
+        ESP_LOGI(TAG, "%s: Replayed buffered messages [count: %d, left: %d, dropped: %" PRIu32 "]", __func__, count,
+                 _ring.count(), _ring.dropped());
+    }
 }
 
 /**
@@ -152,13 +480,19 @@ void IotMqtt::on_event(void *args, esp_event_base_t base, int32_t id, void *data
 
     switch ((esp_mqtt_event_id_t)id) {
         case MQTT_EVENT_CONNECTED:
+            self->on_connected();
             self->_connected = true;
-            ESP_LOGI(TAG, "%s: Received event [id: MQTT_EVENT_CONNECTED].", __func__);
+            ESP_LOGI(TAG, "%s: Received event [id: MQTT_EVENT_CONNECTED, session_present: %d].", __func__,
+                     event->session_present);
+            if (!event->session_present)
+                self->resubscribe();
+            self->replay();
             esp_event_post(IOT_EVENT, IOT_APP_MQTT_CONNECTED_EVENT, nullptr, 0,portMAX_DELAY);
             break;
         case MQTT_EVENT_DISCONNECTED:
             self->_connected = false;
             ESP_LOGI(TAG, "%s: Received event [id: MQTT_EVENT_DISCONNECTED].", __func__);
+            self->on_disconnected();
             esp_event_post(IOT_EVENT, IOT_APP_MQTT_DISCONNECTED_EVENT, nullptr, 0,portMAX_DELAY);
             break;
         case MQTT_EVENT_SUBSCRIBED:
@@ -169,9 +503,14 @@ void IotMqtt::on_event(void *args, esp_event_base_t base, int32_t id, void *data
             break;
         case MQTT_EVENT_PUBLISHED:
             ESP_LOGI(TAG, "%s: Received event [id: MQTT_EVENT_PUBLISHED, msg_id: %d].", __func__, event->msg_id);
+            self->_outbox.ack(event->msg_id);
+            break;
+        case MQTT_EVENT_DELETED:
+            ESP_LOGW(TAG, "%s: Received event [id: MQTT_EVENT_DELETED, msg_id: %d].", __func__, event->msg_id);
+            self->_outbox.forget(event->msg_id);
             break;
         case MQTT_EVENT_DATA:
-            ESP_LOGI(TAG, "%s: Received event [id: MQTT_EVENT_DATA, topic: %s].", __func__, event->topic);
+            ESP_LOGD(TAG, "%s: Received event [id: MQTT_EVENT_DATA, msg_id: %d].", __func__, event->msg_id);
             self->on_data(event);
             break;
         case MQTT_EVENT_ERROR:
@@ -193,24 +532,156 @@ void IotMqtt::on_event(void *args, esp_event_base_t base, int32_t id, void *data
 }
 
 /**
- * Handles incoming message data and invoking the subscribers.
+ * Handles incoming message data and invoking the subscribers. A message larger than the client's buffer arrives in
+ * fragments, only the first one carrying the topic, which are reassembled into a pool buffer before dispatching.
  *
  * @param[in] evt The event data.
  */
 void IotMqtt::on_data(esp_mqtt_event_handle_t evt)
 {
-    ESP_LOGI(TAG, "%s: Received [data: %s, size: %d].", __func__, evt->data, evt->data_len);
+    if (evt->current_data_offset == 0 && evt->total_data_len <= evt->data_len) {
+        dispatch(evt->topic, evt->topic_len, evt->data, evt->data_len, nullptr);
+        return;
+    }
+
+    if (evt->current_data_offset == 0) {
+        // A new message starts, whatever was left of the previous one is incomplete.
+        _pool.release(_reassembly.buf);
+        _reassembly = {};
+
+        size_t size = evt->topic_len + evt->total_data_len;
 
-    std::string topic = evt->topic;
+        if (size > IOT_MQTT_MAX_BUFFER) {
+            ESP_LOGW(TAG, "%s: Dropped a message larger than the buffer [size: %d, max: %d]", __func__, size,
+                     IOT_MQTT_MAX_BUFFER);
+            return;
+        }
 
-    if (topic.empty())
+        char *buf = _pool.acquire();
+
+        if (buf == nullptr) {
+            ESP_LOGW(TAG, "%s: Dropped a message, no reassembly buffer is free", __func__);
+            return;
+        }
+
+        memcpy(buf, evt->topic, evt->topic_len);
+
+        _reassembly = {.buf = buf, .topic_len = static_cast<size_t>(evt->topic_len),
+                       .total = static_cast<size_t>(evt->total_data_len), .received = 0, .msg_id = evt->msg_id};
+    }
+
+    if (_reassembly.buf == nullptr)
         return;
 
-    auto it = _subscriptions.find(evt->topic);
+    if (evt->msg_id != _reassembly.msg_id || static_cast<size_t>(evt->current_data_offset) != _reassembly.received ||
+        _reassembly.received + evt->data_len > _reassembly.total) {
+        ESP_LOGW(TAG, "%s: Dropped a message, received an unexpected fragment [offset: %d]", __func__,
+                 evt->current_data_offset);
+        _pool.release(_reassembly.buf);
+        _reassembly = {};
+        return;
+    }
+
+    memcpy(_reassembly.buf + _reassembly.topic_len + _reassembly.received, evt->data, evt->data_len);
+    _reassembly.received += evt->data_len;
+
+    if (_reassembly.received < _reassembly.total)
+        return;
+
+    dispatch(_reassembly.buf, _reassembly.topic_len, _reassembly.buf + _reassembly.topic_len, _reassembly.total,
+             _reassembly.buf);
+
+    _pool.release(_reassembly.buf);
+    _reassembly = {};
+}
+
+/**
+ * Queues a complete message for the subscribers of every filter matching it, they are invoked on the dispatch workers
+ * so the client's task only matches and copies the message, once for all of them.
+ *
+ * @param[in] topic A pointer to the message's topic.
+ * @param[in] topic_len The length of the topic.
+ * @param[in] data A pointer to the message's data.
+ * @param[in] len The length of the data.
+ * @param[in] buf A pointer to the pool buffer holding the message if it was reassembled, otherwise nullptr.
+ */
+void IotMqtt::dispatch(const char *topic, size_t topic_len, const char *data, size_t len, char *buf)
+{
+    ESP_LOGI(TAG, "%s: Received [topic: %.*s, size: %d].", __func__, static_cast<int>(topic_len), topic, len);
+
+    if (topic == nullptr || topic_len == 0)
+        return;
+
+    iot_mqtt_subscriber_t matches[IOT_MQTT_MAX_MATCHES];
+    size_t count;
+
+    {
+        // The subscribers are copied out, so callbacks run without holding the lock.
+        std::lock_guard<std::mutex> lock(_subscribe_mutex);
+        count = _subscriptions.match(topic, topic_len, matches, IOT_MQTT_MAX_MATCHES);
+    }
 
-    if (it != _subscriptions.end()) {
-        it->second(evt->topic, evt->data, evt->data_len, nullptr);
+    if (count > IOT_MQTT_MAX_MATCHES) {
+        ESP_LOGW(TAG, "%s: Too many matching subscribers [count: %d, max: %d]", __func__, count, IOT_MQTT_MAX_MATCHES);
+        count = IOT_MQTT_MAX_MATCHES;
     }
+
+    _dispatcher.post(matches, count, topic, topic_len, data, len, buf);
+}
+
+/**
+ * Checks if the component was started, messages can be published from then on even while disconnected.
+ *
+ * @return true if started, false otherwise.
+ */
+bool IotMqtt::started() const
+{
+    return _initialized;
+}
+
+/**
+ * Gets the connection state and the metrics of the reconnect supervisor.
+ *
+ * @return The metrics.
+ */
+iot_mqtt_metrics_t IotMqtt::metrics() const
+{
+    std::lock_guard<std::mutex> lock(_state_mutex);
+
+    return _metrics;
+}
+
+/**
+ * Gets the metrics of the dispatch queue.
+ *
+ * @return The metrics.
+ */
+iot_mqtt_dispatch_metrics_t IotMqtt::dispatch_metrics() const
+{
+    return _dispatcher.metrics();
+}
+
+/**
+ * Gets the execution time of the callback of a subscription.
+ *
+ * @param[in] topic The topic filter of the subscription.
+ * @param[out] stats A pointer to store the execution time in.
+ * @return ESP_OK on success, ESP_ERR_NOT_FOUND if the topic filter isn't subscribed.
+ */
+esp_err_t IotMqtt::callback_stats(std::string topic, iot_mqtt_callback_stats_t *stats) const
+{
+    iot_mqtt_subscriber_t subscriber;
+
+    {
+        std::lock_guard<std::mutex> lock(_subscribe_mutex);
+
+        if (!_subscriptions.find(topic, &subscriber))
+            return ESP_ERR_NOT_FOUND;
+    }
+
+    *stats = _dispatcher.stats(subscriber.id);
+
+    return ESP_OK;
 }
 
 /**
@@ -224,16 +695,18 @@ bool IotMqtt::connected() const
 }
 
 /**
- * @brief Checks if a given topic is currently subscribed.
+ * @brief Checks if a given topic filter is currently subscribed.
  *
- * This function checks whether the specified MQTT topic is present in the
- * list of subscriptions. If there are no subscriptions, it returns `false`.
+ * This function checks whether the specified MQTT topic filter is present in the
+ * subscription trie. If there are no subscriptions, it returns `false`.
  *
- * @param topic The MQTT topic to check for subscription.
- * @return `true` if the topic is subscribed, `false` otherwise.
+ * @param topic The MQTT topic filter to check for subscription.
+ * @return `true` if the topic filter is subscribed, `false` otherwise.
  */
 bool IotMqtt::subscribed(std::string topic) const
 {
+    std::lock_guard<std::mutex> lock(_subscribe_mutex);
+
     if (_subscriptions.empty())
         return false;
 
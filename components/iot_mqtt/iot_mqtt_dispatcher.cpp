@@ -0,0 +1,307 @@
+#include "iot_mqtt_dispatcher.h"
+
+/**
+ * Starts the worker tasks, if they weren't started yet.
+ *
+ * @param[in] workers The number of worker tasks, at most IOT_MQTT_DISPATCH_WORKERS.
+ * @param[in] large A pointer to the pool of reassembly buffers, copies of messages too large for a dispatch buffer are
+ *                  taken from it.
+ * @return ESP_OK on success, otherwise an error code.
+ */
+esp_err_t IotMqttDispatcher::start(size_t workers, IotMqttPool *large)
+{
+    if (_workers > 0)
+        return ESP_OK;
+
+    if (_pool.init(IOT_MQTT_DISPATCH_BUFFERS, IOT_MQTT_DISPATCH_BUFFER_SIZE) != ESP_OK)
+        return ESP_ERR_NO_MEM;
+
+    _large = large;
+
+    workers = std::clamp<size_t>(workers, 1, IOT_MQTT_DISPATCH_WORKERS);
+
+    for (size_t i = 0; i < workers; i++) {
+        if (xTaskCreate(task, "iot_mqtt_dispatch", STACK_SIZE, this, 3, &_tasks[i]) != pdPASS) {
+            ESP_LOGE(TAG, "%s: Failed to create a dispatch worker [index: %d]", __func__, i);
+            break;
+        }
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        _workers++;
+    }
+
+    return _workers > 0 ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+/**
+ * Queues a message for its subscribers. It runs on the mqtt client's task, so it never blocks, a message that finds
+ * the queue full makes room by evicting a lower priority one or is handled by the subscription's overflow policy.
+ * The message is copied once into a pooled buffer, unless it was reassembled in one, and every subscriber holds a
+ * reference to it.
+ *
+ * @param[in] subscribers A pointer to the subscribers to deliver the message to.
+ * @param[in] count The number of subscribers.
+ * @param[in] topic A pointer to the message's topic.
+ * @param[in] topic_len The length of the topic.
+ * @param[in] data A pointer to the message's data.
+ * @param[in] len The length of the data.
+ * @param[in] buf A pointer to the reassembly buffer holding the topic followed by the data, nullptr to copy the message.
+ */
+void IotMqttDispatcher::post(const iot_mqtt_subscriber_t *subscribers, size_t count, const char *topic,
+                             size_t topic_len, const char *data, size_t len, char *buf)
+{
+    if (count == 0)
+        return;
+
+    uint8_t priority = IOT_MQTT_PRIORITY_LOW;
+    bool oldest = false;
+
+    for (size_t i = 0; i < count; i++)
+        priority = std::max<uint8_t>(priority, subscribers[i].priority);
+
+    for (size_t i = 0; i < count; i++)
+        oldest |= subscribers[i].priority == priority && subscribers[i].overflow == IOT_MQTT_OVERFLOW_DROP_OLDEST;
+
+    IotMqttPool *pool = buf != nullptr || topic_len + len > _pool.size() ? _large : &_pool;
+
+    if (buf != nullptr) {
+        pool->retain(buf);
+    } else if (topic_len + len <= pool->size() && (buf = acquire(pool, priority, oldest)) != nullptr) {
+        memcpy(buf, topic, topic_len);
+        memcpy(buf + topic_len, data, len);
+    } else {
+        ESP_LOGW(TAG, "%s: Dropped a message, no buffer is free [topic: %.*s, size: %d]", __func__,
+                 static_cast<int>(topic_len), topic, topic_len + len);
+        std::lock_guard<std::mutex> lock(_mutex);
+        _metrics.dropped += count;
+        return;
+    }
+
+    size_t queued = 0;
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        int64_t now = esp_timer_get_time();
+
+        for (size_t i = 0; i < count; i++) {
+            const iot_mqtt_subscriber_t &subscriber = subscribers[i];
+
+            bool room = _depth < IOT_MQTT_DISPATCH_QUEUE_SIZE;
+
+            for (uint8_t lower = IOT_MQTT_PRIORITY_LOW; !room && lower < subscriber.priority; lower++)
+                room = evict(lower);
+
+            if (!room && subscriber.overflow == IOT_MQTT_OVERFLOW_DROP_OLDEST)
+                room = evict(subscriber.priority);
+
+            if (!room) {
+                _metrics.dropped++;
+                ESP_LOGW(TAG, "%s: Dropped a message, the dispatch queue is full [topic: %.*s, priority: %d]",
+                         __func__, static_cast<int>(topic_len), topic, subscriber.priority);
+                continue;
+            }
+
+            pool->retain(buf);
+            _queues[subscriber.priority].push_back({.subscriber = subscriber, .buf = buf, .pool = pool,
+                                                    .topic_len = topic_len, .len = len, .queued_at = now});
+            _depth++;
+            _metrics.max_depth = std::max<uint32_t>(_metrics.max_depth, _depth);
+            queued++;
+        }
+    }
+
+    // The subscribers hold their own references by now.
+    pool->release(buf);
+
+    if (queued == 1)
+        _cond.notify_one();
+    else if (queued > 1)
+        _cond.notify_all();
+}
+
+/**
+ * Gets the metrics of the dispatch queue.
+ *
+ * @return The metrics.
+ */
+iot_mqtt_dispatch_metrics_t IotMqttDispatcher::metrics(void) const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    iot_mqtt_dispatch_metrics_t metrics = _metrics;
+
+    for (uint8_t priority = 0; priority < IOT_MQTT_PRIORITY_MAX; priority++)
+        metrics.depth[priority] = _queues[priority].size();
+
+    return metrics;
+}
+
+/**
+ * Gets the execution time of a subscription's callback.
+ *
+ * @param[in] id The id of the subscription.
+ * @return The execution time, empty for an unknown subscription.
+ */
+iot_mqtt_callback_stats_t IotMqttDispatcher::stats(uint8_t id) const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    return id < IOT_MQTT_MAX_SUBSCRIPTIONS ? _stats[id] : iot_mqtt_callback_stats_t{};
+}
+
+/**
+ * Acquires a buffer for a message. While the pool is exhausted the waiting messages of a lower priority holding one of
+ * its buffers are evicted, so bulk traffic can't hold every buffer and starve the commands, then those of the same
+ * priority if the message may replace them. Messages in the other pool are left alone, evicting them frees nothing.
+ *
+ * @param[in] pool A pointer to the pool to acquire the buffer from.
+ * @param[in] priority The highest priority of the message's subscribers.
+ * @param[in] oldest Indicates that a subscriber of that priority drops the oldest message when the queue is full.
+ * @return A pointer to the buffer, or nullptr if none could be freed.
+ */
+char *IotMqttDispatcher::acquire(IotMqttPool *pool, uint8_t priority, bool oldest)
+{
+    char *buf = pool->acquire();
+
+    if (buf != nullptr)
+        return buf;
+
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    // A buffer is only free once every subscriber of its message let go of it.
+    for (uint8_t lower = IOT_MQTT_PRIORITY_LOW; buf == nullptr && (lower < priority || (oldest && lower == priority));
+         lower++) {
+        while (buf == nullptr && evict(lower, pool))
+            buf = pool->acquire();
+    }
+
+    return buf;
+}
+
+/**
+ * A dispatch worker, it delivers the waiting messages one by one, highest priority first.
+ *
+ * @param[in] arg A pointer to the dispatcher instance.
+ */
+void IotMqttDispatcher::task(void *arg)
+{
+    auto *self = static_cast<IotMqttDispatcher *>(arg);
+    iot_mqtt_dispatch_item_t item;
+
+    while (true) {
+        self->take(&item);
+        self->deliver(item);
+    }
+}
+
+/**
+ * Waits for a message that can be delivered, the oldest of the highest priority whose subscription isn't being
+ * delivered to already. Low priority messages are left waiting while they'd take the last idle worker.
+ *
+ * @param[out] item A pointer to store the message in.
+ */
+void IotMqttDispatcher::take(iot_mqtt_dispatch_item_t *item)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    while (true) {
+        for (int priority = IOT_MQTT_PRIORITY_MAX - 1; priority >= IOT_MQTT_PRIORITY_LOW; priority--) {
+            // The worker taking it is idle itself, another one must stay idle.
+            if (priority == IOT_MQTT_PRIORITY_LOW && _workers > 1 && _workers - _active < 2)
+                continue;
+
+            std::deque<iot_mqtt_dispatch_item_t> &queue = _queues[priority];
+
+            auto it = std::find_if(queue.begin(), queue.end(), [this](const iot_mqtt_dispatch_item_t &queued) {
+                return (_busy & (1UL << queued.subscriber.id)) == 0;
+            });
+
+            if (it == queue.end())
+                continue;
+
+            *item = *it;
+            queue.erase(it);
+            _depth--;
+            _busy |= 1UL << item->subscriber.id;
+            _active++;
+
+            auto wait_us = static_cast<uint32_t>(esp_timer_get_time() - item->queued_at);
+
+            _metrics.max_wait_us = std::max(_metrics.max_wait_us, wait_us);
+
+            return;
+        }
+
+        _cond.wait(lock);
+    }
+}
+
+/**
+ * Delivers a message to its subscriber and records how long the callback ran.
+ *
+ * @param[in] item The message, its reference to the copy is released.
+ */
+void IotMqttDispatcher::deliver(iot_mqtt_dispatch_item_t &item)
+{
+    const iot_mqtt_subscriber_t &subscriber = item.subscriber;
+    int64_t start = esp_timer_get_time();
+
+    subscriber.cb(item.buf, item.topic_len, item.buf + item.topic_len, item.len, subscriber.priv_data);
+
+    auto elapsed_us = static_cast<uint32_t>(esp_timer_get_time() - start);
+
+    if (elapsed_us > IOT_MQTT_DISPATCH_SLOW_US)
+        ESP_LOGW(TAG, "%s: A slow callback held a worker [topic: %.*s, elapsed_us: %" PRIu32 "]", __func__,
+                 static_cast<int>(item.topic_len), item.buf, elapsed_us);
+
+    item.pool->release(item.buf);
+
+    bool pending;
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        iot_mqtt_callback_stats_t &stats = _stats[subscriber.id];
+
+        stats.calls++;
+        stats.total_us += elapsed_us;
+        stats.max_us = std::max(stats.max_us, elapsed_us);
+
+        _busy &= ~(1UL << subscriber.id);
+        _active--;
+
+        _metrics.delivered++;
+        pending = _depth > 0;
+    }
+
+    // The subscription or the worker just freed up may be what another worker is waiting on.
+    if (pending)
+        _cond.notify_all();
+}
+
+/**
+ * Drops the oldest waiting message of a priority to make room. The mutex must be held.
+ *
+ * @param[in] priority The priority to drop a message of.
+ * @param[in] pool A pointer to the pool the message's buffer must come from, nullptr for any message.
+ * @return true if a message was dropped, otherwise false.
+ */
+bool IotMqttDispatcher::evict(uint8_t priority, const IotMqttPool *pool)
+{
+    std::deque<iot_mqtt_dispatch_item_t> &queue = _queues[priority];
+
+    auto it = std::find_if(queue.begin(), queue.end(), [pool](const iot_mqtt_dispatch_item_t &queued) {
+        return pool == nullptr || queued.pool == pool;
+    });
+
+    if (it == queue.end())
+        return false;
+
+    it->pool->release(it->buf);
+    queue.erase(it);
+    _depth--;
+    _metrics.evicted++;
+
+    return true;
+}
@@ -0,0 +1,718 @@
+#include "esp_rom_crc.h"
+#include "iot_mqtt_outbox.h"
+
+/**
+ * Opens the outbox partition, recovers the unacknowledged messages stored in it and starts the task writing batches.
+ *
+ * @param[in] label The label of the outbox partition.
+ * @return ESP_OK on success, ESP_ERR_NOT_FOUND if there is no such partition, otherwise an error code.
+ */
+esp_err_t IotMqttOutbox::init(const char *label)
+{
+    if (_task != nullptr)
+        return ESP_OK;
+
+    _partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, label);
+
+    if (_partition == nullptr)
+        return ESP_ERR_NOT_FOUND;
+
+    if (_partition->size < 2 * SECTOR_SIZE || _partition->encrypted) {
+        ESP_LOGE(TAG, "%s: The outbox partition must be unencrypted and at least two sectors [size: %" PRIu32 "]",
+                 __func__, _partition->size);
+        _partition = nullptr;
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    _batch = iot_allocate_mem<uint8_t>(IOT_MQTT_OUTBOX_BATCH_SIZE);
+    _writing = iot_allocate_mem<uint8_t>(IOT_MQTT_OUTBOX_BATCH_SIZE);
+    _live.assign(_partition->size / SECTOR_SIZE, 0);
+
+    esp_err_t ret = _batch == nullptr || _writing == nullptr ? ESP_ERR_NO_MEM : recover();
+
+    if (ret == ESP_OK && xTaskCreate(task, "iot_outbox", STACK_SIZE, this, 2, &_task) != pdPASS)
+        ret = ESP_ERR_NO_MEM;
+
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "%s: Failed to initialise the outbox [reason: %s]", __func__, esp_err_to_name(ret));
+        // Either buffer may be missing, free is null safe.
+        free(_batch);
+        free(_writing);
+        _batch = nullptr;
+        _writing = nullptr;
+        _partition = nullptr;
+        _entries.clear();
+        return ret;
+    }
+
+    ESP_LOGI(TAG, "%s: Recovered unacknowledged messages [count: %d, sector: %d, offset: %" PRIu32 "]", __func__,
+             _entries.size(), _head, _head_offset);
+
+    return ESP_OK;
+}
+
+/**
+ * Records a message before it's handed to the client, so an acknowledgement arriving before the client returned the
+ * message's id finds the record. Messages below QoS 1 aren't recorded.
+ *
+ * @param[in] topic The topic of the message.
+ * @param[in] data A pointer to the data of the message.
+ * @param[in] len The length of the data.
+ * @param[in] qos The quality of service for the message.
+ * @return The token the record is reserved with until it's bound to the message id, 0 if it isn't recorded.
+ */
+int IotMqttOutbox::reserve(std::string_view topic, const char *data, size_t len, uint8_t qos)
+{
+    if (_partition == nullptr || qos == 0)
+        return 0;
+
+    size_t size = record_size(topic.size(), len);
+    size_t before;
+    int reserved;
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        if (size > SECTOR_SIZE - sizeof(sector_t) || _entries.size() >= IOT_MQTT_OUTBOX_MAX_ENTRIES ||
+            _batch_len + size > IOT_MQTT_OUTBOX_BATCH_SIZE) {
+            _dropped++;
+            ESP_LOGW(TAG, "%s: Failed to record a message [topic: %.*s, size: %d, count: %d]", __func__,
+                     static_cast<int>(topic.size()), topic.data(), size, _entries.size());
+            return 0;
+        }
+
+        auto *header = reinterpret_cast<header_t *>(_batch + _batch_len);
+        char *body = reinterpret_cast<char *>(header + 1);
+
+        *header = {.state = LIVE, .topic_len = static_cast<uint16_t>(topic.size()), .len = static_cast<uint16_t>(len),
+                   .qos = qos, .reserved = {}, .crc = 0};
+        memcpy(body, topic.data(), topic.size());
+        memcpy(body + topic.size(), data, len);
+        memset(body + topic.size() + len, 0, size - sizeof(header_t) - topic.size() - len);
+        header->crc = crc(header);
+
+        reserved = token();
+
+        _entries.push_back({.msg_id = reserved, .offset = static_cast<uint32_t>(_batch_len),
+                            .state = IOT_MQTT_OUTBOX_BATCHED, .acked = false});
+
+        before = _batch_len;
+        _batch_len += size;
+    }
+
+    // The first record wakes the task to start a batch, crossing half the batch cuts the batching window short.
+    if (before == 0 || (before < IOT_MQTT_OUTBOX_BATCH_SIZE / 2 && before + size >= IOT_MQTT_OUTBOX_BATCH_SIZE / 2))
+        xTaskNotifyGive(_task);
+
+    return reserved;
+}
+
+/**
+ * Binds a reserved record to the id the client gave its message. The record of a message the client refused is
+ * dropped, the caller buffers the message elsewhere.
+ *
+ * @param[in] token The token the record is reserved with, 0 is ignored.
+ * @param[in] msg_id The id of the message, negative if the client refused it.
+ */
+void IotMqttOutbox::bind(int token, int msg_id)
+{
+    if (_partition == nullptr || token >= 0)
+        return;
+
+    bool notify = false;
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        auto it = find(token);
+
+        if (it != _entries.end())
+            notify = msg_id > 0 ? assign(it, msg_id) : clear(it);
+
+        expire();
+    }
+
+    if (notify)
+        xTaskNotifyGive(_task);
+}
+
+/**
+ * Clears the record of an acknowledged message. A record still waiting in the batch is never written. The client may
+ * acknowledge a message before its id is bound to the record, such an acknowledgement is kept until it is.
+ *
+ * @param[in] msg_id The id of the acknowledged message.
+ */
+void IotMqttOutbox::ack(int msg_id)
+{
+    if (_partition == nullptr || msg_id <= 0)
+        return;
+
+    bool notify = false;
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        auto it = find(msg_id);
+
+        if (it != _entries.end()) {
+            notify = clear(it);
+        } else if (std::any_of(_entries.begin(), _entries.end(),
+                               [](const iot_mqtt_outbox_entry_t &entry) { return entry.msg_id < 0; })) {
+            _early[_early_next] = msg_id;
+            _early_next = (_early_next + 1) % _early.size();
+        }
+    }
+
+    if (notify)
+        xTaskNotifyGive(_task);
+}
+
+/**
+ * Forgets the id of a message the client gave up on, its record is kept and republished at the next replay.
+ *
+ * @param[in] msg_id The id of the message.
+ */
+void IotMqttOutbox::forget(int msg_id)
+{
+    if (_partition == nullptr || msg_id <= 0)
+        return;
+
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    for (iot_mqtt_outbox_entry_t &entry : _entries) {
+        if (entry.msg_id != msg_id)
+            continue;
+
+        entry.msg_id = 0;
+
+        if (entry.state == IOT_MQTT_OUTBOX_STORED)
+            _unreplayed++;
+
+        return;
+    }
+}
+
+/**
+ * Republishes the stored messages which have no message id, i.e. the ones recovered after a restart or given up on
+ * by the client. They are enqueued to the client's outbox, a message the outbox refuses waits for the next replay.
+ * The mutex isn't held while enqueueing, the client holds its own lock while running the event handler, which
+ * acknowledges messages. Instead the entry is claimed with a token, so it isn't replayed twice meanwhile.
+ *
+ * @param[in] client The mqtt client handle.
+ * @return The number of messages republished.
+ */
+size_t IotMqttOutbox::replay(esp_mqtt_client_handle_t client)
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        if (_unreplayed == 0)
+            return 0;
+    }
+
+    auto *buf = iot_allocate_mem<uint8_t>(SECTOR_SIZE);
+
+    if (buf == nullptr)
+        return 0;
+
+    auto *header = reinterpret_cast<header_t *>(buf);
+    size_t count = 0;
+    bool notify = false;
+
+    while (true) {
+        uint32_t offset;
+        int claim;
+
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+
+            expire();
+
+            auto it = std::find_if(_entries.begin(), _entries.end(), [](const iot_mqtt_outbox_entry_t &entry) {
+                return entry.msg_id == 0 && entry.state == IOT_MQTT_OUTBOX_STORED;
+            });
+
+            if (it == _entries.end())
+                break;
+
+            claim = token();
+            it->msg_id = claim;
+            offset = it->offset;
+            _unreplayed--;
+        }
+
+        // The sector may be erased meanwhile, which the crc catches.
+        uint32_t max = SECTOR_SIZE - offset % SECTOR_SIZE;
+        bool valid = esp_partition_read(_partition, offset, header, sizeof(header_t)) == ESP_OK &&
+                     header->state == LIVE && record_size(header->topic_len, header->len) <= max &&
+                     esp_partition_read(_partition, offset + sizeof(header_t), header + 1,
+                                        header->topic_len + header->len) == ESP_OK && header->crc == crc(header);
+        int msg_id = 0;
+
+        if (valid) {
+            const char *body = reinterpret_cast<const char *>(header + 1);
+            std::string topic(body, header->topic_len);
+
+            msg_id = esp_mqtt_client_enqueue(client, topic.c_str(), body + header->topic_len, header->len,
+                                             header->qos, 0, true);
+        }
+
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        auto it = find(claim);
+
+        if (!valid) {
+            ESP_LOGW(TAG, "%s: Dropped a corrupt record [offset: %" PRIu32 "]", __func__, offset);
+            _dropped++;
+
+            if (it != _entries.end())
+                _entries.erase(it);
+
+            continue;
+        }
+
+        if (msg_id <= 0) {
+            if (it != _entries.end() && it->state == IOT_MQTT_OUTBOX_STORED) {
+                it->msg_id = 0;
+                _unreplayed++;
+            }
+
+            break;
+        }
+
+        if (it != _entries.end() && assign(it, msg_id))
+            notify = true;
+
+        count++;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        expire();
+    }
+
+    iot_free(buf);
+
+    if (notify)
+        xTaskNotifyGive(_task);
+
+    if (count > 0)
+        ESP_LOGI(TAG, "%s: Republished stored messages [count: %d]", __func__, count);
+
+    return count;
+}
+
+/**
+ * Gets the number of messages that couldn't be persisted or were overwritten before being acknowledged.
+ *
+ * @return The number of messages.
+ */
+uint32_t IotMqttOutbox::dropped(void)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    return _dropped;
+}
+
+/**
+ * The outbox task, once a record is added it waits out the batching window and writes the batch.
+ *
+ * @param[in] arg A pointer to the outbox instance.
+ */
+void IotMqttOutbox::task(void *arg)
+{
+    auto *self = static_cast<IotMqttOutbox *>(arg);
+
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(IOT_MQTT_OUTBOX_FLUSH_MS));
+        self->flush();
+    }
+}
+
+/**
+ * Recovers the log from the partition, the live records become entries waiting to be republished and the head is
+ * placed after the last record of the newest sector.
+ *
+ * @return ESP_OK on success, otherwise an error code.
+ */
+esp_err_t IotMqttOutbox::recover(void)
+{
+    std::vector<std::pair<uint32_t, uint16_t>> sectors;
+
+    for (uint16_t sector = 0; sector < _live.size(); sector++) {
+        sector_t header;
+
+        if (esp_partition_read(_partition, sector * SECTOR_SIZE, &header, sizeof(header)) != ESP_OK)
+            return ESP_FAIL;
+
+        if (header.magic == MAGIC)
+            sectors.push_back({header.seq, sector});
+    }
+
+    if (sectors.empty())
+        return ESP_OK;
+
+    std::sort(sectors.begin(), sectors.end());
+
+    auto *buf = iot_allocate_mem<uint8_t>(SECTOR_SIZE);
+
+    if (buf == nullptr)
+        return ESP_ERR_NO_MEM;
+
+    esp_err_t ret = ESP_OK;
+
+    for (size_t i = 0; i < sectors.size() && ret == ESP_OK; i++) {
+        ret = esp_partition_read(_partition, sectors[i].second * SECTOR_SIZE, buf, SECTOR_SIZE);
+
+        if (ret == ESP_OK)
+            scan(sectors[i].second, buf, i == sectors.size() - 1);
+    }
+
+    iot_free(buf);
+
+    _seq = sectors.back().first;
+    _has_head = true;
+
+    return ret;
+}
+
+/**
+ * Scans the records of a sector read from the log, adding an entry for each live record.
+ *
+ * @param[in] sector The index of the sector.
+ * @param[in] buf A pointer to the sector's content.
+ * @param[in] head Indicates whether the sector is the newest one, new records are appended after its last record.
+ */
+void IotMqttOutbox::scan(uint16_t sector, const uint8_t *buf, bool head)
+{
+    uint32_t offset = sizeof(sector_t);
+
+    while (offset + sizeof(header_t) <= SECTOR_SIZE) {
+        auto *header = reinterpret_cast<const header_t *>(buf + offset);
+
+        if (header->state == UINT32_MAX)
+            break;
+
+        size_t size = record_size(header->topic_len, header->len);
+
+        // A torn write, nothing after it can be trusted and the sector is treated as full.
+        if (offset + size > SECTOR_SIZE || header->crc != crc(header)) {
+            ESP_LOGW(TAG, "%s: Found a torn record [sector: %d, offset: %" PRIu32 "]", __func__, sector, offset);
+            offset = SECTOR_SIZE;
+            break;
+        }
+
+        if (header->state == LIVE) {
+            _live[sector]++;
+
+            if (_entries.size() < IOT_MQTT_OUTBOX_MAX_ENTRIES) {
+                _entries.push_back({.msg_id = 0, .offset = sector * SECTOR_SIZE + offset,
+                                    .state = IOT_MQTT_OUTBOX_STORED, .acked = false});
+                _unreplayed++;
+            }
+        }
+
+        offset += size;
+    }
+
+    if (head) {
+        _head = sector;
+        _head_offset = offset;
+    }
+}
+
+/**
+ * Writes the batch to the log. The records of acknowledged messages are cleared first, before the sector they're in
+ * may be erased, then the batch is written outside the lock, so publishing isn't held up by the flash.
+ */
+void IotMqttOutbox::flush(void)
+{
+    std::vector<uint32_t> cleared;
+    size_t len;
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        std::erase_if(_entries, [&cleared](const iot_mqtt_outbox_entry_t &entry) {
+            if (entry.state != IOT_MQTT_OUTBOX_STORED || !entry.acked)
+                return false;
+
+            cleared.push_back(entry.offset);
+            return true;
+        });
+
+        memcpy(_writing, _batch, _batch_len);
+        len = _batch_len;
+        _batch_len = 0;
+
+        for (iot_mqtt_outbox_entry_t &entry : _entries) {
+            if (entry.state == IOT_MQTT_OUTBOX_BATCHED)
+                entry.state = IOT_MQTT_OUTBOX_WRITING;
+        }
+    }
+
+    for (uint32_t offset : cleared) {
+        if (esp_partition_write(_partition, offset, &ACKED, sizeof(ACKED)) != ESP_OK)
+            ESP_LOGW(TAG, "%s: Failed to clear a record [offset: %" PRIu32 "]", __func__, offset);
+
+        _live[offset / SECTOR_SIZE]--;
+    }
+
+    std::vector<std::pair<uint32_t, uint32_t>> placed;
+    std::vector<uint16_t> erased;
+
+    esp_err_t ret = write(_writing, len, &placed, &erased);
+
+    if (ret != ESP_OK)
+        ESP_LOGE(TAG, "%s: Failed to write the batch [reason: %s]", __func__, esp_err_to_name(ret));
+
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    std::erase_if(_entries, [this, &placed, &erased](iot_mqtt_outbox_entry_t &entry) {
+        if (entry.state == IOT_MQTT_OUTBOX_STORED) {
+            if (std::find(erased.begin(), erased.end(), entry.offset / SECTOR_SIZE) == erased.end())
+                return false;
+
+            _dropped++;
+
+            if (entry.msg_id == 0)
+                _unreplayed--;
+
+            return true;
+        }
+
+        if (entry.state != IOT_MQTT_OUTBOX_WRITING)
+            return false;
+
+        auto it = std::find_if(placed.begin(), placed.end(),
+                               [&entry](const std::pair<uint32_t, uint32_t> &p) { return p.first == entry.offset; });
+
+        if (it == placed.end()) {
+            _dropped++;
+            return true;
+        }
+
+        entry.offset = it->second;
+        entry.state = IOT_MQTT_OUTBOX_STORED;
+
+        if (entry.msg_id == 0)
+            _unreplayed++;
+
+        return false;
+    });
+}
+
+/**
+ * Appends the live records of a batch to the log, the records going to the same sector in a single write.
+ *
+ * @param[in] buf A pointer to the batch.
+ * @param[in] len The length of the batch.
+ * @param[out] placed The batch offset and the flash offset of each record written.
+ * @param[out] erased The sectors erased to make room.
+ * @return ESP_OK on success, otherwise an error code.
+ */
+esp_err_t IotMqttOutbox::write(const uint8_t *buf, size_t len, std::vector<std::pair<uint32_t, uint32_t>> *placed,
+                               std::vector<uint16_t> *erased)
+{
+    size_t run_start = 0;
+    size_t run_len = 0;
+    size_t run_placed = placed->size();
+    uint32_t run_offset = 0;
+
+    auto write_run = [&]() {
+        if (run_len == 0)
+            return ESP_OK;
+
+        esp_err_t ret = esp_partition_write(_partition, run_offset, buf + run_start, run_len);
+
+        if (ret != ESP_OK) {
+            // Whatever was written is torn, the next records go to a fresh sector.
+            _live[_head] -= placed->size() - run_placed;
+            _head_offset = SECTOR_SIZE;
+            placed->resize(run_placed);
+        }
+
+        run_len = 0;
+        run_placed = placed->size();
+
+        return ret;
+    };
+
+    for (size_t pos = 0; pos < len;) {
+        auto *header = reinterpret_cast<const header_t *>(buf + pos);
+        size_t size = record_size(header->topic_len, header->len);
+
+        if (header->state != LIVE) {
+            if (write_run() != ESP_OK)
+                return ESP_FAIL;
+
+            pos += size;
+            continue;
+        }
+
+        if (_head_offset + size > SECTOR_SIZE) {
+            if (write_run() != ESP_OK)
+                return ESP_FAIL;
+
+            esp_err_t ret = advance(erased);
+
+            if (ret != ESP_OK)
+                return ret;
+        }
+
+        if (run_len == 0) {
+            run_start = pos;
+            run_offset = _head * SECTOR_SIZE + _head_offset;
+        }
+
+        placed->push_back({static_cast<uint32_t>(pos), _head * SECTOR_SIZE + _head_offset});
+        _live[_head]++;
+        _head_offset += size;
+        run_len += size;
+        pos += size;
+    }
+
+    return write_run();
+}
+
+/**
+ * Moves the head to the next sector of the circle, erasing it. Its remaining live records are dropped.
+ *
+ * @param[out] erased The sectors erased, the sector is added to it.
+ * @return ESP_OK on success, otherwise an error code.
+ */
+esp_err_t IotMqttOutbox::advance(std::vector<uint16_t> *erased)
+{
+    uint16_t next = _has_head ? (_head + 1) % _live.size() : 0;
+
+    if (_live[next] > 0)
+        ESP_LOGW(TAG, "%s: The outbox is full, dropping unacknowledged messages [sector: %d, count: %d]", __func__,
+                 next, _live[next]);
+
+    erased->push_back(next);
+    _live[next] = 0;
+
+    esp_err_t ret = esp_partition_erase_range(_partition, next * SECTOR_SIZE, SECTOR_SIZE);
+
+    if (ret != ESP_OK)
+        return ret;
+
+    sector_t header = {.magic = MAGIC, .seq = _seq + 1};
+
+    ret = esp_partition_write(_partition, next * SECTOR_SIZE, &header, sizeof(header));
+
+    if (ret != ESP_OK)
+        return ret;
+
+    _head = next;
+    _head_offset = sizeof(sector_t);
+    _seq++;
+    _has_head = true;
+
+    return ESP_OK;
+}
+
+/**
+ * Computes the crc of a record, covering the header after the state, the topic and the data.
+ *
+ * @param[in] header A pointer to the record's header, followed by its topic and data.
+ * @return The crc.
+ */
+uint32_t IotMqttOutbox::crc(const header_t *header)
+{
+    auto *bytes = reinterpret_cast<const uint8_t *>(header);
+    uint32_t value = esp_rom_crc32_le(0, bytes + sizeof(header->state), offsetof(header_t, crc) - sizeof(header->state));
+
+    return esp_rom_crc32_le(value, bytes + sizeof(header_t), header->topic_len + header->len);
+}
+
+/**
+ * Gets the size of a record, aligned to a word so records can be written back to back.
+ *
+ * @param[in] topic_len The length of the topic.
+ * @param[in] len The length of the data.
+ * @return The size of the record.
+ */
+size_t IotMqttOutbox::record_size(size_t topic_len, size_t len)
+{
+    return (sizeof(header_t) + topic_len + len + 3) & ~static_cast<size_t>(3);
+}
+
+/**
+ * Finds the entry of a message. The mutex must be held.
+ *
+ * @param[in] msg_id The id of the message, or the token it's claimed with.
+ * @return An iterator to the entry, or the end of the entries if there is none.
+ */
+std::vector<iot_mqtt_outbox_entry_t>::iterator IotMqttOutbox::find(int msg_id)
+{
+    return std::find_if(_entries.begin(), _entries.end(),
+                        [msg_id](const iot_mqtt_outbox_entry_t &entry) { return entry.msg_id == msg_id; });
+}
+
+/**
+ * Gives a claimed entry the id of its message, applying an acknowledgement which arrived before. The mutex must be
+ * held.
+ *
+ * @param[in] it An iterator to the entry.
+ * @param[in] msg_id The id of the message.
+ * @return true if the task must be woken to clear the record in flash, otherwise false.
+ */
+bool IotMqttOutbox::assign(std::vector<iot_mqtt_outbox_entry_t>::iterator it, int msg_id)
+{
+    it->msg_id = msg_id;
+
+    auto early = std::find(_early.begin(), _early.end(), msg_id);
+
+    if (early == _early.end())
+        return false;
+
+    *early = 0;
+
+    return clear(it);
+}
+
+/**
+ * Clears the record of an entry, a record still waiting in the batch is never written. The mutex must be held.
+ *
+ * @param[in] it An iterator to the entry, it's erased unless the record is in flash.
+ * @return true if the task must be woken to clear the record in flash, otherwise false.
+ */
+bool IotMqttOutbox::clear(std::vector<iot_mqtt_outbox_entry_t>::iterator it)
+{
+    if (it->state == IOT_MQTT_OUTBOX_BATCHED) {
+        reinterpret_cast<header_t *>(_batch + it->offset)->state = ACKED;
+        _entries.erase(it);
+        return false;
+    }
+
+    it->acked = true;
+
+    // A pending batch is written soon anyway and clears the record along the way.
+    return _batch_len == 0;
+}
+
+/**
+ * Forgets the early acknowledgements once no entry is claimed, as the client reuses message ids. The mutex must be
+ * held.
+ */
+void IotMqttOutbox::expire(void)
+{
+    if (std::none_of(_entries.begin(), _entries.end(),
+                     [](const iot_mqtt_outbox_entry_t &entry) { return entry.msg_id < 0; }))
+        _early.fill(0);
+}
+
+/**
+ * Gets a new token claiming an entry while its message is being handed to the client. Tokens are negative, so they
+ * never collide with a message id. The mutex must be held.
+ *
+ * @return The token.
+ */
+int IotMqttOutbox::token(void)
+{
+    _token = _token == INT32_MIN ? -1 : _token - 1;
+
+    return _token;
+}
@@ -0,0 +1,103 @@
+#include "iot_mqtt_pool.h"
+
+/**
+ * Allocates the buffers of the pool, if they weren't allocated yet.
+ *
+ * @param[in] count The number of buffers.
+ * @param[in] size The size of a buffer.
+ * @return ESP_OK on success, ESP_ERR_NO_MEM if the buffers couldn't be allocated.
+ */
+esp_err_t IotMqttPool::init(size_t count, size_t size)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    if (_bufs != nullptr)
+        return ESP_OK;
+
+    _bufs = iot_allocate_mem<char>(count * size);
+
+    if (_bufs == nullptr) {
+        ESP_LOGE(TAG, "%s: Failed to allocate the pool [count: %d, size: %d]", __func__, count, size);
+        return ESP_ERR_NO_MEM;
+    }
+
+    _size = size;
+    _refs.assign(count, 0);
+
+    return ESP_OK;
+}
+
+/**
+ * Acquires a free buffer, holding its first reference.
+ *
+ * @return A pointer to the buffer, or nullptr if every buffer is in use.
+ */
+char *IotMqttPool::acquire(void)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    for (size_t i = 0; i < _refs.size(); i++) {
+        if (_refs[i] > 0)
+            continue;
+
+        _refs[i] = 1;
+
+        return _bufs + i * _size;
+    }
+
+    return nullptr;
+}
+
+/**
+ * Adds a reference to an acquired buffer.
+ *
+ * @param[in] buf A pointer to the buffer, nullptr or a buffer of another pool is ignored.
+ */
+void IotMqttPool::retain(char *buf)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    int i = index(buf);
+
+    if (i >= 0)
+        _refs[i]++;
+}
+
+/**
+ * Drops a reference to a buffer, it's back in the pool once the last one is dropped.
+ *
+ * @param[in] buf A pointer to the buffer, nullptr or a buffer of another pool is ignored.
+ */
+void IotMqttPool::release(char *buf)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    int i = index(buf);
+
+    if (i >= 0 && _refs[i] > 0)
+        _refs[i]--;
+}
+
+/**
+ * Gets the size of a buffer of the pool.
+ *
+ * @return The size.
+ */
+size_t IotMqttPool::size(void) const
+{
+    return _size;
+}
+
+/**
+ * Gets the index of a buffer. The mutex must be held.
+ *
+ * @param[in] buf A pointer to the buffer.
+ * @return The index, or -1 if the buffer isn't one of the pool's.
+ */
+int IotMqttPool::index(const char *buf) const
+{
+    if (buf == nullptr || _bufs == nullptr || buf < _bufs || buf >= _bufs + _refs.size() * _size)
+        return -1;
+
+    return static_cast<int>((buf - _bufs) / _size);
+}
@@ -0,0 +1,211 @@
+#include <cstring>
+#include "iot_mqtt_ring.h"
+
+/**
+ * Allocates the ring's buffer, if it wasn't allocated yet.
+ *
+ * @param[in] size The size of the buffer.
+ * @return ESP_OK on success, ESP_ERR_NO_MEM if the buffer couldn't be allocated.
+ */
+esp_err_t IotMqttRing::init(size_t size)
+{
+    if (_buf != nullptr)
+        return ESP_OK;
+
+    _buf = iot_allocate_mem<uint8_t>(size);
+
+    if (_buf == nullptr) {
+        ESP_LOGE(TAG, "%s: Failed to allocate the ring [size: %d]", __func__, size);
+        return ESP_ERR_NO_MEM;
+    }
+
+    // Records are 4 byte aligned, so is the end of the ring.
+    _size = size & ~static_cast<size_t>(3);
+
+    return ESP_OK;
+}
+
+/**
+ * Appends a message to the ring, dropping the oldest messages if it doesn't fit.
+ *
+ * @param[in] topic The message's topic.
+ * @param[in] data A pointer to the message's data.
+ * @param[in] len The length of the data.
+ * @param[in] qos The quality of service for the message.
+ * @param[in] latest Indicates that the buffered messages of the topic are replaced.
+ * @return ESP_OK on success, ESP_ERR_INVALID_SIZE if the message can never fit, ESP_ERR_INVALID_STATE if the ring
+ *         isn't initialised.
+ */
+esp_err_t IotMqttRing::push(std::string_view topic, const char *data, size_t len, uint8_t qos, bool latest)
+{
+    if (_buf == nullptr)
+        return ESP_ERR_INVALID_STATE;
+
+    size_t size = (sizeof(header_t) + topic.size() + 1 + len + 3) & ~static_cast<size_t>(3);
+
+    // A record may cost its size plus the space skipped at the end when wrapping.
+    if (size > _size / 2 || size > UINT16_MAX)
+        return ESP_ERR_INVALID_SIZE;
+
+    if (latest && _count > 0) {
+        for (size_t offset = _head, used = 0; used < _used;) {
+            auto *header = reinterpret_cast<header_t *>(_buf + offset);
+
+            if (_size - offset < sizeof(header_t) || header->size == 0) {
+                used += _size - offset;
+                offset = 0;
+                continue;
+            }
+
+            if (header->live && header->topic_len == topic.size() &&
+                memcmp(_buf + offset + sizeof(header_t), topic.data(), topic.size()) == 0) {
+                header->live = 0;
+                _count--;
+            }
+
+            used += header->size;
+            offset += header->size;
+        }
+    }
+
+    while (_used > 0) {
+        bool fits = _tail >= _head ? (_size - _tail >= size || _head >= size) : _head - _tail >= size;
+
+        if (fits && _size - _used >= size)
+            break;
+
+        drop();
+    }
+
+    if (_used == 0)
+        _head = _tail = 0;
+
+    if (_size - _tail < size) {
+        if (_size - _tail >= sizeof(header_t))
+            reinterpret_cast<header_t *>(_buf + _tail)->size = 0;
+
+        _used += _size - _tail;
+        _tail = 0;
+    }
+
+    auto *header = reinterpret_cast<header_t *>(_buf + _tail);
+    char *dst = reinterpret_cast<char *>(header + 1);
+
+    *header = {.size = static_cast<uint16_t>(size), .topic_len = static_cast<uint16_t>(topic.size()),
+               .len = static_cast<uint16_t>(len), .qos = qos, .live = 1};
+
+    memcpy(dst, topic.data(), topic.size());
+    dst[topic.size()] = '\0';
+    memcpy(dst + topic.size() + 1, data, len);
+
+    _tail += size;
+    _used += size;
+    _count++;
+
+    return ESP_OK;
+}
+
+/**
+ * Gets the oldest live message in the ring.
+ *
+ * @param[out] record A pointer to the record to fill, it points into the ring until the message is popped.
+ * @return true if there is a message, otherwise false.
+ */
+bool IotMqttRing::front(iot_mqtt_record_t *record)
+{
+    header_t *header;
+
+    // Messages replaced by a later one of their topic are skipped over.
+    while ((header = at_head()) != nullptr && !header->live)
+        drop();
+
+    if (header == nullptr)
+        return false;
+
+    auto *topic = reinterpret_cast<const char *>(header + 1);
+
+    *record = {.topic = topic, .data = topic + header->topic_len + 1, .len = header->len, .qos = header->qos};
+
+    return true;
+}
+
+/**
+ * Removes the oldest message from the ring.
+ */
+void IotMqttRing::pop(void)
+{
+    if (at_head() == nullptr)
+        return;
+
+    header_t *header = at_head();
+
+    if (header->live)
+        _count--;
+
+    _head += header->size;
+    _used -= header->size;
+}
+
+/**
+ * Checks whether the ring has no messages.
+ *
+ * @return true if empty, otherwise false.
+ */
+bool IotMqttRing::empty(void) const
+{
+    return _count == 0;
+}
+
+/**
+ * Gets the number of messages in the ring.
+ *
+ * @return The number of messages.
+ */
+size_t IotMqttRing::count(void) const
+{
+    return _count;
+}
+
+/**
+ * Gets the number of messages dropped to make room since the ring was created.
+ *
+ * @return The number of messages.
+ */
+uint32_t IotMqttRing::dropped(void) const
+{
+    return _dropped;
+}
+
+/**
+ * Gets the header of the oldest record, skipping the space left at the end when the ring wrapped.
+ *
+ * @return A pointer to the header, or nullptr if the ring is empty.
+ */
+IotMqttRing::header_t *IotMqttRing::at_head(void)
+{
+    if (_used == 0)
+        return nullptr;
+
+    if (_size - _head < sizeof(header_t) || reinterpret_cast<header_t *>(_buf + _head)->size == 0) {
+        _used -= _size - _head;
+        _head = 0;
+    }
+
+    return _used == 0 ? nullptr : reinterpret_cast<header_t *>(_buf + _head);
+}
+
+/**
+ * Drops the oldest record to make room.
+ */
+void IotMqttRing::drop(void)
+{
+    header_t *header = at_head();
+
+    if (header == nullptr)
+        return;
+
+    if (header->live)
+        _dropped++;
+
+    pop();
+}
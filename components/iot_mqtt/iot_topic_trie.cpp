@@ -0,0 +1,282 @@
+#include <cstring>
+#include "iot_topic_trie.h"
+
+/**
+ * Initialises a new instance of the IotTopicTrie class with an empty root.
+ */
+IotTopicTrie::IotTopicTrie(void)
+{
+    _nodes.emplace_back();
+}
+
+/**
+ * Adds a subscriber of a topic filter, a filter can have multiple subscribers.
+ *
+ * @param[in] filter The topic filter, levels may be a + wildcard and the last one a # wildcard.
+ * @param[in] subscriber The subscriber to add.
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG if the filter is invalid, ESP_ERR_INVALID_STATE if the subscriber
+ *         already subscribed to the filter, ESP_ERR_NO_MEM if the trie is full.
+ */
+esp_err_t IotTopicTrie::insert(std::string_view filter, iot_mqtt_subscriber_t subscriber)
+{
+    if (!valid_filter(filter) || subscriber.cb == nullptr)
+        return ESP_ERR_INVALID_ARG;
+
+    uint16_t node = 0;
+    size_t pos = 0;
+
+    while (true) {
+        size_t sep = filter.find('/', pos);
+        std::string_view level = filter.substr(pos, sep == std::string_view::npos ? std::string_view::npos : sep - pos);
+
+        uint16_t child = find_child(node, level);
+
+        if (child == IOT_MQTT_TOPIC_NODE_NONE) {
+            if (_nodes.size() >= IOT_MQTT_TOPIC_NODE_NONE) {
+                ESP_LOGE(TAG, "%s: The topic trie is full", __func__);
+                return ESP_ERR_NO_MEM;
+            }
+
+            child = static_cast<uint16_t>(_nodes.size());
+
+            _nodes.push_back({.level = std::string(level), .child = IOT_MQTT_TOPIC_NODE_NONE,
+                              .sibling = _nodes[node].child});
+            _nodes[node].child = child;
+        }
+
+        node = child;
+
+        if (sep == std::string_view::npos)
+            break;
+
+        pos = sep + 1;
+    }
+
+    for (const auto &existing: _nodes[node].subscribers) {
+        if (existing.cb == subscriber.cb && existing.priv_data == subscriber.priv_data)
+            return ESP_ERR_INVALID_STATE;
+    }
+
+    _nodes[node].subscribers.push_back(subscriber);
+
+    return ESP_OK;
+}
+
+/**
+ * Removes a subscriber of a topic filter, the filter's nodes are kept.
+ *
+ * @param[in] filter The topic filter.
+ * @param[in] id The id of the subscriber.
+ * @return ESP_OK on success, ESP_ERR_NOT_FOUND if the filter has no such subscriber.
+ */
+esp_err_t IotTopicTrie::remove(std::string_view filter, uint8_t id)
+{
+    uint16_t node = find_node(filter);
+
+    if (node == IOT_MQTT_TOPIC_NODE_NONE)
+        return ESP_ERR_NOT_FOUND;
+
+    auto &subscribers = _nodes[node].subscribers;
+
+    if (std::erase_if(subscribers, [id](const iot_mqtt_subscriber_t &subscriber) { return subscriber.id == id; }) == 0)
+        return ESP_ERR_NOT_FOUND;
+
+    return ESP_OK;
+}
+
+/**
+ * Checks whether a topic filter has any subscriber, the filter is compared level by level, not matched.
+ *
+ * @param[in] filter The topic filter.
+ * @return true if the filter has subscribers, otherwise false.
+ */
+bool IotTopicTrie::contains(std::string_view filter) const
+{
+    uint16_t node = find_node(filter);
+
+    return node != IOT_MQTT_TOPIC_NODE_NONE && !_nodes[node].subscribers.empty();
+}
+
+/**
+ * Finds the first subscriber of a topic filter, the filter is compared level by level, not matched.
+ *
+ * @param[in] filter The topic filter.
+ * @param[out] out A pointer to store the subscriber in.
+ * @return true if the filter has subscribers, otherwise false.
+ */
+bool IotTopicTrie::find(std::string_view filter, iot_mqtt_subscriber_t *out) const
+{
+    uint16_t node = find_node(filter);
+
+    if (node == IOT_MQTT_TOPIC_NODE_NONE || _nodes[node].subscribers.empty())
+        return false;
+
+    *out = _nodes[node].subscribers.front();
+
+    return true;
+}
+
+/**
+ * Finds the node a topic filter ends at.
+ *
+ * @param[in] filter The topic filter.
+ * @return The index of the node, or IOT_MQTT_TOPIC_NODE_NONE if the filter isn't in the trie.
+ */
+uint16_t IotTopicTrie::find_node(std::string_view filter) const
+{
+    uint16_t node = 0;
+    size_t pos = 0;
+
+    while (node != IOT_MQTT_TOPIC_NODE_NONE) {
+        size_t sep = filter.find('/', pos);
+        std::string_view level = filter.substr(pos, sep == std::string_view::npos ? std::string_view::npos : sep - pos);
+
+        node = find_child(node, level);
+
+        if (sep == std::string_view::npos)
+            break;
+
+        pos = sep + 1;
+    }
+
+    return node;
+}
+
+/**
+ * Finds the subscribers of every filter matching a topic.
+ *
+ * @param[in] topic A pointer to the topic, it doesn't need to be null terminated.
+ * @param[in] len The length of the topic.
+ * @param[out] out A pointer to the array to copy the subscribers to.
+ * @param[in] max The size of the array.
+ * @return The number of matching subscribers, which may be larger than max.
+ */
+size_t IotTopicTrie::match(const char *topic, size_t len, iot_mqtt_subscriber_t *out, size_t max) const
+{
+    size_t count = 0;
+
+    if (topic != nullptr)
+        collect(0, topic, topic + len, false, true, out, max, &count);
+
+    return count;
+}
+
+/**
+ * Checks whether the trie has no subscribers.
+ *
+ * @return true if empty, otherwise false.
+ */
+bool IotTopicTrie::empty(void) const
+{
+    for (const auto &node: _nodes) {
+        if (!node.subscribers.empty())
+            return false;
+    }
+
+    return true;
+}
+
+/**
+ * Checks whether a topic filter is valid, wildcards must take a whole level and # can only be the last level.
+ *
+ * @param[in] filter The topic filter.
+ * @return true if valid, otherwise false.
+ */
+bool IotTopicTrie::valid_filter(std::string_view filter)
+{
+    if (filter.empty())
+        return false;
+
+    for (size_t i = 0; i < filter.size(); i++) {
+        if (filter[i] != '+' && filter[i] != '#')
+            continue;
+
+        bool whole = (i == 0 || filter[i - 1] == '/') && (i + 1 == filter.size() || filter[i + 1] == '/');
+
+        if (!whole || (filter[i] == '#' && i + 1 != filter.size()))
+            return false;
+    }
+
+    return true;
+}
+
+/**
+ * Finds the child of a node with a level.
+ *
+ * @param[in] node The index of the parent node.
+ * @param[in] level The child's level.
+ * @return The index of the child, or IOT_MQTT_TOPIC_NODE_NONE if there is none.
+ */
+uint16_t IotTopicTrie::find_child(uint16_t node, std::string_view level) const
+{
+    for (uint16_t child = _nodes[node].child; child != IOT_MQTT_TOPIC_NODE_NONE; child = _nodes[child].sibling) {
+        if (_nodes[child].level == level)
+            return child;
+    }
+
+    return IOT_MQTT_TOPIC_NODE_NONE;
+}
+
+/**
+ * Collects the subscribers of the filters below a node matching the rest of a topic.
+ *
+ * @param[in] node The index of the node whose level matched.
+ * @param[in] pos A pointer to the next level of the topic.
+ * @param[in] end A pointer to the end of the topic.
+ * @param[in] done Indicates that every level of the topic was matched.
+ * @param[in] first Indicates that the next level is the topic's first one.
+ * @param[out] out A pointer to the array to copy the subscribers to.
+ * @param[in] max The size of the array.
+ * @param[in,out] count A pointer to the number of matching subscribers.
+ */
+void IotTopicTrie::collect(uint16_t node, const char *pos, const char *end, bool done, bool first,
+                           iot_mqtt_subscriber_t *out, size_t max, size_t *count) const
+{
+    if (done) {
+        add(_nodes[node], out, max, count);
+
+        // A trailing # also matches its parent level, a/# matches a.
+        uint16_t multi = find_child(node, "#");
+
+        if (multi != IOT_MQTT_TOPIC_NODE_NONE)
+            add(_nodes[multi], out, max, count);
+
+        return;
+    }
+
+    auto *sep = static_cast<const char *>(memchr(pos, '/', end - pos));
+    std::string_view level(pos, (sep == nullptr ? end : sep) - pos);
+    const char *next = sep == nullptr ? end : sep + 1;
+
+    // Wildcards at the first level don't match system topics starting with $.
+    bool wildcards = !(first && !level.empty() && level[0] == '$');
+
+    for (uint16_t child = _nodes[node].child; child != IOT_MQTT_TOPIC_NODE_NONE; child = _nodes[child].sibling) {
+        const std::string &name = _nodes[child].level;
+
+        if (name == "#") {
+            if (wildcards)
+                add(_nodes[child], out, max, count);
+        } else if (name == "+" ? wildcards : name == level) {
+            collect(child, next, end, sep == nullptr, false, out, max, count);
+        }
+    }
+}
+
+/**
+ * Adds the subscribers of a node to the matches.
+ *
+ * @param[in] node The matching node.
+ * @param[out] out A pointer to the array to copy the subscribers to.
+ * @param[in] max The size of the array.
+ * @param[in,out] count A pointer to the number of matching subscribers.
+ */
+void IotTopicTrie::add(const iot_mqtt_topic_node_t &node, iot_mqtt_subscriber_t *out, size_t max, size_t *count)
+{
+    for (const auto &subscriber: node.subscribers) {
+        if (*count < max)
+            out[*count] = subscriber;
+
+        (*count)++;
+    }
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "esp_http_server.h"
+#include "iot_common.h"
+#include "iot_server_defs.h"
+
+/**
+ * A class for streaming a json http response through a small fixed scratch buffer.
+ *
+ * Values are written straight into the scratch buffer which is flushed as a chunk whenever it fills up,
+ * large raw blocks bypass the buffer entirely, so no full document copy is ever made.
+ */
+class IotResWriter final
+{
+public:
+    explicit IotResWriter(httpd_req_t *req);
+
+    IotResWriter(const IotResWriter&) = delete;
+    IotResWriter(IotResWriter&&) = delete;
+    IotResWriter& operator=(const IotResWriter&) = delete;
+    IotResWriter& operator=(IotResWriter&&) = delete;
+
+    esp_err_t begin(iot_http_status_e status, const char *type = HTTPD_TYPE_JSON);
+    esp_err_t end(void);
+    esp_err_t error(void) const;
+    size_t written(void) const;
+
+    IotResWriter &raw(const char *data, size_t len);
+    IotResWriter &raw(const char *data);
+    IotResWriter &key(const char *key);
+    IotResWriter &begin_object(const char *key = nullptr);
+    IotResWriter &end_object(void);
+    IotResWriter &begin_array(const char *key = nullptr);
+    IotResWriter &end_array(void);
+    IotResWriter &add_raw(const char *key, const char *json);
+    IotResWriter &add_raw(const char *key, const char *json, size_t len);
+    IotResWriter &add_str(const char *key, const char *value, size_t len);
+    IotResWriter &add_str(const char *key, const char *value);
+    IotResWriter &add_bool(const char *key, bool value);
+    IotResWriter &add_uint(const char *key, uint32_t value);
+    IotResWriter &add_ulong(const char *key, uint64_t value);
+    IotResWriter &add_float(const char *key, float value);
+
+    static const char *status_str(iot_http_status_e status);
+
+private:
+    static constexpr const char *TAG = "IotResWriter";   /**< A constant used to identify the source of the log message of this class. */
+    static constexpr uint8_t MAX_DEPTH = 32;             /**< The maximum nesting depth of objects and arrays. */
+
+    httpd_req_t *_req;                                   /**< A pointer to the http request object. */
+    char _buf[IOT_HTTP_RES_SCRATCH_SIZE];                /**< The scratch buffer. */
+    size_t _len = 0;                                     /**< The number of bytes currently in the scratch buffer. */
+    size_t _written = 0;                                 /**< The total number of bytes written to the response. */
+    esp_err_t _err = ESP_OK;                             /**< The first error that occurred while writing. */
+    uint8_t _depth = 0;                                  /**< The current nesting depth. */
+    uint32_t _has_items = 0;                             /**< A bit per depth indicating that the container already has items. */
+    bool _after_key = false;                             /**< Indicates that a key has been written and a value is expected. */
+
+    void separate(void);
+    void put(char c);
+    void escape(const char *value, size_t len);
+    esp_err_t flush(void);
+    IotResWriter &open(const char *key, char c);
+    IotResWriter &close(char c);
+};
@@ -1,11 +1,23 @@
 #pragma once
 
 #include <functional>
+#include <mutex>
+#include <string_view>
 #include "esp_https_server.h"
 #include "iot_common.h"
 #include "iot_component.h"
 #include "iot_factory.h"
 #include "iot_server_defs.h"
+#include "iot_res_writer.h"
+
+#if CONFIG_IOT_HOVER_SERVER_HTTPS
+struct mbedtls_ssl_session;
+
+extern "C" int __real_mbedtls_ssl_ticket_parse(void *p_ticket, struct mbedtls_ssl_session *session,
+                                               unsigned char *buf, size_t len);
+extern "C" int __wrap_mbedtls_ssl_ticket_parse(void *p_ticket, struct mbedtls_ssl_session *session,
+                                               unsigned char *buf, size_t len);
+#endif
 
 /**
  * A class for handling http server related functionalities.
@@ -24,19 +36,105 @@ public:
     esp_err_t start(void) override;
     void stop(void) override;
     void set_auth(std::string auth);
-    esp_err_t register_route(const std::string route, httpd_method_t method, esp_err_t (*handler)(httpd_req_t *r));
+    esp_err_t register_route(const std::string route, httpd_method_t method, iot_route_handler_t handler);
     static esp_err_t on_auth(httpd_req_t *req);
+    static bool is_authorized(httpd_req_t *req);
     esp_err_t send_res(httpd_req_t *req, const char *body, bool message = false, iot_http_status_e status = IOT_HTTP_STATUS_200_OK);
+    esp_err_t send_res(httpd_req_t *req, const std::function<esp_err_t(IotResWriter &)> &body, iot_http_status_e status = IOT_HTTP_STATUS_200_OK);
+    esp_err_t send_cached(httpd_req_t *req, const char *data, size_t len, const char *etag);
     esp_err_t get_body(httpd_req_t *req, char *buf, size_t buf_len);
     esp_err_t get_query_value(const char *query, const char *key, char **value);
     esp_err_t send_err(httpd_req_t *req, const char *error = IOT_HTTP_DEFAULT_ERR_MSG, iot_http_status_e status = IOT_HTTP_STATUS_500_INT_SERVER_ERROR);
-    std::string get_path_param(httpd_req_t *p_req, std::string path);
+    std::string_view get_path_param(httpd_req_t *req);
+    esp_err_t run_async(httpd_req_t *req, iot_route_handler_t handler);
+#ifdef CONFIG_IOT_HOVER_SERVER_PUSH
+    esp_err_t publish(const char *data, size_t len);
+    bool has_subscribers(void) const;
+#endif
 
 private:
     static constexpr const char *TAG = "IotServer";                                      /**< A constant used to identify the source of the log message of this class. */
     static constexpr const char *API_KEY = "aesY}zeN]v4DOp@o2)-";                        /**< A temporary api key*/
     static constexpr const char *BASE_SERVER_PATH = "/api/v1/device/";                   /**< The base url path for the server. */
+    static constexpr const char *DISPATCH_PATH = "/api/v1/device/*";                     /**< The wildcard url path of the route dispatcher. */
+    static constexpr const char *PUSH_PATH = "/api/v1/device/events";                    /**< The url path of the push channel websocket. */
     const uint8_t MAX_QUERY_VALUE_SIZE = 51;                                             /**< The max query length size.*/
-    static std::string _api_key;
+    static uint8_t _api_key_hash[IOT_HTTP_API_KEY_HASH_LEN];
     httpd_handle_t _server;
+    std::mutex _routes_mutex;                                                            /**< The mutex for protecting access to the route table. */
+    iot_route_t _routes[CONFIG_IOT_HOVER_SERVER_MAX_ROUTES]{};                          /**< The registered routes, in registration order. */
+    uint8_t _route_index[CONFIG_IOT_HOVER_SERVER_MAX_ROUTES]{};                         /**< The indexes of the routes sorted by path, wildcard and method. */
+    uint8_t _route_count = 0;                                                            /**< The number of registered routes. */
+    iot_route_stats_t _stats[CONFIG_IOT_HOVER_SERVER_MAX_ROUTES]{};                     /**< The statistics of the routes, by route index. */
+    std::atomic<uint32_t> _unmatched{0};                                                 /**< The number of requests that matched no route or method. */
+    static constexpr uint16_t LATENCY_BOUNDS_MS[IOT_HTTP_LATENCY_BUCKETS - 1] = {
+            1, 2, 5, 10, 25, 50, 100, 250, 500, 1000
+    };                                                                                   /**< The upper bounds of the latency histogram buckets. */
+#if CONFIG_IOT_HOVER_SERVER_HTTPS
+    uint8_t *_cert = nullptr;                                                            /**< The server's certificate, loaded once. */
+    size_t _cert_len = 0;                                                                /**< The length of the server's certificate. */
+    uint8_t *_pvt_key = nullptr;                                                         /**< The server's private key, loaded once. */
+    size_t _pvt_key_len = 0;                                                             /**< The length of the server's private key. */
+    uint8_t *_ca_cert = nullptr;                                                         /**< The ca certificate, loaded once. */
+    size_t _ca_cert_len = 0;                                                             /**< The length of the ca certificate. */
+    static std::atomic<uint32_t> _tls_handshakes;
+    static std::atomic<uint32_t> _tls_resumed;
+    static const struct mbedtls_ssl_session *_tls_ticket_session;
+    static int64_t _tls_ticket_start;
+#endif
+    std::atomic<uint32_t> _rejected_rate{0};                                             /**< The number of requests rejected by the rate limits. */
+    std::atomic<uint32_t> _rejected_heap{0};                                             /**< The number of requests rejected for low free heap. */
+    std::atomic<uint32_t> _rejected_auth{0};                                             /**< The number of requests rejected as unauthorized. */
+#ifdef CONFIG_IOT_HOVER_SERVER_RATE_LIMIT
+    iot_token_bucket_t _global_bucket{};                                                 /**< The token bucket shared by all clients. */
+    iot_rate_client_t _clients[CONFIG_IOT_HOVER_SERVER_MAX_CLIENTS]{};                  /**< The token buckets of the recently seen clients. */
+#endif
+#if CONFIG_IOT_HOVER_SERVER_ASYNC_WORKERS > 0
+    static constexpr uint32_t ASYNC_STACK_SIZE = 6144;                                  /**< The stack size of the async workers, which run the handlers. */
+    QueueHandle_t _async_queue = nullptr;                                                /**< The queue of requests waiting for an async worker. */
+#endif
+#ifdef CONFIG_IOT_HOVER_SERVER_PUSH
+    std::mutex _ws_mutex;                                                                /**< The mutex for protecting access to the subscribers and their queues. */
+    iot_ws_subscriber_t _subscribers[CONFIG_IOT_HOVER_SERVER_MAX_SUBSCRIBERS]{};        /**< The push channel subscribers. */
+    std::atomic<uint8_t> _subscriber_count{0};                                           /**< The number of push channel subscribers. */
+    std::atomic<uint32_t> _ws_dropped{0};                                                /**< The number of messages dropped for slow subscribers. */
+    TaskHandle_t _push_task = nullptr;                                                   /**< The handle of the task sending queued messages. */
+#endif
+
+#if CONFIG_IOT_HOVER_SERVER_HTTPS
+    esp_err_t load_credentials(void);
+    static void on_tls_session(esp_https_server_user_cb_arg_t *arg);
+    friend int ::__wrap_mbedtls_ssl_ticket_parse(void *p_ticket, struct mbedtls_ssl_session *session,
+                                                 unsigned char *buf, size_t len);
+#endif
+    static esp_err_t on_request(httpd_req_t *req);
+    static esp_err_t on_metrics(httpd_req_t *req);
+    esp_err_t admit(httpd_req_t *req);
+#ifdef CONFIG_IOT_HOVER_SERVER_RATE_LIMIT
+    iot_token_bucket_t *client_bucket(httpd_req_t *req, uint32_t now);
+    static uint32_t take_token(iot_token_bucket_t *bucket, uint32_t now, uint32_t rate, uint32_t burst);
+#endif
+    esp_err_t send_metrics(httpd_req_t *req);
+    void record_request(const iot_route_ctx_t &ctx, httpd_req_t *req, esp_err_t ret, int64_t elapsed_us);
+    static void record_response(httpd_req_t *req, iot_http_status_e status, size_t bytes);
+    static iot_route_ctx_t *route_ctx(httpd_req_t *req);
+    esp_err_t find_route(const char *path, size_t len, httpd_method_t method, iot_route_ctx_t *ctx);
+    bool match_route(const char *path, size_t len, bool wildcard, httpd_method_t method, uint8_t *route, bool *path_found);
+    size_t lower_bound(const char *path, size_t len, bool wildcard, int method);
+    static int compare_route(const iot_route_t &route, const char *path, size_t len, bool wildcard, int method);
+    esp_err_t end_envelope(httpd_req_t *req, IotResWriter &writer, iot_http_status_e status);
+#if CONFIG_IOT_HOVER_SERVER_ASYNC_WORKERS > 0
+    [[noreturn]] static void async_task(void *param);
+#endif
+#ifdef CONFIG_IOT_HOVER_SERVER_PUSH
+#ifdef CONFIG_HTTPD_WS_PRE_HANDSHAKE_CB_SUPPORT
+    static esp_err_t on_ws_handshake(httpd_req_t *req);
+#endif
+    static esp_err_t on_ws(httpd_req_t *req);
+    static void on_close(httpd_handle_t handle, int fd);
+    [[noreturn]] static void push_task(void *param);
+    esp_err_t add_subscriber(int fd);
+    void remove_subscriber(int fd);
+    static void release_msg(iot_ws_msg_t *msg);
+#endif
 };
@@ -1,20 +1,130 @@
 #pragma once
 
+#include <atomic>
+#include "sdkconfig.h"
+#include "esp_http_server.h"
+
 #define IOT_HTTP_SERIALIZATION_ERR "Failed to serialize response"       /**< Error message for when a serialization error occurred. */
 #define IOT_HTTP_DESERIALIZATION_ERR "Failed to deserialize request"    /**< Error message for when a deserialization error occurred. */
 
 #define IOT_HTTP_DEFAULT_ERR_MSG "The request could not be processed"         /**< The default error message.*/
 
+#define IOT_HTTP_RES_SCRATCH_SIZE 256   /**< The size of the scratch buffer used to stream responses. */
+#define IOT_HTTP_MAX_ETAG_LEN 64        /**< The maximum length of an If-None-Match header value that is checked. */
+#define IOT_HTTP_MAX_API_KEY_LEN 64     /**< The maximum length of an api key header value. */
+#define IOT_HTTP_API_KEY_HASH_LEN 32    /**< The length of the sha-256 hash of the api key. */
+#define IOT_HTTP_MAX_ROUTE_LEN 32       /**< The maximum length of a route path, excluding the base path. */
+#define IOT_HTTP_LATENCY_BUCKETS 11     /**< The number of request latency histogram buckets, including the +Inf bucket. */
+#define IOT_HTTP_ROUTE_CTX_TAG 0x52544358 /**< Tags a route context, handlers outside the dispatcher have other contexts. */
+
 /**
  * An enum of common http status codes
  */
 typedef enum iot_http_status {
     IOT_HTTP_STATUS_200_OK = 200,                   /**< Indicates the request was successful. */
     IOT_HTTP_STATUS_201_CREATED = 201,              /**< Indicates the request was successful and a new resource was created. */
+    IOT_HTTP_STATUS_304_NOT_MODIFIED = 304,         /**< Indicates the resource has not changed since the version the client holds. */
     IOT_HTTP_STATUS_400_BAD_REQUEST = 400,          /**< Indicates the request could not be understood or was missing required parameters. */
     IOT_HTTP_STATUS_401_UNAUTHORIZED = 401,         /**< Indicates the authentication failed or user does not have permissions for the desired action. */
     IOT_HTTP_STATUS_403_FORBIDDEN = 403,            /**< Indicates the Authentication succeeded but authenticated user does not have access to the resource. */
     IOT_HTTP_STATUS_404_NOT_FOUND = 404,            /**< Indicates the requested resource could not be found. */
     IOT_HTTP_STATUS_405_METHOD_NOT_ALLOWED = 405,   /**< Indicates the HTTP method used is not allowed for the requested resource. */
+    IOT_HTTP_STATUS_429_TOO_MANY_REQUESTS = 429,    /**< Indicates the client sent too many requests in a given amount of time. */
     IOT_HTTP_STATUS_500_INT_SERVER_ERROR = 500,     /**< Indicates that An error occurred on the server side. */
-} iot_http_status_e;
\ No newline at end of file
+    IOT_HTTP_STATUS_503_SERVICE_UNAVAILABLE = 503,  /**< Indicates the server is temporarily unable to handle the request. */
+} iot_http_status_e;
+
+class IotServer;
+
+/**
+ * A function for handling requests to a route.
+ *
+ * @param[in] req A pointer to the http request object.
+ * @return ESP_OK on success, otherwise an error code.
+ */
+typedef esp_err_t (*iot_route_handler_t)(httpd_req_t *req);
+
+/**
+ * A struct of a registered route.
+ */
+typedef struct iot_route {
+    char path[IOT_HTTP_MAX_ROUTE_LEN];  /**< The route's path relative to the base path, without the trailing wildcard. */
+    uint8_t path_len;                   /**< The length of the route's path. */
+    bool wildcard;                      /**< Indicates whether the path is a prefix followed by a path parameter. */
+    httpd_method_t method;              /**< The route's http method. */
+    iot_route_handler_t handler;        /**< The function that handles requests to the route. */
+} iot_route_t;
+
+/**
+ * A struct of the context of a request that is being dispatched, it lives on the dispatcher's stack.
+ */
+typedef struct iot_route_ctx {
+    uint32_t tag;             /**< IOT_HTTP_ROUTE_CTX_TAG, the request's user context is only a route context if set. */
+    IotServer *server;        /**< A pointer to the server dispatching the request. */
+    uint8_t route;            /**< The index of the matched route. */
+    const char *param;        /**< A pointer to the path parameter within the request uri. */
+    size_t param_len;         /**< The length of the path parameter. */
+    uint16_t status;          /**< The status of the response sent, 0 if none was sent through the server. */
+    size_t bytes_out;         /**< The number of response body bytes sent. */
+    int64_t start;            /**< The time the request was dispatched at in microseconds. */
+    bool detached;            /**< Indicates the request was handed to an async worker, which records its statistics. */
+} iot_route_ctx_t;
+
+/**
+ * A struct of the statistics of a route, the counters are updated without locking and wrap around.
+ */
+typedef struct iot_route_stats {
+    std::atomic<uint32_t> requests;                             /**< The number of requests handled. */
+    std::atomic<uint32_t> errors;                               /**< The number of requests that failed or got an error status. */
+    std::atomic<uint32_t> bytes_in;                             /**< The number of request body bytes received. */
+    std::atomic<uint32_t> bytes_out;                            /**< The number of response body bytes sent. */
+    std::atomic<uint32_t> latency_sum_ms;                       /**< The sum of the request latencies in milliseconds. */
+    std::atomic<uint32_t> latency[IOT_HTTP_LATENCY_BUCKETS];    /**< The number of requests per latency bucket, non cumulative. */
+} iot_route_stats_t;
+
+/**
+ * A struct of a token bucket, refilled lazily when tokens are taken.
+ */
+typedef struct iot_token_bucket {
+    uint32_t tokens;    /**< The available tokens, in thousandths of a token. */
+    uint32_t updated;   /**< The time the bucket was last refilled, in milliseconds. */
+} iot_token_bucket_t;
+
+/**
+ * A struct of the token bucket of a client.
+ */
+typedef struct iot_rate_client {
+    uint8_t family;                 /**< The family of the client's address, AF_INET for ipv4 mapped ipv6 addresses. */
+    uint8_t addr[16];               /**< The client's address, the first 4 bytes of an ipv4 address. */
+    iot_token_bucket_t bucket;      /**< The client's token bucket. */
+} iot_rate_client_t;
+
+/**
+ * A struct of a request detached from the http server task, to be handled by an async worker.
+ */
+typedef struct iot_async_job {
+    httpd_req_t *req;               /**< A pointer to the detached copy of the request. */
+    iot_route_handler_t handler;    /**< The function that handles the request. */
+    iot_route_ctx_t ctx;            /**< The dispatch context of the request without the path parameter, no server if none. */
+} iot_async_job_t;
+
+#ifdef CONFIG_IOT_HOVER_SERVER_PUSH
+/**
+ * A struct of a message pushed to subscribers, shared by the queues of all the subscribers it's sent to.
+ */
+typedef struct iot_ws_msg {
+    uint8_t refs;       /**< The number of subscriber queues holding the message. */
+    size_t len;         /**< The length of the message. */
+    char *data;         /**< A pointer to the message, allocated with the struct. */
+} iot_ws_msg_t;
+
+/**
+ * A struct of a push channel subscriber and its bounded message queue.
+ */
+typedef struct iot_ws_subscriber {
+    int fd;                                                         /**< The subscriber's socket, -1 if the slot is free. */
+    iot_ws_msg_t *queue[CONFIG_IOT_HOVER_SERVER_PUSH_QUEUE_LEN];    /**< The ring of queued messages. */
+    uint8_t head;                                                   /**< The index of the oldest queued message. */
+    uint8_t count;                                                  /**< The number of queued messages. */
+} iot_ws_subscriber_t;
+#endif
@@ -0,0 +1,486 @@
+#include <cfloat>
+#include "iot_res_writer.h"
+
+/**
+ * Initialises a new instance of the IotResWriter class.
+ *
+ * @param[in] req A pointer to the http request object to respond to.
+ */
+IotResWriter::IotResWriter(httpd_req_t *req) : _req(req)
+{
+}
+
+/**
+ * Sets the response status and content type, must be called before anything is written.
+ *
+ * @param[in] status The response status.
+ * @param[in] type The response content type. Default is json.
+ * @return ESP_OK on success, otherwise an error code.
+ */
+esp_err_t IotResWriter::begin(iot_http_status_e status, const char *type)
+{
+    esp_err_t ret = httpd_resp_set_status(_req, status_str(status));
+
+    if (ret == ESP_OK)
+        ret = httpd_resp_set_type(_req, type);
+
+    if (ret != ESP_OK)
+        _err = ret;
+
+    return ret;
+}
+
+/**
+ * Flushes the scratch buffer and terminates the chunked response.
+ *
+ * @return ESP_OK on success, otherwise an error code.
+ */
+esp_err_t IotResWriter::end(void)
+{
+    flush();
+
+    if (_err != ESP_OK) {
+        ESP_LOGE(TAG, "%s: Failed to stream response [reason: %s]", __func__, esp_err_to_name(_err));
+        return _err;
+    }
+
+    return httpd_resp_send_chunk(_req, nullptr, 0);
+}
+
+/**
+ * Gets the first error that occurred while writing.
+ *
+ * @return ESP_OK if nothing failed, otherwise an error code.
+ */
+esp_err_t IotResWriter::error(void) const
+{
+    return _err;
+}
+
+/**
+ * Gets the total number of bytes written to the response body so far.
+ *
+ * @return The number of bytes.
+ */
+size_t IotResWriter::written(void) const
+{
+    return _written + _len;
+}
+
+/**
+ * Writes raw data to the response. Data that does not fit the scratch buffer is sent as is without copying.
+ *
+ * @param[in] data A pointer to the data to write.
+ * @param[in] len The length of the data.
+ * @return A reference to the writer.
+ */
+IotResWriter &IotResWriter::raw(const char *data, size_t len)
+{
+    if (_err != ESP_OK || len == 0)
+        return *this;
+
+    if (_len + len <= sizeof(_buf)) {
+        memcpy(_buf + _len, data, len);
+        _len += len;
+        return *this;
+    }
+
+    if (flush() != ESP_OK)
+        return *this;
+
+    if (len < sizeof(_buf)) {
+        memcpy(_buf, data, len);
+        _len = len;
+        return *this;
+    }
+
+    _err = httpd_resp_send_chunk(_req, data, len);
+    _written += len;
+
+    return *this;
+}
+
+/**
+ * Writes a raw null terminated string to the response.
+ *
+ * @param[in] data A pointer to the string to write.
+ * @return A reference to the writer.
+ */
+IotResWriter &IotResWriter::raw(const char *data)
+{
+    return data == nullptr ? *this : raw(data, strlen(data));
+}
+
+/**
+ * Writes an object key, the next value written belongs to it.
+ *
+ * @param[in] key The key to write.
+ * @return A reference to the writer.
+ */
+IotResWriter &IotResWriter::key(const char *key)
+{
+    separate();
+    put('"');
+    escape(key, strlen(key));
+    put('"');
+    put(':');
+    _after_key = true;
+
+    return *this;
+}
+
+/**
+ * Opens an object.
+ *
+ * @param[in] key The key of the object. Default is nullptr for array items or the root.
+ * @return A reference to the writer.
+ */
+IotResWriter &IotResWriter::begin_object(const char *key)
+{
+    return open(key, '{');
+}
+
+/**
+ * Closes the current object.
+ *
+ * @return A reference to the writer.
+ */
+IotResWriter &IotResWriter::end_object(void)
+{
+    return close('}');
+}
+
+/**
+ * Opens an array.
+ *
+ * @param[in] key The key of the array. Default is nullptr for array items or the root.
+ * @return A reference to the writer.
+ */
+IotResWriter &IotResWriter::begin_array(const char *key)
+{
+    return open(key, '[');
+}
+
+/**
+ * Closes the current array.
+ *
+ * @return A reference to the writer.
+ */
+IotResWriter &IotResWriter::end_array(void)
+{
+    return close(']');
+}
+
+/**
+ * Writes an already serialized json value.
+ *
+ * @param[in] key The value's key or nullptr for array items.
+ * @param[in] json A pointer to the serialized json.
+ * @return A reference to the writer.
+ */
+IotResWriter &IotResWriter::add_raw(const char *key, const char *json)
+{
+    return json == nullptr ? add_raw(key, "null", 4) : add_raw(key, json, strlen(json));
+}
+
+/**
+ * Writes an already serialized json value of a known length.
+ *
+ * @param[in] key The value's key or nullptr for array items.
+ * @param[in] json A pointer to the serialized json.
+ * @param[in] len The length of the serialized json.
+ * @return A reference to the writer.
+ */
+IotResWriter &IotResWriter::add_raw(const char *key, const char *json, size_t len)
+{
+    if (key != nullptr)
+        this->key(key);
+    else
+        separate();
+
+    _after_key = false;
+
+    return raw(json, len);
+}
+
+/**
+ * Writes an escaped string value.
+ *
+ * @param[in] key The value's key or nullptr for array items.
+ * @param[in] value A pointer to the string.
+ * @param[in] len The length of the string.
+ * @return A reference to the writer.
+ */
+IotResWriter &IotResWriter::add_str(const char *key, const char *value, size_t len)
+{
+    if (key != nullptr)
+        this->key(key);
+    else
+        separate();
+
+    _after_key = false;
+
+    if (value == nullptr)
+        return raw("null", 4);
+
+    put('"');
+    escape(value, len);
+    put('"');
+
+    return *this;
+}
+
+/**
+ * Writes an escaped null terminated string value.
+ *
+ * @param[in] key The value's key or nullptr for array items.
+ * @param[in] value A pointer to the string.
+ * @return A reference to the writer.
+ */
+IotResWriter &IotResWriter::add_str(const char *key, const char *value)
+{
+    return add_str(key, value, value == nullptr ? 0 : strlen(value));
+}
+
+/**
+ * Writes a boolean value.
+ *
+ * @param[in] key The value's key or nullptr for array items.
+ * @param[in] value The boolean.
+ * @return A reference to the writer.
+ */
+IotResWriter &IotResWriter::add_bool(const char *key, bool value)
+{
+    return add_raw(key, value ? "true" : "false");
+}
+
+/**
+ * Writes an unsigned 32-bit integer value.
+ *
+ * @param[in] key The value's key or nullptr for array items.
+ * @param[in] value The integer.
+ * @return A reference to the writer.
+ */
+IotResWriter &IotResWriter::add_uint(const char *key, uint32_t value)
+{
+    char num[11];
+    snprintf(num, sizeof(num), "%" PRIu32, value);
+    return add_raw(key, num);
+}
+
+/**
+ * Writes an unsigned 64-bit integer value.
+ *
+ * @param[in] key The value's key or nullptr for array items.
+ * @param[in] value The integer.
+ * @return A reference to the writer.
+ */
+IotResWriter &IotResWriter::add_ulong(const char *key, uint64_t value)
+{
+    char num[21];
+    snprintf(num, sizeof(num), "%" PRIu64, value);
+    return add_raw(key, num);
+}
+
+/**
+ * Writes a floating point value.
+ *
+ * @param[in] key The value's key or nullptr for array items.
+ * @param[in] value The float.
+ * @return A reference to the writer.
+ */
+IotResWriter &IotResWriter::add_float(const char *key, float value)
+{
+    if (value != value)
+        return add_raw(key, "null");
+
+    char num[24];
+
+    // The shortest precision which reads back as the same float, 9 digits always do.
+    for (int precision = FLT_DIG + 1; precision < FLT_DECIMAL_DIG; precision++) {
+        snprintf(num, sizeof(num), "%.*g", precision, value);
+
+        if (strtof(num, nullptr) == value)
+            return add_raw(key, num);
+    }
+
+    snprintf(num, sizeof(num), "%.*g", FLT_DECIMAL_DIG, value);
+    return add_raw(key, num);
+}
+
+/**
+ * Gets the http status line for a status code.
+ *
+ * @param[in] status The status code.
+ * @return A pointer to the status line, which is a string literal.
+ */
+const char *IotResWriter::status_str(iot_http_status_e status)
+{
+    switch (status) {
+        case IOT_HTTP_STATUS_200_OK:
+            return HTTPD_200;
+        case IOT_HTTP_STATUS_201_CREATED:
+            return "201 Created";
+        case IOT_HTTP_STATUS_304_NOT_MODIFIED:
+            return "304 Not Modified";
+        case IOT_HTTP_STATUS_400_BAD_REQUEST:
+            return HTTPD_400;
+        case IOT_HTTP_STATUS_401_UNAUTHORIZED:
+            return "401 Unauthorized";
+        case IOT_HTTP_STATUS_403_FORBIDDEN:
+            return "403 Forbidden";
+        case IOT_HTTP_STATUS_404_NOT_FOUND:
+            return HTTPD_404;
+        case IOT_HTTP_STATUS_405_METHOD_NOT_ALLOWED:
+            return "405 Method Not Allowed";
+        case IOT_HTTP_STATUS_429_TOO_MANY_REQUESTS:
+            return "429 Too Many Requests";
+        case IOT_HTTP_STATUS_503_SERVICE_UNAVAILABLE:
+            return "503 Service Unavailable";
+        default:
+            return HTTPD_500;
+    }
+}
+
+/**
+ * Writes the separator required before a new value or key.
+ */
+void IotResWriter::separate(void)
+{
+    if (_after_key) {
+        _after_key = false;
+        return;
+    }
+
+    if (_depth == 0)
+        return;
+
+    uint32_t bit = 1UL << (_depth - 1);
+
+    if (_has_items & bit)
+        put(',');
+    else
+        _has_items |= bit;
+}
+
+/**
+ * Writes a single character to the scratch buffer.
+ *
+ * @param[in] c The character to write.
+ */
+void IotResWriter::put(char c)
+{
+    if (_len == sizeof(_buf) && flush() != ESP_OK)
+        return;
+
+    _buf[_len++] = c;
+}
+
+/**
+ * Writes a string escaping the characters which are not allowed in a json string.
+ *
+ * @param[in] value A pointer to the string to escape.
+ * @param[in] len The length of the string.
+ */
+void IotResWriter::escape(const char *value, size_t len)
+{
+    static constexpr const char *hex = "0123456789abcdef";
+
+    for (size_t i = 0; i < len && _err == ESP_OK; i++) {
+        auto c = static_cast<unsigned char>(value[i]);
+
+        switch (c) {
+            case '"':
+            case '\\':
+                put('\\');
+                put(static_cast<char>(c));
+                break;
+            case '\n':
+                put('\\');
+                put('n');
+                break;
+            case '\r':
+                put('\\');
+                put('r');
+                break;
+            case '\t':
+                put('\\');
+                put('t');
+                break;
+            default:
+                if (c < 0x20) {
+                    raw("\\u00", 4);
+                    put(hex[c >> 4]);
+                    put(hex[c & 0x0F]);
+                } else {
+                    put(static_cast<char>(c));
+                }
+                break;
+        }
+    }
+}
+
+/**
+ * Sends the content of the scratch buffer as a chunk.
+ *
+ * @return ESP_OK on success, otherwise an error code.
+ */
+esp_err_t IotResWriter::flush(void)
+{
+    if (_err != ESP_OK || _len == 0)
+        return _err;
+
+    _err = httpd_resp_send_chunk(_req, _buf, _len);
+    _written += _len;
+    _len = 0;
+
+    return _err;
+}
+
+/**
+ * Opens an object or an array.
+ *
+ * @param[in] key The key of the container or nullptr.
+ * @param[in] c The opening character.
+ * @return A reference to the writer.
+ */
+IotResWriter &IotResWriter::open(const char *key, char c)
+{
+    if (key != nullptr)
+        this->key(key);
+    else
+        separate();
+
+    _after_key = false;
+
+    if (_depth == MAX_DEPTH) {
+        _err = ESP_ERR_INVALID_SIZE;
+        return *this;
+    }
+
+    put(c);
+
+    _depth++;
+    _has_items &= ~(1UL << (_depth - 1));
+
+    return *this;
+}
+
+/**
+ * Closes an object or an array.
+ *
+ * @param[in] c The closing character.
+ * @return A reference to the writer.
+ */
+IotResWriter &IotResWriter::close(char c)
+{
+    if (_depth == 0) {
+        _err = ESP_ERR_INVALID_STATE;
+        return *this;
+    }
+
+    _depth--;
+    put(c);
+
+    return *this;
+}
@@ -1,8 +1,33 @@
-#include <cJSON.h>
+#include <algorithm>
+#include <climits>
+#include <unistd.h>
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "lwip/sockets.h"
+#include "mbedtls/sha256.h"
+#if CONFIG_IOT_HOVER_SERVER_HTTPS
+#include "esp_tls.h"
+#include "mbedtls/ssl.h"
+#endif
 #include "iot_server.h"
 #include "iot_storage.h"
 
-std::string IotServer::_api_key{};
+/** The sha-256 hash of the api key used to validate requests. */
+uint8_t IotServer::_api_key_hash[]{};
+
+#if CONFIG_IOT_HOVER_SERVER_HTTPS
+/** The number of tls sessions established. */
+std::atomic<uint32_t> IotServer::_tls_handshakes{0};
+
+/** The number of tls sessions established by resuming a previous session. */
+std::atomic<uint32_t> IotServer::_tls_resumed{0};
+
+/** The session the last session ticket was parsed into, only used by the server task. */
+const mbedtls_ssl_session *IotServer::_tls_ticket_session{nullptr};
+
+/** The start time of the session the last session ticket was parsed into, only used by the server task. */
+int64_t IotServer::_tls_ticket_start{0};
+#endif
 
 /**
  * Initialises a new instance of the IotServer class.
@@ -10,6 +35,8 @@ std::string IotServer::_api_key{};
 IotServer::IotServer(void)
 {
     _server = nullptr;
+
+    register_route("metrics", HTTP_GET, on_metrics);
 }
 
 /**
@@ -18,6 +45,10 @@ IotServer::IotServer(void)
 IotServer::~IotServer(void)
 {
     stop();
+
+#if CONFIG_IOT_HOVER_SERVER_HTTPS
+    iot_free(_cert, _pvt_key, _ca_cert);
+#endif
 }
 
 /**
@@ -38,63 +69,46 @@ esp_err_t IotServer::start(void)
     }
 
 #if CONFIG_IOT_HOVER_SERVER_HTTPS
-    auto storage = IotFactory::create_scoped<IotStorage>(IOT_NVS_FACTORY_PART_NAME,
-                                                         IOT_NVS_FACTORY_NAMESPACE);
-
-    size_t cert_len = 0;
-    uint8_t *cert = nullptr;
-
-    ret = storage->read("cert", reinterpret_cast<void **>(&cert), cert_len, TYPE_STR);
+    ret = load_credentials();
 
-    if(ret != ESP_OK)
-    {
-        ESP_LOGE(TAG, "%s: Failed to get cert [reason: %s] ", __func__, esp_err_to_name(ret));
-        return ret;
-    }
-
-    ESP_LOGI(TAG, "%s: Got cert [length: %d, data: %s]", __func__, cert_len, (char *)cert);
-
-    size_t pvt_key_len = 0;
-    uint8_t *pvt_key = nullptr;
-
-    ret = storage->read("pvt_key", reinterpret_cast<void **>(&pvt_key), pvt_key_len, TYPE_STR);
-
-    if(ret != ESP_OK)
-    {
-        ESP_LOGE(TAG, "%s: Failed to get private key [reason: %s] ", __func__, esp_err_to_name(ret));
+    if (ret != ESP_OK)
         return ret;
-    }
-
-    size_t ca_cert_len = 0;
-    uint8_t *ca_cert = nullptr;
-
-    ret = storage->read("ca_cert", reinterpret_cast<void **>(&ca_cert), ca_cert_len, TYPE_STR);
-
-    if(ret != ESP_OK)
-    {
-        ESP_LOGE(TAG, "%s: Failed to get private key [reason: %s]", __func__, esp_err_to_name(ret));
-        return ret;
-    }
 
     httpd_ssl_config_t config = HTTPD_SSL_CONFIG_DEFAULT();
 
-    config.servercert = cert;
-    config.servercert_len = cert_len;
-    config.prvtkey_pem = pvt_key;
-    config.prvtkey_len = pvt_key_len;
-    config.cacert_pem = ca_cert;
-    config.cacert_len = ca_cert_len;
+    config.servercert = _cert;
+    config.servercert_len = _cert_len;
+    config.prvtkey_pem = _pvt_key;
+    config.prvtkey_len = _pvt_key_len;
+    config.cacert_pem = _ca_cert;
+    config.cacert_len = _ca_cert_len;
+    config.user_cb = on_tls_session;
+#ifdef CONFIG_ESP_TLS_SERVER_SESSION_TICKETS
+    // Returning clients resume with a ticket instead of repeating the full handshake.
+    config.session_tickets = true;
+#endif
+    config.httpd.max_uri_handlers = 4;
     config.httpd.uri_match_fn = httpd_uri_match_wildcard;
+#ifdef CONFIG_IOT_HOVER_SERVER_PUSH
+    config.httpd.global_user_ctx = this;
+    config.httpd.global_user_ctx_free_fn = [](void *) {};
+    config.httpd.close_fn = on_close;
+#endif
 
     ret = httpd_ssl_start(&_server, &config);
 #elif CONFIG_IOT_HOVER_SERVER_HTTP
     httpd_config_t config = HTTPD_DEFAULT_CONFIG();
     config.task_priority = 4;
     config.stack_size = 8192;
-    config.max_uri_handlers = 10;
+    config.max_uri_handlers = 4;
     config.recv_wait_timeout = 10;
     config.send_wait_timeout = 10;
     config.uri_match_fn = httpd_uri_match_wildcard;
+#ifdef CONFIG_IOT_HOVER_SERVER_PUSH
+    config.global_user_ctx = this;
+    config.global_user_ctx_free_fn = [](void *) {};
+    config.close_fn = on_close;
+#endif
 
     ret = httpd_start(&_server, &config);
 #endif
@@ -104,6 +118,63 @@ esp_err_t IotServer::start(void)
         return ret;
     }
 
+#if CONFIG_IOT_HOVER_SERVER_ASYNC_WORKERS > 0
+    if (_async_queue == nullptr) {
+        _async_queue = xQueueCreate(CONFIG_IOT_HOVER_SERVER_ASYNC_QUEUE_LEN, sizeof(iot_async_job_t));
+
+        if (_async_queue == nullptr)
+            ESP_LOGW(TAG, "%s: Failed to create the async queue, handlers will run on the server task", __func__);
+
+        for (uint8_t i = 0; _async_queue != nullptr && i < CONFIG_IOT_HOVER_SERVER_ASYNC_WORKERS; i++)
+            xTaskCreate(async_task, "iot_server_async", ASYNC_STACK_SIZE, this, 4, nullptr);
+    }
+#endif
+
+#ifdef CONFIG_IOT_HOVER_SERVER_PUSH
+    for (auto &subscriber : _subscribers)
+        subscriber.fd = -1;
+
+    if (_push_task == nullptr)
+        xTaskCreate(push_task, "iot_server_push", 3072, this, 4, &_push_task);
+
+    // Registered before the dispatcher so its wildcard doesn't shadow the websocket.
+    const httpd_uri_t push = {
+            .uri = PUSH_PATH,
+            .method = HTTP_GET,
+            .handler = on_ws,
+            .user_ctx = this,
+            .is_websocket = true,
+#ifdef CONFIG_HTTPD_WS_PRE_HANDSHAKE_CB_SUPPORT
+            .ws_pre_handshake_cb = on_ws_handshake
+#endif
+    };
+
+    ret = httpd_register_uri_handler(_server, &push);
+
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "%s: Failed to register the push channel [reason: %s]", __func__, esp_err_to_name(ret));
+        httpd_stop(_server);
+        _server = nullptr;
+        return ret;
+    }
+#endif
+
+    const httpd_uri_t dispatcher = {
+            .uri = DISPATCH_PATH,
+            .method = static_cast<httpd_method_t>(HTTP_ANY),
+            .handler = on_request,
+            .user_ctx = this
+    };
+
+    ret = httpd_register_uri_handler(_server, &dispatcher);
+
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "%s: Failed to register the route dispatcher [reason: %s]", __func__, esp_err_to_name(ret));
+        httpd_stop(_server);
+        _server = nullptr;
+        return ret;
+    }
+
     _started = true;
 
     ESP_LOGI(TAG, "%s: Component started successfully", __func__);
@@ -111,6 +182,110 @@ esp_err_t IotServer::start(void)
     return ret;
 }
 
+#if CONFIG_IOT_HOVER_SERVER_HTTPS
+/**
+ * Reads the server's certificate, private key and ca certificate from the factory storage. They are read only
+ * once and kept for the lifetime of the server, so restarting the server doesn't read or allocate them again.
+ *
+ * @return ESP_OK on success, otherwise an error code.
+ */
+esp_err_t IotServer::load_credentials(void)
+{
+    if (_cert != nullptr && _pvt_key != nullptr && _ca_cert != nullptr)
+        return ESP_OK;
+
+    auto storage = IotFactory::create_scoped<IotStorage>(IOT_NVS_FACTORY_PART_NAME,
+                                                         IOT_NVS_FACTORY_NAMESPACE);
+
+    const struct {
+        const char *key;
+        uint8_t **buf;
+        size_t *len;
+    } credentials[] = {
+            {"cert", &_cert, &_cert_len},
+            {"pvt_key", &_pvt_key, &_pvt_key_len},
+            {"ca_cert", &_ca_cert, &_ca_cert_len},
+    };
+
+    for (const auto &credential : credentials) {
+        if (*credential.buf != nullptr)
+            continue;
+
+        esp_err_t ret = storage->read(credential.key, reinterpret_cast<void **>(credential.buf), *credential.len,
+                                      IOT_TYPE_STR);
+
+        if (ret != ESP_OK) {
+            ESP_LOGE(TAG, "%s: Failed to get credential [key: %s, reason: %s]", __func__, credential.key,
+                     esp_err_to_name(ret));
+            return ret;
+        }
+
+        ESP_LOGI(TAG, "%s: Loaded credential [key: %s, length: %d]", __func__, credential.key, *credential.len);
+    }
+
+    return ESP_OK;
+}
+
+/**
+ * Counts the tls sessions created by the https server and how many of them were resumed. A session is resumed if it's
+ * the one a session ticket was parsed into during its handshake. The handshakes run one at a time on the server task,
+ * the session is compared by its address and, as a failed handshake's session may be freed and its address reused,
+ * by the start time carried in the ticket.
+ *
+ * @param[in] arg A pointer to the session's callback argument.
+ */
+void IotServer::on_tls_session(esp_https_server_user_cb_arg_t *arg)
+{
+    if (arg->user_cb_state != HTTPD_SSL_USER_CB_SESS_CREATE)
+        return;
+
+    _tls_handshakes.fetch_add(1, std::memory_order_relaxed);
+
+    const mbedtls_ssl_session *ticket = _tls_ticket_session;
+
+    _tls_ticket_session = nullptr;
+
+    auto *ssl = static_cast<mbedtls_ssl_context *>(esp_tls_get_ssl_context(const_cast<esp_tls_t *>(arg->tls)));
+
+    if (ssl == nullptr || ticket == nullptr || ssl->MBEDTLS_PRIVATE(session) != ticket)
+        return;
+
+#if defined(MBEDTLS_HAVE_TIME)
+    if (static_cast<int64_t>(ticket->MBEDTLS_PRIVATE(start)) != _tls_ticket_start)
+        return;
+#endif
+
+    _tls_resumed.fetch_add(1, std::memory_order_relaxed);
+}
+#endif
+
+#if CONFIG_IOT_HOVER_SERVER_HTTPS && defined(CONFIG_ESP_TLS_SERVER_SESSION_TICKETS)
+/**
+ * Parses a session ticket, it wraps the tls stack's parser through the linker's --wrap option. A ticket parsed
+ * successfully resumes the session it was parsed into, which is remembered for the session callback.
+ *
+ * @param[in] p_ticket A pointer to the ticket context.
+ * @param[out] session A pointer to the session to restore from the ticket.
+ * @param[in] buf A pointer to the ticket.
+ * @param[in] len The length of the ticket.
+ * @return 0 on success, otherwise an mbedtls error code.
+ */
+extern "C" int __wrap_mbedtls_ssl_ticket_parse(void *p_ticket, mbedtls_ssl_session *session, unsigned char *buf,
+                                               size_t len)
+{
+    int ret = __real_mbedtls_ssl_ticket_parse(p_ticket, session, buf, len);
+
+    if (ret == 0) {
+        IotServer::_tls_ticket_session = session;
+#if defined(MBEDTLS_HAVE_TIME)
+        IotServer::_tls_ticket_start = static_cast<int64_t>(session->MBEDTLS_PRIVATE(start));
+#endif
+    }
+
+    return ret;
+}
+#endif
+
 /**
  * Stops the components.
  */
@@ -121,32 +296,35 @@ void IotServer::stop(void)
 }
 
 /**
- * Sets the api key to use to validate request.
+ * Sets the api key to use to validate request, only its hash is kept.
  *
  * @param[in] auth The api key to set. If empty default will be used.
  */
 void IotServer::set_auth(std::string auth)
 {
     if (auth.empty())
-        _api_key = API_KEY;
-    else
-        _api_key = auth;
+        auth = API_KEY;
+
+    if (auth.length() > IOT_HTTP_MAX_API_KEY_LEN)
+        ESP_LOGW(TAG, "%s: API key is longer than the max [length: %d], requests will be rejected", __func__,
+                 IOT_HTTP_MAX_API_KEY_LEN);
+
+    mbedtls_sha256(reinterpret_cast<const unsigned char *>(auth.data()), auth.length(), _api_key_hash, 0);
 
-    ESP_LOGI(TAG, "%s: API KEY: %s", __func__, _api_key.c_str());
+    ESP_LOGI(TAG, "%s: API key set [length: %d]", __func__, auth.length());
 }
 
 /**
  * Register an http route with the server.
  *
- * @param[in] path   The URL path to register.
+ * @param[in] path   The URL path to register, relative to the base path. A trailing '*' matches a path parameter.
  * @param[in] method The http method of the route to register.
  * @param[in] handler The function to handle requests to the path.
- * @returns ESP_OK on success, ESP_FAIL or ESP_ERR_INVALID_ARG on failure.
+ * @returns ESP_OK on success, ESP_ERR_NO_MEM if the route table is full, ESP_ERR_INVALID_STATE for duplicates or
+ * ESP_ERR_INVALID_ARG on failure.
  */
-esp_err_t IotServer::register_route(const std::string path, httpd_method_t method, esp_err_t (*handler)(httpd_req_t *r))
+esp_err_t IotServer::register_route(const std::string path, httpd_method_t method, iot_route_handler_t handler)
 {
-    ESP_LOGI(TAG, "%s: Registering route", __func__);
-
     if (handler == nullptr) {
         ESP_LOGE(TAG, "%s: Handler cannot be null", __func__);
         return ESP_ERR_INVALID_ARG;
@@ -155,266 +333,1175 @@ esp_err_t IotServer::register_route(const std::string path, httpd_method_t metho
     if (!iot_valid_str(path.c_str()))
         return ESP_ERR_INVALID_ARG;
 
-    std::string uri = BASE_SERVER_PATH + path;
+    iot_route_t route{};
 
-    const httpd_uri_t uri_handler = {
-            .uri = uri.c_str(),
-            .method = method,
-            .handler = on_auth,
-            .user_ctx = (void *)handler
-    };
+    size_t len = path.length();
+    route.wildcard = path.back() == '*';
 
-    esp_err_t ret = httpd_register_uri_handler(_server, &uri_handler);
+    if (route.wildcard)
+        len--;
 
-    if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "%s: Failed to register route [path: %s, reason: %s]", __func__, uri.c_str(),
-                 esp_err_to_name(ret));
-        return ret;
+    if (len >= IOT_HTTP_MAX_ROUTE_LEN || path.find('*') < len) {
+        ESP_LOGE(TAG, "%s: Invalid route [path: %s]", __func__, path.c_str());
+        return ESP_ERR_INVALID_ARG;
     }
 
-    ESP_LOGI(TAG, "%s: Successfully registered route [path: %s]", __func__, uri.c_str());
+    memcpy(route.path, path.data(), len);
+    route.path_len = len;
+    route.method = method;
+    route.handler = handler;
 
-    return ret;
-}
+    std::lock_guard<std::mutex> lock(_routes_mutex);
 
-/**
- * Checks the request header for valid authorization.
- *
- * @param[in] req A pointer to the http request object.
- * @return ESP_OK on success, ESP_FAIL request is not authorized.
- */
-esp_err_t IotServer::on_auth(httpd_req_t *req)
-{
-    ESP_LOGI(TAG, "%s: Verifying if the request is authorized", __func__);
+    if (_route_count == CONFIG_IOT_HOVER_SERVER_MAX_ROUTES) {
+        ESP_LOGE(TAG, "%s: Route table is full [path: %s]", __func__, path.c_str());
+        return ESP_ERR_NO_MEM;
+    }
 
-    const char *hdr_key = "X-API-KEY";
+    size_t pos = lower_bound(route.path, len, route.wildcard, method);
 
-    esp_err_t ret = ESP_FAIL;
+    if (pos < _route_count && compare_route(_routes[_route_index[pos]], route.path, len, route.wildcard, method) == 0) {
+        ESP_LOGE(TAG, "%s: Route is already registered [path: %s, method: %d]", __func__, path.c_str(), method);
+        return ESP_ERR_INVALID_STATE;
+    }
 
-    size_t hdr_len = httpd_req_get_hdr_value_len(req, hdr_key);
+    _routes[_route_count] = route;
 
-    if (hdr_len < 1) {
-        ESP_LOGE(TAG, "%s: Couldn't find header [name: %s ]", __func__, hdr_key);
-        httpd_resp_send_err(req,  HTTPD_401_UNAUTHORIZED, nullptr);
-        return ret;
-    }
+    memmove(&_route_index[pos + 1], &_route_index[pos], _route_count - pos);
+    _route_index[pos] = _route_count;
+    _route_count++;
 
-    hdr_len += 1;
+    ESP_LOGI(TAG, "%s: Successfully registered route [path: %s%s, method: %d]", __func__, BASE_SERVER_PATH,
+             path.c_str(), method);
 
-    ESP_LOGI(TAG, "%s: Found header [name: %s]", __func__, hdr_key);
+    return ESP_OK;
+}
 
-    char *api_key = iot_allocate_mem<char>(hdr_len);
+/**
+ * Dispatches a request under the base path to its route, after checking the request is authorized. Unauthorized
+ * requests are answered with a 401 before the route is resolved, whether or not it exists.
+ *
+ * @param[in] req A pointer to the http request object.
+ * @return ESP_OK on success, otherwise an error code which closes the connection.
+ */
+esp_err_t IotServer::on_request(httpd_req_t *req)
+{
+    int64_t start = esp_timer_get_time();
 
-    if (api_key == nullptr)
-        return ret;
+    iot_route_ctx_t ctx{};
+    ctx.tag = IOT_HTTP_ROUTE_CTX_TAG;
+    ctx.server = static_cast<IotServer *>(req->user_ctx);
+    ctx.start = start;
+    req->user_ctx = &ctx;
 
-    ret = httpd_req_get_hdr_value_str(req, hdr_key, api_key, hdr_len);
+    if (ctx.server->admit(req) != ESP_OK)
+        return ESP_OK;
 
-    if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "%s: Couldn't GET header [name: %s ] value", __func__, hdr_key);
-        iot_free_one(api_key);
-        httpd_resp_send_err(req,  HTTPD_401_UNAUTHORIZED, nullptr);
-        return ret;
+    // Authenticated before routing, so unauthorized clients can't probe which routes and methods exist.
+    if (on_auth(req) != ESP_OK) {
+        ctx.server->_rejected_auth.fetch_add(1, std::memory_order_relaxed);
+        return ESP_FAIL;
     }
 
-    ESP_LOGI(TAG, "%s: %s Header value retrieved, verifying match", __func__, hdr_key);
-
-    ret = _api_key == api_key ? ESP_OK : ESP_FAIL;
+    size_t base_len = strlen(BASE_SERVER_PATH);
+    const char *path = strncmp(req->uri, BASE_SERVER_PATH, base_len) == 0 ? req->uri + base_len : "";
+    size_t len = strcspn(path, "?#");
 
-    ESP_LOGI(TAG, "%s: Request [state: %s]", __func__, ret == ESP_OK ? "authorized" : "unauthorized");
+    esp_err_t ret = ctx.server->find_route(path, len, static_cast<httpd_method_t>(req->method), &ctx);
 
-    iot_free_one(api_key);
+    if (ret == ESP_ERR_NOT_FOUND) {
+        ctx.server->_unmatched.fetch_add(1, std::memory_order_relaxed);
+        ctx.server->send_err(req, "The requested resource could not be found", IOT_HTTP_STATUS_404_NOT_FOUND);
+        return ESP_OK;
+    }
 
-    if (ret == ESP_OK) {
-        iot_not_null(req->user_ctx);
-        auto handler = reinterpret_cast<esp_err_t (*)(httpd_req_t *)>(req->user_ctx);
-        return handler(req);
+    if (ret == ESP_ERR_NOT_SUPPORTED) {
+        ctx.server->_unmatched.fetch_add(1, std::memory_order_relaxed);
+        ctx.server->send_err(req, "The requested method is not allowed", IOT_HTTP_STATUS_405_METHOD_NOT_ALLOWED);
+        return ESP_OK;
     }
 
-    httpd_resp_send_err(req,  HTTPD_401_UNAUTHORIZED, nullptr);
+    ret = ctx.server->_routes[ctx.route].handler(req);
+
+    // A detached request is recorded by the async worker once its handler is done.
+    if (!ctx.detached)
+        ctx.server->record_request(ctx, req, ret, esp_timer_get_time() - start);
 
     return ret;
 }
 
 /**
- * Sends an http success response.
+ * Decides whether to handle a request before it's routed, so overload is shed before anything is allocated.
+ * Requests are rejected with a 503 while the free heap is below the watermark, and with a 429 when the global
+ * or the client's token bucket is empty.
  *
  * @param[in] req A pointer to the http request object.
- * @param[in] body The response data.
- * @param[in] status The response status. Default is 200.
- * @param[in] message Whether the response body is just plain text and not json. Default is false
- * @return ESP_OK on success, otherwise an error code
+ * @return ESP_OK if the request is admitted, otherwise ESP_FAIL after responding.
+ * @note Only runs on the server task, so the buckets aren't locked.
  */
-esp_err_t IotServer::send_res(httpd_req_t *req, const char *data, bool message, iot_http_status_e status)
+esp_err_t IotServer::admit(httpd_req_t *req)
 {
-    httpd_resp_set_status(req, std::to_string(status).c_str());
-
-    bool parse_error = false;
+#if CONFIG_IOT_HOVER_SERVER_MIN_FREE_HEAP > 0
+    if (heap_caps_get_free_size(MALLOC_CAP_8BIT) < CONFIG_IOT_HOVER_SERVER_MIN_FREE_HEAP) {
+        _rejected_heap.fetch_add(1, std::memory_order_relaxed);
+        ESP_LOGW(TAG, "%s: Free heap is below the watermark, shedding request [uri: %s]", __func__, req->uri);
+        httpd_resp_set_hdr(req, "Retry-After", "1");
+        send_err(req, "The device is overloaded, try again later", IOT_HTTP_STATUS_503_SERVICE_UNAVAILABLE);
+        return ESP_FAIL;
+    }
+#endif
 
-    char *buf;
+#ifdef CONFIG_IOT_HOVER_SERVER_RATE_LIMIT
+    auto now = static_cast<uint32_t>(esp_timer_get_time() / 1000);
 
-    cJSON *res = cJSON_CreateObject();
+    // The client's bucket goes first, so a client over its own rate doesn't drain the bucket shared by the others.
+    iot_token_bucket_t *bucket = client_bucket(req, now);
+    uint32_t wait_ms = take_token(bucket, now, CONFIG_IOT_HOVER_SERVER_CLIENT_RATE,
+                                  CONFIG_IOT_HOVER_SERVER_CLIENT_BURST);
 
-    if (res == nullptr) {
-        parse_error = true;
-    } else {
-        if (message)
-            cJSON_AddStringToObject(res, "message", data);
-        else {
-            if (data != nullptr)
-                cJSON_AddRawToObject(res, "data", data);
-        }
+    if (wait_ms == 0) {
+        wait_ms = take_token(&_global_bucket, now, CONFIG_IOT_HOVER_SERVER_GLOBAL_RATE,
+                             CONFIG_IOT_HOVER_SERVER_GLOBAL_BURST);
 
-        cJSON_AddNumberToObject(res, "status", status);
-        cJSON_AddStringToObject(res, "timestamp", iot_now_str().data());
+        // A request shed for the others' load doesn't count against the client, its token is given back.
+        if (wait_ms > 0)
+            bucket->tokens += 1000;
     }
 
-    if (!parse_error) {
-        buf = cJSON_Print(res);
+    if (wait_ms > 0) {
+        // Must outlive the response, the header value isn't copied.
+        char retry_after[11];
 
-        if (buf == nullptr)
-            parse_error = true;
+        _rejected_rate.fetch_add(1, std::memory_order_relaxed);
+        snprintf(retry_after, sizeof(retry_after), "%" PRIu32, (wait_ms + 999) / 1000);
+        httpd_resp_set_hdr(req, "Retry-After", retry_after);
+        send_err(req, "Too many requests, try again later", IOT_HTTP_STATUS_429_TOO_MANY_REQUESTS);
+        return ESP_FAIL;
     }
+#endif
 
-    esp_err_t ret;
+    return ESP_OK;
+}
 
-    size_t len =  data == nullptr ? 0 : HTTPD_RESP_USE_STRLEN;
+#ifdef CONFIG_IOT_HOVER_SERVER_RATE_LIMIT
+/**
+ * Gets the token bucket of the client of a request, replacing the least recently seen client if it's new.
+ *
+ * @param[in] req A pointer to the http request object.
+ * @param[in] now The current time in milliseconds.
+ * @return A pointer to the client's token bucket.
+ */
+iot_token_bucket_t *IotServer::client_bucket(httpd_req_t *req, uint32_t now)
+{
+    struct sockaddr_storage peer{};
+    socklen_t peer_len = sizeof(peer);
+    uint8_t family = AF_UNSPEC;
+    uint8_t addr[sizeof(iot_rate_client_t::addr)]{};
+
+    // Clients are told apart by their full address, ipv4 clients are the same whether or not they're mapped.
+    if (getpeername(httpd_req_to_sockfd(req), reinterpret_cast<struct sockaddr *>(&peer), &peer_len) == 0) {
+        if (peer.ss_family == AF_INET) {
+            family = AF_INET;
+            memcpy(addr, &reinterpret_cast<struct sockaddr_in *>(&peer)->sin_addr.s_addr, 4);
+        }
+#if LWIP_IPV6
+        if (peer.ss_family == AF_INET6) {
+            const uint32_t *words = reinterpret_cast<struct sockaddr_in6 *>(&peer)->sin6_addr.un.u32_addr;
+
+            if (words[0] == 0 && words[1] == 0 && words[2] == htonl(0xffff)) {
+                family = AF_INET;
+                memcpy(addr, &words[3], 4);
+            } else {
+                family = AF_INET6;
+                memcpy(addr, words, sizeof(addr));
+            }
+        }
+#endif
+    }
 
-    if (parse_error) {
-        httpd_resp_set_type(req, HTTPD_TYPE_JSON);
-        ret = httpd_resp_send(req,  data, len);
-    } else {
-        httpd_resp_set_type(req, HTTPD_TYPE_TEXT);
+    iot_rate_client_t *oldest = &_clients[0];
 
-        ret = httpd_resp_send(req, buf, len);
+    for (auto &client : _clients) {
+        if (client.family == family && memcmp(client.addr, addr, sizeof(addr)) == 0 && client.bucket.updated != 0)
+            return &client.bucket;
 
-        iot_free(buf);
-        cJSON_Delete(res);
+        if (now - client.bucket.updated > now - oldest->bucket.updated)
+            oldest = &client;
     }
 
-    return ret;
+    oldest->family = family;
+    memcpy(oldest->addr, addr, sizeof(addr));
+    oldest->bucket = {.tokens = CONFIG_IOT_HOVER_SERVER_CLIENT_BURST * 1000UL, .updated = now};
+
+    return &oldest->bucket;
 }
 
 /**
- * Gets the request body.
+ * Refills a token bucket for the time elapsed since it was last updated and takes a token from it.
  *
- * @param[in] req A pointer to the http request object.
- * @param[out] buf A pointer to the buffer to store the request body.
- * @param[in] buf_len The length of the buffer.
- * @return ESP_OK on success, otherwise an error code.
+ * @param[in] bucket A pointer to the token bucket.
+ * @param[in] now The current time in milliseconds.
+ * @param[in] rate The number of tokens added per second.
+ * @param[in] burst The capacity of the bucket.
+ * @return 0 if a token was taken, otherwise the number of milliseconds until one is available.
  */
-esp_err_t IotServer::get_body(httpd_req_t *req, char *buf, size_t buf_len)
+uint32_t IotServer::take_token(iot_token_bucket_t *bucket, uint32_t now, uint32_t rate, uint32_t burst)
 {
-    ESP_LOGI(TAG, "%s: Reading payload", __func__);
+    uint32_t capacity = burst * 1000;
 
-    int ret = httpd_req_recv(req, buf, buf_len);
-
-    if (ret <= 0) {
-        ESP_LOGE(TAG, "%s: Failed to read payload [reason: %s]", __func__, esp_err_to_name(ret));
-        return ESP_FAIL;
+    if (bucket->updated == 0) {
+        bucket->tokens = capacity;
+    } else {
+        // Thousandths of a token per millisecond is the same as tokens per second.
+        uint64_t tokens = bucket->tokens + static_cast<uint64_t>(now - bucket->updated) * rate;
+        bucket->tokens = tokens > capacity ? capacity : tokens;
     }
 
-    buf[buf_len] = '\0';
+    bucket->updated = now == 0 ? 1 : now;
 
-    ESP_LOGI(TAG, "%s: Successfully read [payload: %s]", __func__, buf);
+    if (bucket->tokens < 1000)
+        return (1000 - bucket->tokens + rate - 1) / rate;
 
-    return ESP_OK;
+    bucket->tokens -= 1000;
+
+    return 0;
 }
+#endif
 
 /**
- * Sends an error response.
+ * Records the statistics of a dispatched request in its route's counters.
  *
+ * @param[in] ctx The context of the dispatched request.
  * @param[in] req A pointer to the http request object.
- * @param[in] message The error message. Default is DEFAULT_ERR_MSG define.
- * @param[in] status The error status. Default is 500
- * @return ESP_FAIL.
+ * @param[in] ret The result of handling the request.
+ * @param[in] elapsed_us The time it took to handle the request in microseconds.
  */
-esp_err_t IotServer::send_err(httpd_req_t *req, const char *message, iot_http_status_e status)
+void IotServer::record_request(const iot_route_ctx_t &ctx, httpd_req_t *req, esp_err_t ret, int64_t elapsed_us)
 {
-    bool parse_error = false;
-
-    char *buf;
+    iot_route_stats_t &stats = _stats[ctx.route];
 
-    cJSON *res = cJSON_CreateObject();
+    uint32_t elapsed_ms = elapsed_us / 1000;
+    uint8_t bucket = 0;
 
-    if (res == nullptr) {
-        parse_error = true;
-    } else {
-        cJSON_AddStringToObject(res, "problem", message);
-        cJSON_AddNumberToObject(res, "status", status);
-        cJSON_AddStringToObject(res, "timestamp", iot_now_str().data());
-    }
-    
-    if (!parse_error) {
-        buf = cJSON_Print(res);
+    while (bucket < IOT_HTTP_LATENCY_BUCKETS - 1 && elapsed_us > LATENCY_BOUNDS_MS[bucket] * 1000LL)
+        bucket++;
 
-        if (buf == nullptr)
-            parse_error = true;
-    }
+    stats.requests.fetch_add(1, std::memory_order_relaxed);
+    stats.bytes_in.fetch_add(req->content_len, std::memory_order_relaxed);
+    stats.bytes_out.fetch_add(ctx.bytes_out, std::memory_order_relaxed);
+    stats.latency_sum_ms.fetch_add(elapsed_ms, std::memory_order_relaxed);
+    stats.latency[bucket].fetch_add(1, std::memory_order_relaxed);
 
-    if (parse_error) {
-        httpd_resp_set_type(req, HTTPD_TYPE_TEXT);
-        httpd_resp_send_err(req,  HTTPD_500_INTERNAL_SERVER_ERROR, message);
-    } else {
-        httpd_resp_set_type(req, HTTPD_TYPE_JSON);
-        httpd_resp_set_status(req, std::to_string(status).c_str());
+    if (ret != ESP_OK || ctx.status >= IOT_HTTP_STATUS_400_BAD_REQUEST)
+        stats.errors.fetch_add(1, std::memory_order_relaxed);
+}
 
-        httpd_resp_send(req, buf, HTTPD_RESP_USE_STRLEN);
+/**
+ * Records the status and size of a response in the context of the request, if it's being dispatched.
+ *
+ * @param[in] req A pointer to the http request object.
+ * @param[in] status The response status.
+ * @param[in] bytes The number of response body bytes sent.
+ */
+void IotServer::record_response(httpd_req_t *req, iot_http_status_e status, size_t bytes)
+{
+    iot_route_ctx_t *ctx = route_ctx(req);
 
-        cJSON_free(buf);
-        cJSON_Delete(res);
-    }
+    if (ctx == nullptr)
+        return;
 
-    return ESP_FAIL;
+    ctx->status = status;
+    ctx->bytes_out += bytes;
 }
 
 /**
- * Get the URL query value string from an URL query string.
+ * Handles requests for the server's metrics.
  *
- * @param[in] query  A pointer to the URL query string.
- * @param[in] key    A pointer to the URL query string key.
- * @param[out] value A pointer to the buf to store the URL query string.
- * @return ESP_OK on success, otherwise an error code
- * @note Ensure to free the query_string after usage.
+ * @param[in] req A pointer to the http request object.
+ * @return ESP_OK on success, otherwise an error code.
  */
-esp_err_t IotServer::get_query_value(const char *query, const char *key, char **value)
+esp_err_t IotServer::on_metrics(httpd_req_t *req)
 {
-    char *buf = iot_allocate_mem<char>(MAX_QUERY_VALUE_SIZE);
+    iot_route_ctx_t *ctx = route_ctx(req);
 
-    esp_err_t ret = httpd_query_key_value(query, key, buf, MAX_QUERY_VALUE_SIZE);
+    if (ctx == nullptr)
+        return ESP_FAIL;
 
-    if (ret != ESP_OK) {
-        free(buf);
-        ESP_LOGE(TAG, "%s: Error getting value from -> %s", __func__, query);
-        return ret;
-    }
+    return ctx->server->send_metrics(req);
+}
 
-    buf[MAX_QUERY_VALUE_SIZE] = '\0';
+/**
+ * Gets the route context of a request being dispatched. Handlers registered outside the dispatcher, like the push
+ * channel's, have the server as their user context, so the context is only taken for a route context once its tag
+ * matches.
+ *
+ * @param[in] req A pointer to the http request object.
+ * @return A pointer to the route context, or nullptr if the request isn't being dispatched.
+ */
+iot_route_ctx_t *IotServer::route_ctx(httpd_req_t *req)
+{
+    uint32_t tag;
 
-    *value = buf;
-    return ESP_OK;
+    if (req->user_ctx == nullptr)
+        return nullptr;
+
+    // Read as bytes, the context may be any object at least as large as the tag.
+    memcpy(&tag, req->user_ctx, sizeof(tag));
+
+    return tag == IOT_HTTP_ROUTE_CTX_TAG ? static_cast<iot_route_ctx_t *>(req->user_ctx) : nullptr;
 }
 
 /**
- * Gets the path parameter or resource identifier from the requested url.
+ * Sends the route statistics in the prometheus text exposition format.
  *
  * @param[in] req A pointer to the http request object.
- * @param[in] path The path to search for within the url.
- * @return std::string The path parameter if found, otherwise an empty string.
+ * @return ESP_OK on success, otherwise an error code.
  */
-std::string IotServer::get_path_param(httpd_req_t *req, std::string path)
+esp_err_t IotServer::send_metrics(httpd_req_t *req)
 {
-    ESP_LOGI(TAG, "%s: Getting path param from [url:  %s]", __func__, req->uri);
+    static constexpr struct {
+        const char *name;
+        std::atomic<uint32_t> iot_route_stats_t::*counter;
+    } counters[] = {
+            {"iot_http_requests_total", &iot_route_stats_t::requests},
+            {"iot_http_errors_total", &iot_route_stats_t::errors},
+            {"iot_http_bytes_in_total", &iot_route_stats_t::bytes_in},
+            {"iot_http_bytes_out_total", &iot_route_stats_t::bytes_out},
+    };
+
+    uint8_t count;
+
+    {
+        std::lock_guard<std::mutex> lock(_routes_mutex);
+        count = _route_count;
+    }
+
+    char labels[IOT_HTTP_MAX_ROUTE_LEN + 32];
+    char line[IOT_HTTP_MAX_ROUTE_LEN + 96];
+
+    auto route_labels = [&](uint8_t i) {
+        const iot_route_t &route = _routes[i];
+        snprintf(labels, sizeof(labels), "route=\"%.*s%s\",method=\"%s\"", route.path_len, route.path,
+                 route.wildcard ? "*" : "", http_method_str(static_cast<http_method>(route.method)));
+    };
+
+    IotResWriter writer(req);
+
+    writer.begin(IOT_HTTP_STATUS_200_OK, "text/plain; version=0.0.4");
+
+    for (const auto &counter : counters) {
+        writer.raw(line, snprintf(line, sizeof(line), "# TYPE %s counter\n", counter.name));
 
-    std::string uri(req->uri);
+        for (uint8_t i = 0; i < count; i++) {
+            route_labels(i);
+            writer.raw(line, snprintf(line, sizeof(line), "%s{%s} %" PRIu32 "\n", counter.name, labels,
+                                      (_stats[i].*counter.counter).load(std::memory_order_relaxed)));
+        }
+    }
+
+    writer.raw("# TYPE iot_http_unmatched_total counter\n");
+    writer.raw(line, snprintf(line, sizeof(line), "iot_http_unmatched_total %" PRIu32 "\n",
+                              _unmatched.load(std::memory_order_relaxed)));
+
+#if CONFIG_IOT_HOVER_SERVER_HTTPS
+    uint32_t handshakes = _tls_handshakes.load(std::memory_order_relaxed);
+    uint32_t resumed = _tls_resumed.load(std::memory_order_relaxed);
+
+    writer.raw("# TYPE iot_tls_handshakes_total counter\n");
+    writer.raw(line, snprintf(line, sizeof(line), "iot_tls_handshakes_total %" PRIu32 "\n", handshakes));
+    writer.raw("# TYPE iot_tls_resumed_total counter\n");
+    writer.raw(line, snprintf(line, sizeof(line), "iot_tls_resumed_total %" PRIu32 "\n", resumed));
+    writer.raw("# TYPE iot_tls_resumption_ratio gauge\n");
+    writer.raw(line, snprintf(line, sizeof(line), "iot_tls_resumption_ratio %.3f\n",
+                              handshakes == 0 ? 0.0 : static_cast<double>(resumed) / handshakes));
+#endif
+
+    writer.raw("# TYPE iot_http_rejected_total counter\n");
+    writer.raw(line, snprintf(line, sizeof(line), "iot_http_rejected_total{reason=\"rate\"} %" PRIu32 "\n",
+                              _rejected_rate.load(std::memory_order_relaxed)));
+    writer.raw(line, snprintf(line, sizeof(line), "iot_http_rejected_total{reason=\"heap\"} %" PRIu32 "\n",
+                              _rejected_heap.load(std::memory_order_relaxed)));
+    writer.raw(line, snprintf(line, sizeof(line), "iot_http_rejected_total{reason=\"auth\"} %" PRIu32 "\n",
+                              _rejected_auth.load(std::memory_order_relaxed)));
+
+#ifdef CONFIG_IOT_HOVER_SERVER_PUSH
+    writer.raw("# TYPE iot_ws_subscribers gauge\n");
+    writer.raw(line, snprintf(line, sizeof(line), "iot_ws_subscribers %" PRIu8 "\n",
+                              _subscriber_count.load(std::memory_order_relaxed)));
+    writer.raw("# TYPE iot_ws_dropped_total counter\n");
+    writer.raw(line, snprintf(line, sizeof(line), "iot_ws_dropped_total %" PRIu32 "\n",
+                              _ws_dropped.load(std::memory_order_relaxed)));
+#endif
 
-    size_t start = uri.find(path);
+    writer.raw("# TYPE iot_http_request_duration_ms histogram\n");
 
-    if (start != std::string::npos) {
-        return uri.substr(start + path.length());
+    for (uint8_t i = 0; i < count; i++) {
+        const iot_route_stats_t &stats = _stats[i];
+        uint32_t cumulative = 0;
+
+        route_labels(i);
+
+        for (uint8_t bucket = 0; bucket < IOT_HTTP_LATENCY_BUCKETS; bucket++) {
+            cumulative += stats.latency[bucket].load(std::memory_order_relaxed);
+
+            if (bucket < IOT_HTTP_LATENCY_BUCKETS - 1)
+                writer.raw(line, snprintf(line, sizeof(line),
+                                          "iot_http_request_duration_ms_bucket{%s,le=\"%" PRIu16 "\"} %" PRIu32 "\n",
+                                          labels, LATENCY_BOUNDS_MS[bucket], cumulative));
+            else
+                writer.raw(line, snprintf(line, sizeof(line),
+                                          "iot_http_request_duration_ms_bucket{%s,le=\"+Inf\"} %" PRIu32 "\n",
+                                          labels, cumulative));
+        }
+
+        writer.raw(line, snprintf(line, sizeof(line), "iot_http_request_duration_ms_sum{%s} %" PRIu32 "\n", labels,
+                                  stats.latency_sum_ms.load(std::memory_order_relaxed)));
+        writer.raw(line, snprintf(line, sizeof(line), "iot_http_request_duration_ms_count{%s} %" PRIu32 "\n", labels,
+                                  cumulative));
     }
 
-    ESP_LOGW(TAG, "%s: Path param not found for the [path: %s]", __func__, path.c_str());
+    esp_err_t ret = writer.end();
+
+    record_response(req, IOT_HTTP_STATUS_200_OK, writer.written());
 
-    return "";
-}
\ No newline at end of file
+    return ret;
+}
+
+/**
+ * Finds the route of a request path, exact paths take precedence over the longest matching wildcard prefix.
+ *
+ * @param[in] path A pointer to the request path relative to the base path.
+ * @param[in] len The length of the path, excluding the query.
+ * @param[in] method The http method of the request.
+ * @param[out] ctx A pointer to the context to fill with the matched route and path parameter.
+ * @return ESP_OK if found, ESP_ERR_NOT_FOUND if no path matched, or ESP_ERR_NOT_SUPPORTED if the method didn't.
+ */
+esp_err_t IotServer::find_route(const char *path, size_t len, httpd_method_t method, iot_route_ctx_t *ctx)
+{
+    std::lock_guard<std::mutex> lock(_routes_mutex);
+
+    bool path_found = false;
+
+    if (match_route(path, len, false, method, &ctx->route, &path_found)) {
+        ctx->param = path + len;
+        ctx->param_len = 0;
+        return ESP_OK;
+    }
+
+    for (size_t prefix = len; ; prefix--) {
+        if ((prefix == 0 || path[prefix - 1] == '/') &&
+            match_route(path, prefix, true, method, &ctx->route, &path_found)) {
+            ctx->param = path + prefix;
+            ctx->param_len = len - prefix;
+            return ESP_OK;
+        }
+
+        if (prefix == 0)
+            break;
+    }
+
+    return path_found ? ESP_ERR_NOT_SUPPORTED : ESP_ERR_NOT_FOUND;
+}
+
+/**
+ * Looks up a route by its path, wildcard flag and method in the sorted route index.
+ *
+ * @param[in] path A pointer to the path.
+ * @param[in] len The length of the path.
+ * @param[in] wildcard Whether to look up a wildcard route.
+ * @param[in] method The http method.
+ * @param[out] route A pointer to set to the index of the matched route.
+ * @param[out] path_found A pointer which is set to true if a route with the path exists for any method.
+ * @return true if a route matched, otherwise false.
+ */
+bool IotServer::match_route(const char *path, size_t len, bool wildcard, httpd_method_t method, uint8_t *route,
+                            bool *path_found)
+{
+    for (size_t i = lower_bound(path, len, wildcard, INT_MIN); i < _route_count; i++) {
+        const iot_route_t &candidate = _routes[_route_index[i]];
+
+        if (compare_route(candidate, path, len, wildcard, candidate.method) != 0)
+            break;
+
+        *path_found = true;
+
+        if (candidate.method == method) {
+            *route = _route_index[i];
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Finds the position of the first route in the sorted index which is not less than the given key.
+ *
+ * @param[in] path A pointer to the path.
+ * @param[in] len The length of the path.
+ * @param[in] wildcard The wildcard flag.
+ * @param[in] method The http method.
+ * @return The position in the sorted index.
+ */
+size_t IotServer::lower_bound(const char *path, size_t len, bool wildcard, int method)
+{
+    size_t low = 0;
+    size_t high = _route_count;
+
+    while (low < high) {
+        size_t mid = (low + high) / 2;
+
+        if (compare_route(_routes[_route_index[mid]], path, len, wildcard, method) < 0)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    return low;
+}
+
+/**
+ * Compares a route with a key ordering by path, then the wildcard flag, then the method.
+ *
+ * @param[in] route The route to compare.
+ * @param[in] path A pointer to the path of the key.
+ * @param[in] len The length of the path of the key.
+ * @param[in] wildcard The wildcard flag of the key.
+ * @param[in] method The http method of the key.
+ * @return Less than, equal to or greater than zero if the route is less than, equal to or greater than the key.
+ */
+int IotServer::compare_route(const iot_route_t &route, const char *path, size_t len, bool wildcard, int method)
+{
+    int ret = memcmp(route.path, path, std::min<size_t>(route.path_len, len));
+
+    if (ret != 0)
+        return ret;
+
+    if (route.path_len != len)
+        return route.path_len < len ? -1 : 1;
+
+    if (route.wildcard != wildcard)
+        return route.wildcard ? 1 : -1;
+
+    if (route.method != method)
+        return route.method < method ? -1 : 1;
+
+    return 0;
+}
+
+/**
+ * Checks the request header for valid authorization, responding with a 401 if it isn't.
+ *
+ * @param[in] req A pointer to the http request object.
+ * @return ESP_OK if the request is authorized, otherwise ESP_FAIL after responding with a 401.
+ */
+esp_err_t IotServer::on_auth(httpd_req_t *req)
+{
+    if (is_authorized(req))
+        return ESP_OK;
+
+    httpd_resp_send_err(req, HTTPD_401_UNAUTHORIZED, nullptr);
+
+    return ESP_FAIL;
+}
+
+/**
+ * Checks the request header for a valid api key.
+ *
+ * @param[in] req A pointer to the http request object.
+ * @return true if the request is authorized, otherwise false.
+ * @note Runs on every request, it doesn't allocate and only logs failures.
+ */
+bool IotServer::is_authorized(httpd_req_t *req)
+{
+    static constexpr const char *hdr_key = "X-API-KEY";
+
+    char api_key[IOT_HTTP_MAX_API_KEY_LEN + 1];
+    uint8_t hash[IOT_HTTP_API_KEY_HASH_LEN];
+
+    size_t hdr_len = httpd_req_get_hdr_value_len(req, hdr_key);
+
+    if (hdr_len < 1 || hdr_len > IOT_HTTP_MAX_API_KEY_LEN ||
+        httpd_req_get_hdr_value_str(req, hdr_key, api_key, sizeof(api_key)) != ESP_OK) {
+        ESP_LOGW(TAG, "%s: Request is unauthorized, header missing or invalid [name: %s]", __func__, hdr_key);
+        return false;
+    }
+
+    mbedtls_sha256(reinterpret_cast<const unsigned char *>(api_key), hdr_len, hash, 0);
+
+    // Constant time so the comparison doesn't leak how much of the key matched.
+    uint8_t diff = 0;
+
+    for (size_t i = 0; i < IOT_HTTP_API_KEY_HASH_LEN; i++)
+        diff |= hash[i] ^ _api_key_hash[i];
+
+    if (diff != 0) {
+        ESP_LOGW(TAG, "%s: Request is unauthorized, api key mismatch", __func__);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Sends an http success response.
+ *
+ * @param[in] req A pointer to the http request object.
+ * @param[in] data The response data, which is json unless message is true.
+ * @param[in] message Whether the response body is just plain text and not json. Default is false
+ * @param[in] status The response status. Default is 200.
+ * @return ESP_OK on success, otherwise an error code
+ */
+esp_err_t IotServer::send_res(httpd_req_t *req, const char *data, bool message, iot_http_status_e status)
+{
+    IotResWriter writer(req);
+
+    writer.begin(status);
+    writer.begin_object();
+
+    if (message)
+        writer.add_str("message", data);
+    else if (data != nullptr)
+        writer.add_raw("data", data);
+
+    return end_envelope(req, writer, status);
+}
+
+/**
+ * Sends an http success response, streaming the data straight into the response envelope.
+ *
+ * @param[in] req A pointer to the http request object.
+ * @param[in] body The function used to write the response data, it must write exactly one json value.
+ * @param[in] status The response status. Default is 200.
+ * @return ESP_OK on success, otherwise an error code, the response is left unterminated and the handler must return
+ *         the error so the connection is closed.
+ */
+esp_err_t IotServer::send_res(httpd_req_t *req, const std::function<esp_err_t(IotResWriter &)> &body,
+                              iot_http_status_e status)
+{
+    IotResWriter writer(req);
+
+    writer.begin(status);
+    writer.begin_object();
+    writer.key("data");
+
+    esp_err_t ret = body(writer);
+
+    // Part of the response may be out already. It isn't terminated, so the client can't take the truncated body for
+    // a complete one, and the error makes httpd close the connection.
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "%s: Failed to write response data [reason: %s]", __func__, esp_err_to_name(ret));
+        record_response(req, IOT_HTTP_STATUS_500_INT_SERVER_ERROR, writer.written());
+        return ret;
+    }
+
+    return end_envelope(req, writer, status);
+}
+
+/**
+ * Sends a pre-serialized json document with an entity tag, or an empty 304 response if the client already has it.
+ *
+ * @param[in] req A pointer to the http request object.
+ * @param[in] data A pointer to the serialized json document.
+ * @param[in] len The length of the document.
+ * @param[in] etag The quoted entity tag of the document.
+ * @return ESP_OK on success, otherwise an error code
+ */
+esp_err_t IotServer::send_cached(httpd_req_t *req, const char *data, size_t len, const char *etag)
+{
+    char if_none_match[IOT_HTTP_MAX_ETAG_LEN];
+
+    size_t hdr_len = httpd_req_get_hdr_value_len(req, "If-None-Match");
+
+    httpd_resp_set_hdr(req, "ETag", etag);
+    httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+
+    if (hdr_len > 0 && hdr_len < sizeof(if_none_match) &&
+        httpd_req_get_hdr_value_str(req, "If-None-Match", if_none_match, sizeof(if_none_match)) == ESP_OK &&
+        (strcmp(if_none_match, "*") == 0 || strstr(if_none_match, etag) != nullptr)) {
+        httpd_resp_set_status(req, IotResWriter::status_str(IOT_HTTP_STATUS_304_NOT_MODIFIED));
+        record_response(req, IOT_HTTP_STATUS_304_NOT_MODIFIED, 0);
+        return httpd_resp_send(req, nullptr, 0);
+    }
+
+    IotResWriter writer(req);
+
+    writer.begin(IOT_HTTP_STATUS_200_OK);
+    writer.begin_object();
+    writer.add_raw("data", data, len);
+
+    return end_envelope(req, writer, IOT_HTTP_STATUS_200_OK);
+}
+
+/**
+ * Gets the request body as a null terminated string, reading until the whole body or as much as fits is received.
+ *
+ * @param[in] req A pointer to the http request object.
+ * @param[out] buf A pointer to the buffer to store the request body.
+ * @param[in] buf_len The length of the buffer, including space for the null terminator.
+ * @return ESP_OK on success, otherwise an error code.
+ */
+esp_err_t IotServer::get_body(httpd_req_t *req, char *buf, size_t buf_len)
+{
+    if (buf_len == 0)
+        return ESP_ERR_INVALID_SIZE;
+
+    size_t len = std::min(req->content_len, buf_len - 1);
+    size_t received = 0;
+
+    // The body may arrive over several reads, a single recv could truncate it.
+    while (received < len) {
+        int ret = httpd_req_recv(req, buf + received, len - received);
+
+        if (ret <= 0) {
+            ESP_LOGE(TAG, "%s: Failed to read payload [reason: %d, received: %d]", __func__, ret, received);
+            return ESP_FAIL;
+        }
+
+        received += ret;
+    }
+
+    buf[received] = '\0';
+
+    ESP_LOGD(TAG, "%s: Successfully read payload [length: %d]", __func__, received);
+
+    return ESP_OK;
+}
+
+/**
+ * Sends an error response.
+ *
+ * @param[in] req A pointer to the http request object.
+ * @param[in] message The error message. Default is DEFAULT_ERR_MSG define.
+ * @param[in] status The error status. Default is 500
+ * @return ESP_FAIL.
+ */
+esp_err_t IotServer::send_err(httpd_req_t *req, const char *message, iot_http_status_e status)
+{
+    IotResWriter writer(req);
+
+    writer.begin(status);
+    writer.begin_object();
+    writer.add_str("problem", message == nullptr ? IOT_HTTP_DEFAULT_ERR_MSG : message);
+
+    end_envelope(req, writer, status);
+
+    return ESP_FAIL;
+}
+
+/**
+ * Writes the status and timestamp of the response envelope, closes it and ends the response.
+ *
+ * @param[in] req A pointer to the http request object.
+ * @param[in] writer The writer of the response, with the envelope object still open.
+ * @param[in] status The response status.
+ * @return ESP_OK on success, otherwise an error code
+ */
+esp_err_t IotServer::end_envelope(httpd_req_t *req, IotResWriter &writer, iot_http_status_e status)
+{
+    char timestamp[32];
+    size_t len = iot_now_str(timestamp, sizeof(timestamp));
+
+    writer.add_uint("status", status);
+    writer.add_str("timestamp", timestamp, len);
+    writer.end_object();
+
+    esp_err_t ret = writer.end();
+
+    record_response(req, status, writer.written());
+
+    return ret;
+}
+
+/**
+ * Get the URL query value string from an URL query string.
+ *
+ * @param[in] query  A pointer to the URL query string.
+ * @param[in] key    A pointer to the URL query string key.
+ * @param[out] value A pointer to the buf to store the URL query string.
+ * @return ESP_OK on success, otherwise an error code
+ * @note Ensure to free the query_string after usage.
+ */
+esp_err_t IotServer::get_query_value(const char *query, const char *key, char **value)
+{
+    char *buf = iot_allocate_mem<char>(MAX_QUERY_VALUE_SIZE);
+
+    esp_err_t ret = httpd_query_key_value(query, key, buf, MAX_QUERY_VALUE_SIZE);
+
+    if (ret != ESP_OK) {
+        free(buf);
+        ESP_LOGE(TAG, "%s: Error getting value from -> %s", __func__, query);
+        return ret;
+    }
+
+    buf[MAX_QUERY_VALUE_SIZE] = '\0';
+
+    *value = buf;
+    return ESP_OK;
+}
+
+/**
+ * Gets the path parameter or resource identifier matched by the wildcard of the request's route.
+ *
+ * @param[in] req A pointer to the http request object.
+ * @return std::string_view A view of the path parameter within the request uri, empty if there is none.
+ * @note The view is only valid for the lifetime of the request.
+ */
+std::string_view IotServer::get_path_param(httpd_req_t *req)
+{
+    iot_route_ctx_t *ctx = route_ctx(req);
+
+    if (ctx == nullptr)
+        return {};
+
+    return {ctx->param, ctx->param_len};
+}
+
+/**
+ * Detaches a request from the http server task and queues it to be handled by an async worker, so a slow handler
+ * doesn't block other requests. Responds with a 503 if all the workers are busy and the queue is full.
+ *
+ * @param[in] req A pointer to the http request object.
+ * @param[in] handler The function to handle the request, it must respond to the request it's given.
+ * @return ESP_OK if the request was queued or rejected, otherwise the handler's result if it ran synchronously.
+ * @note The detached request has its own uri, so the path parameter isn't available to the handler.
+ */
+esp_err_t IotServer::run_async(httpd_req_t *req, iot_route_handler_t handler)
+{
+#if CONFIG_IOT_HOVER_SERVER_ASYNC_WORKERS > 0
+    if (_async_queue == nullptr)
+        return handler(req);
+
+    iot_route_ctx_t *ctx = route_ctx(req);
+    iot_async_job_t job = {.req = nullptr, .handler = handler, .ctx = {}};
+
+    esp_err_t ret = httpd_req_async_handler_begin(req, &job.req);
+
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "%s: Failed to detach request, running it synchronously [reason: %s]", __func__,
+                 esp_err_to_name(ret));
+        return handler(req);
+    }
+
+    // The dispatch context lives on the server task's stack, the detached copy mustn't reference it. The job carries
+    // a copy of it instead, so the worker records the request's statistics once the handler is done.
+    job.req->user_ctx = nullptr;
+
+    if (ctx != nullptr) {
+        job.ctx = *ctx;
+        job.ctx.param = nullptr;
+        job.ctx.param_len = 0;
+    }
+
+    if (xQueueSend(_async_queue, &job, 0) == pdTRUE) {
+        if (ctx != nullptr)
+            ctx->detached = true;
+    } else {
+        ESP_LOGW(TAG, "%s: All async workers are busy, rejecting request [uri: %s]", __func__, req->uri);
+        httpd_resp_set_hdr(job.req, "Retry-After", "1");
+        send_err(job.req, "The device is busy, try again later", IOT_HTTP_STATUS_503_SERVICE_UNAVAILABLE);
+        httpd_req_async_handler_complete(job.req);
+        record_response(req, IOT_HTTP_STATUS_503_SERVICE_UNAVAILABLE, 0);
+    }
+
+    return ESP_OK;
+#else
+    return handler(req);
+#endif
+}
+
+#if CONFIG_IOT_HOVER_SERVER_ASYNC_WORKERS > 0
+/**
+ * Task which handles the requests detached from the http server task.
+ *
+ * @param[in] param A pointer to the task parameter (this).
+ */
+[[noreturn]] void IotServer::async_task(void *param)
+{
+    auto *self = static_cast<IotServer *>(param);
+    iot_async_job_t job;
+
+    while (true) {
+        if (xQueueReceive(self->_async_queue, &job, portMAX_DELAY) != pdTRUE)
+            continue;
+
+        if (job.ctx.server != nullptr)
+            job.req->user_ctx = &job.ctx;
+
+        esp_err_t ret = job.handler(job.req);
+
+        if (job.ctx.server != nullptr)
+            self->record_request(job.ctx, job.req, ret, esp_timer_get_time() - job.ctx.start);
+
+        // A failing handler closes the connection, like it would on the server task.
+        if (ret != ESP_OK)
+            httpd_sess_trigger_close(job.req->handle, httpd_req_to_sockfd(job.req));
+
+        job.req->user_ctx = nullptr;
+        httpd_req_async_handler_complete(job.req);
+    }
+}
+#endif
+
+#ifdef CONFIG_IOT_HOVER_SERVER_PUSH
+/**
+ * Queues a text message for every push channel subscriber. The message is copied once and shared by all the
+ * subscriber queues, a subscriber whose queue is full loses its oldest message.
+ *
+ * @param[in] data A pointer to the message.
+ * @param[in] len The length of the message.
+ * @return ESP_OK on success, otherwise an error code.
+ */
+esp_err_t IotServer::publish(const char *data, size_t len)
+{
+    if (!has_subscribers())
+        return ESP_OK;
+
+    auto *msg = static_cast<iot_ws_msg_t *>(malloc(sizeof(iot_ws_msg_t) + len));
+
+    if (msg == nullptr) {
+        ESP_LOGE(TAG, "%s: Failed to allocate message [size: %d]", __func__, len);
+        return ESP_ERR_NO_MEM;
+    }
+
+    msg->refs = 0;
+    msg->len = len;
+    msg->data = reinterpret_cast<char *>(msg + 1);
+    memcpy(msg->data, data, len);
+
+    {
+        std::lock_guard<std::mutex> lock(_ws_mutex);
+
+        for (auto &subscriber : _subscribers) {
+            if (subscriber.fd < 0)
+                continue;
+
+            if (subscriber.count == CONFIG_IOT_HOVER_SERVER_PUSH_QUEUE_LEN) {
+                release_msg(subscriber.queue[subscriber.head]);
+                subscriber.head = (subscriber.head + 1) % CONFIG_IOT_HOVER_SERVER_PUSH_QUEUE_LEN;
+                subscriber.count--;
+                _ws_dropped.fetch_add(1, std::memory_order_relaxed);
+            }
+
+            subscriber.queue[(subscriber.head + subscriber.count) % CONFIG_IOT_HOVER_SERVER_PUSH_QUEUE_LEN] = msg;
+            subscriber.count++;
+            msg->refs++;
+        }
+
+        if (msg->refs == 0) {
+            free(msg);
+            return ESP_OK;
+        }
+    }
+
+    xTaskNotifyGive(_push_task);
+
+    return ESP_OK;
+}
+
+/**
+ * Checks whether any client is subscribed to the push channel, so publishers can skip serializing messages.
+ *
+ * @return true if there is at least one subscriber, otherwise false.
+ */
+bool IotServer::has_subscribers(void) const
+{
+    return _subscriber_count.load(std::memory_order_relaxed) > 0;
+}
+
+#ifdef CONFIG_HTTPD_WS_PRE_HANDSHAKE_CB_SUPPORT
+/**
+ * Checks the push channel's upgrade request is authorized before the websocket handshake is answered.
+ *
+ * @param[in] req A pointer to the http request object.
+ * @return ESP_OK if the request is authorized, otherwise ESP_FAIL after responding with a 401, which aborts the
+ * handshake.
+ */
+esp_err_t IotServer::on_ws_handshake(httpd_req_t *req)
+{
+    if (on_auth(req) == ESP_OK)
+        return ESP_OK;
+
+    static_cast<IotServer *>(req->user_ctx)->_rejected_auth.fetch_add(1, std::memory_order_relaxed);
+
+    return ESP_FAIL;
+}
+#endif
+
+/**
+ * Handles the push channel websocket, the client subscribes once the handshake is done.
+ *
+ * @param[in] req A pointer to the http request object.
+ * @return ESP_OK on success, otherwise an error code which closes the socket.
+ * @note The upgrade request is authorized by on_ws_handshake before the handshake is answered, if the http server
+ * supports it.
+ */
+esp_err_t IotServer::on_ws(httpd_req_t *req)
+{
+    auto *self = static_cast<IotServer *>(req->user_ctx);
+
+    if (req->method == HTTP_GET) {
+#ifndef CONFIG_HTTPD_WS_PRE_HANDSHAKE_CB_SUPPORT
+        // Without the pre handshake callback the handshake is already answered, the client is just disconnected.
+        if (!is_authorized(req))
+            return ESP_FAIL;
+#endif
+
+        return self->add_subscriber(httpd_req_to_sockfd(req));
+    }
+
+    // The channel is one way, frames from the client are read and discarded.
+    uint8_t buf[64];
+    httpd_ws_frame_t frame{};
+
+    esp_err_t ret = httpd_ws_recv_frame(req, &frame, 0);
+
+    if (ret != ESP_OK || frame.len == 0)
+        return ret;
+
+    if (frame.len > sizeof(buf))
+        return ESP_ERR_INVALID_SIZE;
+
+    frame.payload = buf;
+
+    return httpd_ws_recv_frame(req, &frame, sizeof(buf));
+}
+
+/**
+ * Closes a socket of the server, unsubscribing it from the push channel.
+ *
+ * @param[in] handle The handle of the server.
+ * @param[in] fd The socket to close.
+ */
+void IotServer::on_close(httpd_handle_t handle, int fd)
+{
+    auto *self = static_cast<IotServer *>(httpd_get_global_user_ctx(handle));
+
+    self->remove_subscriber(fd);
+
+    close(fd);
+}
+
+/**
+ * Adds a push channel subscriber.
+ *
+ * @param[in] fd The subscriber's socket.
+ * @return ESP_OK on success, ESP_ERR_NO_MEM if all the subscriber slots are taken.
+ */
+esp_err_t IotServer::add_subscriber(int fd)
+{
+    std::lock_guard<std::mutex> lock(_ws_mutex);
+
+    for (auto &subscriber : _subscribers) {
+        if (subscriber.fd >= 0)
+            continue;
+
+        subscriber.fd = fd;
+        subscriber.head = 0;
+        subscriber.count = 0;
+        _subscriber_count.fetch_add(1, std::memory_order_relaxed);
+
+        ESP_LOGI(TAG, "%s: Client subscribed to the push channel [fd: %d]", __func__, fd);
+
+        return ESP_OK;
+    }
+
+    ESP_LOGW(TAG, "%s: Push channel is full, rejecting subscriber [fd: %d]", __func__, fd);
+
+    return ESP_ERR_NO_MEM;
+}
+
+/**
+ * Removes a push channel subscriber and releases its queued messages.
+ *
+ * @param[in] fd The subscriber's socket.
+ */
+void IotServer::remove_subscriber(int fd)
+{
+    std::lock_guard<std::mutex> lock(_ws_mutex);
+
+    for (auto &subscriber : _subscribers) {
+        if (subscriber.fd != fd)
+            continue;
+
+        for (; subscriber.count > 0; subscriber.count--) {
+            release_msg(subscriber.queue[subscriber.head]);
+            subscriber.head = (subscriber.head + 1) % CONFIG_IOT_HOVER_SERVER_PUSH_QUEUE_LEN;
+        }
+
+        subscriber.fd = -1;
+        _subscriber_count.fetch_sub(1, std::memory_order_relaxed);
+
+        ESP_LOGI(TAG, "%s: Client unsubscribed from the push channel [fd: %d]", __func__, fd);
+
+        return;
+    }
+}
+
+/**
+ * Releases a subscriber queue's reference to a message, freeing it when it was the last.
+ *
+ * @param[in] msg A pointer to the message.
+ * @note The websocket mutex must be held.
+ */
+void IotServer::release_msg(iot_ws_msg_t *msg)
+{
+    if (--msg->refs == 0)
+        free(msg);
+}
+
+/**
+ * Task which sends the queued messages of the push channel subscribers.
+ *
+ * @param[in] param A pointer to the task parameter (this).
+ */
+[[noreturn]] void IotServer::push_task(void *param)
+{
+    auto *self = static_cast<IotServer *>(param);
+
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        for (auto &subscriber : self->_subscribers) {
+            while (true) {
+                iot_ws_msg_t *msg;
+                int fd;
+
+                {
+                    std::lock_guard<std::mutex> lock(self->_ws_mutex);
+
+                    if (subscriber.fd < 0 || subscriber.count == 0)
+                        break;
+
+                    msg = subscriber.queue[subscriber.head];
+                    subscriber.head = (subscriber.head + 1) % CONFIG_IOT_HOVER_SERVER_PUSH_QUEUE_LEN;
+                    subscriber.count--;
+                    fd = subscriber.fd;
+                }
+
+                httpd_ws_frame_t frame = {
+                        .final = true,
+                        .fragmented = false,
+                        .type = HTTPD_WS_TYPE_TEXT,
+                        .payload = reinterpret_cast<uint8_t *>(msg->data),
+                        .len = msg->len
+                };
+
+                esp_err_t ret = httpd_ws_send_frame_async(self->_server, fd, &frame);
+
+                {
+                    std::lock_guard<std::mutex> lock(self->_ws_mutex);
+                    release_msg(msg);
+                }
+
+                if (ret != ESP_OK) {
+                    ESP_LOGW(TAG, "%s: Failed to push message, closing [fd: %d, reason: %s]", __func__, fd,
+                             esp_err_to_name(ret));
+                    httpd_sess_trigger_close(self->_server, fd);
+                    break;
+                }
+            }
+        }
+    }
+}
+#endif
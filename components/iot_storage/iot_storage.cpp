@@ -126,6 +126,12 @@ esp_err_t IotStorage::read(const char *key, void **buf, size_t &len, iot_nvs_val
     else if (type == IOT_TYPE_BLOB)
         ret = nvs_get_blob(_handle, key, nullptr, &len);
 
+    // A missing key is expected for optional values, so it isn't reported as an error.
+    if (ret == ESP_ERR_NVS_NOT_FOUND) {
+        ESP_LOGD(TAG, "%s:  No data for [key: %s]", __func__, key);
+        return ret;
+    }
+
     if (ret != ESP_OK) {
         ESP_LOGE(TAG, "%s:  Failed get the data size for [key: %s, reason: %s]", __func__, key, esp_err_to_name(ret));
         return ret;
@@ -10,6 +10,24 @@
 /* A constant used to identify the source of the log message of this file. */
 static constexpr const char *MAIN_TAG = "Main";
 
+/* The device's attributes, declared at compile time. */
+static constexpr IotDeviceSchema light_schema{iot_attr(IOT_ATTR_NAME_POWER, false).primary(),
+                                              iot_attr(IOT_ATTR_NAME_BRIGHTNESS, 100u)
+                                                  .range(0, 100)
+                                                  .max_age(1000)
+                                                  .coalesce(50)
+                                                  .telemetry(IOT_TELEMETRY_FAST)};
+
+/* The telemetry periods, changed values are published per class and a snapshot of every value each minute. */
+static const iot_telemetry_cfg_t light_telemetry = {.period_ms = {0, 1000, 5000, 30000}, .snapshot_ms = 60000};
+
+/* The slots of the device's attributes, their position in the schema. */
+enum light_slot : uint8_t
+{
+    LIGHT_SLOT_POWER = 0,
+    LIGHT_SLOT_BRIGHTNESS
+};
+
 /**
  * Callback for handling reads on the iot attributes.
  *
@@ -19,25 +37,23 @@ static constexpr const char *MAIN_TAG = "Main";
  */
 esp_err_t iot_attribute_read_cb(iot_attribute_req_param_t *read_data)
 {
-    ESP_LOGI(MAIN_TAG, "%s: Received write for attribute", __func__);
+    ESP_LOGI(MAIN_TAG, "%s: Received read for attributes", __func__);
 
     for (auto &attribute: read_data->attributes)
     {
-        if (attribute.name.empty())
-        {
-            ESP_LOGI(MAIN_TAG, "%s: Failed read for attribute [name: null]", __func__);
-            return ESP_FAIL;
-        }
+        ESP_LOGI(MAIN_TAG, "%s: Received read for attribute [name: %s ]", __func__, attribute.name.data());
 
-        ESP_LOGI(MAIN_TAG, "%s: Received read for attribute [name: %s ]", __func__, attribute.name.c_str());
-
-        if(attribute.name == IOT_ATTR_NAME_POWER)
-        {
-            attribute.value = iot_val_bool(gpio_get_level(GPIO_NUM_2));
-        }
-        else if (attribute.name == IOT_ATTR_NAME_BRIGHTNESS)
+        switch (attribute.slot)
         {
-            attribute.value.i = esp_random() % 20;
+            case LIGHT_SLOT_POWER:
+                attribute.value = iot_val_bool(gpio_get_level(GPIO_NUM_2));
+                break;
+            case LIGHT_SLOT_BRIGHTNESS:
+                attribute.value.i = esp_random() % 20;
+                break;
+            default:
+                ESP_LOGI(MAIN_TAG, "%s: Failed read for attribute [name: %s ]", __func__, attribute.name.data());
+                return ESP_FAIL;
         }
     }
 
@@ -51,35 +67,31 @@ esp_err_t iot_attribute_read_cb(iot_attribute_req_param_t *read_data)
  */
 esp_err_t iot_attribute_write_cb(iot_attribute_req_param_t *param)
 {
-    uint8_t count = param->attributes.size();
-
-    ESP_LOGI(MAIN_TAG, "%s: Received write for attributes [count:  %d ]", __func__, count);
+    ESP_LOGI(MAIN_TAG, "%s: Received write for attributes [count:  %d ]", __func__, param->attributes.size());
 
-    for (uint8_t i = 0; i < count; i++)
+    for (const auto &attribute: param->attributes)
     {
-        iot_attribute_req_data_t attribute = param->attributes[i];
-        ESP_LOGI(MAIN_TAG, "%s: Received write for attribute [name: %s ]", __func__, attribute.name.c_str());
+        ESP_LOGI(MAIN_TAG, "%s: Received write for attribute [name: %s ]", __func__, attribute.name.data());
 
-        if (attribute.name == IOT_ATTR_NAME_POWER)
+        switch (attribute.slot)
         {
-            if (gpio_get_level(GPIO_NUM_2) == attribute.value.b)
-            {
-                ESP_LOGI(MAIN_TAG, "%s: attribute is already set [to: %d ]", __func__, attribute.value.b);
-            }
-            else
-            {
-                gpio_set_level(GPIO_NUM_2, attribute.value.b);
-                ESP_LOGI(MAIN_TAG, "%s: Toggling %s [to: %d ]", __func__, attribute.name.c_str(), attribute.value.b);
-            }
-        }
-        else if (attribute.name == IOT_ATTR_NAME_BRIGHTNESS)
-        {
-            ESP_LOGI(MAIN_TAG, "%s: Toggling %s [to: %lu ]", __func__, attribute.name.c_str(), attribute.value.i);
-        }
-        else
-        {
-            ESP_LOGE(MAIN_TAG, "%s: Received write for a unknown attribute  [name: %s ]", attribute.name.c_str(), __func__);
-            return ESP_ERR_INVALID_ARG;
+            case LIGHT_SLOT_POWER:
+                if (gpio_get_level(GPIO_NUM_2) == attribute.value.b)
+                {
+                    ESP_LOGI(MAIN_TAG, "%s: attribute is already set [to: %d ]", __func__, attribute.value.b);
+                }
+                else
+                {
+                    gpio_set_level(GPIO_NUM_2, attribute.value.b);
+                    ESP_LOGI(MAIN_TAG, "%s: Toggling %s [to: %d ]", __func__, attribute.name.data(), attribute.value.b);
+                }
+                break;
+            case LIGHT_SLOT_BRIGHTNESS:
+                ESP_LOGI(MAIN_TAG, "%s: Toggling %s [to: %lu ]", __func__, attribute.name.data(), attribute.value.i);
+                break;
+            default:
+                ESP_LOGE(MAIN_TAG, "%s: Received write for a unknown attribute  [name: %s ]", __func__, attribute.name.data());
+                return ESP_ERR_INVALID_ARG;
         }
     }
 
@@ -157,19 +169,11 @@ extern "C" void app_main(void)
 
     iot_device_info_t *device = iot_device_create("Light", IOT_DEVICE_TYPE_LIGHT);
 
-    iot_attribute_t pwr = iot_attribute_create(IOT_ATTR_NAME_POWER, iot_val_bool(false), true);
-    iot_attribute_t bri = iot_attribute_create(IOT_ATTR_NAME_BRIGHTNESS, iot_val_int(100));
-
-    iot_attribute_add_param(&bri, IOT_ATTR_PARAM_MIN, iot_val_int(0));
-    iot_attribute_add_param(&bri, IOT_ATTR_PARAM_MAX, iot_val_int(100));
-
-    iot_device_add_attribute(device, pwr);
-    iot_device_add_attribute(device, bri);
-
     iot_device_add_service(device, IOT_OTA_SERVICE, true, true);
 
     iot_device_cfg_t cfg = {.device_info = device, .req_mode = IOT_ATTRIBUTE_CB_RW, .read_cb = &iot_attribute_read_cb,
-                            .write_cb = &iot_attribute_write_cb,.notify_cfg = nullptr};
+                            .write_cb = &iot_attribute_write_cb,.notify_cfg = nullptr,
+                            .schema = &iot_schema_v<light_schema>, .telemetry_cfg = &light_telemetry};
 
     iot_app_cfg_t app_cfg = {.op_mode = IOT_WIFI_APSTA, .device_cfg = &cfg, .model = "IOT_LIGHT_543210XV6" };
 
@@ -0,0 +1,281 @@
+#include <cJSON.h>
+#include <cmath>
+#include <cstring>
+#include <random>
+#include "host_test.h"
+#include "iot_json_reader.h"
+
+/*
+ * The json reader against cJSON. Random documents are printed by cJSON and read back token by token, every token is
+ * compared with the tree the document was printed from, and some containers are skipped on the way. The documents are
+ * then mutated at random: cJSON is more lenient than the reader, so whatever the reader accepts must parse with cJSON
+ * and read the same, and whatever cJSON rejects the reader must reject too. A corpus of edge cases pins the verdicts
+ * of strict json where cJSON can't be the judge.
+ */
+
+static constexpr int DOCUMENTS = 3000;
+static constexpr int MUTATIONS = 20;
+
+static cJSON *random_value(std::mt19937 &rng, int depth)
+{
+    static const char *pieces[] = {"a", "Z", "0", " ", "/", "\"", "\\", "\n", "\t", "\b", "\f", "\r", "\x01", "\x1f",
+                                   "\xc3\xa9", "\xe2\x82\xac", "\xf0\x9f\x98\x80"};
+    static const double numbers[] = {0, -0.0, 1, -1, 7, 42, 1e21, -1e-7, 3.25, 0.1, 123456789, 4294967295.0,
+                                     9007199254740991.0, 1.5e300, -2.5e-300};
+    int kind = static_cast<int>(rng() % (depth < 5 ? 8 : 6));
+
+    switch (kind) {
+        case 0:
+            return cJSON_CreateNull();
+        case 1:
+            return cJSON_CreateBool(rng() % 2);
+        case 2:
+            return cJSON_CreateNumber(rng() % 2 ? numbers[rng() % std::size(numbers)]
+                                                : static_cast<double>(static_cast<int32_t>(rng())) / (1 << rng() % 12));
+        case 3:
+        case 4:
+        case 5: {
+            std::string value;
+            size_t len = rng() % 12;
+
+            for (size_t i = 0; i < len; i++)
+                value += pieces[rng() % std::size(pieces)];
+
+            return cJSON_CreateString(value.c_str());
+        }
+        case 6: {
+            cJSON *array = cJSON_CreateArray();
+            size_t count = rng() % 6;
+
+            for (size_t i = 0; i < count; i++)
+                cJSON_AddItemToArray(array, random_value(rng, depth + 1));
+
+            return array;
+        }
+        default: {
+            cJSON *object = cJSON_CreateObject();
+            size_t count = rng() % 6;
+
+            // Distinct keys, cJSON and the reader would disagree on which of two equal ones counts.
+            for (size_t i = 0; i < count; i++)
+                cJSON_AddItemToObject(object, ("k" + std::to_string(i) + (rng() % 2 ? "\"\\" : "")).c_str(),
+                                      random_value(rng, depth + 1));
+
+            return object;
+        }
+    }
+}
+
+/**
+ * Checks that the text of a string or key token is the text of a cJSON string, which ends at an escaped null.
+ */
+static bool same_text(const iot_json_token_t &token, const char *text)
+{
+    return token.start[token.len] == '\0' && strcmp(token.start, text) == 0;
+}
+
+/**
+ * Reads the rest of the value whose first token was just read, and compares it with the node it should be.
+ */
+static void compare(IotJsonReader &reader, const iot_json_token_t &token, const cJSON *node, std::mt19937 &rng)
+{
+    switch (node->type & 0xff) {
+        case cJSON_NULL:
+            HOST_CHECK(token.type == IOT_JSON_NULL);
+            break;
+        case cJSON_False:
+            HOST_CHECK(token.type == IOT_JSON_FALSE);
+            break;
+        case cJSON_True:
+            HOST_CHECK(token.type == IOT_JSON_TRUE);
+            break;
+        case cJSON_Number:
+            HOST_CHECK(token.type == IOT_JSON_NUMBER);
+            HOST_CHECK(strtod(std::string(token.start, token.len).c_str(), nullptr) == node->valuedouble);
+            break;
+        case cJSON_String:
+            HOST_CHECK(token.type == IOT_JSON_STRING);
+            HOST_CHECK(same_text(token, node->valuestring));
+            break;
+        case cJSON_Array:
+        case cJSON_Object: {
+            bool object = cJSON_IsObject(node);
+            iot_json_token_t inner;
+
+            HOST_CHECK(token.type == (object ? IOT_JSON_OBJECT_START : IOT_JSON_ARRAY_START));
+
+            if (rng() % 8 == 0) {
+                HOST_CHECK(reader.skip(token) == (object ? IOT_JSON_OBJECT_END : IOT_JSON_ARRAY_END));
+                return;
+            }
+
+            for (const cJSON *child = node->child; child != nullptr; child = child->next) {
+                if (object) {
+                    HOST_CHECK(reader.next(&inner) == IOT_JSON_KEY);
+                    HOST_CHECK(same_text(inner, child->string));
+                }
+
+                reader.next(&inner);
+                compare(reader, inner, child, rng);
+            }
+
+            HOST_CHECK(reader.next(&inner) == (object ? IOT_JSON_OBJECT_END : IOT_JSON_ARRAY_END));
+            break;
+        }
+        default:
+            HOST_CHECK(false);
+    }
+}
+
+/**
+ * Reads a whole document, comparing it with a cJSON tree if one is given.
+ *
+ * @return true if the reader accepted the document.
+ */
+static bool read(std::string doc, const cJSON *tree, std::mt19937 &rng)
+{
+    IotJsonReader reader(doc.data(), doc.size());
+    iot_json_token_t token;
+
+    if (tree != nullptr) {
+        reader.next(&token);
+        compare(reader, token, tree, rng);
+        return reader.next(&token) == IOT_JSON_END;
+    }
+
+    while (true) {
+        switch (reader.next(&token)) {
+            case IOT_JSON_END:
+                return true;
+            case IOT_JSON_ERROR:
+                // The first error sticks.
+                HOST_CHECK(reader.next(&token) == IOT_JSON_ERROR);
+                return false;
+            default:
+                break;
+        }
+    }
+}
+
+static std::string mutate(std::string doc, std::mt19937 &rng)
+{
+    static const char alphabet[] = "{}[]\",:\\ \t\n0123456789-+.eEtrufalsn/u\x01\xc3";
+    size_t count = 1 + rng() % 3;
+
+    for (size_t i = 0; i < count && !doc.empty(); i++) {
+        size_t pos = rng() % doc.size();
+        char c = rng() % 4 == 0 ? static_cast<char>(rng()) : alphabet[rng() % (sizeof(alphabet) - 1)];
+
+        switch (rng() % 4) {
+            case 0: doc[pos] = c; break;
+            case 1: doc.insert(pos, 1, c); break;
+            case 2: doc.erase(pos, 1); break;
+            default: doc.resize(pos); break;
+        }
+    }
+
+    return doc;
+}
+
+static void test_documents(void)
+{
+    std::mt19937 rng(1);
+    int both = 0;
+    int neither = 0;
+    int cjson_only = 0;
+
+    for (int i = 0; i < DOCUMENTS; i++) {
+        cJSON *tree = random_value(rng, 0);
+        char *printed = rng() % 2 ? cJSON_PrintUnformatted(tree) : cJSON_Print(tree);
+        std::string doc = printed;
+
+        cJSON_free(printed);
+        HOST_CHECK(read(doc, tree, rng));
+
+        for (int j = 0; j < MUTATIONS; j++) {
+            std::string mutated = mutate(doc, rng);
+            bool accepted = read(mutated, nullptr, rng);
+            cJSON *parsed = mutated.find('\0') == std::string::npos ? cJSON_ParseWithOpts(mutated.c_str(), nullptr, true)
+                                                                     : nullptr;
+
+            if (accepted) {
+                HOST_CHECK(parsed != nullptr);
+                HOST_CHECK(read(mutated, parsed, rng));
+            }
+
+            both += accepted;
+            neither += !accepted && parsed == nullptr;
+            cjson_only += !accepted && parsed != nullptr;
+
+            cJSON_Delete(parsed);
+        }
+
+        cJSON_Delete(tree);
+    }
+
+    printf("mutated documents: %d, accepted by both: %d, rejected by both: %d, accepted by cjson only: %d\n",
+           DOCUMENTS * MUTATIONS, both, neither, cjson_only);
+
+    HOST_CHECK(both > 0 && neither > 0);
+}
+
+static void test_corpus(void)
+{
+    std::mt19937 rng(2);
+    const char *valid[] = {"0", "-0", "-1.5e+10", "1E-2", "true", " null ", "\"\"", "[]", "{}", "[[],{}]",
+                           "{\"a\":[1,{\"b\":null}]}", "\r\n\t[ 1 , 2 ]\t", "\"\\/\\\\\\\"\\b\\f\\n\\r\\t\""};
+    const char *invalid[] = {"", " ", "01", "-", "1.", ".5", "1e", "1e+", "+1", "0x10", "NaN", "[1,]", "{\"a\":1,}",
+                             "[", "]", "{", "}", "[1 2]", "{\"a\" 1}", "{1:2}", "{\"a\"}", "1 2", "tru", "nul",
+                             "True", "\"abc", "\"a\tb\"", "\"\\x\"", "\"\\u12\"", "\"\\u12g4\"", "\"\\ud800\"",
+                             "\"\\udc00\"", "\"\\ud800\\u0041\"", "\"\\ud800x\"", "[1]]", "\xef\xbb\xbf[]", "[\x0b]"};
+
+    for (const char *doc : valid)
+        HOST_CHECK(read(doc, nullptr, rng));
+
+    for (const char *doc : invalid)
+        HOST_CHECK(!read(doc, nullptr, rng));
+
+    // Unicode escapes are unescaped to utf-8, a surrogate pair to a single code point.
+    std::string doc = "[\"\\u0041\\u00e9\\u20ac\\ud83d\\ude00\", \"tail\"]";
+    IotJsonReader reader(doc.data(), doc.size());
+    iot_json_token_t token;
+
+    HOST_CHECK(reader.next(&token) == IOT_JSON_ARRAY_START);
+    HOST_CHECK(reader.next(&token) == IOT_JSON_STRING);
+    HOST_CHECK(same_text(token, "A\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80"));
+    HOST_CHECK(reader.next(&token) == IOT_JSON_STRING && same_text(token, "tail"));
+
+    // The nesting depth is bounded.
+    HOST_CHECK(read(std::string(32, '[') + std::string(32, ']'), nullptr, rng));
+    HOST_CHECK(!read(std::string(33, '[') + std::string(33, ']'), nullptr, rng));
+}
+
+static void test_numbers(void)
+{
+    auto number = [](const char *text) -> iot_json_token_t {
+        return {.type = IOT_JSON_NUMBER, .start = const_cast<char *>(text), .len = strlen(text)};
+    };
+    uint64_t value;
+    float f;
+
+    HOST_CHECK(IotJsonReader::to_uint(number("0"), &value) && value == 0);
+    HOST_CHECK(IotJsonReader::to_uint(number("18446744073709551615"), &value) && value == UINT64_MAX);
+    HOST_CHECK(!IotJsonReader::to_uint(number("18446744073709551616"), &value));
+    HOST_CHECK(!IotJsonReader::to_uint(number("-1"), &value));
+    HOST_CHECK(!IotJsonReader::to_uint(number("1.0"), &value));
+    HOST_CHECK(!IotJsonReader::to_uint(number("1e3"), &value));
+    HOST_CHECK(IotJsonReader::to_float(number("-2.5e-3"), &f) && f == -2.5e-3f);
+    HOST_CHECK(!IotJsonReader::to_float(number("1.00000000000000000000000000000000"), &f));
+    HOST_CHECK(!IotJsonReader::to_float({.type = IOT_JSON_STRING, .start = const_cast<char *>("1"), .len = 1}, &f));
+}
+
+int main()
+{
+    esp_log_level_set("*", ESP_LOG_NONE);
+
+    test_documents();
+    test_corpus();
+    test_numbers();
+
+    return EXIT_SUCCESS;
+}
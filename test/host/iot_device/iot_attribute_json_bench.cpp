@@ -0,0 +1,643 @@
+#include <cJSON.h>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <random>
+#include "host_test.h"
+#include "iot_device.h"
+
+/*
+ * The attribute write request parsing against the cJSON parsing it replaced. Requests of 1 to 64 attributes are
+ * generated with their keys in any order, unknown keys, escapes and varied whitespace, and must read to the attributes
+ * they were generated from, both with the device and with a cJSON reference held to the device's rules. Mutated
+ * requests may be rejected by the device where cJSON is lenient, but whatever the device accepts the reference must
+ * accept and read the same. A corpus of malformed requests pins the rejections. The benchmark then parses the same
+ * requests both ways, measuring the heap the cJSON path takes through its allocation hooks, and prints the time a
+ * request takes. Nothing is asserted about the timings.
+ *
+ * The parsing is private to IotDevice, the test is built without access control to reach it.
+ */
+
+static constexpr int DOCUMENTS = 1000;
+static constexpr int MUTATIONS = 20;
+static constexpr int ITERATIONS = 2000;
+static constexpr uint8_t ATTRIBUTES = 80;
+
+typedef struct attribute {
+    uint8_t slot;
+    iot_val_type_e type;
+    bool b;
+    uint32_t i;
+    uint64_t l;
+    float f;
+    std::string s;
+} attribute_t;
+
+typedef struct heap {
+    size_t current;
+    size_t peak;
+    size_t total;
+    size_t allocations;
+} heap_t;
+
+static iot_device_info_t info;
+static heap_t heap;
+
+static void *counted_malloc(size_t size)
+{
+    auto *block = static_cast<size_t *>(malloc(size + sizeof(max_align_t)));
+
+    if (block == nullptr)
+        return nullptr;
+
+    *block = size;
+    heap.current += size;
+    heap.peak = std::max(heap.peak, heap.current);
+    heap.total += size;
+    heap.allocations++;
+
+    return reinterpret_cast<uint8_t *>(block) + sizeof(max_align_t);
+}
+
+static void counted_free(void *ptr)
+{
+    if (ptr == nullptr)
+        return;
+
+    auto *block = reinterpret_cast<size_t *>(static_cast<uint8_t *>(ptr) - sizeof(max_align_t));
+
+    heap.current -= *block;
+    free(block);
+}
+
+/**
+ * Registers the attributes with the device, the last few with names which need escaping.
+ */
+static void register_attributes(void)
+{
+    const char *special[] = {"quote\"d", "caf\xc3\xa9", "back\\slash/"};
+
+    for (uint8_t i = 0; i < ATTRIBUTES; i++) {
+        std::string name = i < ATTRIBUTES - std::size(special) ? "attr_" + std::to_string(i)
+                                                               : special[i - (ATTRIBUTES - std::size(special))];
+
+        info.attributes.push_back(iot_attribute_create(name.c_str(), iot_val_t{.is_null = true}));
+    }
+
+    iot_device_cfg_t cfg = {.device_info = &info};
+
+    HOST_CHECK(IotDevice::_registry.build(&cfg) == ESP_OK);
+}
+
+/**
+ * Quotes a string as json, escaping what must be escaped and some of what may be.
+ */
+static std::string quoted(const std::string &value, std::mt19937 &rng)
+{
+    std::string json = "\"";
+    char escape[8];
+
+    for (size_t i = 0; i < value.size(); i++) {
+        auto c = static_cast<uint8_t>(value[i]);
+
+        if (c == '"' || c == '\\') {
+            json += '\\';
+            json += static_cast<char>(c);
+        } else if (c == 0xc3 && i + 1 < value.size() && rng() % 2) {
+            snprintf(escape, sizeof(escape), "\\u00%02x", static_cast<uint8_t>(value[++i]) + 0x40);
+            json += escape;
+        } else if (c < 0x20 || (c < 0x80 && rng() % 8 == 0)) {
+            snprintf(escape, sizeof(escape), rng() % 2 ? "\\u%04x" : "\\u%04X", c);
+            json += escape;
+        } else if (c == '/' && rng() % 2) {
+            json += "\\/";
+        } else {
+            json += static_cast<char>(c);
+        }
+    }
+
+    return json + "\"";
+}
+
+static std::string random_string(std::mt19937 &rng)
+{
+    static const char *pieces[] = {"a", "b", "z", "0", "_", " ", "/", "\"", "\\", "\n", "\t", "\x01", "\x1f",
+                                   "\xc3\xa9", "\xe2\x82\xac", "\xf0\x9f\x98\x80"};
+    std::string value;
+    size_t len = rng() % 16;
+
+    for (size_t i = 0; i < len; i++)
+        value += pieces[rng() % std::size(pieces)];
+
+    return value;
+}
+
+static std::string space(std::mt19937 &rng)
+{
+    static const char *spaces[] = {"", "", "", " ", "\n\t", "\r\n  "};
+
+    return spaces[rng() % std::size(spaces)];
+}
+
+/**
+ * Generates an attribute write request, along with the attributes it should read to.
+ */
+static std::string random_request(std::mt19937 &rng, size_t count, std::vector<attribute_t> *attributes)
+{
+    static const iot_val_type_e types[] = {IOT_VAL_TYPE_BOOLEAN, IOT_VAL_TYPE_INTEGER, IOT_VAL_TYPE_FLOAT,
+                                           IOT_VAL_TYPE_LONG, IOT_VAL_TYPE_STRING};
+    static const char *type_names[] = {"bool", "integer", "float", "long", "string"};
+    // Unknown keys are skipped whole, even when they hold the keys of an attribute.
+    static const char *unknown[] = {"\"unit\":\"C\"", "\"op\":\"read\"", "\"meta\":{\"name\":\"nope\",\"value\":[1,{}]}",
+                                    "\"tags\":[\"name\",null,true,-1.5e3]", "\"names\":\"attr_0\""};
+    std::string doc = space(rng) + "[";
+
+    attributes->clear();
+
+    for (size_t n = 0; n < count; n++) {
+        attribute_t attribute = {};
+        size_t type = rng() % std::size(types);
+        std::string value;
+
+        attribute.slot = static_cast<uint8_t>(rng() % ATTRIBUTES);
+        attribute.type = types[type];
+
+        switch (attribute.type) {
+            case IOT_VAL_TYPE_BOOLEAN:
+                attribute.b = rng() % 2;
+                value = attribute.b ? "true" : "false";
+                break;
+            case IOT_VAL_TYPE_INTEGER:
+                attribute.i = rng() % 4 == 0 ? (rng() % 2 ? 0 : UINT32_MAX) : static_cast<uint32_t>(rng());
+                value = std::to_string(attribute.i);
+                break;
+            case IOT_VAL_TYPE_LONG:
+                // cJSON reads numbers as doubles, longs past 2^53 are checked in the corpus only.
+                attribute.l = (static_cast<uint64_t>(rng()) << 32 | rng()) >> (11 + rng() % 53);
+                value = std::to_string(attribute.l);
+                break;
+            case IOT_VAL_TYPE_FLOAT: {
+                char num[32];
+
+                attribute.f = std::ldexp(static_cast<float>(static_cast<int32_t>(rng()) >> 8),
+                                         static_cast<int>(rng() % 60) - 40);
+                snprintf(num, sizeof(num), "%.9g", attribute.f);
+                value = num;
+                break;
+            }
+            default:
+                attribute.s = random_string(rng);
+                value = quoted(attribute.s, rng);
+                break;
+        }
+
+        std::vector<std::string> members = {quoted("name", rng) + ":" + space(rng) +
+                                                quoted(info.attributes[attribute.slot].name, rng),
+                                            quoted("type", rng) + ":" + space(rng) + quoted(type_names[type], rng),
+                                            quoted("value", rng) + ":" + space(rng) + value};
+
+        if (rng() % 4 == 0)
+            members.push_back(unknown[rng() % std::size(unknown)]);
+
+        std::shuffle(members.begin(), members.end(), rng);
+
+        doc += (n > 0 ? "," : "") + space(rng) + "{";
+
+        for (size_t i = 0; i < members.size(); i++)
+            doc += (i > 0 ? "," : "") + space(rng) + members[i] + space(rng);
+
+        doc += "}" + space(rng);
+        attributes->push_back(attribute);
+    }
+
+    return doc + "]" + space(rng);
+}
+
+static bool same(const iot_attribute_req_param_t &param, const std::vector<attribute_t> &attributes)
+{
+    if (param.attributes.size() != attributes.size())
+        return false;
+
+    for (size_t n = 0; n < attributes.size(); n++) {
+        const iot_attribute_req_data_t &data = param.attributes[n];
+        const attribute_t &attribute = attributes[n];
+
+        if (data.slot != attribute.slot || data.name != info.attributes[attribute.slot].name ||
+            data.value.is_null || data.value.type != attribute.type)
+            return false;
+
+        switch (attribute.type) {
+            case IOT_VAL_TYPE_BOOLEAN:
+                if (data.value.b != attribute.b)
+                    return false;
+                break;
+            case IOT_VAL_TYPE_INTEGER:
+                if (data.value.i != attribute.i)
+                    return false;
+                break;
+            case IOT_VAL_TYPE_LONG:
+                if (data.value.l != attribute.l)
+                    return false;
+                break;
+            case IOT_VAL_TYPE_FLOAT:
+                if (data.value.f != attribute.f)
+                    return false;
+                break;
+            default:
+                if (strcmp(data.value.s, attribute.s.c_str()) != 0)
+                    return false;
+                break;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Finds the last member of an object with the key, the one the device keeps when keys repeat.
+ */
+static const cJSON *last_item(const cJSON *object, const char *key)
+{
+    const cJSON *found = nullptr;
+    const cJSON *item;
+
+    cJSON_ArrayForEach(item, object) {
+        if (item->string != nullptr && strcmp(item->string, key) == 0)
+            found = item;
+    }
+
+    return found;
+}
+
+/**
+ * Parses a request with cJSON, held to the device's rules: registered names, known types, and whole non-negative
+ * numbers which fit for integers and longs.
+ *
+ * @return true if the request is valid.
+ */
+static bool reference_parse(const std::string &doc, std::vector<attribute_t> *attributes)
+{
+    static const char *type_names[] = {"bool", "integer", "float", "long", "string"};
+    static const iot_val_type_e types[] = {IOT_VAL_TYPE_BOOLEAN, IOT_VAL_TYPE_INTEGER, IOT_VAL_TYPE_FLOAT,
+                                           IOT_VAL_TYPE_LONG, IOT_VAL_TYPE_STRING};
+    cJSON *root = doc.find('\0') == std::string::npos ? cJSON_ParseWithOpts(doc.c_str(), nullptr, true) : nullptr;
+    const cJSON *item;
+    bool valid = cJSON_IsArray(root) && cJSON_GetArraySize(root) > 0;
+    const cJSON *array = valid ? root : nullptr;
+
+    attributes->clear();
+
+    cJSON_ArrayForEach(item, array) {
+        const char *name = cJSON_GetStringValue(last_item(item, "name"));
+        const char *type = cJSON_GetStringValue(last_item(item, "type"));
+        const cJSON *value = last_item(item, "value");
+        attribute_t attribute = {};
+        size_t index = std::find_if(std::begin(type_names), std::end(type_names),
+                                    [type](const char *type_name) { return type != nullptr && strcmp(type, type_name) == 0; }) -
+                       std::begin(type_names);
+
+        valid = cJSON_IsObject(item) && name != nullptr && value != nullptr && index < std::size(types);
+
+        if (!valid)
+            break;
+
+        attribute.slot = IotDevice::_registry.find(name, strlen(name));
+        attribute.type = types[index];
+
+        double number = value->valuedouble;
+        bool whole = cJSON_IsNumber(value) && number >= 0 && std::floor(number) == number;
+
+        switch (attribute.type) {
+            case IOT_VAL_TYPE_BOOLEAN:
+                valid = cJSON_IsBool(value);
+                attribute.b = cJSON_IsTrue(value);
+                break;
+            case IOT_VAL_TYPE_INTEGER:
+                valid = whole && number <= UINT32_MAX;
+                attribute.i = valid ? static_cast<uint32_t>(number) : 0;
+                break;
+            case IOT_VAL_TYPE_LONG:
+                valid = whole && number < 18446744073709551616.0;
+                attribute.l = valid ? static_cast<uint64_t>(number) : 0;
+                break;
+            case IOT_VAL_TYPE_FLOAT:
+                valid = cJSON_IsNumber(value);
+                attribute.f = static_cast<float>(number);
+                break;
+            default:
+                valid = cJSON_IsString(value);
+                attribute.s = valid ? value->valuestring : "";
+                break;
+        }
+
+        valid = valid && attribute.slot != IOT_ATTR_SLOT_NONE;
+
+        if (!valid)
+            break;
+
+        attributes->push_back(attribute);
+    }
+
+    cJSON_Delete(root);
+
+    return valid;
+}
+
+/**
+ * Checks that what the device read matches the reference, comparing longs as the doubles cJSON reads them as.
+ */
+static bool same_as_reference(const iot_attribute_req_param_t &param, std::vector<attribute_t> reference)
+{
+    if (param.attributes.size() != reference.size())
+        return false;
+
+    for (size_t n = 0; n < reference.size(); n++) {
+        if (reference[n].type == IOT_VAL_TYPE_LONG &&
+            static_cast<double>(param.attributes[n].value.l) == static_cast<double>(reference[n].l))
+            reference[n].l = param.attributes[n].value.l;
+    }
+
+    return same(param, reference);
+}
+
+static esp_err_t parse(std::string &doc, iot_attribute_req_param_t *param)
+{
+    return IotDevice::iot_attribute_req_from_json(doc.data(), doc.size(), param);
+}
+
+static std::string mutate(std::string doc, std::mt19937 &rng)
+{
+    static const char alphabet[] = "{}[]\",:\\ \n0123456789-.eEtrufalsn_u";
+    size_t count = 1 + rng() % 2;
+
+    for (size_t i = 0; i < count && !doc.empty(); i++) {
+        size_t pos = rng() % doc.size();
+        char c = rng() % 8 == 0 ? static_cast<char>(rng()) : alphabet[rng() % (sizeof(alphabet) - 1)];
+
+        switch (rng() % 4) {
+            case 0: doc[pos] = c; break;
+            case 1: doc.insert(pos, 1, c); break;
+            case 2: doc.erase(pos, 1); break;
+            default: doc.resize(pos); break;
+        }
+    }
+
+    return doc;
+}
+
+static void test_requests(void)
+{
+    std::mt19937 rng(1);
+    std::vector<attribute_t> attributes;
+    std::vector<attribute_t> reference;
+    iot_attribute_req_param_t param;
+    int accepted = 0;
+
+    for (int n = 0; n < DOCUMENTS; n++) {
+        std::string doc = random_request(rng, 1 + rng() % 64, &attributes);
+        std::string parsed = doc;
+
+        HOST_CHECK(parse(parsed, &param) == ESP_OK);
+        HOST_CHECK(same(param, attributes));
+        HOST_CHECK(reference_parse(doc, &reference));
+        HOST_CHECK(same(param, reference));
+
+        for (int i = 0; i < MUTATIONS; i++) {
+            std::string mutated = mutate(doc, rng);
+            bool valid = reference_parse(mutated, &reference);
+
+            if (parse(mutated, &param) == ESP_OK) {
+                HOST_CHECK(valid);
+                HOST_CHECK(same_as_reference(param, reference));
+                accepted++;
+            }
+        }
+    }
+
+    // Most mutations break the request, but not all of them.
+    HOST_CHECK(accepted > 0 && accepted < DOCUMENTS * MUTATIONS);
+}
+
+static void test_malformed(void)
+{
+    const char *requests[] = {
+        "", " ", "{}", "[]", "[[]]", "[1]", "[null]", "{\"name\":\"attr_0\",\"type\":\"bool\",\"value\":true}",
+        "[{\"name\":\"attr_0\",\"type\":\"bool\",\"value\":true}",
+        "[{\"name\":\"attr_0\",\"type\":\"bool\",\"value\":true},]",
+        "[{\"name\":\"attr_0\",\"type\":\"bool\",\"value\":true}] []",
+        "[{\"name\":\"attr_0\",\"type\":\"bool\",\"value\":true}]x",
+        "[{\"name\":\"attr_0\",\"type\":\"bool\",\"value\":true,}]",
+        "[{\"name\":\"attr_0\",\"type\":\"bool\",\"value\":true},{}]",
+        // Names which aren't registered or aren't strings.
+        "[{\"type\":\"bool\",\"value\":true}]",
+        "[{\"name\":\"nope\",\"type\":\"bool\",\"value\":true}]",
+        "[{\"name\":\"ATTR_0\",\"type\":\"bool\",\"value\":true}]",
+        "[{\"name\":\"attr_0 \",\"type\":\"bool\",\"value\":true}]",
+        "[{\"name\":0,\"type\":\"bool\",\"value\":true}]",
+        "[{\"name\":[\"attr_0\"],\"type\":\"bool\",\"value\":true}]",
+        "[{\"Name\":\"attr_0\",\"type\":\"bool\",\"value\":true}]",
+        // Missing or unknown types and missing values.
+        "[{\"name\":\"attr_0\",\"value\":true}]",
+        "[{\"name\":\"attr_0\",\"type\":\"bool\"}]",
+        "[{\"name\":\"attr_0\",\"type\":\"Bool\",\"value\":true}]",
+        "[{\"name\":\"attr_0\",\"type\":\"boolean\",\"value\":true}]",
+        "[{\"name\":\"attr_0\",\"type\":\"int\",\"value\":1}]",
+        "[{\"name\":\"attr_0\",\"type\":1,\"value\":1}]",
+        "[{\"name\":\"attr_0\",\"type\":null,\"value\":1}]",
+        // Values which don't fit their type.
+        "[{\"name\":\"attr_0\",\"type\":\"bool\",\"value\":1}]",
+        "[{\"name\":\"attr_0\",\"type\":\"bool\",\"value\":\"true\"}]",
+        "[{\"name\":\"attr_0\",\"type\":\"integer\",\"value\":-1}]",
+        "[{\"name\":\"attr_0\",\"type\":\"integer\",\"value\":-0}]",
+        "[{\"name\":\"attr_0\",\"type\":\"integer\",\"value\":1.0}]",
+        "[{\"name\":\"attr_0\",\"type\":\"integer\",\"value\":1e3}]",
+        "[{\"name\":\"attr_0\",\"type\":\"integer\",\"value\":4294967296}]",
+        "[{\"name\":\"attr_0\",\"type\":\"integer\",\"value\":\"1\"}]",
+        "[{\"name\":\"attr_0\",\"type\":\"long\",\"value\":18446744073709551616}]",
+        "[{\"name\":\"attr_0\",\"type\":\"long\",\"value\":-5}]",
+        "[{\"name\":\"attr_0\",\"type\":\"float\",\"value\":\"1.5\"}]",
+        "[{\"name\":\"attr_0\",\"type\":\"float\",\"value\":null}]",
+        "[{\"name\":\"attr_0\",\"type\":\"string\",\"value\":5}]",
+        "[{\"name\":\"attr_0\",\"type\":\"string\",\"value\":null}]",
+        "[{\"name\":\"attr_0\",\"type\":\"string\",\"value\":[\"a\"]}]",
+        // Malformed json inside otherwise valid attributes.
+        "[{\"name\":\"attr_0\",\"type\":\"integer\",\"value\":01}]",
+        "[{\"name\":\"attr_0\",\"type\":\"string\",\"value\":\"a\tb\"}]",
+        "[{\"name\":\"attr_0\",\"type\":\"string\",\"value\":\"\\ud800\"}]",
+        "[{\"name\":\"attr_0\",\"type\":\"bool\",\"value\":true,\"meta\":{\"a\":[1,}}]",
+        "[{\"name\":\"attr_0\" \"type\":\"bool\",\"value\":true}]",
+    };
+    iot_attribute_req_param_t param;
+
+    for (const char *request : requests) {
+        std::string doc = request;
+
+        HOST_CHECK(parse(doc, &param) == ESP_ERR_INVALID_ARG);
+    }
+}
+
+static void test_values(void)
+{
+    iot_attribute_req_param_t param;
+
+    // The edges of the numbers, past what cJSON's doubles hold for longs.
+    std::string doc = "[{\"name\":\"attr_1\",\"type\":\"integer\",\"value\":4294967295},"
+                      "{\"name\":\"attr_2\",\"type\":\"long\",\"value\":18446744073709551615},"
+                      "{\"name\":\"attr_3\",\"type\":\"long\",\"value\":9007199254740993},"
+                      "{\"name\":\"attr_4\",\"type\":\"float\",\"value\":-2.5E-3},"
+                      "{\"name\":\"attr_5\",\"type\":\"float\",\"value\":1e3}]";
+
+    HOST_CHECK(parse(doc, &param) == ESP_OK && param.attributes.size() == 5);
+    HOST_CHECK(param.attributes[0].value.i == UINT32_MAX);
+    HOST_CHECK(param.attributes[1].value.l == UINT64_MAX);
+    HOST_CHECK(param.attributes[2].value.l == 9007199254740993);
+    HOST_CHECK(param.attributes[3].value.f == -2.5e-3f);
+    HOST_CHECK(param.attributes[4].value.f == 1000);
+
+    // Escapes in names, keys and values, the value points into the request.
+    doc = "[{\"n\\u0061me\":\"attr\\u005f7\",\"type\":\"string\",\"value\":\"a\\u00e9\\ud83d\\ude00\\n\\/\"},"
+          "{\"name\":\"quote\\\"d\",\"type\":\"bool\",\"value\":false},"
+          "{\"name\":\"caf\\u00E9\",\"type\":\"bool\",\"value\":true}]";
+
+    HOST_CHECK(parse(doc, &param) == ESP_OK && param.attributes.size() == 3);
+    HOST_CHECK(param.attributes[0].name == "attr_7");
+    HOST_CHECK(strcmp(param.attributes[0].value.s, "a\xc3\xa9\xf0\x9f\x98\x80\n/") == 0);
+    HOST_CHECK(param.attributes[0].value.s > doc.data() && param.attributes[0].value.s < doc.data() + doc.size());
+    HOST_CHECK(param.attributes[1].name == "quote\"d" && !param.attributes[1].value.b);
+    HOST_CHECK(param.attributes[2].slot == ATTRIBUTES - 2 && param.attributes[2].value.b);
+
+    // A repeated key overrides the earlier one, nested keys of unknown members don't count.
+    doc = "[{\"value\":1,\"x\":{\"value\":3,\"name\":\"attr_9\"},\"type\":\"integer\",\"name\":\"attr_8\",\"value\":2,"
+          "\"op\":\"read\"}]";
+
+    HOST_CHECK(parse(doc, &param) == ESP_OK && param.attributes.size() == 1);
+    HOST_CHECK(param.attributes[0].name == "attr_8" && param.attributes[0].value.i == 2);
+}
+
+/**
+ * Parses a request the way the device did with cJSON, copying the names and the string values.
+ */
+static esp_err_t parse_cjson(const char *buf, std::vector<std::pair<std::string, iot_val_t>> *attributes)
+{
+    cJSON *root = cJSON_Parse(buf);
+    cJSON *item;
+
+    if (!cJSON_IsArray(root) || cJSON_GetArraySize(root) == 0) {
+        cJSON_Delete(root);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    attributes->clear();
+
+    cJSON_ArrayForEach(item, root) {
+        const char *name = cJSON_GetStringValue(cJSON_GetObjectItem(item, "name"));
+        const cJSON *value = cJSON_GetObjectItem(item, "value");
+        const char *type = cJSON_GetStringValue(cJSON_GetObjectItem(item, "type"));
+        iot_val_t val = {.is_null = false};
+
+        if (name == nullptr || value == nullptr || type == nullptr) {
+            cJSON_Delete(root);
+            return ESP_ERR_INVALID_ARG;
+        }
+
+        if (strcmp(type, IOT_VAL_TYPE_BOOLEAN_STR) == 0 && cJSON_IsBool(value)) {
+            val.type = IOT_VAL_TYPE_BOOLEAN;
+            val.b = cJSON_IsTrue(value);
+        } else if (strcmp(type, IOT_VAL_TYPE_INTEGER_STR) == 0 && cJSON_IsNumber(value)) {
+            val.type = IOT_VAL_TYPE_INTEGER;
+            val.i = static_cast<uint32_t>(value->valuedouble);
+        } else if (strcmp(type, IOT_VAL_TYPE_LONG_STR) == 0 && cJSON_IsNumber(value)) {
+            val.type = IOT_VAL_TYPE_LONG;
+            val.l = static_cast<uint64_t>(value->valuedouble);
+        } else if (strcmp(type, IOT_VAL_TYPE_FLOAT_STR) == 0 && cJSON_IsNumber(value)) {
+            val.type = IOT_VAL_TYPE_FLOAT;
+            val.f = static_cast<float>(value->valuedouble);
+        } else if (strcmp(type, IOT_VAL_TYPE_STRING_STR) == 0 && cJSON_IsString(value)) {
+            size_t len = strlen(value->valuestring) + 1;
+
+            val.type = IOT_VAL_TYPE_STRING;
+            val.s = static_cast<char *>(memcpy(counted_malloc(len), value->valuestring, len));
+        } else {
+            cJSON_Delete(root);
+            return ESP_ERR_INVALID_ARG;
+        }
+
+        attributes->emplace_back(name, val);
+    }
+
+    cJSON_Delete(root);
+
+    return ESP_OK;
+}
+
+static void bench(void)
+{
+    std::mt19937 rng(2);
+    std::vector<attribute_t> attributes;
+    std::vector<std::pair<std::string, iot_val_t>> cjson_attributes;
+    iot_attribute_req_param_t param;
+    cJSON_Hooks hooks = {.malloc_fn = counted_malloc, .free_fn = counted_free};
+
+    printf("%10s %12s %14s %14s %14s %12s %14s\n", "attributes", "body bytes", "cjson ns", "cjson peak", "cjson heap",
+           "cjson allocs", "reader ns");
+
+    for (size_t count : {1, 8, 16, 32, 64}) {
+        std::string doc = random_request(rng, count, &attributes);
+        heap = {};
+        cJSON_InitHooks(&hooks);
+
+        // Both paths parse a copy of the body, the reader because it parses in place.
+        auto start = std::chrono::steady_clock::now();
+
+        for (int i = 0; i < ITERATIONS; i++) {
+            std::string body = doc;
+
+            HOST_CHECK(parse_cjson(body.c_str(), &cjson_attributes) == ESP_OK);
+
+            for (auto &attribute : cjson_attributes) {
+                if (attribute.second.type == IOT_VAL_TYPE_STRING)
+                    counted_free(attribute.second.s);
+            }
+        }
+
+        auto cjson = std::chrono::steady_clock::now() - start;
+
+        cJSON_InitHooks(nullptr);
+        HOST_CHECK(heap.current == 0);
+
+        start = std::chrono::steady_clock::now();
+
+        for (int i = 0; i < ITERATIONS; i++) {
+            std::string body = doc;
+
+            HOST_CHECK(parse(body, &param) == ESP_OK);
+        }
+
+        auto reader = std::chrono::steady_clock::now() - start;
+
+        // The string values point into the body, which is gone after each iteration.
+        std::string body = doc;
+
+        HOST_CHECK(parse(body, &param) == ESP_OK && same(param, attributes));
+
+        printf("%10zu %12zu %14lld %14zu %14zu %12zu %14lld\n", count, doc.size(),
+               static_cast<long long>(std::chrono::nanoseconds(cjson).count() / ITERATIONS), heap.peak,
+               heap.total / ITERATIONS, heap.allocations / ITERATIONS,
+               static_cast<long long>(std::chrono::nanoseconds(reader).count() / ITERATIONS));
+    }
+
+    printf("The reader takes no heap besides the attribute list, which both paths fill.\n");
+}
+
+int main()
+{
+    esp_log_level_set("*", ESP_LOG_NONE);
+
+    register_attributes();
+    test_requests();
+    test_malformed();
+    test_values();
+    bench();
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,172 @@
+#include <thread>
+#include <vector>
+#include "host_test.h"
+#include "iot_device.h"
+
+/*
+ * Tests of the attribute mailboxes. The clock is frozen and the mailbox task is stepped but never stepped, so it stays
+ * parked and the test flushes the mailboxes itself at known times. Posted values are applied at most once per window,
+ * latest wins, and a direct write cancels the older value waiting in its attribute's mailbox.
+ */
+
+static constexpr IotDeviceSchema schema{iot_attr("power", false),
+                                        iot_attr("brightness", 100u).coalesce(100),
+                                        iot_attr("level", 0u).coalesce(50),
+                                        iot_attr("label", "lamp").coalesce(100)};
+
+static constexpr uint8_t POWER = 0;
+static constexpr uint8_t BRIGHTNESS = 1;
+static constexpr uint8_t LEVEL = 2;
+static constexpr uint8_t LABEL = 3;
+
+static IotAttributeRegistry registry;
+static std::vector<iot_attribute_req_param_t> writes;
+static esp_err_t write_ret = ESP_OK;
+
+static esp_err_t on_write(iot_attribute_req_param_t *param)
+{
+    writes.push_back(*param);
+
+    return write_ret;
+}
+
+static iot_attribute_req_data_t item(uint8_t slot, iot_val_t value)
+{
+    return {.name = registry.name(slot), .value = value, .slot = slot};
+}
+
+static iot_val_t number(uint32_t i)
+{
+    return {.is_null = false, .i = i, .type = IOT_VAL_TYPE_INTEGER};
+}
+
+/**
+ * Checks that a write applied exactly the given numbers, in slot order.
+ */
+static bool applied(const iot_attribute_req_param_t &param, const std::vector<std::pair<uint8_t, uint32_t>> &values)
+{
+    if (param.attributes.size() != values.size())
+        return false;
+
+    for (size_t i = 0; i < values.size(); i++) {
+        if (param.attributes[i].slot != values[i].first || param.attributes[i].value.i != values[i].second)
+            return false;
+    }
+
+    return true;
+}
+
+static void advance(uint32_t ms)
+{
+    host_time_advance(static_cast<int64_t>(ms) * 1000);
+}
+
+int main()
+{
+    esp_log_level_set("*", ESP_LOG_NONE);
+    host_time_freeze(0);
+    host_task_stepped("iot_mailbox");
+
+    iot_device_cfg_t cfg = {.device_info = nullptr, .schema = &iot_schema_v<schema>};
+    IotAttributeShadow shadow;
+    IotAttributeMailbox mailbox;
+    std::mutex cb_mutex;
+    iot_val_t value;
+
+    HOST_CHECK(registry.build(&cfg) == ESP_OK);
+    shadow.init(registry);
+    HOST_CHECK(mailbox.init(registry, on_write, &shadow, &cb_mutex) == ESP_OK);
+    HOST_CHECK(host_task_find("iot_mailbox") != nullptr);
+
+    // Only the numbers of coalesced attributes are posted, the rest is left to be written as usual.
+    char label[] = "desk";
+    iot_attribute_req_param_t param;
+
+    param.attributes = {item(POWER, {.is_null = false, .b = true, .type = IOT_VAL_TYPE_BOOLEAN}),
+                        item(BRIGHTNESS, number(1)),
+                        item(LABEL, {.is_null = false, .s = label, .type = IOT_VAL_TYPE_STRING})};
+    HOST_CHECK(mailbox.post(&param) == 1);
+    HOST_CHECK(param.attributes.size() == 2);
+    HOST_CHECK(param.attributes[0].slot == POWER && param.attributes[1].slot == LABEL);
+
+    // The first write of an attribute is applied right away, with the shadow updated after it.
+    HOST_CHECK(mailbox.flush() == portMAX_DELAY);
+    HOST_CHECK(writes.size() == 1 && applied(writes[0], {{BRIGHTNESS, 1}}));
+    HOST_CHECK(shadow.get(BRIGHTNESS, &value) && value.i == 1);
+
+    // Within the window the latest value wins, and the mailboxes due together are applied in one write.
+    param.attributes = {item(BRIGHTNESS, number(2)), item(LEVEL, number(10))};
+    mailbox.post(&param);
+    param.attributes = {item(BRIGHTNESS, number(3))};
+    mailbox.post(&param);
+
+    HOST_CHECK(mailbox.flush() == pdMS_TO_TICKS(100));
+    HOST_CHECK(writes.size() == 2 && applied(writes[1], {{LEVEL, 10}}));
+
+    advance(30);
+    param.attributes = {item(LEVEL, number(11))};
+    mailbox.post(&param);
+    HOST_CHECK(mailbox.flush() == pdMS_TO_TICKS(20));
+    HOST_CHECK(writes.size() == 2);
+
+    advance(70);
+    HOST_CHECK(mailbox.flush() == portMAX_DELAY);
+    HOST_CHECK(writes.size() == 3 && applied(writes[2], {{BRIGHTNESS, 3}, {LEVEL, 11}}));
+
+    // A failed write leaves the shadow alone, the value isn't applied again.
+    advance(100);
+    param.attributes = {item(BRIGHTNESS, number(4))};
+    mailbox.post(&param);
+    write_ret = ESP_FAIL;
+    HOST_CHECK(mailbox.flush() == portMAX_DELAY);
+    write_ret = ESP_OK;
+    HOST_CHECK(writes.size() == 4 && applied(writes[3], {{BRIGHTNESS, 4}}));
+    HOST_CHECK(shadow.get(BRIGHTNESS, &value) && value.i == 3);
+    HOST_CHECK(mailbox.flush() == portMAX_DELAY && writes.size() == 4);
+
+    // A direct write cancels the older value waiting in the mailbox, and counts as the window's write.
+    param.attributes = {item(BRIGHTNESS, number(5))};
+    mailbox.post(&param);
+
+    iot_attribute_req_param_t direct;
+
+    direct.attributes = {item(POWER, {.is_null = false, .b = false, .type = IOT_VAL_TYPE_BOOLEAN}),
+                         item(BRIGHTNESS, number(6))};
+    HOST_CHECK(mailbox.cancel(&direct) == 1);
+    HOST_CHECK(mailbox.cancel(&direct) == 0);
+
+    advance(100);
+    HOST_CHECK(mailbox.flush() == portMAX_DELAY && writes.size() == 4);
+
+    advance(50);
+    mailbox.cancel(&direct);
+    param.attributes = {item(BRIGHTNESS, number(7))};
+    mailbox.post(&param);
+    HOST_CHECK(mailbox.flush() == pdMS_TO_TICKS(100) && writes.size() == 4);
+
+    advance(100);
+    HOST_CHECK(mailbox.flush() == portMAX_DELAY);
+    HOST_CHECK(writes.size() == 5 && applied(writes[4], {{BRIGHTNESS, 7}}));
+
+    // A flush waits for a direct write in progress, which cancels the older value the flush would have applied.
+    advance(100);
+    param.attributes = {item(BRIGHTNESS, number(8))};
+    mailbox.post(&param);
+    direct.attributes = {item(BRIGHTNESS, number(9))};
+
+    {
+        std::unique_lock<std::mutex> lock(cb_mutex);
+        std::thread flush([&mailbox] { mailbox.flush(); });
+
+        mailbox.cancel(&direct);
+        on_write(&direct);
+        shadow.update(&direct);
+        lock.unlock();
+        flush.join();
+    }
+
+    HOST_CHECK(writes.size() == 6 && applied(writes[5], {{BRIGHTNESS, 9}}));
+    HOST_CHECK(shadow.get(BRIGHTNESS, &value) && value.i == 9);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,107 @@
+#include <string>
+#include "host_test.h"
+#include "iot_device.h"
+
+/*
+ * Tests of the attribute registry, built from a schema and from the device info. Every name must resolve to its slot
+ * whatever the table's collisions, and nothing else may resolve: not a prefix, not an extension, not another case.
+ */
+
+static constexpr IotDeviceSchema schema{iot_attr("power", false),
+                                        iot_attr("brightness", 100u).max_age(500).coalesce(50),
+                                        iot_attr("temperature", 0.0f).telemetry(IOT_TELEMETRY_SLOW),
+                                        iot_attr("label", "lamp")};
+
+static void test_schema(void)
+{
+    iot_device_cfg_t cfg = {.device_info = nullptr, .schema = &iot_schema_v<schema>};
+    IotAttributeRegistry registry;
+
+    HOST_CHECK(registry.build(&cfg) == ESP_OK);
+    HOST_CHECK(registry.count() == 4);
+
+    const char *names[] = {"power", "brightness", "temperature", "label"};
+
+    for (uint8_t slot = 0; slot < 4; slot++) {
+        HOST_CHECK(registry.find(names[slot], strlen(names[slot])) == slot);
+        HOST_CHECK(registry.name(slot) == names[slot] && registry.name(slot).data()[strlen(names[slot])] == '\0');
+        HOST_CHECK(registry.schema(slot) != nullptr && registry.schema(slot)->name == registry.name(slot));
+    }
+
+    // Names needn't be null terminated, the length decides.
+    HOST_CHECK(registry.find("powerful", 5) == 0);
+    HOST_CHECK(registry.find("powerful", 8) == IOT_ATTR_SLOT_NONE);
+    HOST_CHECK(registry.find("powe", 4) == IOT_ATTR_SLOT_NONE);
+    HOST_CHECK(registry.find("Power", 5) == IOT_ATTR_SLOT_NONE);
+    HOST_CHECK(registry.find("", 0) == IOT_ATTR_SLOT_NONE);
+
+    HOST_CHECK(registry.max_age(1) == 500 && registry.coalesce(1) == 50);
+    HOST_CHECK(registry.max_age(0) == 0 && registry.coalesce(0) == 0);
+    HOST_CHECK(registry.telemetry(2) == IOT_TELEMETRY_SLOW && registry.telemetry(0) == IOT_TELEMETRY_NORMAL);
+
+    // Unknown slots have no name and no policy.
+    HOST_CHECK(registry.name(4).empty() && registry.name(IOT_ATTR_SLOT_NONE).empty());
+    HOST_CHECK(registry.schema(4) == nullptr && registry.max_age(4) == 0 && registry.coalesce(4) == 0);
+    HOST_CHECK(registry.telemetry(IOT_ATTR_SLOT_NONE) == IOT_TELEMETRY_NONE);
+}
+
+static void test_device_info(void)
+{
+    static iot_device_info_t info;
+    iot_device_cfg_t cfg = {.device_info = &info};
+    IotAttributeRegistry registry;
+
+    // An empty registry resolves nothing.
+    HOST_CHECK(registry.find("power", 5) == IOT_ATTR_SLOT_NONE);
+    HOST_CHECK(registry.build(&cfg) == ESP_OK && registry.count() == 0);
+    HOST_CHECK(registry.find("power", 5) == IOT_ATTR_SLOT_NONE);
+
+    // Enough names that the open addressing table has collisions and probes wrap around.
+    for (int i = 0; i < IOT_ATTR_SLOT_NONE - 1; i++)
+        info.attributes.push_back(iot_attribute_create(("attr_" + std::to_string(i)).c_str(), {.is_null = true}));
+
+    info.attributes[7].max_age_ms = 250;
+    info.attributes[7].coalesce_ms = 20;
+    info.attributes[7].telemetry = IOT_TELEMETRY_FAST;
+
+    HOST_CHECK(registry.build(&cfg) == ESP_OK);
+    HOST_CHECK(registry.count() == IOT_ATTR_SLOT_NONE - 1);
+
+    for (uint8_t slot = 0; slot < registry.count(); slot++) {
+        const std::string &name = info.attributes[slot].name;
+
+        HOST_CHECK(registry.find(name.c_str(), name.size()) == slot);
+        HOST_CHECK(registry.name(slot).data() == name.c_str());
+        HOST_CHECK(registry.schema(slot) == nullptr);
+
+        std::string other = name + "x";
+
+        HOST_CHECK(registry.find(other.c_str(), other.size()) == IOT_ATTR_SLOT_NONE);
+    }
+
+    HOST_CHECK(registry.max_age(7) == 250 && registry.coalesce(7) == 20);
+    HOST_CHECK(registry.telemetry(7) == IOT_TELEMETRY_FAST && registry.telemetry(8) == IOT_TELEMETRY_NORMAL);
+
+    // One more attribute would take the slot reserved for none.
+    info.attributes.push_back(iot_attribute_create("attr_last", {.is_null = true}));
+    HOST_CHECK(registry.build(&cfg) == ESP_ERR_INVALID_ARG);
+
+    // A name declared twice is rejected.
+    info.attributes.resize(3);
+    info.attributes.push_back(iot_attribute_create("attr_1", {.is_null = true}));
+    HOST_CHECK(registry.build(&cfg) == ESP_ERR_INVALID_ARG);
+
+    info.attributes.pop_back();
+    HOST_CHECK(registry.build(&cfg) == ESP_OK && registry.count() == 3);
+    HOST_CHECK(registry.find("attr_3", 6) == IOT_ATTR_SLOT_NONE && registry.find("attr_2", 6) == 2);
+}
+
+int main()
+{
+    esp_log_level_set("*", ESP_LOG_NONE);
+
+    test_schema();
+    test_device_info();
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,266 @@
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "host_test.h"
+#include "iot_device.h"
+
+/*
+ * Tests of the attribute shadow's reads, on threads. The clock is frozen so freshness only changes when a test moves
+ * it, and the read callback can be held at a gate, which keeps a read pending while other reads of the same attribute
+ * arrive. A read which must wait for the pending one is told apart by not finishing before the gate opens.
+ */
+
+static constexpr auto SETTLE = std::chrono::milliseconds(50);
+static constexpr auto TIMEOUT = std::chrono::seconds(5);
+
+static constexpr IotDeviceSchema schema{iot_attr("temperature", 0u).max_age(1000),
+                                        iot_attr("humidity", 0u).max_age(1000),
+                                        iot_attr("power", false)};
+
+static constexpr uint8_t TEMPERATURE = 0;
+static constexpr uint8_t HUMIDITY = 1;
+static constexpr uint8_t POWER = 2;
+
+static IotAttributeRegistry registry;
+static std::mutex mutex;
+static std::condition_variable cond;
+static bool gated = false;                        // Whether the next read callback waits at the gate.
+static bool waiting = false;                      // Whether a read callback is waiting at the gate.
+static esp_err_t read_ret = ESP_OK;
+static uint32_t generation = 0;                   // Added to each value read, so a test can tell reads apart.
+static std::vector<std::vector<uint8_t>> reads;   // The slots of each read callback.
+
+static esp_err_t on_read(iot_attribute_req_param_t *param)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    std::vector<uint8_t> slots;
+
+    for (auto &item : param->attributes) {
+        slots.push_back(item.slot);
+        item.value = {.is_null = false, .i = generation + item.slot, .type = IOT_VAL_TYPE_INTEGER};
+    }
+
+    reads.push_back(slots);
+
+    // Only the first callback waits, a later one passes the gate while it's closed.
+    if (gated && !waiting) {
+        waiting = true;
+        cond.notify_all();
+        cond.wait(lock, [] { return !gated; });
+        waiting = false;
+    }
+
+    return read_ret;
+}
+
+static void gate(void)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    gated = true;
+}
+
+static void open_gate(void)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    gated = false;
+    cond.notify_all();
+}
+
+static void await_waiting(void)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    HOST_CHECK(cond.wait_for(lock, TIMEOUT, [] { return waiting; }));
+}
+
+static size_t read_count(void)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return reads.size();
+}
+
+static void reset(uint32_t gen, esp_err_t ret = ESP_OK)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    reads.clear();
+    generation = gen;
+    read_ret = ret;
+}
+
+static iot_attribute_req_param_t request(const std::vector<uint8_t> &slots)
+{
+    iot_attribute_req_param_t param;
+
+    for (uint8_t slot : slots)
+        param.attributes.push_back(iot_attribute_create_read_req_data(registry.name(slot), slot));
+
+    return param;
+}
+
+/*
+ * A read of the shadow on its own thread, whose result is checked once it's joined.
+ */
+typedef struct reader {
+    iot_attribute_req_param_t param;
+    esp_err_t ret = ESP_ERR_INVALID_STATE;
+    bool done = false;
+    std::thread thread;
+} reader_t;
+
+static void start(reader_t *reader, IotAttributeShadow *shadow, const std::vector<uint8_t> &slots)
+{
+    reader->param = request(slots);
+    reader->thread = std::thread([reader, shadow] {
+        esp_err_t ret = shadow->read(&reader->param, on_read);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        reader->ret = ret;
+        reader->done = true;
+    });
+}
+
+static bool done(reader_t *reader)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return reader->done;
+}
+
+/*
+ * A fresh value is served from the shadow without a read, a stale or uncached one is read.
+ */
+static void test_fresh(IotAttributeShadow *shadow)
+{
+    reset(100);
+    HOST_CHECK(shadow->set(TEMPERATURE, {.is_null = false, .i = 21, .type = IOT_VAL_TYPE_INTEGER}) == ESP_OK);
+
+    iot_attribute_req_param_t param = request({TEMPERATURE});
+
+    host_time_advance(1000 * 1000);
+    HOST_CHECK(shadow->read(&param, on_read) == ESP_OK);
+    HOST_CHECK(read_count() == 0 && param.attributes[0].value.i == 21);
+
+    host_time_advance(1000);
+    HOST_CHECK(shadow->read(&param, on_read) == ESP_OK);
+    HOST_CHECK(reads == std::vector<std::vector<uint8_t>>({{TEMPERATURE}}) && param.attributes[0].value.i == 100);
+
+    // The value read is fresh again, the uncached attribute is read every time.
+    param = request({TEMPERATURE, POWER});
+    HOST_CHECK(shadow->read(&param, on_read) == ESP_OK);
+    HOST_CHECK(shadow->read(&param, on_read) == ESP_OK);
+    HOST_CHECK(reads == std::vector<std::vector<uint8_t>>({{TEMPERATURE}, {POWER}, {POWER}}));
+    HOST_CHECK(param.attributes[0].value.i == 100 && param.attributes[1].value.i == 100 + POWER);
+}
+
+/*
+ * Concurrent misses of an attribute cost one read, the later request waits for it and gets its value.
+ */
+static void test_coalesced(IotAttributeShadow *shadow)
+{
+    reader_t leader;
+    reader_t follower;
+
+    host_time_advance(2000 * 1000);
+    reset(200);
+    gate();
+    start(&leader, shadow, {HUMIDITY});
+    await_waiting();
+    start(&follower, shadow, {HUMIDITY});
+    std::this_thread::sleep_for(SETTLE);
+    HOST_CHECK(!done(&follower));
+
+    open_gate();
+    leader.thread.join();
+    follower.thread.join();
+
+    HOST_CHECK(reads == std::vector<std::vector<uint8_t>>({{HUMIDITY}}));
+    HOST_CHECK(leader.ret == ESP_OK && leader.param.attributes[0].value.i == 200 + HUMIDITY);
+    HOST_CHECK(follower.ret == ESP_OK && follower.param.attributes[0].value.i == 200 + HUMIDITY);
+}
+
+/*
+ * When the read failed, the requests which waited for it fail too rather than return an older value.
+ */
+static void test_failed(IotAttributeShadow *shadow)
+{
+    reader_t leader;
+    reader_t follower;
+
+    host_time_advance(2000 * 1000);
+    reset(300, ESP_ERR_TIMEOUT);
+    gate();
+    start(&leader, shadow, {HUMIDITY});
+    await_waiting();
+    start(&follower, shadow, {HUMIDITY});
+    std::this_thread::sleep_for(SETTLE);
+    HOST_CHECK(!done(&follower));
+
+    open_gate();
+    leader.thread.join();
+    follower.thread.join();
+
+    HOST_CHECK(read_count() == 1);
+    HOST_CHECK(leader.ret == ESP_ERR_TIMEOUT && follower.ret == ESP_FAIL);
+
+    // Nothing is left pending, the next read reads again.
+    reset(310);
+
+    iot_attribute_req_param_t param = request({HUMIDITY});
+
+    HOST_CHECK(shadow->read(&param, on_read) == ESP_OK && param.attributes[0].value.i == 310 + HUMIDITY);
+    HOST_CHECK(read_count() == 1);
+}
+
+/*
+ * A request can lead the read of one attribute while waiting for another request's read of another one, it only
+ * reads what nobody is reading and returns once both values are in.
+ */
+static void test_lead_and_wait(IotAttributeShadow *shadow)
+{
+    reader_t first;
+    reader_t second;
+
+    host_time_advance(2000 * 1000);
+    reset(400);
+    gate();
+    start(&first, shadow, {TEMPERATURE});
+    await_waiting();
+    start(&second, shadow, {HUMIDITY, TEMPERATURE});
+
+    auto deadline = std::chrono::steady_clock::now() + TIMEOUT;
+
+    while (read_count() < 2)
+        HOST_CHECK(std::chrono::steady_clock::now() < deadline);
+
+    std::this_thread::sleep_for(SETTLE);
+    HOST_CHECK(!done(&second));
+
+    open_gate();
+    first.thread.join();
+    second.thread.join();
+
+    HOST_CHECK(reads == std::vector<std::vector<uint8_t>>({{TEMPERATURE}, {HUMIDITY}}));
+    HOST_CHECK(first.ret == ESP_OK && first.param.attributes[0].value.i == 400 + TEMPERATURE);
+    HOST_CHECK(second.ret == ESP_OK);
+    HOST_CHECK(second.param.attributes[0].value.i == 400 + HUMIDITY);
+    HOST_CHECK(second.param.attributes[1].value.i == 400 + TEMPERATURE);
+}
+
+int main()
+{
+    esp_log_level_set("*", ESP_LOG_NONE);
+    host_time_freeze(1000 * 1000);
+
+    iot_device_cfg_t cfg = {.device_info = nullptr, .schema = &iot_schema_v<schema>};
+    IotAttributeShadow shadow;
+
+    HOST_CHECK(registry.build(&cfg) == ESP_OK);
+    shadow.init(registry);
+
+    test_fresh(&shadow);
+    test_coalesced(&shadow);
+    test_failed(&shadow);
+    test_lead_and_wait(&shadow);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,264 @@
+#include <cstring>
+#include <set>
+#include <vector>
+#include "host_test.h"
+#include "iot_device.h"
+
+/*
+ * Tests of the telemetry publisher. The clock is frozen and the telemetry task is stepped, so each step runs one tick
+ * at a known time, and the messages it publishes are compared byte by byte: the header, then a slot and a little
+ * endian value per attribute which changed in a class that's due, or per attribute for a snapshot. A failed publish
+ * must leave its values to be sent again at the next period.
+ */
+
+typedef struct message {
+    std::vector<uint8_t> data;
+    bool snapshot;
+    bool published;
+} message_t;
+
+static constexpr IotDeviceSchema schema{iot_attr("power", false),
+                                        iot_attr("brightness", 100u).telemetry(IOT_TELEMETRY_FAST),
+                                        iot_attr("temperature", 0.0f).telemetry(IOT_TELEMETRY_SLOW),
+                                        iot_attr("energy", uint64_t{0}),
+                                        iot_attr("label", "lamp"),
+                                        iot_attr("hidden", 0u).telemetry(IOT_TELEMETRY_NONE)};
+
+static constexpr uint8_t POWER = 0;
+static constexpr uint8_t BRIGHTNESS = 1;
+static constexpr uint8_t TEMPERATURE = 2;
+static constexpr uint8_t ENERGY = 3;
+static constexpr uint8_t LABEL = 4;
+static constexpr uint8_t HIDDEN = 5;
+
+static std::vector<message_t> messages;
+static int fail_in = -1;
+
+/**
+ * Records a message, failing the publish after fail_in more successful ones.
+ */
+static esp_err_t on_publish(const uint8_t *data, size_t len, bool snapshot)
+{
+    bool published = fail_in != 0;
+
+    if (fail_in >= 0)
+        fail_in--;
+
+    messages.push_back({std::vector<uint8_t>(data, data + len), snapshot, published});
+
+    return published ? ESP_OK : ESP_FAIL;
+}
+
+static std::vector<uint8_t> header(uint16_t seq, bool snapshot)
+{
+    return {IOT_TELEMETRY_VERSION, static_cast<uint8_t>(snapshot ? IOT_TELEMETRY_FLAG_SNAPSHOT : 0),
+            static_cast<uint8_t>(seq), static_cast<uint8_t>(seq >> 8)};
+}
+
+static void add_value(std::vector<uint8_t> *data, uint8_t slot, uint64_t bits, size_t size)
+{
+    data->push_back(slot);
+
+    for (size_t i = 0; i < size; i++)
+        data->push_back(static_cast<uint8_t>(bits >> (8 * i)));
+}
+
+static uint32_t float_bits(float value)
+{
+    uint32_t bits;
+
+    memcpy(&bits, &value, sizeof(bits));
+
+    return bits;
+}
+
+static void set(IotAttributeShadow *shadow, uint8_t slot, iot_val_t value)
+{
+    value.is_null = false;
+    HOST_CHECK(shadow->set(slot, value) == ESP_OK);
+}
+
+/**
+ * Advances the frozen clock and runs one tick of the telemetry task.
+ */
+static void advance(TaskHandle_t task, uint32_t ms)
+{
+    host_time_advance(static_cast<int64_t>(ms) * 1000);
+    host_task_step(task);
+}
+
+static void test_classes(void)
+{
+    static const iot_telemetry_cfg_t cfg = {.period_ms = {0, 100, 300, 1000}, .snapshot_ms = 10000};
+    iot_device_cfg_t device_cfg = {.device_info = nullptr, .schema = &iot_schema_v<schema>};
+    IotAttributeRegistry registry;
+    IotAttributeShadow shadow;
+    IotTelemetry telemetry;
+
+    HOST_CHECK(registry.build(&device_cfg) == ESP_OK);
+    shadow.init(registry);
+    messages.clear();
+
+    set(&shadow, POWER, {.b = true});
+    set(&shadow, BRIGHTNESS, {.i = 42});
+    set(&shadow, TEMPERATURE, {.f = 21.5f});
+    set(&shadow, ENERGY, {.l = 0x0102030405060708});
+    set(&shadow, HIDDEN, {.i = 7});
+    // Strings aren't kept by the shadow, this one has no value to publish.
+    HOST_CHECK(shadow.set(LABEL, {.is_null = false, .s = const_cast<char *>("desk")}) == ESP_OK);
+
+    HOST_CHECK(telemetry.start(registry, &shadow, &cfg, on_publish) == ESP_OK);
+
+    TaskHandle_t task = host_task_find("iot_telemetry");
+
+    HOST_CHECK(task != nullptr);
+
+    // The first snapshot is published when the task starts, with every published value known.
+    host_task_step(task);
+
+    std::vector<uint8_t> expected = header(0, true);
+
+    add_value(&expected, POWER, 1, 1);
+    add_value(&expected, BRIGHTNESS, 42, 4);
+    add_value(&expected, TEMPERATURE, float_bits(21.5f), 4);
+    add_value(&expected, ENERGY, 0x0102030405060708, 8);
+
+    HOST_CHECK(messages.size() == 1);
+    HOST_CHECK(messages[0].data == expected && messages[0].snapshot);
+
+    // Nothing changed since the snapshot.
+    advance(task, 100);
+    HOST_CHECK(messages.size() == 1);
+
+    // Each class only publishes its own changes, at its own period.
+    set(&shadow, POWER, {.b = false});
+    set(&shadow, BRIGHTNESS, {.i = 43});
+    set(&shadow, TEMPERATURE, {.f = 22.0f});
+    set(&shadow, HIDDEN, {.i = 8});
+
+    advance(task, 100);
+    expected = header(1, false);
+    add_value(&expected, BRIGHTNESS, 43, 4);
+    HOST_CHECK(messages.size() == 2);
+    HOST_CHECK(messages[1].data == expected && !messages[1].snapshot);
+
+    advance(task, 100);
+    expected = header(2, false);
+    add_value(&expected, POWER, 0, 1);
+    HOST_CHECK(messages.size() == 3 && messages[2].data == expected);
+
+    for (int i = 0; i < 6; i++)
+        advance(task, 100);
+
+    HOST_CHECK(messages.size() == 3);
+
+    advance(task, 100);
+    expected = header(3, false);
+    add_value(&expected, TEMPERATURE, float_bits(22.0f), 4);
+    HOST_CHECK(messages.size() == 4 && messages[3].data == expected);
+
+    // A failed publish keeps its sequence number and its values for the next period.
+    set(&shadow, BRIGHTNESS, {.i = 44});
+    fail_in = 0;
+    advance(task, 100);
+    expected = header(4, false);
+    add_value(&expected, BRIGHTNESS, 44, 4);
+    HOST_CHECK(messages.size() == 5 && messages[4].data == expected && !messages[4].published);
+
+    advance(task, 100);
+    HOST_CHECK(messages.size() == 6 && messages[5].data == expected && messages[5].published);
+
+    // A late tick publishes each due class once, and the snapshot carries every value whether it changed or not.
+    set(&shadow, ENERGY, {.l = UINT64_MAX});
+    advance(task, 8800);
+    expected = header(5, true);
+    add_value(&expected, POWER, 0, 1);
+    add_value(&expected, BRIGHTNESS, 44, 4);
+    add_value(&expected, TEMPERATURE, float_bits(22.0f), 4);
+    add_value(&expected, ENERGY, UINT64_MAX, 8);
+    HOST_CHECK(messages.size() == 7 && messages[6].data == expected && messages[6].snapshot);
+
+    advance(task, 100);
+    HOST_CHECK(messages.size() == 7);
+}
+
+static void test_split(void)
+{
+    static const iot_telemetry_cfg_t cfg = {.period_ms = {0, 0, 100, 0}, .snapshot_ms = 0};
+    static iot_device_info_t info;
+    constexpr uint8_t count = 40;
+    iot_device_cfg_t device_cfg = {.device_info = &info};
+    IotAttributeRegistry registry;
+    IotAttributeShadow shadow;
+    IotTelemetry telemetry;
+
+    for (uint8_t slot = 0; slot < count; slot++)
+        info.attributes.push_back(iot_attribute_create(("meter_" + std::to_string(slot)).c_str(), {.is_null = true}));
+
+    HOST_CHECK(registry.build(&device_cfg) == ESP_OK);
+    shadow.init(registry);
+
+    for (uint8_t slot = 0; slot < count; slot++)
+        set(&shadow, slot, {.l = slot, .type = IOT_VAL_TYPE_LONG});
+
+    messages.clear();
+    HOST_CHECK(telemetry.start(registry, &shadow, &cfg, on_publish) == ESP_OK);
+
+    TaskHandle_t task = host_task_find("iot_telemetry");
+
+    host_task_step(task);
+
+    // The values which don't fit a message go in the next one, each value is sent once.
+    auto check = [&](size_t first, uint16_t seq, bool snapshot, uint64_t base, std::set<uint8_t> *slots) {
+        for (size_t i = first; i < messages.size(); i++) {
+            const std::vector<uint8_t> &data = messages[i].data;
+
+            HOST_CHECK(data.size() <= IOT_TELEMETRY_MAX_SIZE && (data.size() - 4) % 9 == 0);
+            HOST_CHECK(std::vector<uint8_t>(data.begin(), data.begin() + 4) == header(seq++, snapshot));
+
+            for (size_t pos = 4; pos < data.size(); pos += 9) {
+                uint64_t bits = 0;
+
+                for (size_t byte = 0; byte < 8; byte++)
+                    bits |= static_cast<uint64_t>(data[pos + 1 + byte]) << (8 * byte);
+
+                HOST_CHECK(bits == base + data[pos] && slots->insert(data[pos]).second);
+            }
+        }
+    };
+    std::set<uint8_t> slots;
+
+    HOST_CHECK(messages.size() == 2 && messages[0].data.size() == IOT_TELEMETRY_MAX_SIZE);
+    check(0, 0, true, 0, &slots);
+    HOST_CHECK(slots.size() == count);
+
+    // The values of a message which failed are sent again, those of the messages before it aren't.
+    for (uint8_t slot = 0; slot < count; slot++)
+        set(&shadow, slot, {.l = 1000u + slot, .type = IOT_VAL_TYPE_LONG});
+
+    fail_in = 1;
+    advance(task, 100);
+    HOST_CHECK(messages.size() == 4 && messages[2].published && !messages[3].published);
+
+    slots.clear();
+    check(2, 2, false, 1000, &slots);
+    HOST_CHECK(slots.size() == count);
+
+    slots.clear();
+    advance(task, 100);
+    HOST_CHECK(messages.size() == 5);
+    check(4, 3, false, 1000, &slots);
+    HOST_CHECK(slots.size() == count - (messages[2].data.size() - 4) / 9);
+}
+
+int main()
+{
+    esp_log_level_set("*", ESP_LOG_NONE);
+    host_time_freeze(0);
+    host_task_stepped("iot_telemetry");
+
+    test_classes();
+    test_split();
+
+    return EXIT_SUCCESS;
+}
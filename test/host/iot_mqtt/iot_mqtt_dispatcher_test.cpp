@@ -0,0 +1,419 @@
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+#include "host_test.h"
+#include "iot_mqtt_dispatcher.h"
+
+/*
+ * Tests of the dispatcher with its workers on threads. A subscriber's callback can be held at a gate, which keeps a
+ * worker busy for as long as a test needs. The dispatchers are never destroyed, their workers run until the end.
+ */
+
+static constexpr auto SETTLE = std::chrono::milliseconds(50);
+static constexpr auto TIMEOUT = std::chrono::seconds(5);
+
+static std::mutex mutex;
+static std::condition_variable cond;
+static uint32_t gated = 0;                       // A bit per subscription whose callbacks wait at the gate.
+static uint32_t waiting = 0;                     // A bit per subscription with a callback waiting at the gate.
+static uint32_t running = 0;                     // A bit per subscription with a callback running.
+static std::vector<std::string> calls[IOT_MQTT_MAX_SUBSCRIPTIONS];
+static std::vector<const char *> bufs[IOT_MQTT_MAX_SUBSCRIPTIONS];
+
+static void on_message(const char *topic, size_t topic_len, const char *data, size_t len, void *priv_data)
+{
+    auto id = static_cast<uint8_t>(reinterpret_cast<intptr_t>(priv_data));
+    std::unique_lock<std::mutex> lock(mutex);
+
+    // A subscription's messages are delivered one at a time.
+    HOST_CHECK((running & (1UL << id)) == 0);
+    running |= 1UL << id;
+    calls[id].push_back(std::string(topic, topic_len) + "|" + std::string(data, len));
+    bufs[id].push_back(topic);
+
+    waiting |= 1UL << id;
+    cond.notify_all();
+    cond.wait(lock, [id] { return (gated & (1UL << id)) == 0; });
+    waiting &= ~(1UL << id);
+    running &= ~(1UL << id);
+    cond.notify_all();
+}
+
+static iot_mqtt_subscriber_t subscriber(uint8_t id, iot_mqtt_priority_e priority,
+                                        iot_mqtt_overflow_e overflow = IOT_MQTT_OVERFLOW_DROP_NEWEST)
+{
+    return {.cb = on_message, .priv_data = reinterpret_cast<void *>(static_cast<intptr_t>(id)), .priority = priority,
+            .overflow = overflow, .id = id};
+}
+
+static void post(IotMqttDispatcher *dispatcher, const iot_mqtt_subscriber_t &sub, const std::string &topic,
+                 const std::string &data)
+{
+    dispatcher->post(&sub, 1, topic.data(), topic.size(), data.data(), data.size(), nullptr);
+}
+
+static void gate(uint8_t id)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    gated |= 1UL << id;
+}
+
+static void open_gate(uint8_t id)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    gated &= ~(1UL << id);
+    cond.notify_all();
+}
+
+static void await_waiting(uint8_t id)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    HOST_CHECK(cond.wait_for(lock, TIMEOUT, [id] { return (waiting & (1UL << id)) != 0; }));
+}
+
+static size_t call_count(uint8_t id)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return calls[id].size();
+}
+
+static void await_calls(uint8_t id, size_t count)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    HOST_CHECK(cond.wait_for(lock, TIMEOUT, [id, count] { return calls[id].size() >= count; }));
+}
+
+static void await_idle(IotMqttDispatcher *dispatcher)
+{
+    auto deadline = std::chrono::steady_clock::now() + TIMEOUT;
+
+    while (true) {
+        iot_mqtt_dispatch_metrics_t metrics = dispatcher->metrics();
+        bool queued = metrics.depth[0] + metrics.depth[1] + metrics.depth[2] > 0;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            if (!queued && running == 0)
+                return;
+        }
+
+        HOST_CHECK(std::chrono::steady_clock::now() < deadline);
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+static void reset(void)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    for (auto &list : calls)
+        list.clear();
+
+    for (auto &list : bufs)
+        list.clear();
+}
+
+static IotMqttDispatcher *start(IotMqttPool *large)
+{
+    auto *dispatcher = new IotMqttDispatcher();
+
+    reset();
+    HOST_CHECK(dispatcher->start(IOT_MQTT_DISPATCH_WORKERS, large) == ESP_OK);
+
+    return dispatcher;
+}
+
+/*
+ * A message is copied once and shared by its subscribers, it arrives intact at each of them.
+ */
+static void test_shared_copy(IotMqttPool *large)
+{
+    IotMqttDispatcher *dispatcher = start(large);
+    iot_mqtt_subscriber_t subs[] = {subscriber(0, IOT_MQTT_PRIORITY_NORMAL), subscriber(1, IOT_MQTT_PRIORITY_HIGH),
+                                    subscriber(2, IOT_MQTT_PRIORITY_NORMAL)};
+    std::string topic = "hover/shared";
+    std::string data = "{\"power\":true}";
+
+    dispatcher->post(subs, 3, topic.data(), topic.size(), data.data(), data.size(), nullptr);
+    await_idle(dispatcher);
+
+    for (uint8_t id = 0; id < 3; id++) {
+        HOST_CHECK(calls[id] == std::vector<std::string>({topic + "|" + data}));
+        HOST_CHECK(bufs[id][0] == bufs[0][0]);
+    }
+
+    // A message too large for a dispatch buffer takes a buffer of the large pool.
+    std::string big(IOT_MQTT_DISPATCH_BUFFER_SIZE, 'x');
+
+    dispatcher->post(subs, 1, topic.data(), topic.size(), big.data(), big.size(), nullptr);
+    await_idle(dispatcher);
+    HOST_CHECK(calls[0].size() == 2 && calls[0][1] == topic + "|" + big);
+
+    HOST_CHECK(dispatcher->metrics().delivered == 4);
+    HOST_CHECK(dispatcher->stats(1).calls == 1);
+    HOST_CHECK(dispatcher->stats(IOT_MQTT_MAX_SUBSCRIPTIONS).calls == 0);
+}
+
+/*
+ * A subscription's messages are delivered one at a time and in order, even with an idle worker.
+ */
+static void test_one_at_a_time(IotMqttPool *large)
+{
+    IotMqttDispatcher *dispatcher = start(large);
+
+    gate(6);
+
+    for (int i = 0; i < 4; i++)
+        post(dispatcher, subscriber(6, IOT_MQTT_PRIORITY_HIGH), "hover/6", std::to_string(i));
+
+    await_waiting(6);
+    std::this_thread::sleep_for(SETTLE);
+    HOST_CHECK(call_count(6) == 1);
+
+    // The idle worker still delivers to other subscriptions.
+    post(dispatcher, subscriber(7, IOT_MQTT_PRIORITY_NORMAL), "hover/7", "other");
+    await_calls(7, 1);
+
+    open_gate(6);
+    await_idle(dispatcher);
+    HOST_CHECK(calls[6] == std::vector<std::string>({"hover/6|0", "hover/6|1", "hover/6|2", "hover/6|3"}));
+}
+
+/*
+ * Higher priorities are taken first, and a low priority message never takes the last idle worker.
+ */
+static void test_priorities(IotMqttPool *large)
+{
+    IotMqttDispatcher *dispatcher = start(large);
+
+    gate(0);
+    post(dispatcher, subscriber(0, IOT_MQTT_PRIORITY_HIGH), "hover/0", "a");
+    await_waiting(0);
+
+    // One worker is idle, the low priority message waits for another one.
+    post(dispatcher, subscriber(1, IOT_MQTT_PRIORITY_LOW), "hover/1", "b");
+    std::this_thread::sleep_for(SETTLE);
+    HOST_CHECK(call_count(1) == 0);
+    HOST_CHECK(dispatcher->metrics().depth[IOT_MQTT_PRIORITY_LOW] == 1);
+
+    post(dispatcher, subscriber(2, IOT_MQTT_PRIORITY_HIGH), "hover/2", "c");
+    await_calls(2, 1);
+    HOST_CHECK(call_count(1) == 0);
+
+    open_gate(0);
+    await_calls(1, 1);
+    await_idle(dispatcher);
+
+    // With every worker busy, the waiting messages are taken highest priority first.
+    gate(0);
+    gate(1);
+    post(dispatcher, subscriber(0, IOT_MQTT_PRIORITY_HIGH), "hover/0", "d");
+    post(dispatcher, subscriber(1, IOT_MQTT_PRIORITY_HIGH), "hover/1", "e");
+    await_waiting(0);
+    await_waiting(1);
+
+    post(dispatcher, subscriber(3, IOT_MQTT_PRIORITY_LOW), "hover/3", "low");
+    post(dispatcher, subscriber(4, IOT_MQTT_PRIORITY_NORMAL), "hover/4", "normal");
+    post(dispatcher, subscriber(5, IOT_MQTT_PRIORITY_HIGH), "hover/5", "high");
+    gate(5);
+    gate(4);
+    open_gate(0);
+    await_waiting(5);
+    HOST_CHECK(call_count(4) == 0 && call_count(3) == 0);
+    open_gate(1);
+    await_waiting(4);
+    HOST_CHECK(call_count(3) == 0);
+    open_gate(5);
+    open_gate(4);
+    await_idle(dispatcher);
+    HOST_CHECK(call_count(3) == 1);
+}
+
+/*
+ * A full queue makes room by evicting a lower priority message, then applies the subscription's overflow policy.
+ */
+static void test_overflow(IotMqttPool *large)
+{
+    IotMqttDispatcher *dispatcher = start(large);
+
+    gate(0);
+    gate(1);
+    post(dispatcher, subscriber(0, IOT_MQTT_PRIORITY_HIGH), "hover/0", "busy");
+    post(dispatcher, subscriber(1, IOT_MQTT_PRIORITY_HIGH), "hover/1", "busy");
+    await_waiting(0);
+    await_waiting(1);
+
+    for (int i = 0; i < IOT_MQTT_DISPATCH_QUEUE_SIZE; i++)
+        post(dispatcher, subscriber(2, IOT_MQTT_PRIORITY_LOW), "hover/2", std::to_string(i));
+
+    HOST_CHECK(dispatcher->metrics().dropped == 0);
+    HOST_CHECK(dispatcher->metrics().max_depth == IOT_MQTT_DISPATCH_QUEUE_SIZE);
+
+    // Every buffer is in use, the new message still gets one by evicting the oldest low priority message.
+    post(dispatcher, subscriber(3, IOT_MQTT_PRIORITY_NORMAL, IOT_MQTT_OVERFLOW_DROP_OLDEST), "hover/3", "first");
+    HOST_CHECK(dispatcher->metrics().evicted == 1);
+
+    post(dispatcher, subscriber(2, IOT_MQTT_PRIORITY_LOW), "hover/2", "dropped");
+    HOST_CHECK(dispatcher->metrics().dropped == 1);
+
+    post(dispatcher, subscriber(2, IOT_MQTT_PRIORITY_LOW, IOT_MQTT_OVERFLOW_DROP_OLDEST), "hover/2", "last");
+    HOST_CHECK(dispatcher->metrics().evicted == 2);
+
+    iot_mqtt_dispatch_metrics_t metrics = dispatcher->metrics();
+
+    HOST_CHECK(metrics.depth[IOT_MQTT_PRIORITY_LOW] == IOT_MQTT_DISPATCH_QUEUE_SIZE - 1);
+    HOST_CHECK(metrics.depth[IOT_MQTT_PRIORITY_NORMAL] == 1);
+
+    open_gate(0);
+    open_gate(1);
+    await_idle(dispatcher);
+
+    // The two oldest were evicted, the rest arrive in order.
+    std::vector<std::string> expected;
+
+    for (int i = 2; i < IOT_MQTT_DISPATCH_QUEUE_SIZE; i++)
+        expected.push_back("hover/2|" + std::to_string(i));
+
+    expected.push_back("hover/2|last");
+
+    HOST_CHECK(calls[2] == expected);
+    HOST_CHECK(calls[3] == std::vector<std::string>({"hover/3|first"}));
+}
+
+/*
+ * An exhausted pool only evicts the waiting messages holding one of its buffers, the small messages queued in the
+ * dispatch pool aren't dropped for a large message they can't make room for.
+ */
+static void test_evict_same_pool(IotMqttPool *large)
+{
+    IotMqttDispatcher *dispatcher = start(large);
+    std::string big(600, 'b');
+    std::vector<char *> taken;
+
+    gate(0);
+    gate(1);
+    post(dispatcher, subscriber(0, IOT_MQTT_PRIORITY_HIGH), "hover/0", "busy");
+    post(dispatcher, subscriber(1, IOT_MQTT_PRIORITY_HIGH), "hover/1", "busy");
+    await_waiting(0);
+    await_waiting(1);
+
+    // The large pool is held by the client, no eviction can free one of its buffers.
+    for (char *buf; (buf = large->acquire()) != nullptr;)
+        taken.push_back(buf);
+
+    for (int i = 0; i < 5; i++)
+        post(dispatcher, subscriber(2, IOT_MQTT_PRIORITY_LOW), "hover/2", std::to_string(i));
+
+    post(dispatcher, subscriber(3, IOT_MQTT_PRIORITY_HIGH), "hover/3", big);
+    HOST_CHECK(dispatcher->metrics().evicted == 0);
+    HOST_CHECK(dispatcher->metrics().dropped == 1);
+
+    for (char *buf : taken)
+        large->release(buf);
+
+    // The large pool is held by waiting messages, the oldest of them makes room and the small ones stay.
+    for (int i = 0; i < IOT_MQTT_BUFFER_COUNT; i++)
+        post(dispatcher, subscriber(4, IOT_MQTT_PRIORITY_LOW), "hover/4", std::to_string(i) + big);
+
+    post(dispatcher, subscriber(3, IOT_MQTT_PRIORITY_HIGH), "hover/3", big);
+    HOST_CHECK(dispatcher->metrics().evicted == 1);
+    HOST_CHECK(dispatcher->metrics().dropped == 1);
+
+    open_gate(0);
+    open_gate(1);
+    await_idle(dispatcher);
+
+    HOST_CHECK(calls[2] == std::vector<std::string>({"hover/2|0", "hover/2|1", "hover/2|2", "hover/2|3", "hover/2|4"}));
+    HOST_CHECK(calls[3] == std::vector<std::string>({"hover/3|" + big}));
+    HOST_CHECK(calls[4].size() == IOT_MQTT_BUFFER_COUNT - 1 && calls[4][0] == "hover/4|1" + big);
+}
+
+/*
+ * Random traffic, afterwards every buffer of both pools must be back: the queue fills up without a drop.
+ */
+static void test_buffers_returned(IotMqttPool *large)
+{
+    IotMqttDispatcher *dispatcher = start(large);
+    std::mt19937 rng(1);
+
+    for (int i = 0; i < 5000; i++) {
+        iot_mqtt_subscriber_t subs[4];
+        size_t count = 1 + rng() % 4;
+
+        for (size_t n = 0; n < count; n++) {
+            auto id = static_cast<uint8_t>(2 + (i + n) % 8);
+            subs[n] = subscriber(id, static_cast<iot_mqtt_priority_e>(rng() % IOT_MQTT_PRIORITY_MAX),
+                                 static_cast<iot_mqtt_overflow_e>(rng() % 2));
+        }
+
+        std::string topic = "hover/" + std::to_string(i);
+        std::string data(rng() % 2 == 0 ? 16 : IOT_MQTT_DISPATCH_BUFFER_SIZE + rng() % 1000, 'd');
+
+        // Messages reassembled in a large buffer are handed over, the poster keeps its own reference.
+        if (rng() % 4 == 0 && topic.size() + data.size() <= large->size()) {
+            char *buf = large->acquire();
+
+            if (buf != nullptr) {
+                memcpy(buf, topic.data(), topic.size());
+                memcpy(buf + topic.size(), data.data(), data.size());
+                dispatcher->post(subs, count, buf, topic.size(), buf + topic.size(), data.size(), buf);
+                large->release(buf);
+                continue;
+            }
+        }
+
+        dispatcher->post(subs, count, topic.data(), topic.size(), data.data(), data.size(), nullptr);
+    }
+
+    await_idle(dispatcher);
+
+    std::vector<char *> taken;
+
+    for (char *buf; (buf = large->acquire()) != nullptr;)
+        taken.push_back(buf);
+
+    HOST_CHECK(taken.size() == IOT_MQTT_BUFFER_COUNT);
+
+    for (char *buf : taken)
+        large->release(buf);
+
+    uint32_t dropped = dispatcher->metrics().dropped;
+
+    gate(0);
+    gate(1);
+    post(dispatcher, subscriber(0, IOT_MQTT_PRIORITY_HIGH), "hover/0", "busy");
+    post(dispatcher, subscriber(1, IOT_MQTT_PRIORITY_HIGH), "hover/1", "busy");
+    await_waiting(0);
+    await_waiting(1);
+
+    for (int i = 0; i < IOT_MQTT_DISPATCH_QUEUE_SIZE; i++)
+        post(dispatcher, subscriber(static_cast<uint8_t>(2 + i % 8), IOT_MQTT_PRIORITY_HIGH), "hover/x", "y");
+
+    HOST_CHECK(dispatcher->metrics().dropped == dropped);
+
+    open_gate(0);
+    open_gate(1);
+    await_idle(dispatcher);
+}
+
+int main()
+{
+    IotMqttPool large;
+
+    esp_log_level_set("*", ESP_LOG_NONE);
+    HOST_CHECK(large.init(IOT_MQTT_BUFFER_COUNT, IOT_MQTT_MAX_BUFFER) == ESP_OK);
+
+    test_shared_copy(&large);
+    test_one_at_a_time(&large);
+    test_priorities(&large);
+    test_overflow(&large);
+    test_evict_same_pool(&large);
+    test_buffers_returned(&large);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,255 @@
+#include <algorithm>
+#include <map>
+#include <random>
+#include <set>
+#include "host_test.h"
+#include "iot_mqtt_outbox.h"
+
+/*
+ * A crash recovery model of the outbox. Each round boots an outbox on the flash the previous round left behind,
+ * replays it, and checks the replay against a model of every message published so far: nothing unknown or corrupt is
+ * replayed, nothing twice, nothing acknowledged once the acknowledgement reached the flash, and unless the outbox
+ * reported dropping messages, every unacknowledged message which reached the flash. The round then publishes,
+ * acknowledges and flushes at random, may cut the power in the middle of a flush, and crashes by abandoning the outbox.
+ */
+
+static constexpr const char *LABEL = "mqtt_outbox";
+static constexpr uint32_t SECTORS = 8;
+static constexpr int ROUNDS = 400;
+static constexpr size_t MAX_TRACKED = 40;
+
+/*
+ * The states of a message in the model.
+ */
+typedef enum {
+    MSG_PENDING,     // Published, its record waits in the batch.
+    MSG_DURABLE,     // Its record is in flash, it must be replayed.
+    MSG_MAYBE,       // Its record was being written when the power was cut, it may be replayed.
+    MSG_ACKING,      // Acknowledged once durable, the flash isn't cleared yet, it may be replayed.
+} msg_state_e;
+
+typedef struct msg {
+    std::string topic;
+    std::string data;
+    int msg_id;
+    msg_state_e state;
+    bool forgotten;
+    bool required;
+} msg_t;
+
+typedef struct published {
+    std::string topic;
+    std::string data;
+    int qos;
+} published_t;
+
+static std::vector<published_t> published;
+static int next_msg_id = 1;
+
+int esp_mqtt_client_enqueue(esp_mqtt_client_handle_t client, const char *topic, const char *data, int len, int qos,
+                            int retain, bool store)
+{
+    published.push_back({topic, std::string(data, len), qos});
+
+    return next_msg_id++;
+}
+
+static uint64_t serial_of(const std::string &topic)
+{
+    HOST_CHECK(topic.rfind("hover/outbox/", 0) == 0);
+
+    return std::stoull(topic.substr(13));
+}
+
+/**
+ * Applies the messages replayed by the outbox to the model, they're given the ids the client returned.
+ *
+ * @param[in] model The messages which may be replayed, by serial.
+ * @param[in] first The index of the first replayed message in the published messages.
+ * @return The serials replayed.
+ */
+static std::set<uint64_t> replayed(std::map<uint64_t, msg_t> &model, size_t first)
+{
+    std::set<uint64_t> serials;
+
+    for (size_t i = first; i < published.size(); i++) {
+        const published_t &message = published[i];
+        uint64_t serial = serial_of(message.topic);
+        auto it = model.find(serial);
+
+        HOST_CHECK(it != model.end());
+        HOST_CHECK(serials.insert(serial).second);
+        HOST_CHECK(message.data == it->second.data);
+        HOST_CHECK(message.qos == 1);
+
+        it->second.msg_id = next_msg_id - static_cast<int>(published.size() - i);
+        it->second.state = MSG_DURABLE;
+        it->second.forgotten = false;
+        it->second.required = false;
+    }
+
+    return serials;
+}
+
+int main()
+{
+    std::mt19937 rng(1);
+    auto chance = [&rng](int percent) { return static_cast<int>(rng() % 100) < percent; };
+
+    esp_log_level_set("*", ESP_LOG_NONE);
+    host_task_stepped("iot_outbox");
+
+    const esp_partition_t *partition = host_partition_add(LABEL, SECTORS * 4096);
+    std::map<uint64_t, msg_t> model;
+    uint64_t next_serial = 0;
+    int strict = 0;
+    int cuts = 0;
+
+    for (int round = 0; round < ROUNDS; round++) {
+        auto *outbox = new IotMqttOutbox();
+
+        host_flash_power_restore(partition);
+        HOST_CHECK(outbox->init(LABEL) == ESP_OK);
+
+        TaskHandle_t task = host_task_find("iot_outbox");
+        size_t first = published.size();
+
+        outbox->replay(nullptr);
+        HOST_CHECK(outbox->dropped() == 0);
+
+        std::set<uint64_t> serials = replayed(model, first);
+
+        // Whatever wasn't replayed is gone, a round which dropped nothing must have left every durable one.
+        for (auto it = model.begin(); it != model.end();) {
+            if (serials.count(it->first) > 0) {
+                ++it;
+                continue;
+            }
+
+            HOST_CHECK(!it->second.required);
+            it = model.erase(it);
+        }
+
+        bool cut = false;
+        uint32_t refused = 0;
+        int ops = static_cast<int>(rng() % 60);
+
+        for (int op = 0; op < ops && !cut; op++) {
+            int kind = static_cast<int>(rng() % 100);
+
+            if (kind < 40 && model.size() < MAX_TRACKED) {
+                uint64_t serial = next_serial++;
+                std::string topic = "hover/outbox/" + std::to_string(serial);
+                std::string data(rng() % 300, static_cast<char>('a' + serial % 26));
+                int token = outbox->reserve(topic, data.data(), data.size(), 1);
+                int msg_id = next_msg_id++;
+
+                if (token == 0) {
+                    refused++;
+                    continue;
+                }
+
+                // The broker may acknowledge before the client returned the id, the record then never reaches flash.
+                if (chance(10)) {
+                    outbox->ack(msg_id);
+                    outbox->bind(token, msg_id);
+                    continue;
+                }
+
+                outbox->bind(token, msg_id);
+                model[serial] = {.topic = topic, .data = data, .msg_id = msg_id, .state = MSG_PENDING,
+                                 .forgotten = false, .required = false};
+            } else if (kind < 70 && !model.empty()) {
+                // Mostly the oldest, as the broker acknowledges in order.
+                auto it = model.begin();
+
+                if (chance(30))
+                    std::advance(it, rng() % model.size());
+
+                if (it->second.msg_id == 0 || it->second.state == MSG_ACKING)
+                    continue;
+
+                outbox->ack(it->second.msg_id);
+
+                if (it->second.state == MSG_PENDING)
+                    model.erase(it);
+                else
+                    it->second.state = MSG_ACKING;
+            } else if (kind < 75 && !model.empty()) {
+                // The client gave up on a message, the next replay republishes it once it's in flash.
+                auto it = model.begin();
+
+                std::advance(it, rng() % model.size());
+
+                if (it->second.msg_id == 0 || it->second.state == MSG_ACKING)
+                    continue;
+
+                outbox->forget(it->second.msg_id);
+                it->second.msg_id = 0;
+                it->second.forgotten = true;
+            } else if (kind < 80) {
+                size_t replay_first = published.size();
+                uint32_t dropped = outbox->dropped();
+
+                outbox->replay(nullptr);
+                HOST_CHECK(outbox->dropped() == dropped);
+                replayed(model, replay_first);
+
+                for (auto &[serial, message] : model)
+                    HOST_CHECK(!message.forgotten || message.state == MSG_PENDING);
+            } else {
+                if (chance(10))
+                    host_flash_power_cut(partition, rng() % 2048);
+
+                host_task_step(task);
+                cut = !host_flash_powered(partition);
+                cuts += cut;
+
+                for (auto it = model.begin(); it != model.end();) {
+                    if (it->second.state == MSG_ACKING && !cut) {
+                        it = model.erase(it);
+                        continue;
+                    }
+
+                    if (it->second.state == MSG_PENDING)
+                        it->second.state = cut ? MSG_MAYBE : MSG_DURABLE;
+
+                    ++it;
+                }
+            }
+        }
+
+        // A crash loses the batch, a record being written may or may not have made it.
+        bool lossless = !cut && outbox->dropped() == refused;
+
+        for (auto it = model.begin(); it != model.end();) {
+            if (it->second.state == MSG_PENDING) {
+                it = model.erase(it);
+                continue;
+            }
+
+            it->second.required = lossless && it->second.state == MSG_DURABLE;
+            ++it;
+        }
+
+        strict += lossless;
+    }
+
+    // The log is written in a circle, an erase is only repeated when the power was cut before its sector was used.
+    uint32_t least = UINT32_MAX;
+    uint32_t most = 0;
+
+    for (uint32_t sector = 0; sector < SECTORS; sector++) {
+        least = std::min(least, host_flash_erases(partition, sector));
+        most = std::max(most, host_flash_erases(partition, sector));
+    }
+
+    printf("rounds: %d, lossless: %d, power cuts: %d, erases: %" PRIu32 "-%" PRIu32 "\n", ROUNDS, strict, cuts,
+           least, most);
+
+    HOST_CHECK(most > 0);
+    HOST_CHECK(most <= least + cuts + 1);
+    HOST_CHECK(strict > ROUNDS / 4);
+
+    return EXIT_SUCCESS;
+}
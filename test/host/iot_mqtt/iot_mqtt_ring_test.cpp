@@ -0,0 +1,99 @@
+#include <deque>
+#include <random>
+#include "host_test.h"
+#include "iot_mqtt_ring.h"
+
+/*
+ * A model of the outgoing ring. Random pushes, replacing pushes and pops run against a deque of the messages which
+ * should be buffered, on rings of random sizes so the records wrap at every offset. The messages the ring reports
+ * dropping must be the oldest ones, and whatever it hands out must match the model.
+ */
+
+static constexpr int ROUNDS = 200;
+static constexpr int OPS = 3000;
+
+typedef struct message {
+    std::string topic;
+    std::string data;
+    uint8_t qos;
+} message_t;
+
+static size_t record_size(const message_t &message)
+{
+    return (8 + message.topic.size() + 1 + message.data.size() + 3) & ~static_cast<size_t>(3);
+}
+
+int main()
+{
+    std::mt19937 rng(1);
+
+    esp_log_level_set("*", ESP_LOG_NONE);
+
+    {
+        IotMqttRing ring;
+
+        HOST_CHECK(ring.push("t", "x", 1, 0, false) == ESP_ERR_INVALID_STATE);
+        HOST_CHECK(ring.empty());
+    }
+
+    for (int round = 0; round < ROUNDS; round++) {
+        IotMqttRing ring;
+        size_t size = 300 + rng() % 500;
+        std::deque<message_t> model;
+        uint32_t dropped = 0;
+
+        HOST_CHECK(ring.init(size) == ESP_OK);
+
+        for (int op = 0; op < OPS; op++) {
+            if (rng() % 10 < 6) {
+                message_t message = {.topic = "hover/" + std::to_string(rng() % 4),
+                                     .data = std::string(rng() % 200, static_cast<char>('a' + rng() % 26)),
+                                     .qos = static_cast<uint8_t>(rng() % 2)};
+                bool latest = rng() % 3 == 0;
+                esp_err_t ret = ring.push(message.topic, message.data.data(), message.data.size(), message.qos,
+                                          latest);
+
+                // Anything up to half the ring always fits, after dropping older messages.
+                if (record_size(message) > (size & ~static_cast<size_t>(3)) / 2) {
+                    HOST_CHECK(ret == ESP_ERR_INVALID_SIZE);
+                    HOST_CHECK(ring.dropped() == dropped);
+                    continue;
+                }
+
+                HOST_CHECK(ret == ESP_OK);
+
+                if (latest)
+                    std::erase_if(model, [&message](const message_t &m) { return m.topic == message.topic; });
+
+                HOST_CHECK(ring.dropped() >= dropped);
+                HOST_CHECK(ring.dropped() - dropped <= model.size());
+
+                model.erase(model.begin(), model.begin() + (ring.dropped() - dropped));
+                model.push_back(message);
+                dropped = ring.dropped();
+            } else {
+                iot_mqtt_record_t record;
+                bool found = ring.front(&record);
+
+                HOST_CHECK(found == !model.empty());
+
+                if (!found) {
+                    ring.pop();
+                    continue;
+                }
+
+                HOST_CHECK(model.front().topic == record.topic);
+                HOST_CHECK(model.front().data == std::string(record.data, record.len));
+                HOST_CHECK(model.front().qos == record.qos);
+
+                ring.pop();
+                model.pop_front();
+            }
+
+            HOST_CHECK(ring.count() == model.size());
+            HOST_CHECK(ring.empty() == model.empty());
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
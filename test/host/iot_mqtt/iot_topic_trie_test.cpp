@@ -0,0 +1,201 @@
+#include <algorithm>
+#include <random>
+#include <vector>
+#include "host_test.h"
+#include "iot_topic_trie.h"
+
+/*
+ * Tests of the topic trie: the wildcard examples of the MQTT 3.1.1 spec (4.7), then random filters and topics matched
+ * against a reference matcher comparing level by level, and the bookkeeping of subscribers.
+ */
+
+static void on_message(const char *topic, size_t topic_len, const char *data, size_t len, void *priv_data)
+{
+}
+
+static iot_mqtt_subscriber_t subscriber(uint8_t id)
+{
+    return {.cb = on_message, .priv_data = reinterpret_cast<void *>(static_cast<intptr_t>(id)),
+            .priority = IOT_MQTT_PRIORITY_NORMAL, .overflow = IOT_MQTT_OVERFLOW_DROP_NEWEST, .id = id};
+}
+
+static std::vector<std::string> split(const std::string &value)
+{
+    std::vector<std::string> levels;
+    size_t pos = 0;
+
+    while (true) {
+        size_t sep = value.find('/', pos);
+
+        levels.push_back(value.substr(pos, sep == std::string::npos ? std::string::npos : sep - pos));
+
+        if (sep == std::string::npos)
+            return levels;
+
+        pos = sep + 1;
+    }
+}
+
+static bool reference_match(const std::string &filter, const std::string &topic)
+{
+    std::vector<std::string> filter_levels = split(filter);
+    std::vector<std::string> topic_levels = split(topic);
+
+    if (topic[0] == '$' && (filter[0] == '+' || filter[0] == '#'))
+        return false;
+
+    for (size_t i = 0; i < filter_levels.size(); i++) {
+        if (filter_levels[i] == "#")
+            return true;
+
+        if (i == topic_levels.size() || (filter_levels[i] != "+" && filter_levels[i] != topic_levels[i]))
+            return false;
+    }
+
+    return filter_levels.size() == topic_levels.size();
+}
+
+static std::vector<uint8_t> matched_ids(const IotTopicTrie &trie, const std::string &topic)
+{
+    iot_mqtt_subscriber_t out[64];
+    size_t count = trie.match(topic.data(), topic.size(), out, 64);
+    std::vector<uint8_t> ids;
+
+    HOST_CHECK(count <= 64);
+
+    for (size_t i = 0; i < count; i++)
+        ids.push_back(out[i].id);
+
+    std::sort(ids.begin(), ids.end());
+
+    return ids;
+}
+
+static void test_spec_examples(void)
+{
+    const char *filters[] = {"sport/tennis/player1/#", "sport/#", "#", "sport/tennis/#", "+", "+/tennis/#",
+                             "sport/+/player1", "/+", "+/+", "$SYS/#", "$SYS/monitor/+", "+/monitor/Clients"};
+    IotTopicTrie trie;
+
+    for (uint8_t i = 0; i < std::size(filters); i++)
+        HOST_CHECK(trie.insert(filters[i], subscriber(i)) == ESP_OK);
+
+    const char *topics[] = {"sport/tennis/player1", "sport/tennis/player1/ranking",
+                            "sport/tennis/player1/score/wimbledon", "sport", "sport/", "/finance", "$SYS/monitor/Clients",
+                            "$SYS", "sport/tennis/player2"};
+
+    for (const char *topic : topics) {
+        std::vector<uint8_t> expected;
+
+        for (uint8_t i = 0; i < std::size(filters); i++) {
+            if (reference_match(filters[i], topic))
+                expected.push_back(i);
+        }
+
+        HOST_CHECK(matched_ids(trie, topic) == expected);
+    }
+
+    // The spec's own verdicts, in case the reference matcher shares a misreading.
+    HOST_CHECK(matched_ids(trie, "sport") == std::vector<uint8_t>({1, 2, 4}));
+    HOST_CHECK(matched_ids(trie, "$SYS/monitor/Clients") == std::vector<uint8_t>({9, 10}));
+    HOST_CHECK(matched_ids(trie, "/finance") == std::vector<uint8_t>({2, 7, 8}));
+}
+
+static void test_valid_filters(void)
+{
+    for (const char *filter : {"a", "a/b", "+", "#", "a/+/b", "a/#", "+/+", "/", "a//b", "$SYS/#"})
+        HOST_CHECK(IotTopicTrie::valid_filter(filter));
+
+    for (const char *filter : {"", "a/#/b", "a+", "a/b#", "#/a", "a/+b", "++", "##"})
+        HOST_CHECK(!IotTopicTrie::valid_filter(filter));
+}
+
+static void test_random_filters(void)
+{
+    const char *levels[] = {"a", "b", "$s", "", "+", "#"};
+    std::mt19937 rng(1);
+
+    for (int round = 0; round < 200; round++) {
+        IotTopicTrie trie;
+        std::vector<std::string> filters;
+
+        for (uint8_t id = 0; id < 48; id++) {
+            std::string filter;
+            size_t depth = 1 + rng() % 4;
+
+            for (size_t i = 0; i < depth; i++)
+                filter += (i > 0 ? "/" : "") + std::string(levels[rng() % std::size(levels)]);
+
+            if (!IotTopicTrie::valid_filter(filter)) {
+                HOST_CHECK(trie.insert(filter, subscriber(id)) == ESP_ERR_INVALID_ARG);
+                filter.clear();
+            } else {
+                HOST_CHECK(trie.insert(filter, subscriber(id)) == ESP_OK);
+            }
+
+            filters.push_back(filter);
+        }
+
+        for (int i = 0; i < 50; i++) {
+            std::string topic;
+            size_t depth = 1 + rng() % 4;
+
+            for (size_t level = 0; level < depth; level++)
+                topic += (level > 0 ? "/" : "") + std::string(levels[rng() % 4]);
+
+            std::vector<uint8_t> expected;
+
+            for (uint8_t id = 0; id < filters.size(); id++) {
+                if (!filters[id].empty() && reference_match(filters[id], topic))
+                    expected.push_back(id);
+            }
+
+            HOST_CHECK(matched_ids(trie, topic) == expected);
+        }
+    }
+}
+
+static void test_subscribers(void)
+{
+    IotTopicTrie trie;
+    iot_mqtt_subscriber_t found;
+    iot_mqtt_subscriber_t out[1];
+
+    HOST_CHECK(trie.empty());
+    HOST_CHECK(trie.insert("a/+", subscriber(1)) == ESP_OK);
+    HOST_CHECK(trie.insert("a/+", subscriber(1)) == ESP_ERR_INVALID_STATE);
+    HOST_CHECK(trie.insert("a/+", subscriber(2)) == ESP_OK);
+    HOST_CHECK(trie.insert("a/#", {.cb = nullptr}) == ESP_ERR_INVALID_ARG);
+
+    // Filters are compared level by level, not matched.
+    HOST_CHECK(trie.contains("a/+"));
+    HOST_CHECK(!trie.contains("a/b"));
+    HOST_CHECK(!trie.contains("a"));
+    HOST_CHECK(trie.find("a/+", &found) && found.id == 1);
+
+    // The count includes the matches which didn't fit.
+    HOST_CHECK(trie.match("a/b", 3, out, 1) == 2);
+    HOST_CHECK(trie.match("a/bc", 3, out, 1) == 2);
+    HOST_CHECK(trie.match(nullptr, 0, out, 1) == 0);
+
+    HOST_CHECK(trie.remove("a/+", 3) == ESP_ERR_NOT_FOUND);
+    HOST_CHECK(trie.remove("a/b", 1) == ESP_ERR_NOT_FOUND);
+    HOST_CHECK(trie.remove("a/+", 1) == ESP_OK);
+    HOST_CHECK(trie.find("a/+", &found) && found.id == 2);
+    HOST_CHECK(trie.remove("a/+", 2) == ESP_OK);
+    HOST_CHECK(!trie.contains("a/+"));
+    HOST_CHECK(trie.empty());
+    HOST_CHECK(trie.match("a/b", 3, out, 1) == 0);
+}
+
+int main()
+{
+    esp_log_level_set("*", ESP_LOG_NONE);
+
+    test_spec_examples();
+    test_valid_filters();
+    test_random_filters();
+    test_subscribers();
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,417 @@
+#include <cJSON.h>
+#include <chrono>
+#include <cstring>
+#include <random>
+#include "host_test.h"
+#include "iot_res_writer.h"
+
+/*
+ * The response writer against the cJSON envelope it replaced. Attribute lists of 1 to 64 attributes are sent both ways
+ * and must parse to the same document, streamed in chunks no larger than the scratch buffer. The benchmark then sends
+ * both ways again, measuring the heap the cJSON path takes through its allocation hooks and the bytes the writer copies
+ * through its scratch buffer, and prints the time a response takes. Nothing is asserted about the timings.
+ */
+
+static constexpr int ITERATIONS = 2000;
+
+typedef enum {
+    VAL_BOOLEAN,
+    VAL_INTEGER,
+    VAL_FLOAT,
+    VAL_LONG,
+    VAL_STRING,
+} val_type_e;
+
+typedef struct attribute {
+    std::string name;
+    val_type_e type;
+    bool b;
+    uint32_t i;
+    float f;
+    uint64_t l;
+    std::string s;
+} attribute_t;
+
+typedef struct heap {
+    size_t current;
+    size_t peak;
+    size_t total;
+    size_t allocations;
+} heap_t;
+
+static const char *type_names[] = {"bool", "integer", "float", "long", "string"};
+static heap_t heap;
+
+static void *counted_malloc(size_t size)
+{
+    auto *block = static_cast<size_t *>(malloc(size + sizeof(max_align_t)));
+
+    if (block == nullptr)
+        return nullptr;
+
+    *block = size;
+    heap.current += size;
+    heap.peak = std::max(heap.peak, heap.current);
+    heap.total += size;
+    heap.allocations++;
+
+    return reinterpret_cast<uint8_t *>(block) + sizeof(max_align_t);
+}
+
+static void counted_free(void *ptr)
+{
+    if (ptr == nullptr)
+        return;
+
+    auto *block = reinterpret_cast<size_t *>(static_cast<uint8_t *>(ptr) - sizeof(max_align_t));
+
+    heap.current -= *block;
+    free(block);
+}
+
+static std::string random_string(std::mt19937 &rng, size_t max_len)
+{
+    // Quotes, backslashes, control characters and multibyte utf-8 all need care when escaping.
+    static const char *pieces[] = {"a", "b", "z", "0", "_", " ", "/", "\"", "\\", "\n", "\t", "\x01", "\x1f", "\xc3\xa9"};
+    std::string value;
+    size_t len = rng() % (max_len + 1);
+
+    for (size_t i = 0; i < len; i++)
+        value += pieces[rng() % std::size(pieces)];
+
+    return value;
+}
+
+static std::vector<attribute_t> random_attributes(std::mt19937 &rng, size_t count)
+{
+    std::vector<attribute_t> attributes;
+
+    for (size_t i = 0; i < count; i++) {
+        attribute_t attribute = {.name = "attr" + std::to_string(i) + random_string(rng, 4),
+                                 .type = static_cast<val_type_e>(rng() % 5)};
+
+        attribute.b = rng() % 2 == 0;
+        attribute.i = rng() % 2 == 0 ? rng() % 1000 : rng();
+        attribute.f = static_cast<float>(static_cast<int32_t>(rng() % 2000000) - 1000000) / 64.0f;
+        // Kept within a double's 53 bits, so cJSON prints them exactly too.
+        attribute.l = (static_cast<uint64_t>(rng()) << 21) ^ rng();
+        attribute.s = random_string(rng, 40);
+        attributes.push_back(attribute);
+    }
+
+    return attributes;
+}
+
+/**
+ * Sends the attributes the way the server did before the writer: the handler printed a cJSON tree of the attributes,
+ * which send_res added raw to a cJSON envelope and printed again.
+ */
+static esp_err_t send_cjson(httpd_req_t *req, const std::vector<attribute_t> &attributes)
+{
+    cJSON *response = cJSON_CreateArray();
+
+    for (const attribute_t &item : attributes) {
+        cJSON *attribute = cJSON_CreateObject();
+
+        cJSON_AddStringToObject(attribute, "name", item.name.c_str());
+
+        switch (item.type) {
+            case VAL_BOOLEAN: cJSON_AddBoolToObject(attribute, "value", item.b); break;
+            case VAL_INTEGER: cJSON_AddNumberToObject(attribute, "value", item.i); break;
+            case VAL_FLOAT: cJSON_AddNumberToObject(attribute, "value", item.f); break;
+            case VAL_LONG: cJSON_AddNumberToObject(attribute, "value", static_cast<double>(item.l)); break;
+            case VAL_STRING: cJSON_AddStringToObject(attribute, "value", item.s.c_str()); break;
+        }
+
+        cJSON_AddStringToObject(attribute, "type", type_names[item.type]);
+        cJSON_AddItemToArray(response, attribute);
+    }
+
+    char *data = cJSON_Print(response);
+
+    HOST_CHECK(data != nullptr);
+
+    httpd_resp_set_status(req, HTTPD_200);
+
+    cJSON *res = cJSON_CreateObject();
+
+    cJSON_AddRawToObject(res, "data", data);
+    cJSON_AddNumberToObject(res, "status", IOT_HTTP_STATUS_200_OK);
+    cJSON_AddStringToObject(res, "timestamp", iot_now_str().data());
+
+    char *buf = cJSON_Print(res);
+
+    HOST_CHECK(buf != nullptr);
+
+    httpd_resp_set_type(req, HTTPD_TYPE_TEXT);
+    esp_err_t ret = httpd_resp_send(req, buf, HTTPD_RESP_USE_STRLEN);
+
+    cJSON_free(buf);
+    cJSON_Delete(res);
+    cJSON_free(data);
+    cJSON_Delete(response);
+
+    return ret;
+}
+
+/**
+ * Sends the attributes the way the server does now, streamed into the envelope by the writer.
+ */
+static esp_err_t send_writer(httpd_req_t *req, const std::vector<attribute_t> &attributes, IotResWriter *writer)
+{
+    writer->begin(IOT_HTTP_STATUS_200_OK);
+    writer->begin_object();
+    writer->key("data");
+    writer->begin_array();
+
+    for (const attribute_t &item : attributes) {
+        writer->begin_object();
+        writer->add_str("name", item.name.data(), item.name.size());
+
+        switch (item.type) {
+            case VAL_BOOLEAN: writer->add_bool("value", item.b); break;
+            case VAL_INTEGER: writer->add_uint("value", item.i); break;
+            case VAL_FLOAT: writer->add_float("value", item.f); break;
+            case VAL_LONG: writer->add_ulong("value", item.l); break;
+            case VAL_STRING: writer->add_str("value", item.s.data(), item.s.size()); break;
+        }
+
+        writer->add_str("type", type_names[item.type]);
+        writer->end_object();
+    }
+
+    writer->end_array();
+
+    char timestamp[32];
+    size_t len = iot_now_str(timestamp, sizeof(timestamp));
+
+    writer->add_uint("status", IOT_HTTP_STATUS_200_OK);
+    writer->add_str("timestamp", timestamp, len);
+    writer->end_object();
+
+    return writer->end();
+}
+
+/**
+ * Compares two parsed documents. The timestamps are only compared by type, the clock may tick between the responses.
+ */
+static bool same(const cJSON *a, const cJSON *b, bool as_float)
+{
+    if ((a->type & 0xff) != (b->type & 0xff))
+        return false;
+
+    if (cJSON_IsNumber(a))
+        return as_float ? static_cast<float>(a->valuedouble) == static_cast<float>(b->valuedouble)
+                        : a->valuedouble == b->valuedouble;
+
+    if (cJSON_IsString(a))
+        return a->string != nullptr && strcmp(a->string, "timestamp") == 0 ? true
+                                                                            : strcmp(a->valuestring, b->valuestring) == 0;
+
+    if (!cJSON_IsArray(a) && !cJSON_IsObject(a))
+        return true;
+
+    const cJSON *type = cJSON_GetObjectItem(a, "type");
+    bool floats = cJSON_IsString(type) && strcmp(type->valuestring, "float") == 0;
+    const cJSON *x = a->child;
+    const cJSON *y = b->child;
+
+    for (; x != nullptr && y != nullptr; x = x->next, y = y->next) {
+        if (cJSON_IsObject(a) && strcmp(x->string, y->string) != 0)
+            return false;
+
+        if (!same(x, y, floats && strcmp(x->string, "value") == 0))
+            return false;
+    }
+
+    return x == nullptr && y == nullptr;
+}
+
+static void test_documents(void)
+{
+    std::mt19937 rng(1);
+    httpd_req_t *req = host_http_req(HTTP_GET, "/api/v1/attributes");
+
+    for (size_t count = 1; count <= 64; count++) {
+        std::vector<attribute_t> attributes = random_attributes(rng, count);
+
+        *host_http_res(req) = {};
+        HOST_CHECK(send_cjson(req, attributes) == ESP_OK);
+
+        cJSON *expected = cJSON_Parse(host_http_res(req)->body.c_str());
+
+        *host_http_res(req) = {};
+
+        auto *writer = new IotResWriter(req);
+
+        HOST_CHECK(send_writer(req, attributes, writer) == ESP_OK);
+
+        host_http_res_t *res = host_http_res(req);
+        cJSON *actual = cJSON_Parse(res->body.c_str());
+
+        HOST_CHECK(expected != nullptr && actual != nullptr);
+        HOST_CHECK(same(expected, actual, false));
+        HOST_CHECK(res->status == HTTPD_200 && res->type == HTTPD_TYPE_JSON);
+        HOST_CHECK(res->chunked && res->sent);
+        HOST_CHECK(writer->written() == res->body.size());
+
+        // Everything went through the scratch buffer, the last chunk ends the response.
+        for (size_t i = 0; i + 1 < res->chunks.size(); i++) {
+            HOST_CHECK(res->chunks[i].second > 0 && res->chunks[i].second <= IOT_HTTP_RES_SCRATCH_SIZE);
+            HOST_CHECK(res->chunks[i].first >= reinterpret_cast<const char *>(writer));
+            HOST_CHECK(res->chunks[i].first < reinterpret_cast<const char *>(writer + 1));
+        }
+
+        HOST_CHECK(res->chunks.back().second == 0);
+
+        delete writer;
+        cJSON_Delete(expected);
+        cJSON_Delete(actual);
+    }
+
+    host_http_req_free(req);
+}
+
+static void test_values(void)
+{
+    httpd_req_t *req = host_http_req(HTTP_GET, "/");
+    std::string large = "[" + std::string(999, '1') + "]";
+    IotResWriter writer(req);
+
+    writer.begin(IOT_HTTP_STATUS_404_NOT_FOUND);
+    writer.begin_object();
+    writer.add_ulong("l", UINT64_MAX);
+    writer.add_float("f", 0.1f);
+    writer.add_float("g", 6614.359375f);
+    writer.add_float("nan", NAN);
+    writer.add_str("null", nullptr);
+    writer.add_raw("raw", nullptr);
+    writer.begin_array("a");
+    writer.add_raw(nullptr, large.c_str());
+    writer.add_bool(nullptr, false);
+    writer.end_array();
+    writer.end_object();
+    HOST_CHECK(writer.end() == ESP_OK);
+
+    host_http_res_t *res = host_http_res(req);
+
+    HOST_CHECK(res->status == HTTPD_404);
+    HOST_CHECK(res->body == R"({"l":18446744073709551615,"f":0.1,"g":6614.3594,"nan":null,"null":null,"raw":null,"a":[)" + large + ",false]}");
+
+    // A value larger than the scratch buffer is sent from where it is.
+    bool passed = false;
+
+    for (const auto &[data, len] : res->chunks)
+        passed |= data == large.c_str() && len == large.size();
+
+    HOST_CHECK(passed);
+    host_http_req_free(req);
+}
+
+static void test_errors(void)
+{
+    httpd_req_t *req = host_http_req(HTTP_GET, "/");
+
+    {
+        IotResWriter writer(req);
+
+        // The first failure sticks, nothing is sent after it.
+        host_http_send_fail(req, 1);
+        writer.begin(IOT_HTTP_STATUS_200_OK);
+        writer.begin_array();
+
+        for (int i = 0; i < 200; i++)
+            writer.add_uint(nullptr, i);
+
+        writer.end_array();
+        HOST_CHECK(writer.error() == ESP_FAIL);
+        HOST_CHECK(writer.end() == ESP_FAIL);
+        HOST_CHECK(host_http_res(req)->chunks.size() == 1);
+        HOST_CHECK(!host_http_res(req)->sent);
+    }
+
+    {
+        IotResWriter writer(req);
+
+        for (int i = 0; i < 33; i++)
+            writer.begin_array();
+
+        HOST_CHECK(writer.error() == ESP_ERR_INVALID_SIZE);
+    }
+
+    {
+        IotResWriter writer(req);
+
+        writer.end_object();
+        HOST_CHECK(writer.error() == ESP_ERR_INVALID_STATE);
+    }
+
+    host_http_req_free(req);
+}
+
+static void bench(void)
+{
+    std::mt19937 rng(2);
+    httpd_req_t *req = host_http_req(HTTP_GET, "/api/v1/attributes");
+    cJSON_Hooks hooks = {.malloc_fn = counted_malloc, .free_fn = counted_free};
+
+    printf("%10s %14s %14s %14s %12s %14s %14s %12s\n", "attributes", "cjson ns", "cjson peak", "cjson heap",
+           "cjson allocs", "writer ns", "writer copied", "body bytes");
+
+    for (size_t count : {1, 8, 16, 32, 64}) {
+        std::vector<attribute_t> attributes = random_attributes(rng, count);
+        heap = {};
+        cJSON_InitHooks(&hooks);
+
+        auto start = std::chrono::steady_clock::now();
+
+        for (int i = 0; i < ITERATIONS; i++) {
+            *host_http_res(req) = {};
+            send_cjson(req, attributes);
+        }
+
+        auto cjson = std::chrono::steady_clock::now() - start;
+
+        cJSON_InitHooks(nullptr);
+        HOST_CHECK(heap.current == 0);
+
+        size_t copied = 0;
+        size_t body = 0;
+
+        start = std::chrono::steady_clock::now();
+
+        for (int i = 0; i < ITERATIONS; i++) {
+            *host_http_res(req) = {};
+
+            IotResWriter writer(req);
+
+            send_writer(req, attributes, &writer);
+            copied = writer.written();
+            body = host_http_res(req)->body.size();
+        }
+
+        auto streamed = std::chrono::steady_clock::now() - start;
+
+        printf("%10zu %14lld %14zu %14zu %12zu %14lld %14zu %12zu\n", count,
+               static_cast<long long>(std::chrono::nanoseconds(cjson).count() / ITERATIONS), heap.peak,
+               heap.total / ITERATIONS, heap.allocations / ITERATIONS,
+               static_cast<long long>(std::chrono::nanoseconds(streamed).count() / ITERATIONS), copied, body);
+    }
+
+    printf("The writer takes no heap, its scratch buffer is part of the %zu bytes it takes on the stack.\n",
+           sizeof(IotResWriter));
+
+    host_http_req_free(req);
+}
+
+int main()
+{
+    esp_log_level_set("*", ESP_LOG_NONE);
+
+    test_documents();
+    test_values();
+    test_errors();
+    bench();
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,106 @@
+#include <cstring>
+#include <string>
+#include <vector>
+#include "host_test.h"
+#include "iot_server.h"
+
+/*
+ * Tests of the server's responses on requests built by the test, the server itself is never started. What a handler
+ * sent is read back from the http stub, and the status and size recorded for the route from the request's context,
+ * when the request has one.
+ */
+
+static iot_route_ctx_t route_ctx(IotServer *server)
+{
+    return {.tag = IOT_HTTP_ROUTE_CTX_TAG, .server = server, .route = 0, .param = nullptr, .param_len = 0, .status = 0, .bytes_out = 0, .start = 0,
+            .detached = false};
+}
+
+/*
+ * A streamed body which fails leaves the chunked response unterminated, so the client can't take the part already
+ * sent for a whole response, and the failure is recorded for the route.
+ */
+static void test_send_res_body_error(IotServer *server)
+{
+    std::string value(IOT_HTTP_RES_SCRATCH_SIZE * 2, 'v');
+    httpd_req_t *req = host_http_req(HTTP_GET, "/api/v1/device/info");
+    iot_route_ctx_t ctx = route_ctx(server);
+
+    req->user_ctx = &ctx;
+
+    esp_err_t ret = server->send_res(req, [&value](IotResWriter &writer) -> esp_err_t {
+        writer.begin_object();
+        writer.add_str("value", value.c_str());
+
+        return ESP_ERR_NO_MEM;
+    });
+
+    host_http_res_t *res = host_http_res(req);
+
+    HOST_CHECK(ret == ESP_ERR_NO_MEM);
+    HOST_CHECK(res->chunked && !res->sent);
+    HOST_CHECK(res->body.rfind("{\"data\":{\"value\":\"vvv", 0) == 0);
+    HOST_CHECK(res->body.find("\"status\"") == std::string::npos);
+    HOST_CHECK(ctx.status == IOT_HTTP_STATUS_500_INT_SERVER_ERROR && ctx.bytes_out > value.size());
+    host_http_req_free(req);
+
+    // The same body without the failure is a whole response.
+    req = host_http_req(HTTP_GET, "/api/v1/device/info");
+    ctx = route_ctx(server);
+    req->user_ctx = &ctx;
+
+    ret = server->send_res(req, [&value](IotResWriter &writer) -> esp_err_t {
+        writer.begin_object();
+        writer.add_str("value", value.c_str());
+        writer.end_object();
+
+        return ESP_OK;
+    });
+
+    res = host_http_res(req);
+
+    HOST_CHECK(ret == ESP_OK && res->sent);
+    HOST_CHECK(res->body.find("\"status\":200") != std::string::npos && res->body.back() == '}');
+    HOST_CHECK(ctx.status == IOT_HTTP_STATUS_200_OK && ctx.bytes_out == res->body.size());
+    host_http_req_free(req);
+}
+
+/*
+ * Handlers outside the dispatcher, like the push channel's, have the server as their user context. Responding from
+ * them mustn't take it for a route context and write the response's status into the server.
+ */
+static void test_foreign_ctx(IotServer *server)
+{
+    httpd_req_t *req = host_http_req(HTTP_GET, "/api/v1/device/events");
+    auto *bytes = reinterpret_cast<const uint8_t *>(server);
+    std::vector<uint8_t> before(bytes, bytes + sizeof(IotServer));
+
+    req->user_ctx = server;
+
+    HOST_CHECK(server->send_res(req, "Subscribed", true) == ESP_OK && host_http_res(req)->sent);
+    HOST_CHECK(server->get_path_param(req).empty());
+    HOST_CHECK(memcmp(before.data(), bytes, sizeof(IotServer)) == 0);
+    host_http_req_free(req);
+
+    // A route context untagged is no route context either.
+    iot_route_ctx_t ctx = route_ctx(server);
+
+    ctx.tag = 0;
+    req = host_http_req(HTTP_GET, "/api/v1/device/info");
+    req->user_ctx = &ctx;
+    HOST_CHECK(server->send_err(req) == ESP_FAIL && host_http_res(req)->sent);
+    HOST_CHECK(ctx.status == 0 && ctx.bytes_out == 0);
+    host_http_req_free(req);
+}
+
+int main()
+{
+    esp_log_level_set("*", ESP_LOG_NONE);
+
+    auto *server = new IotServer();
+
+    test_send_res_body_error(server);
+    test_foreign_ctx(server);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,260 @@
+#include <algorithm>
+#include <cstring>
+#include "esp_http_server.h"
+#include "lwip/sockets.h"
+#include "host_test.h"
+
+/*
+ * The http server without sockets: the handlers registered are only kept, a request is built by the test and whatever
+ * the handler sends is captured for the test to check. Sending can be made to fail after a number of chunks.
+ */
+
+typedef struct host_http {
+    httpd_req_t req = {};
+    std::string body;
+    size_t received = 0;
+    std::map<std::string, std::string> headers;
+    host_http_res_t res;
+    size_t fail_after = SIZE_MAX;
+} host_http_t;
+
+typedef struct host_httpd {
+    httpd_config_t config;
+    std::vector<httpd_uri_t> handlers;
+} host_httpd_t;
+
+static host_http_t *find(httpd_req_t *req)
+{
+    return static_cast<host_http_t *>(req->aux);
+}
+
+httpd_req_t *host_http_req(int method, const char *uri, const std::string &body,
+                           const std::map<std::string, std::string> &headers)
+{
+    auto *http = new host_http_t{};
+
+    http->req.method = method;
+    strncpy(const_cast<char *>(http->req.uri), uri, HTTPD_MAX_URI_LEN);
+    http->req.content_len = body.size();
+    http->req.aux = http;
+    http->body = body;
+    http->headers = headers;
+
+    return &http->req;
+}
+
+host_http_res_t *host_http_res(httpd_req_t *req)
+{
+    return &find(req)->res;
+}
+
+void host_http_send_fail(httpd_req_t *req, size_t after_chunks)
+{
+    find(req)->fail_after = after_chunks;
+}
+
+void host_http_req_free(httpd_req_t *req)
+{
+    delete find(req);
+}
+
+const char *http_method_str(http_method m)
+{
+    switch (m) {
+        case HTTP_DELETE: return "DELETE";
+        case HTTP_GET: return "GET";
+        case HTTP_HEAD: return "HEAD";
+        case HTTP_POST: return "POST";
+        case HTTP_PUT: return "PUT";
+        default: return "<unknown>";
+    }
+}
+
+esp_err_t httpd_start(httpd_handle_t *handle, const httpd_config_t *config)
+{
+    *handle = new host_httpd_t{.config = *config};
+
+    return ESP_OK;
+}
+
+esp_err_t httpd_stop(httpd_handle_t handle)
+{
+    delete static_cast<host_httpd_t *>(handle);
+
+    return ESP_OK;
+}
+
+esp_err_t httpd_register_uri_handler(httpd_handle_t handle, const httpd_uri_t *uri_handler)
+{
+    auto *server = static_cast<host_httpd_t *>(handle);
+
+    if (server->handlers.size() == server->config.max_uri_handlers)
+        return ESP_ERR_HTTPD_HANDLERS_FULL;
+
+    server->handlers.push_back(*uri_handler);
+
+    return ESP_OK;
+}
+
+bool httpd_uri_match_wildcard(const char *uri_template, const char *uri_to_match, size_t match_upto)
+{
+    size_t len = strlen(uri_template);
+    char last = len > 0 ? uri_template[len - 1] : '\0';
+    char prev = len > 1 ? uri_template[len - 2] : '\0';
+    bool asterisk = last == '*' || (prev == '*' && last == '?');
+    bool quest = last == '?' || (prev == '?' && last == '*');
+    size_t exact = len - asterisk - quest;
+
+    // A '?' makes the character before it optional, a '*' matches any remainder.
+    if (quest && match_upto + 1 == exact && strncmp(uri_template, uri_to_match, match_upto) == 0)
+        return true;
+
+    if (asterisk)
+        return match_upto >= exact && strncmp(uri_template, uri_to_match, exact) == 0;
+
+    return match_upto == exact && strncmp(uri_template, uri_to_match, exact) == 0;
+}
+
+esp_err_t httpd_query_key_value(const char *qry, const char *key, char *val, size_t val_size)
+{
+    size_t key_len = strlen(key);
+
+    for (const char *pair = qry; pair != nullptr && *pair != '\0';) {
+        const char *end = strchr(pair, '&');
+        size_t pair_len = end == nullptr ? strlen(pair) : end - pair;
+
+        if (pair_len > key_len && strncmp(pair, key, key_len) == 0 && pair[key_len] == '=') {
+            size_t len = pair_len - key_len - 1;
+
+            if (val_size == 0)
+                return ESP_ERR_HTTPD_RESULT_TRUNC;
+
+            strncpy(val, pair + key_len + 1, std::min(len, val_size - 1));
+            val[std::min(len, val_size - 1)] = '\0';
+
+            return len < val_size ? ESP_OK : ESP_ERR_HTTPD_RESULT_TRUNC;
+        }
+
+        pair = end == nullptr ? nullptr : end + 1;
+    }
+
+    return ESP_ERR_NOT_FOUND;
+}
+
+int httpd_req_recv(httpd_req_t *r, char *buf, size_t buf_len)
+{
+    host_http_t *http = find(r);
+    size_t len = std::min(buf_len, http->body.size() - http->received);
+
+    memcpy(buf, http->body.data() + http->received, len);
+    http->received += len;
+
+    return static_cast<int>(len);
+}
+
+size_t httpd_req_get_hdr_value_len(httpd_req_t *r, const char *field)
+{
+    host_http_t *http = find(r);
+    auto it = http->headers.find(field);
+
+    return it == http->headers.end() ? 0 : it->second.size();
+}
+
+esp_err_t httpd_req_get_hdr_value_str(httpd_req_t *r, const char *field, char *val, size_t val_size)
+{
+    host_http_t *http = find(r);
+    auto it = http->headers.find(field);
+
+    if (it == http->headers.end())
+        return ESP_ERR_NOT_FOUND;
+
+    if (val_size == 0)
+        return ESP_ERR_INVALID_SIZE;
+
+    strncpy(val, it->second.c_str(), val_size - 1);
+    val[val_size - 1] = '\0';
+
+    return it->second.size() < val_size ? ESP_OK : ESP_ERR_INVALID_SIZE;
+}
+
+int lwip_getpeername(int s, struct sockaddr *name, socklen_t *namelen)
+{
+    return -1;
+}
+
+int httpd_req_to_sockfd(httpd_req_t *r)
+{
+    return -1;
+}
+
+esp_err_t httpd_resp_set_status(httpd_req_t *r, const char *status)
+{
+    find(r)->res.status = status;
+
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_set_type(httpd_req_t *r, const char *type)
+{
+    find(r)->res.type = type;
+
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_set_hdr(httpd_req_t *r, const char *field, const char *value)
+{
+    find(r)->res.headers[field] = value;
+
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_send(httpd_req_t *r, const char *buf, ssize_t buf_len)
+{
+    host_http_t *http = find(r);
+
+    HOST_CHECK(!http->res.sent && !http->res.chunked);
+
+    if (http->fail_after == 0)
+        return ESP_FAIL;
+
+    size_t len = buf == nullptr ? 0 : buf_len == HTTPD_RESP_USE_STRLEN ? strlen(buf) : buf_len;
+
+    http->res.body.assign(buf == nullptr ? "" : buf, len);
+    http->res.sent = true;
+
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_send_chunk(httpd_req_t *r, const char *buf, ssize_t buf_len)
+{
+    host_http_t *http = find(r);
+
+    HOST_CHECK(!http->res.sent);
+
+    if (http->res.chunks.size() >= http->fail_after)
+        return ESP_FAIL;
+
+    size_t len = buf == nullptr ? 0 : buf_len == HTTPD_RESP_USE_STRLEN ? strlen(buf) : buf_len;
+
+    http->res.chunked = true;
+    http->res.chunks.emplace_back(buf, len);
+    http->res.body.append(buf == nullptr ? "" : buf, len);
+    http->res.sent = len == 0;
+
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_send_err(httpd_req_t *req, httpd_err_code_t error, const char *msg)
+{
+    switch (error) {
+        case HTTPD_400_BAD_REQUEST: httpd_resp_set_status(req, HTTPD_400); break;
+        case HTTPD_401_UNAUTHORIZED: httpd_resp_set_status(req, "401 Unauthorized"); break;
+        case HTTPD_404_NOT_FOUND: httpd_resp_set_status(req, HTTPD_404); break;
+        case HTTPD_408_REQ_TIMEOUT: httpd_resp_set_status(req, HTTPD_408); break;
+        default: httpd_resp_set_status(req, HTTPD_500); break;
+    }
+
+    httpd_resp_set_type(req, HTTPD_TYPE_TEXT);
+
+    return httpd_resp_send(req, msg, HTTPD_RESP_USE_STRLEN);
+}
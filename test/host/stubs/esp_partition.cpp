@@ -0,0 +1,167 @@
+#include <cstring>
+#include <list>
+#include <mutex>
+#include <vector>
+#include "esp_partition.h"
+#include "host_test.h"
+
+/*
+ * Partitions in memory which behave like NOR flash: a write can only clear bits and an erase sets a whole sector back
+ * to 0xff. A power cut lets a given number of bytes of the following writes reach the flash and fails every access
+ * after, an erase is all or nothing.
+ */
+
+static constexpr uint32_t SECTOR_SIZE = 4096;
+
+typedef struct host_flash {
+    esp_partition_t partition;
+    std::vector<uint8_t> data;
+    std::vector<uint32_t> erases;
+    bool cut = false;
+    size_t budget = 0;
+    bool powered = true;
+} host_flash_t;
+
+static std::mutex flash_mutex;
+static std::list<host_flash_t> flashes;
+
+static host_flash_t *find(const esp_partition_t *partition)
+{
+    for (host_flash_t &flash : flashes) {
+        if (&flash.partition == partition)
+            return &flash;
+    }
+
+    return nullptr;
+}
+
+const esp_partition_t *host_partition_add(const char *label, uint32_t size)
+{
+    std::lock_guard<std::mutex> lock(flash_mutex);
+    host_flash_t &flash = flashes.emplace_back();
+
+    flash.partition.type = ESP_PARTITION_TYPE_DATA;
+    flash.partition.subtype = ESP_PARTITION_SUBTYPE_ANY;
+    flash.partition.size = size;
+    flash.partition.erase_size = SECTOR_SIZE;
+    strncpy(flash.partition.label, label, sizeof(flash.partition.label) - 1);
+    flash.data.assign(size, 0xff);
+    flash.erases.assign(size / SECTOR_SIZE, 0);
+
+    return &flash.partition;
+}
+
+void host_flash_power_cut(const esp_partition_t *partition, size_t after)
+{
+    std::lock_guard<std::mutex> lock(flash_mutex);
+    host_flash_t *flash = find(partition);
+
+    flash->cut = true;
+    flash->budget = after;
+}
+
+bool host_flash_powered(const esp_partition_t *partition)
+{
+    std::lock_guard<std::mutex> lock(flash_mutex);
+
+    return find(partition)->powered;
+}
+
+void host_flash_power_restore(const esp_partition_t *partition)
+{
+    std::lock_guard<std::mutex> lock(flash_mutex);
+    host_flash_t *flash = find(partition);
+
+    flash->cut = false;
+    flash->powered = true;
+}
+
+uint32_t host_flash_erases(const esp_partition_t *partition, uint32_t sector)
+{
+    std::lock_guard<std::mutex> lock(flash_mutex);
+
+    return find(partition)->erases[sector];
+}
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype,
+                                                const char *label)
+{
+    std::lock_guard<std::mutex> lock(flash_mutex);
+
+    // The latest partition with the label, a test simulating a reboot adds none.
+    for (auto it = flashes.rbegin(); it != flashes.rend(); ++it) {
+        if (it->partition.type == type && (label == nullptr || strcmp(it->partition.label, label) == 0))
+            return &it->partition;
+    }
+
+    return nullptr;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *partition, size_t src_offset, void *dst, size_t size)
+{
+    std::lock_guard<std::mutex> lock(flash_mutex);
+    host_flash_t *flash = find(partition);
+
+    if (src_offset + size > partition->size)
+        return ESP_ERR_INVALID_SIZE;
+
+    if (!flash->powered)
+        return ESP_FAIL;
+
+    memcpy(dst, flash->data.data() + src_offset, size);
+
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t *partition, size_t dst_offset, const void *src, size_t size)
+{
+    std::lock_guard<std::mutex> lock(flash_mutex);
+    host_flash_t *flash = find(partition);
+
+    if (dst_offset + size > partition->size)
+        return ESP_ERR_INVALID_SIZE;
+
+    if (!flash->powered)
+        return ESP_FAIL;
+
+    size_t written = size;
+
+    if (flash->cut && flash->budget < size) {
+        written = flash->budget;
+        flash->powered = false;
+    }
+
+    if (flash->cut)
+        flash->budget -= written;
+
+    const auto *bytes = static_cast<const uint8_t *>(src);
+
+    for (size_t i = 0; i < written; i++)
+        flash->data[dst_offset + i] &= bytes[i];
+
+    return flash->powered ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition, size_t offset, size_t size)
+{
+    std::lock_guard<std::mutex> lock(flash_mutex);
+    host_flash_t *flash = find(partition);
+
+    if (offset % SECTOR_SIZE != 0 || size % SECTOR_SIZE != 0 || offset + size > partition->size)
+        return ESP_ERR_INVALID_ARG;
+
+    if (!flash->powered)
+        return ESP_FAIL;
+
+    if (flash->cut && flash->budget == 0) {
+        flash->powered = false;
+        return ESP_FAIL;
+    }
+
+    memset(flash->data.data() + offset, 0xff, size);
+
+    for (size_t sector = offset / SECTOR_SIZE; sector < (offset + size) / SECTOR_SIZE; sector++)
+        flash->erases[sector]++;
+
+    return ESP_OK;
+}
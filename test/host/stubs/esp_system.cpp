@@ -0,0 +1,132 @@
+#include <atomic>
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include "esp_err.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_rom_crc.h"
+#include "esp_timer.h"
+#include "host_test.h"
+
+/*
+ * The system services of the components: errors, logging, the clock, the heap and the rom crc. Timers never fire on
+ * the host, a test calls what they would have called.
+ */
+
+static std::atomic<esp_log_level_t> log_level{ESP_LOG_WARN};
+static std::atomic<bool> time_frozen{false};
+static std::atomic<int64_t> time_us{0};
+
+const char *esp_err_to_name(esp_err_t code)
+{
+    switch (code) {
+        case ESP_OK: return "ESP_OK";
+        case ESP_FAIL: return "ESP_FAIL";
+        case ESP_ERR_NO_MEM: return "ESP_ERR_NO_MEM";
+        case ESP_ERR_INVALID_ARG: return "ESP_ERR_INVALID_ARG";
+        case ESP_ERR_INVALID_STATE: return "ESP_ERR_INVALID_STATE";
+        case ESP_ERR_INVALID_SIZE: return "ESP_ERR_INVALID_SIZE";
+        case ESP_ERR_NOT_FOUND: return "ESP_ERR_NOT_FOUND";
+        case ESP_ERR_NOT_SUPPORTED: return "ESP_ERR_NOT_SUPPORTED";
+        case ESP_ERR_TIMEOUT: return "ESP_ERR_TIMEOUT";
+        case ESP_ERR_INVALID_CRC: return "ESP_ERR_INVALID_CRC";
+        default: return "UNKNOWN ERROR";
+    }
+}
+
+void esp_system_abort(const char *details)
+{
+    fprintf(stderr, "abort: %s\n", details);
+    std::abort();
+}
+
+void esp_log_level_set(const char *tag, esp_log_level_t level)
+{
+    log_level = level;
+}
+
+void esp_log_write(esp_log_level_t level, const char *tag, const char *format, ...)
+{
+    static const char letters[] = "NEWIDV";
+
+    if (level > log_level)
+        return;
+
+    va_list args;
+    va_start(args, format);
+    fprintf(stderr, "%c (%s) ", letters[level], tag);
+    vfprintf(stderr, format, args);
+    fputc('\n', stderr);
+    va_end(args);
+}
+
+void host_time_freeze(int64_t us)
+{
+    time_us = us;
+    time_frozen = true;
+}
+
+void host_time_advance(int64_t us)
+{
+    time_us += us;
+}
+
+int64_t esp_timer_get_time(void)
+{
+    using namespace std::chrono;
+
+    if (time_frozen)
+        return time_us;
+
+    return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *args, esp_timer_handle_t *handle)
+{
+    *handle = reinterpret_cast<esp_timer_handle_t>(new esp_timer_create_args_t(*args));
+
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t timer)
+{
+    delete reinterpret_cast<esp_timer_create_args_t *>(timer);
+
+    return ESP_OK;
+}
+
+size_t heap_caps_get_free_size(uint32_t caps)
+{
+    return SIZE_MAX / 2;
+}
+
+uint32_t esp_rom_crc32_le(uint32_t crc, uint8_t const *buf, uint32_t len)
+{
+    crc = ~crc;
+
+    for (uint32_t i = 0; i < len; i++) {
+        crc ^= buf[i];
+
+        for (int bit = 0; bit < 8; bit++)
+            crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+    }
+
+    return ~crc;
+}
@@ -0,0 +1,213 @@
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "host_test.h"
+
+/*
+ * FreeRTOS over std::thread. Each task is a detached thread which runs until the process exits. A stepped task only
+ * runs when the test steps it: its timed waits elapse at once and each step lets it pass one wait without a timeout
+ * or one delay, so a test decides exactly when a background task does its work.
+ */
+
+struct tskTaskControlBlock {
+    std::string name;
+    std::mutex mutex;
+    std::condition_variable cv;
+    uint32_t notified = 0;
+    bool stepped = false;
+    bool waiting = false;
+    uint32_t steps = 0;
+};
+
+struct QueueDefinition {
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<std::vector<uint8_t>> items;
+    UBaseType_t length;
+    UBaseType_t item_size;
+};
+
+static std::mutex tasks_mutex;
+static std::vector<TaskHandle_t> tasks;
+static std::vector<std::string> stepped_names;
+static thread_local TaskHandle_t current = nullptr;
+
+void host_task_stepped(const char *name)
+{
+    std::lock_guard<std::mutex> lock(tasks_mutex);
+    stepped_names.emplace_back(name);
+}
+
+TaskHandle_t host_task_find(const char *name)
+{
+    std::lock_guard<std::mutex> lock(tasks_mutex);
+
+    for (auto it = tasks.rbegin(); it != tasks.rend(); ++it) {
+        if ((*it)->name == name)
+            return *it;
+    }
+
+    return nullptr;
+}
+
+/**
+ * Parks a stepped task until the test steps it.
+ */
+static void wait_step(TaskHandle_t task, std::unique_lock<std::mutex> &lock)
+{
+    task->waiting = true;
+    task->cv.notify_all();
+    task->cv.wait(lock, [task] { return task->steps > 0; });
+    task->waiting = false;
+    task->steps--;
+}
+
+void host_task_step(TaskHandle_t task)
+{
+    std::unique_lock<std::mutex> lock(task->mutex);
+
+    task->steps++;
+    task->cv.notify_all();
+    task->cv.wait(lock, [task] { return task->waiting && task->steps == 0; });
+}
+
+BaseType_t xTaskCreate(TaskFunction_t code, const char *name, uint32_t stack_depth, void *params,
+                       UBaseType_t priority, TaskHandle_t *created)
+{
+    // Never freed, a task outlives whatever created it.
+    auto *task = new tskTaskControlBlock();
+
+    task->name = name;
+
+    {
+        std::lock_guard<std::mutex> lock(tasks_mutex);
+
+        for (const std::string &stepped : stepped_names)
+            task->stepped |= stepped == name;
+
+        tasks.push_back(task);
+    }
+
+    if (created != nullptr)
+        *created = task;
+
+    std::thread([task, code, params] {
+        current = task;
+        code(params);
+    }).detach();
+
+    return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+    // A thread can't be stopped from outside, the tests never delete a running task.
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    if (current == nullptr || !current->stepped) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(pdTICKS_TO_MS(ticks)));
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock(current->mutex);
+
+    wait_step(current, lock);
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    using namespace std::chrono;
+
+    return duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count() / portTICK_PERIOD_MS;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    std::lock_guard<std::mutex> lock(task->mutex);
+
+    task->notified++;
+    task->cv.notify_all();
+
+    return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks_to_wait)
+{
+    TaskHandle_t task = current;
+    std::unique_lock<std::mutex> lock(task->mutex);
+
+    if (task->stepped && ticks_to_wait == portMAX_DELAY) {
+        wait_step(task, lock);
+    } else if (!task->stepped) {
+        auto ready = [task] { return task->notified > 0; };
+
+        if (ticks_to_wait == portMAX_DELAY)
+            task->cv.wait(lock, ready);
+        else
+            task->cv.wait_for(lock, std::chrono::milliseconds(pdTICKS_TO_MS(ticks_to_wait)), ready);
+    }
+
+    uint32_t value = task->notified;
+
+    if (value > 0)
+        task->notified = clear_on_exit ? 0 : value - 1;
+
+    return value;
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size)
+{
+    auto *queue = new QueueDefinition();
+
+    queue->length = length;
+    queue->item_size = item_size;
+
+    return queue;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks_to_wait)
+{
+    std::unique_lock<std::mutex> lock(queue->mutex);
+    auto space = [queue] { return queue->items.size() < queue->length; };
+
+    if (!queue->cv.wait_for(lock, std::chrono::milliseconds(pdTICKS_TO_MS(ticks_to_wait)), space))
+        return pdFAIL;
+
+    auto *bytes = static_cast<const uint8_t *>(item);
+
+    queue->items.emplace_back(bytes, bytes + queue->item_size);
+    queue->cv.notify_all();
+
+    return pdPASS;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *buffer, TickType_t ticks_to_wait)
+{
+    std::unique_lock<std::mutex> lock(queue->mutex);
+    auto ready = [queue] { return !queue->items.empty(); };
+
+    if (ticks_to_wait == portMAX_DELAY)
+        queue->cv.wait(lock, ready);
+    else if (!queue->cv.wait_for(lock, std::chrono::milliseconds(pdTICKS_TO_MS(ticks_to_wait)), ready))
+        return pdFAIL;
+
+    memcpy(buffer, queue->items.front().data(), queue->item_size);
+    queue->items.pop_front();
+    queue->cv.notify_all();
+
+    return pdPASS;
+}
+
+void vQueueDelete(QueueHandle_t queue)
+{
+    delete queue;
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+#define IRAM_ATTR
+#define DRAM_ATTR
+
+/* Defined by newlib's sys/cdefs.h on the device. */
+#ifndef __packed
+#define __packed __attribute__((packed))
+#endif
@@ -0,0 +1,8 @@
+#pragma once
+
+#include "esp_http_server.h"
+
+/* Only what the server needs to build without https, its config isn't used on the host. */
+typedef struct httpd_ssl_config {
+    httpd_config_t httpd;
+} httpd_ssl_config_t;
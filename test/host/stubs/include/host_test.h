@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <string>
+#include <vector>
+#include "esp_http_server.h"
+#include "esp_partition.h"
+#include "freertos/FreeRTOS.h"
+
+/*
+ * The controls of the host stubs used by the tests, and a check which fails the test. It aborts rather than exits, so
+ * no destructor runs under the feet of the tasks still running.
+ */
+
+#define HOST_CHECK(cond)                                                                \
+    do {                                                                                \
+        if (!(cond)) {                                                                  \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond);  \
+            std::abort();                                                               \
+        }                                                                               \
+    } while (0)
+
+void host_time_freeze(int64_t us);
+void host_time_advance(int64_t us);
+
+void host_task_stepped(const char *name);
+TaskHandle_t host_task_find(const char *name);
+void host_task_step(TaskHandle_t task);
+
+const esp_partition_t *host_partition_add(const char *label, uint32_t size);
+void host_flash_power_cut(const esp_partition_t *partition, size_t after);
+bool host_flash_powered(const esp_partition_t *partition);
+void host_flash_power_restore(const esp_partition_t *partition);
+uint32_t host_flash_erases(const esp_partition_t *partition, uint32_t sector);
+
+/*
+ * A request handed to a handler, and the response it sent. A chunk sent straight from the caller's memory keeps the
+ * caller's pointer, so a test can tell it wasn't copied.
+ */
+typedef struct host_http_res {
+    std::string status;
+    std::string type;
+    std::map<std::string, std::string> headers;
+    std::string body;
+    std::vector<std::pair<const char *, size_t>> chunks;
+    bool chunked = false;
+    bool sent = false;
+} host_http_res_t;
+
+httpd_req_t *host_http_req(int method, const char *uri, const std::string &body = "",
+                           const std::map<std::string, std::string> &headers = {});
+host_http_res_t *host_http_res(httpd_req_t *req);
+void host_http_send_fail(httpd_req_t *req, size_t after_chunks);
+void host_http_req_free(httpd_req_t *req);
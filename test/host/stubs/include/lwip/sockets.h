@@ -0,0 +1,65 @@
+#pragma once
+
+#include <stdint.h>
+
+/* lwip's own socket structures, its functions are macros as in lwip so they don't clash with the host's. */
+#define AF_UNSPEC 0
+#define AF_INET 2
+#define AF_INET6 10
+
+#define getpeername(s, name, namelen) lwip_getpeername(s, name, namelen)
+
+typedef uint32_t socklen_t;
+typedef uint8_t sa_family_t;
+
+struct sockaddr {
+    uint8_t sa_len;
+    sa_family_t sa_family;
+    char sa_data[14];
+};
+
+struct in_addr {
+    uint32_t s_addr;
+};
+
+struct sockaddr_in {
+    uint8_t sin_len;
+    sa_family_t sin_family;
+    uint16_t sin_port;
+    struct in_addr sin_addr;
+    char sin_zero[8];
+};
+
+typedef struct in6_addr {
+    union {
+        uint32_t u32_addr[4];
+        uint8_t u8_addr[16];
+    } un;
+} in6_addr_t;
+
+struct sockaddr_in6 {
+    uint8_t sin6_len;
+    sa_family_t sin6_family;
+    uint16_t sin6_port;
+    uint32_t sin6_flowinfo;
+    in6_addr_t sin6_addr;
+    uint32_t sin6_scope_id;
+};
+
+struct sockaddr_storage {
+    uint8_t s2_len;
+    sa_family_t ss_family;
+    char s2_data1[2];
+    uint32_t s2_data2[3];
+    uint32_t s2_data3[3];
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int lwip_getpeername(int s, struct sockaddr *name, socklen_t *namelen);
+
+#ifdef __cplusplus
+}
+#endif
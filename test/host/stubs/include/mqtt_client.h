@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stdbool.h>
+#include "esp_err.h"
+
+typedef struct esp_mqtt_client *esp_mqtt_client_handle_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Not defined by the stubs, a test republishing messages captures them by defining it. */
+int esp_mqtt_client_enqueue(esp_mqtt_client_handle_t client, const char *topic, const char *data, int len, int qos,
+                            int retain, bool store);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,13 @@
+#pragma once
+
+/*
+ * The configuration the components are built with on the host, the defaults of iot_application's Kconfig with the
+ * transports the host tests don't exercise turned off.
+ */
+#define CONFIG_IOT_HOVER_SERVER_HTTP 1
+#define CONFIG_IOT_HOVER_ENV_DEV 1
+#define CONFIG_IOT_HOVER_SERVER_MAX_ROUTES 16
+#define CONFIG_IOT_HOVER_SERVER_MAX_CLIENTS 8
+#define CONFIG_IOT_HOVER_SERVER_MIN_FREE_HEAP 0
+#define CONFIG_IOT_HOVER_SERVER_ASYNC_WORKERS 0
+#define CONFIG_IOT_HOVER_SERVER_ASYNC_QUEUE_LEN 4
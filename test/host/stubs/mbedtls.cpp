@@ -0,0 +1,95 @@
+#include <cstdint>
+#include <cstring>
+#include "mbedtls/sha256.h"
+
+/*
+ * SHA-256 as specified by FIPS 180-4, the only primitive of mbedtls the components use.
+ */
+
+static constexpr uint32_t K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static uint32_t rotr(uint32_t x, int n)
+{
+    return x >> n | x << (32 - n);
+}
+
+static void compress(uint32_t state[8], const unsigned char block[64])
+{
+    uint32_t w[64];
+
+    for (int i = 0; i < 16; i++)
+        w[i] = static_cast<uint32_t>(block[i * 4]) << 24 | block[i * 4 + 1] << 16 | block[i * 4 + 2] << 8 |
+               block[i * 4 + 3];
+
+    for (int i = 16; i < 64; i++)
+        w[i] = w[i - 16] + (rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ w[i - 15] >> 3) + w[i - 7] +
+               (rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ w[i - 2] >> 10);
+
+    uint32_t v[8];
+
+    memcpy(v, state, sizeof(v));
+
+    for (int i = 0; i < 64; i++) {
+        uint32_t t1 = v[7] + (rotr(v[4], 6) ^ rotr(v[4], 11) ^ rotr(v[4], 25)) + ((v[4] & v[5]) ^ (~v[4] & v[6])) +
+                      K[i] + w[i];
+        uint32_t t2 = (rotr(v[0], 2) ^ rotr(v[0], 13) ^ rotr(v[0], 22)) + ((v[0] & v[1]) ^ (v[0] & v[2]) ^
+                                                                             (v[1] & v[2]));
+
+        memmove(v + 1, v, sizeof(uint32_t) * 7);
+        v[4] += t1;
+        v[0] = t1 + t2;
+    }
+
+    for (int i = 0; i < 8; i++)
+        state[i] += v[i];
+}
+
+int mbedtls_sha256(const unsigned char *input, size_t ilen, unsigned char *output, int is224)
+{
+    uint32_t state[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab,
+                         0x5be0cd19};
+    unsigned char block[64];
+    size_t i = 0;
+
+    if (is224 != 0)
+        return -1;
+
+    for (; ilen - i >= 64; i += 64)
+        compress(state, input + i);
+
+    size_t rest = ilen - i;
+
+    memset(block, 0, sizeof(block));
+    memcpy(block, input + i, rest);
+    block[rest] = 0x80;
+
+    if (rest >= 56) {
+        compress(state, block);
+        memset(block, 0, sizeof(block));
+    }
+
+    uint64_t bits = static_cast<uint64_t>(ilen) * 8;
+
+    for (int j = 0; j < 8; j++)
+        block[63 - j] = static_cast<unsigned char>(bits >> (j * 8));
+
+    compress(state, block);
+
+    for (int j = 0; j < 8; j++) {
+        output[j * 4] = static_cast<unsigned char>(state[j] >> 24);
+        output[j * 4 + 1] = static_cast<unsigned char>(state[j] >> 16);
+        output[j * 4 + 2] = static_cast<unsigned char>(state[j] >> 8);
+        output[j * 4 + 3] = static_cast<unsigned char>(state[j]);
+    }
+
+    return 0;
+}
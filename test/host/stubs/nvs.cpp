@@ -0,0 +1,258 @@
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "nvs_flash.h"
+
+/*
+ * Non-volatile storage in memory, it lasts as long as the test. Every write is committed at once.
+ */
+
+typedef struct host_nvs_entry {
+    nvs_type_t type;
+    std::string data;
+} host_nvs_entry_t;
+
+typedef std::map<std::string, host_nvs_entry_t> host_nvs_namespace_t;
+
+struct nvs_opaque_iterator {
+    std::vector<nvs_entry_info_t> entries;
+    size_t index;
+};
+
+static std::mutex nvs_mutex;
+static std::map<std::string, std::map<std::string, host_nvs_namespace_t>> partitions;
+static std::map<nvs_handle_t, host_nvs_namespace_t *> handles;
+static nvs_handle_t next_handle = 1;
+
+static host_nvs_namespace_t *find(nvs_handle_t handle)
+{
+    auto it = handles.find(handle);
+
+    return it == handles.end() ? nullptr : it->second;
+}
+
+static esp_err_t set(nvs_handle_t handle, const char *key, nvs_type_t type, const void *value, size_t length)
+{
+    std::lock_guard<std::mutex> lock(nvs_mutex);
+    host_nvs_namespace_t *name_space = find(handle);
+
+    if (name_space == nullptr)
+        return ESP_ERR_INVALID_ARG;
+
+    (*name_space)[key] = {.type = type, .data = std::string(static_cast<const char *>(value), length)};
+
+    return ESP_OK;
+}
+
+static esp_err_t get(nvs_handle_t handle, const char *key, nvs_type_t type, void *out_value, size_t *length)
+{
+    std::lock_guard<std::mutex> lock(nvs_mutex);
+    host_nvs_namespace_t *name_space = find(handle);
+
+    if (name_space == nullptr)
+        return ESP_ERR_INVALID_ARG;
+
+    auto it = name_space->find(key);
+
+    if (it == name_space->end() || it->second.type != type)
+        return ESP_ERR_NVS_NOT_FOUND;
+
+    if (out_value == nullptr) {
+        *length = it->second.data.size();
+        return ESP_OK;
+    }
+
+    if (*length < it->second.data.size())
+        return ESP_ERR_NVS_INVALID_LENGTH;
+
+    memcpy(out_value, it->second.data.data(), it->second.data.size());
+    *length = it->second.data.size();
+
+    return ESP_OK;
+}
+
+esp_err_t nvs_flash_init(void)
+{
+    return ESP_OK;
+}
+
+esp_err_t nvs_flash_init_partition(const char *partition_label)
+{
+    std::lock_guard<std::mutex> lock(nvs_mutex);
+
+    partitions[partition_label];
+
+    return ESP_OK;
+}
+
+esp_err_t nvs_flash_erase(void)
+{
+    std::lock_guard<std::mutex> lock(nvs_mutex);
+
+    for (auto &[label, namespaces] : partitions) {
+        for (auto &[name, name_space] : namespaces)
+            name_space.clear();
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t nvs_open_from_partition(const char *part_name, const char *namespace_name, nvs_open_mode_t open_mode,
+                                  nvs_handle_t *out_handle)
+{
+    std::lock_guard<std::mutex> lock(nvs_mutex);
+    auto it = partitions.find(part_name);
+
+    if (it == partitions.end())
+        return ESP_ERR_NVS_NOT_FOUND;
+
+    *out_handle = next_handle++;
+    handles[*out_handle] = &it->second[namespace_name];
+
+    return ESP_OK;
+}
+
+void nvs_close(nvs_handle_t handle)
+{
+    std::lock_guard<std::mutex> lock(nvs_mutex);
+
+    handles.erase(handle);
+}
+
+esp_err_t nvs_set_str(nvs_handle_t handle, const char *key, const char *value)
+{
+    return set(handle, key, NVS_TYPE_STR, value, strlen(value) + 1);
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t length)
+{
+    return set(handle, key, NVS_TYPE_BLOB, value, length);
+}
+
+esp_err_t nvs_get_str(nvs_handle_t handle, const char *key, char *out_value, size_t *length)
+{
+    return get(handle, key, NVS_TYPE_STR, out_value, length);
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *out_value, size_t *length)
+{
+    return get(handle, key, NVS_TYPE_BLOB, out_value, length);
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char *key)
+{
+    std::lock_guard<std::mutex> lock(nvs_mutex);
+    host_nvs_namespace_t *name_space = find(handle);
+
+    if (name_space == nullptr)
+        return ESP_ERR_INVALID_ARG;
+
+    return name_space->erase(key) == 0 ? ESP_ERR_NVS_NOT_FOUND : ESP_OK;
+}
+
+esp_err_t nvs_erase_all(nvs_handle_t handle)
+{
+    std::lock_guard<std::mutex> lock(nvs_mutex);
+    host_nvs_namespace_t *name_space = find(handle);
+
+    if (name_space == nullptr)
+        return ESP_ERR_INVALID_ARG;
+
+    name_space->clear();
+
+    return ESP_OK;
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle)
+{
+    std::lock_guard<std::mutex> lock(nvs_mutex);
+
+    return find(handle) == nullptr ? ESP_ERR_INVALID_ARG : ESP_OK;
+}
+
+esp_err_t nvs_get_stats(const char *part_name, nvs_stats_t *nvs_stats)
+{
+    std::lock_guard<std::mutex> lock(nvs_mutex);
+    auto it = partitions.find(part_name);
+
+    if (it == partitions.end())
+        return ESP_ERR_NVS_NOT_FOUND;
+
+    *nvs_stats = {.used_entries = 0, .free_entries = 0, .available_entries = 0, .total_entries = 0,
+                  .namespace_count = it->second.size()};
+
+    for (const auto &[name, name_space] : it->second)
+        nvs_stats->used_entries += name_space.size();
+
+    return ESP_OK;
+}
+
+esp_err_t nvs_entry_find(const char *part_name, const char *namespace_name, nvs_type_t type,
+                         nvs_iterator_t *output_iterator)
+{
+    std::lock_guard<std::mutex> lock(nvs_mutex);
+    auto it = partitions.find(part_name);
+
+    *output_iterator = nullptr;
+
+    if (it == partitions.end())
+        return ESP_ERR_NVS_NOT_FOUND;
+
+    auto *iterator = new nvs_opaque_iterator{};
+
+    for (const auto &[name, name_space] : it->second) {
+        if (namespace_name != nullptr && name != namespace_name)
+            continue;
+
+        for (const auto &[key, entry] : name_space) {
+            if (type != NVS_TYPE_ANY && entry.type != type)
+                continue;
+
+            nvs_entry_info_t info = {.namespace_name = {}, .key = {}, .type = entry.type};
+
+            strncpy(info.namespace_name, name.c_str(), sizeof(info.namespace_name) - 1);
+            strncpy(info.key, key.c_str(), sizeof(info.key) - 1);
+            iterator->entries.push_back(info);
+        }
+    }
+
+    if (iterator->entries.empty()) {
+        delete iterator;
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+
+    *output_iterator = iterator;
+
+    return ESP_OK;
+}
+
+esp_err_t nvs_entry_next(nvs_iterator_t *iterator)
+{
+    if (*iterator == nullptr)
+        return ESP_ERR_INVALID_ARG;
+
+    if (++(*iterator)->index == (*iterator)->entries.size()) {
+        delete *iterator;
+        *iterator = nullptr;
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t nvs_entry_info(const nvs_iterator_t iterator, nvs_entry_info_t *out_info)
+{
+    if (iterator == nullptr)
+        return ESP_ERR_INVALID_ARG;
+
+    *out_info = iterator->entries[iterator->index];
+
+    return ESP_OK;
+}
+
+void nvs_release_iterator(nvs_iterator_t iterator)
+{
+    delete iterator;
+}